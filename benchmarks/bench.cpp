@@ -0,0 +1,498 @@
+#include <signal.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <mutex>
+#include <new>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "loopbackServer.hpp"
+#include "scan.hpp"
+#include "simpleHTTP.hpp"
+
+using namespace SimpleHTTP;
+
+typedef std::chrono::steady_clock Clock;
+
+// Every operator new in the process is counted, except on threads that opt out (the loopback
+// server's), so "allocs/req" is what the client itself allocates per request.
+static std::atomic<uint64_t> allocationCount(0);
+static thread_local bool countAllocations = true;
+
+void* operator new(std::size_t size) {
+    if (countAllocations)
+        allocationCount.fetch_add(1, std::memory_order_relaxed);
+    void* memory = std::malloc(size == 0 ? 1 : size);
+    if (memory == nullptr)
+        throw std::bad_alloc();
+    return memory;
+}
+
+void* operator new[](std::size_t size) {
+    return operator new(size);
+}
+
+void* operator new(std::size_t size, const std::nothrow_t&) noexcept {
+    try {
+        return operator new(size);
+    } catch (...) {
+        return nullptr;
+    }
+}
+
+void* operator new[](std::size_t size, const std::nothrow_t&) noexcept {
+    return operator new(size, std::nothrow);
+}
+
+void operator delete(void* memory) noexcept {
+    std::free(memory);
+}
+
+void operator delete[](void* memory) noexcept {
+    std::free(memory);
+}
+
+void operator delete(void* memory, const std::nothrow_t&) noexcept {
+    std::free(memory);
+}
+
+void operator delete[](void* memory, const std::nothrow_t&) noexcept {
+    std::free(memory);
+}
+
+struct BenchOptions {
+    size_t requests;
+    size_t warmup;
+    size_t concurrency;
+    size_t payloadSize;
+    size_t asyncThreads;
+    std::vector<std::string> scenarios;
+    LoopbackServerConfig server;
+    std::string scanner;
+    int servePort;
+
+    BenchOptions()
+        : requests(10000),
+          warmup(200),
+          concurrency(1),
+          payloadSize(1024),
+          asyncThreads(1),
+          scenarios({"get", "reuse", "post", "download", "async", "parse"}),
+          servePort(-1) {}
+};
+
+struct ScenarioResult {
+    std::string name;
+    size_t requests;
+    size_t errors;
+    double seconds;
+    uint64_t bytes;
+    uint64_t allocations;
+    // Per-request latency in microseconds.
+    std::vector<double> latencies;
+};
+
+// One blocking request; returns the body bytes moved, or -1 on failure.
+typedef std::function<int64_t(HttpClient& client, HttpResponse& response)> RequestFunction;
+
+static double percentile(const std::vector<double>& sorted, const double& fraction) {
+    if (sorted.empty())
+        return 0;
+    const size_t index = static_cast<size_t>(fraction * sorted.size());
+    return sorted[std::min(index, sorted.size() - 1)];
+}
+
+static double microsecondsSince(const Clock::time_point& start) {
+    return std::chrono::duration<double, std::micro>(Clock::now() - start).count();
+}
+
+// Runs the requests on options.concurrency threads sharing one client.
+static ScenarioResult runBlocking(const std::string& name, HttpClient& client,
+                                  const BenchOptions& options, const RequestFunction& request) {
+    ScenarioResult result;
+    result.name = name;
+    result.requests = options.requests;
+    result.latencies.assign(options.requests, 0);
+
+    HttpResponse warmupResponse;
+    for (size_t i = 0; i < options.warmup; ++i)
+        request(client, warmupResponse);
+
+    std::atomic<size_t> next(0);
+    std::atomic<size_t> errors(0);
+    std::atomic<uint64_t> bytes(0);
+    std::vector<std::thread> threads;
+    threads.reserve(options.concurrency);
+
+    const uint64_t allocationsBefore = allocationCount.load();
+    const Clock::time_point start = Clock::now();
+    for (size_t t = 0; t < options.concurrency; ++t) {
+        threads.push_back(std::thread([&]() {
+            HttpResponse response;
+            uint64_t moved = 0;
+            for (size_t i = next++; i < options.requests; i = next++) {
+                const Clock::time_point requestStart = Clock::now();
+                const int64_t size = request(client, response);
+                result.latencies[i] = microsecondsSince(requestStart);
+                if (size < 0)
+                    ++errors;
+                else
+                    moved += size;
+            }
+            bytes += moved;
+        }));
+    }
+    for (std::thread& thread : threads)
+        thread.join();
+
+    result.seconds = microsecondsSince(start) / 1e6;
+    result.allocations = allocationCount.load() - allocationsBefore;
+    result.errors = errors;
+    result.bytes = bytes;
+    return result;
+}
+
+// Keeps options.concurrency getAsync requests in flight until all have completed.
+static ScenarioResult runAsync(HttpClient& client, const std::string& url,
+                               const BenchOptions& options) {
+    ScenarioResult result;
+    result.name = "async";
+    result.requests = options.requests;
+    result.latencies.assign(options.requests, 0);
+
+    std::mutex mutex;
+    std::condition_variable changed;
+    size_t inFlight = 0;
+    size_t completed = 0;
+    std::atomic<size_t> errors(0);
+    std::atomic<uint64_t> bytes(0);
+
+    auto submit = [&](const size_t& index, const Clock::time_point& requestStart) {
+        client
+            .getAsync(url, HttpHeaders(),
+                      [&, index, requestStart](HttpResponse response) {
+                          if (index < result.latencies.size())
+                              result.latencies[index] = microsecondsSince(requestStart);
+                          if (response.httpCode != 200)
+                              ++errors;
+                          else
+                              bytes += response.body.size();
+                          std::lock_guard<std::mutex> lock(mutex);
+                          --inFlight;
+                          ++completed;
+                          changed.notify_all();
+                      })
+            ->detach();
+    };
+
+    auto runBatch = [&](const size_t& count, const bool& measured) {
+        for (size_t i = 0; i < count; ++i) {
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                changed.wait(lock, [&]() { return inFlight < options.concurrency; });
+                ++inFlight;
+            }
+            submit(measured ? i : SIZE_MAX, Clock::now());
+        }
+        std::unique_lock<std::mutex> lock(mutex);
+        changed.wait(lock, [&]() { return inFlight == 0; });
+    };
+
+    runBatch(options.warmup, false);
+    errors = 0;
+    bytes = 0;
+    completed = 0;
+
+    const uint64_t allocationsBefore = allocationCount.load();
+    const Clock::time_point start = Clock::now();
+    runBatch(options.requests, true);
+    result.seconds = microsecondsSince(start) / 1e6;
+    result.allocations = allocationCount.load() - allocationsBefore;
+    result.errors = errors;
+    result.bytes = bytes;
+    return result;
+}
+
+// Parses one canned response (the loopback server's head and body, always with Content-Length)
+// over and over, without any I/O, to isolate the parser.
+static ScenarioResult runParse(const BenchOptions& options) {
+    ScenarioResult result;
+    result.name = "parse";
+    result.requests = options.requests;
+    result.latencies.assign(options.requests, 0);
+
+    const size_t size = options.server.responseSize;
+    const std::string text = "HTTP/1.1 200 OK\r\nContent-Type: application/octet-stream\r\n" +
+                             fillerHeaders(options.server.extraHeaders) +
+                             "Content-Length: " + std::to_string(size) + "\r\n\r\n" +
+                             std::string(size, 'x');
+    std::vector<char> message(text.begin(), text.end());
+    HttpResponseParser parser;
+
+    for (size_t i = 0; i < options.warmup; ++i) {
+        parser.reset();
+        parser.parse(message.data(), message.size());
+    }
+
+    size_t errors = 0;
+    const uint64_t allocationsBefore = allocationCount.load();
+    const Clock::time_point start = Clock::now();
+    for (size_t i = 0; i < options.requests; ++i) {
+        const Clock::time_point parseStart = Clock::now();
+        parser.reset();
+        if (!parser.parse(message.data(), message.size()) || !parser.isComplete())
+            ++errors;
+        result.latencies[i] = microsecondsSince(parseStart);
+    }
+    result.seconds = microsecondsSince(start) / 1e6;
+    result.allocations = allocationCount.load() - allocationsBefore;
+    result.errors = errors;
+    result.bytes = static_cast<uint64_t>(message.size()) * options.requests;
+    return result;
+}
+
+static void printHeader() {
+    std::printf("%-10s %9s %7s %11s %10s %10s %10s %10s %11s\n", "scenario", "requests", "errors",
+                "req/s", "p50 us", "p99 us", "p999 us", "MiB/s", "allocs/req");
+}
+
+static void printResult(ScenarioResult& result) {
+    std::sort(result.latencies.begin(), result.latencies.end());
+    const double seconds = result.seconds > 0 ? result.seconds : 1e-9;
+    std::printf("%-10s %9zu %7zu %11.0f %10.1f %10.1f %10.1f %10.1f %11.2f\n",
+                result.name.c_str(), result.requests, result.errors, result.requests / seconds,
+                percentile(result.latencies, 0.50), percentile(result.latencies, 0.99),
+                percentile(result.latencies, 0.999), result.bytes / seconds / (1024.0 * 1024.0),
+                static_cast<double>(result.allocations) / std::max<size_t>(result.requests, 1));
+}
+
+// One row of the sockopts scenario: POSTs on a client with these socket options.
+struct SocketVariant {
+    const char* name;
+    bool keepAlive;
+    SocketOptions socket;
+
+    SocketVariant(const char* name, const bool& keepAlive) : name(name), keepAlive(keepAlive) {}
+};
+
+// Each option on its own against the defaults. Nagle shows with payloads that span several
+// segments; fastopen is compared with connect, both opening a connection per request.
+static std::vector<SocketVariant> socketVariants() {
+    std::vector<SocketVariant> variants;
+    variants.push_back(SocketVariant("nagle", true));
+    variants.back().socket.noDelay = false;
+    variants.push_back(SocketVariant("nodelay", true));
+    variants.push_back(SocketVariant("quickack", true));
+    variants.back().socket.quickAck = true;
+    variants.push_back(SocketVariant("busypoll", true));
+    variants.back().socket.busyPollMicros = 50;
+    variants.push_back(SocketVariant("buffers", true));
+    variants.back().socket.receiveBuffer = 1024 * 1024;
+    variants.back().socket.sendBuffer = 1024 * 1024;
+    variants.push_back(SocketVariant("keepalive", true));
+    variants.back().socket.keepAliveIdle = 60;
+    variants.back().socket.keepAliveInterval = 10;
+    variants.back().socket.keepAliveCount = 3;
+    variants.push_back(SocketVariant("connect", false));
+    variants.push_back(SocketVariant("fastopen", false));
+    variants.back().socket.fastOpen = true;
+    return variants;
+}
+
+static void runSocketOptions(const std::string& url, const std::string& payload,
+                             const BenchOptions& options) {
+    for (const SocketVariant& variant : socketVariants()) {
+        HttpClient client;
+        client.setKeepAlive(variant.keepAlive);
+        client.setSocketOptions(variant.socket);
+        ConnectionPoolConfig poolConfig;
+        poolConfig.maxIdlePerHost = std::max<size_t>(options.concurrency, 8);
+        client.setConnectionPoolConfig(poolConfig);
+
+        ScenarioResult result =
+            runBlocking(variant.name, client, options,
+                        [&](HttpClient& client, HttpResponse& response) -> int64_t {
+                            if (!client.executeRequest(response, "POST", url, payload,
+                                                       "application/octet-stream") ||
+                                response.httpCode != 200)
+                                return -1;
+                            return payload.size() + response.body.size();
+                        });
+        printResult(result);
+    }
+}
+
+static void printUsage() {
+    std::cout
+        << "Usage: simpleHTTP_bench [options]\n"
+           "  --requests N       measured requests per scenario (10000)\n"
+           "  --warmup N         unmeasured requests before each scenario (200)\n"
+           "  --concurrency N    client threads, or async requests in flight (1)\n"
+           "  --size BYTES       response body size (1024)\n"
+           "  --payload BYTES    request body size for post (1024)\n"
+           "  --chunked          send responses with chunked transfer encoding\n"
+           "  --chunk-size BYTES size of each response chunk (16384)\n"
+           "  --delay MS         server-side latency added to every response (0)\n"
+           "  --headers N        filler header fields added to every response (0)\n"
+           "  --scanner NAME     parser delimiter search: avx2, sse2 or scalar\n"
+           "                     (avx2 when the CPU has it, otherwise scalar)\n"
+           "  --async-threads N  event-loop threads for the async scenario (1)\n"
+           "  --scenarios LIST   comma-separated subset of get,reuse,post,download,async,parse,\n"
+           "                     or sockopts (post once per socket option, not run by default)\n"
+           "  --serve PORT       only run the loopback server on 127.0.0.1:PORT\n";
+}
+
+static bool parseOptions(int argc, char** argv, BenchOptions& options) {
+    for (int i = 1; i < argc; ++i) {
+        const std::string name = argv[i];
+        if (name == "--chunked") {
+            options.server.chunked = true;
+            continue;
+        }
+        if (i + 1 >= argc)
+            return false;
+        const char* value = argv[++i];
+        const size_t number = std::strtoull(value, nullptr, 10);
+        if (name == "--requests") {
+            options.requests = number;
+        } else if (name == "--warmup") {
+            options.warmup = number;
+        } else if (name == "--concurrency") {
+            options.concurrency = std::max<size_t>(number, 1);
+        } else if (name == "--size") {
+            options.server.responseSize = number;
+        } else if (name == "--payload") {
+            options.payloadSize = number;
+        } else if (name == "--chunk-size") {
+            options.server.chunkSize = number;
+        } else if (name == "--delay") {
+            options.server.delayMs = static_cast<int>(number);
+        } else if (name == "--headers") {
+            options.server.extraHeaders = number;
+        } else if (name == "--scanner") {
+            options.scanner = value;
+        } else if (name == "--async-threads") {
+            options.asyncThreads = std::max<size_t>(number, 1);
+        } else if (name == "--serve") {
+            options.servePort = static_cast<int>(number);
+        } else if (name == "--scenarios") {
+            options.scenarios.clear();
+            std::istringstream list(value);
+            std::string scenario;
+            while (std::getline(list, scenario, ','))
+                options.scenarios.push_back(scenario);
+        } else {
+            return false;
+        }
+    }
+    return true;
+}
+
+int main(int argc, char** argv) {
+    BenchOptions options;
+    if (!parseOptions(argc, argv, options)) {
+        printUsage();
+        return 1;
+    }
+
+    if (!options.scanner.empty() && !setScanImplementation(options.scanner)) {
+        std::cerr << "Scanner not available: " << options.scanner << std::endl;
+        return 1;
+    }
+
+    signal(SIGPIPE, SIG_IGN);
+    options.server.onThreadStart = []() { countAllocations = false; };
+
+    LoopbackServer server(options.server);
+    if (!server.start(options.servePort > 0 ? options.servePort : 0)) {
+        std::cerr << "Failed to start the loopback server" << std::endl;
+        return 1;
+    }
+
+    if (options.servePort >= 0) {
+        std::cout << "Serving on http://127.0.0.1:" << server.getPort() << "/" << std::endl;
+        while (true)
+            std::this_thread::sleep_for(std::chrono::hours(1));
+    }
+
+    const std::string url = "http://127.0.0.1:" + std::to_string(server.getPort()) + "/bench";
+    const std::string payload(options.payloadSize, 'p');
+
+    std::cout << "response " << options.server.responseSize << " bytes"
+              << (options.server.chunked ? " chunked" : "") << ", delay "
+              << options.server.delayMs << " ms, " << options.server.extraHeaders
+              << " extra headers, concurrency " << options.concurrency << ", scanner "
+              << scanImplementation() << "\n"
+              << std::endl;
+    printHeader();
+
+    HttpClient client;
+    client.setAsyncThreads(options.asyncThreads);
+    ConnectionPoolConfig poolConfig;
+    poolConfig.maxIdlePerHost = std::max<size_t>(options.concurrency, 8);
+    client.setConnectionPoolConfig(poolConfig);
+
+    for (const std::string& scenario : options.scenarios) {
+        ScenarioResult result;
+        if (scenario == "get") {
+            result = runBlocking(scenario, client, options,
+                                 [&](HttpClient& client, HttpResponse&) -> int64_t {
+                                     const HttpResponse response = client.Get(url);
+                                     if (response.httpCode != 200)
+                                         return -1;
+                                     return response.body.size();
+                                 });
+        } else if (scenario == "reuse") {
+            result = runBlocking(scenario, client, options,
+                                 [&](HttpClient& client, HttpResponse& response) -> int64_t {
+                                     if (!client.executeRequest(response, "GET", url) ||
+                                         response.httpCode != 200)
+                                         return -1;
+                                     return response.body.size();
+                                 });
+        } else if (scenario == "post") {
+            result = runBlocking(scenario, client, options,
+                                 [&](HttpClient& client, HttpResponse& response) -> int64_t {
+                                     if (!client.executeRequest(response, "POST", url, payload,
+                                                                "application/octet-stream") ||
+                                         response.httpCode != 200)
+                                         return -1;
+                                     return payload.size() + response.body.size();
+                                 });
+        } else if (scenario == "download") {
+            result = runBlocking(scenario, client, options,
+                                 [&](HttpClient& client, HttpResponse&) -> int64_t {
+                                     int64_t received = 0;
+                                     const bool ok = client.Download(
+                                         url, [&received](const char*, size_t size) {
+                                             received += size;
+                                             return true;
+                                         });
+                                     return ok ? received : -1;
+                                 });
+        } else if (scenario == "async") {
+            result = runAsync(client, url, options);
+        } else if (scenario == "parse") {
+            result = runParse(options);
+        } else if (scenario == "sockopts") {
+            runSocketOptions(url, payload, options);
+            continue;
+        } else {
+            std::cerr << "Unknown scenario: " << scenario << std::endl;
+            continue;
+        }
+        printResult(result);
+    }
+
+    return 0;
+}
@@ -0,0 +1,373 @@
+#include "loopbackServer.hpp"
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <strings.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+namespace SimpleHTTP {
+
+#ifdef MSG_NOSIGNAL
+static const int kSendFlags = MSG_NOSIGNAL;
+#else
+static const int kSendFlags = 0;
+#endif
+
+static const size_t kMaxHeadSize = 64 * 1024;
+static const size_t kFillerSize = 256 * 1024;
+static const size_t kMaxIovecs = 64;
+static const char kCrlf[] = "\r\n";
+static const char kHeadTerminator[] = "\r\n\r\n";
+
+static bool sendAll(const int& fd, iovec* parts, size_t count) {
+    while (count > 0) {
+        msghdr message = {};
+        message.msg_iov = parts;
+        message.msg_iovlen = static_cast<int>(count);
+        ssize_t sent = sendmsg(fd, &message, kSendFlags);
+        if (sent < 0) {
+            if (errno == EINTR)
+                continue;
+            return false;
+        }
+        while (count > 0 && static_cast<size_t>(sent) >= parts->iov_len) {
+            sent -= parts->iov_len;
+            ++parts;
+            --count;
+        }
+        if (count > 0) {
+            parts->iov_base = static_cast<char*>(parts->iov_base) + sent;
+            parts->iov_len -= sent;
+        }
+    }
+    return true;
+}
+
+// Returns the value of name in the query part of target, or nullptr.
+static const char* queryParameter(const std::string& target, const char* name) {
+    const size_t query = target.find('?');
+    if (query == std::string::npos)
+        return nullptr;
+
+    const size_t nameLength = std::strlen(name);
+    size_t pos = query + 1;
+    while (pos < target.size()) {
+        if (target.compare(pos, nameLength, name) == 0 && pos + nameLength < target.size() &&
+            target[pos + nameLength] == '=')
+            return target.c_str() + pos + nameLength + 1;
+        pos = target.find('&', pos);
+        if (pos == std::string::npos)
+            break;
+        ++pos;
+    }
+    return nullptr;
+}
+
+static bool headerEquals(const char* line, const size_t& length, const char* name) {
+    const size_t nameLength = std::strlen(name);
+    return length > nameLength && line[nameLength] == ':' &&
+           strncasecmp(line, name, nameLength) == 0;
+}
+
+static const char* skipSpaces(const char* value, const char* end) {
+    while (value < end && (*value == ' ' || *value == '\t'))
+        ++value;
+    return value;
+}
+
+std::string fillerHeaders(const size_t& count) {
+    std::string block;
+    for (size_t i = 0; i < count; ++i) {
+        block += "X-Filler-" + std::to_string(i + 1) + ": ";
+        block.append(16 + (i * 23) % 64, 'v');
+        block += kCrlf;
+    }
+    return block;
+}
+
+LoopbackServerConfig::LoopbackServerConfig()
+    : responseSize(1024), chunked(false), chunkSize(16 * 1024), delayMs(0), extraHeaders(0) {}
+
+LoopbackServer::LoopbackServer(const LoopbackServerConfig& config)
+    : config(config),
+      filler(kFillerSize, 'x'),
+      headerBlock(fillerHeaders(config.extraHeaders)),
+      listenFd(-1),
+      port(0),
+      stopping(false) {
+    if (this->config.chunkSize == 0)
+        this->config.chunkSize = 16 * 1024;
+    this->config.chunkSize = std::min(this->config.chunkSize, kFillerSize);
+}
+
+LoopbackServer::~LoopbackServer() {
+    stop();
+}
+
+bool LoopbackServer::start(const int& requestedPort) {
+    listenFd = socket(AF_INET, SOCK_STREAM, 0);
+    if (listenFd < 0)
+        return false;
+
+    int on = 1;
+    setsockopt(listenFd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+#ifdef TCP_FASTOPEN
+    // Lets the sockopts scenario measure Fast Open where the kernel allows it on the server side.
+    const int fastOpenQueue = 256;
+    setsockopt(listenFd, IPPROTO_TCP, TCP_FASTOPEN, &fastOpenQueue, sizeof(fastOpenQueue));
+#endif
+
+    sockaddr_in address = {};
+    address.sin_family = AF_INET;
+    address.sin_port = htons(static_cast<uint16_t>(requestedPort));
+    address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    socklen_t length = sizeof(address);
+    if (bind(listenFd, reinterpret_cast<sockaddr*>(&address), length) < 0 ||
+        listen(listenFd, 1024) < 0 ||
+        getsockname(listenFd, reinterpret_cast<sockaddr*>(&address), &length) < 0) {
+        ::close(listenFd);
+        listenFd = -1;
+        return false;
+    }
+
+    port = ntohs(address.sin_port);
+    acceptThread = std::thread(&LoopbackServer::acceptLoop, this);
+    return true;
+}
+
+void LoopbackServer::stop() {
+    if (listenFd < 0)
+        return;
+
+    stopping = true;
+    shutdown(listenFd, SHUT_RDWR);
+    if (acceptThread.joinable())
+        acceptThread.join();
+    ::close(listenFd);
+    listenFd = -1;
+
+    std::vector<std::thread> finished;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        for (const int fd : connections)
+            shutdown(fd, SHUT_RDWR);
+        finished.swap(workers);
+    }
+    for (std::thread& worker : finished)
+        worker.join();
+}
+
+int LoopbackServer::getPort() const {
+    return port;
+}
+
+void LoopbackServer::acceptLoop() {
+    if (config.onThreadStart)
+        config.onThreadStart();
+
+    while (!stopping) {
+        const int fd = accept(listenFd, nullptr, nullptr);
+        if (fd < 0) {
+            if (errno == EINTR || errno == ECONNABORTED)
+                continue;
+            break;
+        }
+        if (stopping) {
+            ::close(fd);
+            break;
+        }
+
+        int on = 1;
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+#ifdef SO_NOSIGPIPE
+        setsockopt(fd, SOL_SOCKET, SO_NOSIGPIPE, &on, sizeof(on));
+#endif
+
+        std::lock_guard<std::mutex> lock(mutex);
+        connections.insert(fd);
+        workers.push_back(std::thread(&LoopbackServer::serve, this, fd));
+    }
+}
+
+void LoopbackServer::serve(const int& fd) {
+    if (config.onThreadStart)
+        config.onThreadStart();
+
+    std::vector<char> input(kMaxHeadSize);
+    std::vector<char> scratch;
+    std::string target;
+    size_t used = 0;
+    bool open = true;
+
+    while (open && !stopping) {
+        // Wait for a complete request head.
+        const char* headEnd = nullptr;
+        while (true) {
+            const char* found = std::search(input.data(), input.data() + used, kHeadTerminator,
+                                            kHeadTerminator + 4);
+            if (found != input.data() + used) {
+                headEnd = found + 4;
+                break;
+            }
+            if (used == input.size())
+                break;
+            const ssize_t received = recv(fd, input.data() + used, input.size() - used, 0);
+            if (received < 0 && errno == EINTR)
+                continue;
+            if (received <= 0)
+                break;
+            used += received;
+        }
+        if (headEnd == nullptr)
+            break;
+
+        const char* cursor = input.data();
+        const char* lineEnd = std::search(cursor, headEnd, kCrlf, kCrlf + 2);
+        const char* methodEnd =
+            static_cast<const char*>(std::memchr(cursor, ' ', lineEnd - cursor));
+        if (methodEnd == nullptr)
+            break;
+        const char* targetEnd =
+            static_cast<const char*>(std::memchr(methodEnd + 1, ' ', lineEnd - methodEnd - 1));
+        if (targetEnd == nullptr)
+            break;
+        target.assign(methodEnd + 1, targetEnd);
+        const bool headRequest = methodEnd - cursor == 4 && std::memcmp(cursor, "HEAD", 4) == 0;
+
+        size_t contentLength = 0;
+        for (cursor = lineEnd + 2; cursor < headEnd - 2; cursor = lineEnd + 2) {
+            lineEnd = std::search(cursor, headEnd, kCrlf, kCrlf + 2);
+            const size_t length = lineEnd - cursor;
+            if (headerEquals(cursor, length, "Content-Length")) {
+                contentLength = std::strtoull(skipSpaces(cursor + 15, lineEnd), nullptr, 10);
+            } else if (headerEquals(cursor, length, "Connection")) {
+                const char* value = skipSpaces(cursor + 11, lineEnd);
+                if (lineEnd - value == 5 && strncasecmp(value, "close", 5) == 0)
+                    open = false;
+            }
+        }
+
+        // Discard the request body, part of which may already be buffered.
+        size_t consumed = headEnd - input.data();
+        const size_t buffered = std::min(contentLength, used - consumed);
+        consumed += buffered;
+        contentLength -= buffered;
+        while (contentLength > 0) {
+            const ssize_t received =
+                recv(fd, input.data(), std::min(contentLength, input.size()), 0);
+            if (received < 0 && errno == EINTR)
+                continue;
+            if (received <= 0) {
+                open = false;
+                break;
+            }
+            contentLength -= received;
+        }
+        if (contentLength > 0)
+            break;
+
+        if (!respond(fd, target, headRequest, scratch))
+            break;
+
+        // Keep bytes of pipelined requests that arrived with this one.
+        std::memmove(input.data(), input.data() + consumed, used - consumed);
+        used -= consumed;
+    }
+
+    std::lock_guard<std::mutex> lock(mutex);
+    connections.erase(fd);
+    ::close(fd);
+}
+
+bool LoopbackServer::respond(const int& fd, const std::string& target, const bool& headRequest,
+                             std::vector<char>& scratch) {
+    size_t size = config.responseSize;
+    bool chunked = config.chunked;
+    int delayMs = config.delayMs;
+    if (const char* value = queryParameter(target, "size"))
+        size = std::strtoull(value, nullptr, 10);
+    if (const char* value = queryParameter(target, "chunked"))
+        chunked = *value == '1';
+    if (const char* value = queryParameter(target, "delay"))
+        delayMs = std::atoi(value);
+
+    if (delayMs > 0)
+        std::this_thread::sleep_for(std::chrono::milliseconds(delayMs));
+
+    char head[160];
+    const int headLength =
+        chunked ? std::snprintf(head, sizeof(head),
+                                "HTTP/1.1 200 OK\r\nContent-Type: application/octet-stream\r\n"
+                                "Transfer-Encoding: chunked\r\n")
+                : std::snprintf(head, sizeof(head),
+                                "HTTP/1.1 200 OK\r\nContent-Type: application/octet-stream\r\n"
+                                "Content-Length: %zu\r\n",
+                                size);
+
+    iovec parts[kMaxIovecs];
+    size_t count = 0;
+    parts[count].iov_base = head;
+    parts[count++].iov_len = headLength;
+    if (!headerBlock.empty()) {
+        parts[count].iov_base = const_cast<char*>(headerBlock.data());
+        parts[count++].iov_len = headerBlock.size();
+    }
+    parts[count].iov_base = const_cast<char*>(kCrlf);
+    parts[count++].iov_len = 2;
+    if (headRequest)
+        return sendAll(fd, parts, count);
+
+    if (!chunked) {
+        while (size > 0) {
+            const size_t piece = std::min(size, filler.size());
+            parts[count].iov_base = const_cast<char*>(filler.data());
+            parts[count++].iov_len = piece;
+            size -= piece;
+            if (count == kMaxIovecs) {
+                if (!sendAll(fd, parts, count))
+                    return false;
+                count = 0;
+            }
+        }
+        return sendAll(fd, parts, count);
+    }
+
+    // Each chunk takes three parts: its size line, the data and the CRLF after it.
+    scratch.resize(kMaxIovecs * 20);
+    size_t sizeLines = 0;
+    while (true) {
+        const size_t piece = std::min(size, config.chunkSize);
+        char* line = scratch.data() + sizeLines * 20;
+        ++sizeLines;
+        parts[count].iov_base = line;
+        parts[count++].iov_len = std::snprintf(line, 20, "%zx\r\n", piece);
+        if (piece > 0) {
+            parts[count].iov_base = const_cast<char*>(filler.data());
+            parts[count++].iov_len = piece;
+        }
+        parts[count].iov_base = const_cast<char*>(kCrlf);
+        parts[count++].iov_len = 2;
+        size -= piece;
+
+        if (piece == 0 || count + 3 > kMaxIovecs) {
+            if (!sendAll(fd, parts, count))
+                return false;
+            count = 0;
+            sizeLines = 0;
+        }
+        if (piece == 0)
+            return true;
+    }
+}
+
+}  // namespace SimpleHTTP
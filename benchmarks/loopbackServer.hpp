@@ -0,0 +1,67 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <functional>
+#include <mutex>
+#include <set>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace SimpleHTTP {
+
+// What the loopback server answers with. Each request may override size, chunked and delay with
+// query parameters of the same names (e.g. "/bytes?size=65536&chunked=1&delay=5").
+struct LoopbackServerConfig {
+    size_t responseSize;
+    bool chunked;
+    size_t chunkSize;
+    int delayMs;
+    // Filler header fields added to every response, for header-heavy workloads.
+    size_t extraHeaders;
+    // Runs first on every server thread (the benchmark uses it to stop counting allocations
+    // made by the server).
+    std::function<void()> onThreadStart;
+
+    LoopbackServerConfig();
+};
+
+// count header lines of assorted lengths ("X-Filler-1: ...\r\n"), as the server sends them.
+std::string fillerHeaders(const size_t& count);
+
+// Minimal HTTP/1.1 server on 127.0.0.1 with one thread per connection. Request bodies are read
+// and discarded; every response is responseSize bytes of filler, optionally chunked, sent after
+// delayMs. Keep-alive and pipelined requests are supported.
+class LoopbackServer {
+    LoopbackServerConfig config;
+    std::string filler;
+    std::string headerBlock;
+    int listenFd;
+    int port;
+    std::atomic<bool> stopping;
+    std::thread acceptThread;
+
+    std::mutex mutex;
+    std::set<int> connections;
+    std::vector<std::thread> workers;
+
+    void acceptLoop();
+    void serve(const int& fd);
+    bool respond(const int& fd, const std::string& target, const bool& headRequest,
+                 std::vector<char>& scratch);
+
+public:
+    explicit LoopbackServer(const LoopbackServerConfig& config = LoopbackServerConfig());
+    ~LoopbackServer();
+
+    LoopbackServer(const LoopbackServer&) = delete;
+    LoopbackServer& operator=(const LoopbackServer&) = delete;
+
+    // Listens on 127.0.0.1:port (0 picks a free port) and starts accepting.
+    bool start(const int& port = 0);
+    void stop();
+    int getPort() const;
+};
+
+}  // namespace SimpleHTTP
@@ -0,0 +1,101 @@
+#pragma once
+
+#include <cstddef>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+namespace SimpleHTTP {
+
+// Contiguous receive buffer with separate read and write cursors. Space freed by consume() is
+// reclaimed by moving the unread bytes to the front before the buffer is ever grown, so a
+// buffer that has reached its working size stops allocating.
+class Buffer {
+    std::unique_ptr<char[]> storage;
+    size_t capacity;
+    size_t readPos;
+    size_t writePos;
+
+public:
+    explicit Buffer(const size_t& initialCapacity = 0);
+
+    Buffer(const Buffer&) = delete;
+    Buffer& operator=(const Buffer&) = delete;
+
+    Buffer(Buffer&& other) noexcept;
+    Buffer& operator=(Buffer&& other) noexcept;
+
+    char* data();
+    const char* data() const;
+    size_t size() const;
+    bool empty() const;
+
+    char* writePtr();
+    size_t writable() const;
+    void ensureWritable(const size_t& count);
+    void commit(const size_t& count);
+
+    void append(const char* bytes, const size_t& count);
+    void consume(const size_t& count);
+    void clear();
+
+    size_t getCapacity() const;
+};
+
+// Free list of receive buffers shared by the requests of one client.
+class BufferPool {
+    std::vector<std::unique_ptr<Buffer>> buffers;
+    size_t maxPooled;
+    size_t maxRetainedCapacity;
+    std::mutex mutex;
+
+public:
+    explicit BufferPool(const size_t& maxPooled = 16,
+                        const size_t& maxRetainedCapacity = 4 * 1024 * 1024);
+
+    BufferPool(const BufferPool&) = delete;
+    BufferPool& operator=(const BufferPool&) = delete;
+
+    std::unique_ptr<Buffer> acquire();
+    void release(std::unique_ptr<Buffer> buffer);
+};
+
+// Free list of reusable objects of one type. Released objects keep the capacity they grew while
+// in use, so the next user of one does not allocate again.
+template <typename T>
+class ObjectPool {
+    std::vector<std::unique_ptr<T>> objects;
+    size_t maxPooled;
+    std::mutex mutex;
+
+public:
+    explicit ObjectPool(const size_t& maxPooled = 16) : maxPooled(maxPooled) {
+        objects.reserve(maxPooled);
+    }
+
+    ObjectPool(const ObjectPool&) = delete;
+    ObjectPool& operator=(const ObjectPool&) = delete;
+
+    std::unique_ptr<T> acquire() {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            if (!objects.empty()) {
+                std::unique_ptr<T> object = std::move(objects.back());
+                objects.pop_back();
+                return object;
+            }
+        }
+        return std::unique_ptr<T>(new T());
+    }
+
+    void release(std::unique_ptr<T> object) {
+        if (!object)
+            return;
+
+        std::lock_guard<std::mutex> lock(mutex);
+        if (objects.size() < maxPooled)
+            objects.push_back(std::move(object));
+    }
+};
+
+}  // namespace SimpleHTTP
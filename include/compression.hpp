@@ -0,0 +1,51 @@
+#pragma once
+
+#include <cstddef>
+#include <functional>
+#include <memory>
+#include <string>
+
+#include "buffer.hpp"
+
+namespace SimpleHTTP {
+
+enum class ContentEncoding { Identity, Gzip, Deflate, Zstd, Unsupported };
+
+// Streaming decoder for one response Content-Encoding. Compressed bytes can be fed in pieces of
+// any size; decoded output is passed to the sink as it is produced. gzip and deflate need zlib
+// and zstd needs libzstd at build time; without them those encodings are reported unsupported.
+class Decompressor {
+public:
+    typedef std::function<bool(const char* data, size_t size)> Sink;
+
+private:
+    class Impl;
+    std::unique_ptr<Impl> impl;
+
+public:
+    Decompressor();
+    ~Decompressor();
+
+    Decompressor(const Decompressor&) = delete;
+    Decompressor& operator=(const Decompressor&) = delete;
+
+    static ContentEncoding parseEncoding(const char* value, const size_t& length);
+    static bool isSupported(const ContentEncoding& encoding);
+    // Value for Accept-Encoding listing what this build can decode, or "" when nothing.
+    static const char* acceptEncoding();
+
+    // Prepares for a new stream; state from a previous stream of the same encoding is reused.
+    bool begin(const ContentEncoding& encoding);
+    // Returns false on corrupt input or when the sink asks to stop.
+    bool decompress(const char* data, const size_t& size, const Sink& sink);
+    // True once the compressed stream has ended cleanly.
+    bool isFinished() const;
+};
+
+class Compressor {
+public:
+    // Appends the gzip encoding of data to output. Returns false when zlib is not available.
+    static bool gzip(const char* data, const size_t& size, Buffer& output, const int& level = 6);
+};
+
+}  // namespace SimpleHTTP
@@ -0,0 +1,50 @@
+#pragma once
+
+#include <chrono>
+#include <deque>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+
+#include "socket.hpp"
+
+namespace SimpleHTTP {
+
+struct ConnectionPoolConfig {
+    size_t maxIdlePerHost;
+    int idleTimeoutSeconds;
+
+    ConnectionPoolConfig();
+};
+
+class ConnectionPool {
+    struct IdleConnection {
+        std::unique_ptr<Socket> socket;
+        std::chrono::steady_clock::time_point idleSince;
+    };
+
+    ConnectionPoolConfig config;
+    std::map<std::string, std::deque<IdleConnection>> idle;
+    mutable std::mutex mutex;
+
+    static std::string makeKey(const std::string& host, const int& port);
+    bool isExpired(const IdleConnection& connection,
+                   const std::chrono::steady_clock::time_point& now) const;
+
+public:
+    explicit ConnectionPool(const ConnectionPoolConfig& config = ConnectionPoolConfig());
+
+    ConnectionPool(const ConnectionPool&) = delete;
+    ConnectionPool& operator=(const ConnectionPool&) = delete;
+
+    std::unique_ptr<Socket> acquire(const std::string& host, const int& port);
+    void release(const std::string& host, const int& port, std::unique_ptr<Socket> socket);
+
+    void setConfig(const ConnectionPoolConfig& newConfig);
+    ConnectionPoolConfig getConfig() const;
+    size_t idleCount() const;
+    void clear();
+};
+
+}  // namespace SimpleHTTP
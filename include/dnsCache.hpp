@@ -0,0 +1,94 @@
+#pragma once
+
+#include <pthread.h>
+
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "socket.hpp"
+
+namespace SimpleHTTP {
+
+struct DnsCacheConfig {
+    int ttlSeconds;
+    int negativeTtlSeconds;
+    // Entries used within this many seconds of expiring are re-resolved in the background while
+    // callers keep getting the cached addresses. 0 disables refresh-ahead.
+    int refreshAheadSeconds;
+    size_t maxEntries;
+
+    DnsCacheConfig();
+};
+
+// Process-wide, thread-safe cache in front of getaddrinfo. A ttlSeconds of 0 disables caching.
+// Concurrent lookups of the same host share one getaddrinfo call.
+class DnsCache {
+    struct Entry {
+        std::vector<SocketAddress> addresses;
+        std::chrono::steady_clock::time_point expires;
+        bool pinned;
+        bool refreshing;
+    };
+
+    // A getaddrinfo call in progress; callers needing the same host wait for its result.
+    struct Lookup {
+        bool done;
+        bool resolved;
+        std::vector<SocketAddress> addresses;
+    };
+
+    DnsCacheConfig config;
+    std::map<std::string, Entry> entries;
+    std::map<std::string, std::shared_ptr<Lookup>> lookups;
+    std::condition_variable lookupDone;
+    // Refresh-ahead runs on one detached thread, started with the first refresh and left running
+    // until the process exits.
+    std::deque<std::string> refreshQueue;
+    std::condition_variable refreshWanted;
+    bool refresherStarted;
+    mutable std::mutex mutex;
+
+    DnsCache();
+
+    static bool lookup(const std::string& host, std::vector<SocketAddress>& addresses);
+    static void* refresherMain(void* arg);
+    void runRefresher();
+    void scheduleRefresh(const std::string& host, Entry& entry);
+    bool lookupShared(const std::string& host, std::vector<SocketAddress>& addresses,
+                      const bool& refresh);
+    void store(const std::string& host, const std::vector<SocketAddress>& addresses,
+               const bool& pinned);
+    void evictIfFull(const std::chrono::steady_clock::time_point& now);
+    bool findCached(const std::string& host, std::vector<SocketAddress>& addresses);
+    bool resolveCached(const std::string& host, std::vector<SocketAddress>& addresses);
+
+public:
+    static DnsCache& instance();
+
+    DnsCache(const DnsCache&) = delete;
+    DnsCache& operator=(const DnsCache&) = delete;
+
+    bool resolve(const std::string& host, const int& port, std::vector<SocketAddress>& addresses);
+    // Answers from the cache only, never blocking on a lookup: returns false when one is needed.
+    // A host cached as unresolvable leaves addresses empty.
+    bool resolveIfCached(const std::string& host, const int& port,
+                         std::vector<SocketAddress>& addresses);
+
+    // Seeded entries expire like resolved ones; pinned entries never expire.
+    bool seed(const std::string& host, const std::vector<std::string>& ips);
+    bool pin(const std::string& host, const std::vector<std::string>& ips);
+    void unpin(const std::string& host);
+    void remove(const std::string& host);
+    void clear();
+
+    void setConfig(const DnsCacheConfig& newConfig);
+    DnsCacheConfig getConfig() const;
+};
+
+}  // namespace SimpleHTTP
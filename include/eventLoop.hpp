@@ -0,0 +1,189 @@
+#pragma once
+
+#include <pthread.h>
+
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "ioUring.hpp"
+#include "socket.hpp"
+
+namespace SimpleHTTP {
+
+// Runs many request/response exchanges over non-blocking sockets on a single thread
+// (epoll on Linux, poll elsewhere). Built with ENABLE_IO_URING, the loop instead submits its
+// sends and receives to an io_uring on kernels that support it, batching them into one system
+// call per iteration.
+class EventLoop {
+public:
+    // Closed and Reset: the peer closed or reset the connection while the response was read.
+    // Unsent: the connection failed before the request was fully written. TimedOut: the
+    // exchange made no progress within the socket timeout.
+    enum class Result { Complete, Closed, Reset, Unsent, TimedOut, Failed };
+
+    // Called after new response bytes were appended to the input buffer; returns true once the
+    // message is complete.
+    typedef std::function<bool(Buffer& input)> DataHandler;
+    typedef std::function<void(Result result, std::unique_ptr<Socket> socket)> CompletionHandler;
+
+private:
+    struct Operation {
+        uint64_t id;
+        std::unique_ptr<Socket> socket;
+        DataView output[2];
+        size_t outputSize;
+        Buffer* input;
+        size_t sent;
+        bool reading;
+        // Taken from the socket timeout; pushed back whenever the exchange makes progress.
+        int timeoutMs;
+        std::chrono::steady_clock::time_point deadline;
+        DataHandler onData;
+        CompletionHandler onComplete;
+        // io_uring only: whether a request for this operation is with the kernel (there is at
+        // most one) and whether it is a multishot receive. finish() cancels it and records the
+        // result, which is reported once the request has completed.
+        bool inFlight;
+        bool multishot;
+        bool finishing;
+        Result result;
+        iovec vectors[2];
+        msghdr message;
+        // While connecting, Happy Eyeballs style (RFC 8305): the interleaved addresses, the next
+        // one to try, when to start it at the latest and the attempts racing each other.
+        std::vector<SocketAddress> addresses;
+        size_t nextAddress;
+        std::chrono::steady_clock::time_point nextAttempt;
+        std::vector<std::unique_ptr<Socket>> attempts;
+    };
+
+    class Poller;
+
+    // The poller watches every socket unless the ring is set; then it only watches connect
+    // attempts, and the ring watches the poller.
+    std::unique_ptr<Poller> poller;
+    std::unique_ptr<IoUring> ring;
+    // Cleared if the kernel turns down a multishot receive; plain receives are used from then on.
+    bool multishot;
+    std::map<int, std::unique_ptr<Operation>> operations;
+    // Operations whose connection is being set up, and the descriptors of their attempts.
+    std::vector<std::unique_ptr<Operation>> connecting;
+    std::map<int, Operation*> attemptOwners;
+    std::deque<std::unique_ptr<Operation>> incoming;
+    std::vector<uint64_t> cancellations;
+    uint64_t nextId;
+    std::mutex mutex;
+    int wakeFds[2];
+    pthread_t threadId;
+    bool running;
+    bool stopping;
+
+    static void* threadMain(void* arg);
+    bool initRing();
+    void run();
+    void runRing();
+    void wake();
+    void acceptIncoming();
+    void start(std::unique_ptr<Operation> operation);
+    void beginConnect(std::unique_ptr<Operation> operation);
+    void startAttempt(Operation* operation);
+    void handleAttempt(Operation* operation, const int& fd);
+    void pollAttempts();
+    std::unique_ptr<Operation> takeConnecting(Operation* operation);
+    void connected(Operation* operation, std::unique_ptr<Socket> socket);
+    void failConnect(Operation* operation, const Result& result);
+    void cancelOperation(const uint64_t& id);
+    void handleEvent(Operation* operation, const bool& readable, const bool& writable);
+    void handleCompletion(Operation* operation, const IoUring::Completion& completion);
+    void sendRing(Operation* operation);
+    void receiveRing(Operation* operation);
+    int expireOperations();
+    static void touch(Operation* operation);
+    void finish(Operation* operation, const Result& result);
+    static void report(std::unique_ptr<Operation> operation, const Result& result);
+    void failAll();
+
+public:
+    EventLoop();
+    ~EventLoop();
+
+    EventLoop(const EventLoop&) = delete;
+    EventLoop& operator=(const EventLoop&) = delete;
+
+    // Takes ownership of a connected socket, or of an unconnected one to be connected to one of
+    // addresses, writes head and body and reads the response into input. The memory behind
+    // head, body and input must outlive the exchange. onComplete runs on the loop thread and
+    // gets the socket back. Returns an id for cancel(), or 0 if the loop is not running.
+    uint64_t submit(std::unique_ptr<Socket> socket, const std::vector<SocketAddress>& addresses,
+                    const DataView& head, const DataView& body, Buffer& input, DataHandler onData,
+                    CompletionHandler onComplete);
+    // Finishes the exchange with Result::Failed if it is still running. Any thread may call it.
+    void cancel(const uint64_t& id);
+    void stop();
+};
+
+// A fixed set of event loops that requests are spread over round-robin. The loop threads are
+// started by the first call to next().
+class EventLoopGroup {
+    std::vector<std::unique_ptr<EventLoop>> loops;
+    size_t threadCount;
+    size_t nextLoop;
+    std::mutex mutex;
+
+public:
+    explicit EventLoopGroup(const size_t& threadCount = 1);
+
+    EventLoopGroup(const EventLoopGroup&) = delete;
+    EventLoopGroup& operator=(const EventLoopGroup&) = delete;
+
+    EventLoop* next();
+    void setThreadCount(const size_t& count);
+};
+
+// Handle for a request running on an EventLoop.
+class AsyncHandle {
+public:
+    struct State {
+        std::mutex mutex;
+        std::condition_variable finished;
+        bool done;
+        bool cancelled;
+        // The loop the request is with and its id there, else null. Cleared before the
+        // connection is closed or pooled, so cancel() never reaches an exchange the request no
+        // longer owns.
+        EventLoop* loop;
+        uint64_t operationId;
+
+        State();
+        void markDone();
+        // Called by the loop's completion handler; returns false if the request was cancelled
+        // (its connection must then not be reused).
+        bool release();
+    };
+
+private:
+    std::shared_ptr<State> state;
+
+public:
+    explicit AsyncHandle(const std::shared_ptr<State>& state);
+
+    void join();
+    // Lets the request finish on its own, as destroying the handle does; afterwards join()
+    // returns at once, isDone() is true and cancel() has no effect.
+    void detach();
+    bool isDone() const;
+    // Stops the request: an HTTP/1.1 exchange is finished by its loop, closing the connection,
+    // and completes with httpCode -1; an HTTP/2 stream keeps running but the request is marked
+    // cancelled.
+    void cancel();
+    bool isCancelled() const;
+};
+
+}  // namespace SimpleHTTP
@@ -0,0 +1,106 @@
+#pragma once
+
+#include <pthread.h>
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+namespace SimpleHTTP {
+
+struct ExecutorConfig {
+    enum class Overflow { Block, Reject };
+
+    // Worker threads; 0 uses the number of hardware threads.
+    size_t threads;
+    // Tasks accepted but not yet started, including those held back by maxPerHost. 0 is
+    // unbounded.
+    size_t queueCapacity;
+    // What submit() does when the queue is full: wait for room, or fail right away.
+    Overflow overflow;
+    // Tasks with the same key (HttpClient uses the request's host:port) that may run at once;
+    // the rest wait without occupying a worker. 0 is unlimited.
+    size_t maxPerHost;
+
+    ExecutorConfig();
+};
+
+// Fixed pool of worker threads, started by the first submit(). Each worker has its own deque:
+// it runs its newest task first and, when it runs dry, steals the oldest task of another worker.
+class Executor {
+public:
+    // Called exactly once: with cancelled false on a worker thread, or with cancelled true when
+    // the executor shuts down before the task started.
+    typedef std::function<void(const bool& cancelled)> Task;
+
+private:
+    struct Job {
+        std::string key;
+        Task task;
+    };
+
+    struct Worker {
+        Executor* owner;
+        size_t index;
+        pthread_t threadId;
+        bool started;
+        std::mutex mutex;
+        std::deque<Job> jobs;
+    };
+
+    struct KeyState {
+        size_t running;
+        std::deque<Job> held;
+    };
+
+    ExecutorConfig config;
+    std::vector<std::unique_ptr<Worker>> workers;
+    std::atomic<size_t> nextWorker;
+
+    std::mutex mutex;
+    std::condition_variable available;
+    std::condition_variable space;
+    std::condition_variable idle;
+    // Jobs sitting in worker deques.
+    int64_t ready;
+    size_t pending;
+    size_t active;
+    // Written under mutex; workers also check it between tasks without the lock.
+    std::atomic<bool> stopping;
+    std::map<std::string, KeyState> keys;
+
+    void start();
+    static void* threadMain(void* arg);
+    void run(Worker& worker);
+    bool take(Worker& worker, Job& job);
+    void push(const size_t& index, Job job);
+    void finish(Worker& worker, const std::string& key);
+
+public:
+    explicit Executor(const ExecutorConfig& config = ExecutorConfig());
+    // Lets running tasks finish and cancels the ones that have not started.
+    ~Executor();
+
+    Executor(const Executor&) = delete;
+    Executor& operator=(const Executor&) = delete;
+
+    // Applies config if no task was submitted yet.
+    void setConfig(const ExecutorConfig& newConfig);
+    // Queues task under key. Returns false, without calling task, when the queue is full and
+    // the overflow policy is Reject, or when the executor is shutting down.
+    bool submit(const std::string& key, const Task& task);
+    // Waits until no task is queued or running.
+    void waitIdle();
+    void shutdown();
+    size_t threadCount();
+};
+
+}  // namespace SimpleHTTP
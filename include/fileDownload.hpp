@@ -0,0 +1,21 @@
+#pragma once
+
+#include <cstddef>
+
+namespace SimpleHTTP {
+
+struct FileDownloadConfig {
+    // Byte ranges fetched at once, each on its own connection.
+    size_t segments;
+    // Segments are at least this large, so small objects are split into fewer of them.
+    size_t minSegmentSize;
+    // Tries per segment; each retry continues where the previous one stopped.
+    int attemptsPerSegment;
+    // Keeps the partial file and its progress record when a download fails, and continues from
+    // them on the next download to the same path if the object did not change.
+    bool resume;
+
+    FileDownloadConfig();
+};
+
+}  // namespace SimpleHTTP
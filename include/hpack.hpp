@@ -0,0 +1,83 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <string>
+#include <vector>
+
+#include "buffer.hpp"
+
+namespace SimpleHTTP {
+
+// One header field as HTTP/2 carries it; names are lowercase.
+struct HpackField {
+    std::string name;
+    std::string value;
+
+    HpackField();
+    HpackField(const std::string& name, const std::string& value);
+};
+
+// HPACK (RFC 7541) dynamic table: newest entry first, oldest entries evicted once the table
+// grows past maxSize, where each entry counts as name + value + 32 bytes.
+class HpackTable {
+    std::deque<HpackField> entries;
+    size_t size;
+    size_t maxSize;
+
+    void evict(const size_t& room);
+
+public:
+    explicit HpackTable(const size_t& maxSize = 4096);
+
+    void add(const std::string& name, const std::string& value);
+    void setMaxSize(const size_t& maxSize);
+    size_t getMaxSize() const;
+
+    // Resolves a 1-based index into the static table followed by this table; nullptr when out
+    // of range.
+    const HpackField* lookup(const uint64_t& index) const;
+    // Returns the index of the field (valueMatch set) or of its name, or 0 when neither is known.
+    size_t find(const std::string& name, const std::string& value, bool& valueMatch) const;
+};
+
+// Encodes request header blocks. Repeated fields are indexed so that after the first request
+// on a connection most of a block is one byte per field; credentials are never indexed.
+class HpackEncoder {
+    HpackTable table;
+    bool sizeUpdatePending;
+
+public:
+    HpackEncoder();
+
+    // Applies the peer's SETTINGS_HEADER_TABLE_SIZE (at most 4096 is used).
+    void setMaxTableSize(const size_t& size);
+    void encode(const std::vector<HpackField>& fields, Buffer& output);
+
+    static void encodeInteger(const uint64_t& value, const int& prefixBits, const uint8_t& flags,
+                              Buffer& output);
+    static void encodeString(const std::string& text, Buffer& output);
+};
+
+// Decodes the header blocks of one connection, keeping its dynamic table in step with the peer.
+class HpackDecoder {
+    HpackTable table;
+    size_t maxTableSize;
+    size_t maxListSize;
+
+public:
+    explicit HpackDecoder(const size_t& maxTableSize = 4096,
+                          const size_t& maxListSize = 256 * 1024);
+
+    // Decodes one complete header block into fields. Returns false on a compression error, after
+    // which the connection cannot be used any more.
+    bool decode(const char* data, const size_t& size, std::vector<HpackField>& fields);
+
+    static bool decodeInteger(const uint8_t* data, const size_t& size, size_t& pos,
+                              const int& prefixBits, uint64_t& value);
+    static bool decodeString(const uint8_t* data, const size_t& size, size_t& pos,
+                             std::string& text);
+};
+
+}  // namespace SimpleHTTP
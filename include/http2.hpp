@@ -0,0 +1,204 @@
+#pragma once
+
+#include <pthread.h>
+
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <string>
+#include <vector>
+
+#include "hpack.hpp"
+#include "socket.hpp"
+
+namespace SimpleHTTP {
+
+// How HttpClient talks HTTP/2 over cleartext TCP (h2c). PriorKnowledge starts every connection
+// with the HTTP/2 preface; Upgrade first asks with an HTTP/1.1 "Upgrade: h2c" request and keeps
+// using HTTP/1.1 for hosts that do not switch.
+enum class Http2Mode { Disabled, PriorKnowledge, Upgrade };
+
+// Outcome of one HTTP/2 request.
+struct Http2Result {
+    bool ok;
+    // The server did not process the request (REFUSED_STREAM, a GOAWAY that excluded it, or a
+    // connection that never spoke HTTP/2), so it is safe to send again on another connection.
+    bool retryable;
+    int status;
+    std::vector<HpackField> headers;
+    std::string body;
+    // When the last request frame was written or queued for the socket and when the response
+    // head arrived, and the frame bytes of the stream in each direction.
+    std::chrono::steady_clock::time_point sent;
+    std::chrono::steady_clock::time_point firstByte;
+    size_t bytesSent;
+    size_t bytesReceived;
+
+    Http2Result();
+};
+
+// One h2c connection. Requests from any thread are multiplexed onto it as streams, subject to the
+// peer's MAX_CONCURRENT_STREAMS (extra requests wait in a queue) and to HTTP/2 flow control in
+// both directions. A reader thread per connection handles incoming frames and runs completions.
+class Http2Connection {
+public:
+    typedef std::function<void(Http2Result& result)> Completion;
+
+private:
+    struct Stream {
+        uint32_t id;
+        std::vector<HpackField> requestHeaders;
+        DataView body;
+        size_t bodySent;
+        int64_t sendWindow;
+        size_t unacknowledged;
+        bool responseStarted;
+        int timeoutMs;
+        std::chrono::steady_clock::time_point deadline;
+        Http2Result result;
+        Completion onComplete;
+    };
+
+    std::unique_ptr<Socket> socket;
+    pthread_t threadId;
+    bool running;
+    // Wakes the reader when a new stream's deadline is earlier than the one it sleeps until.
+    int wakeFds[2];
+
+    // Held while writing frames and while encoding header blocks, so blocks reach the wire in
+    // the order the HPACK encoder produced them. Taken before mutex, never after it. The socket
+    // is non-blocking, so nobody waits for the peer while holding it: what the socket does not
+    // take at once is queued in output and sent by the reader thread once it is writable.
+    std::mutex writeMutex;
+    HpackEncoder encoder;
+    Buffer headerOutput;
+    Buffer output;
+
+    std::mutex mutex;
+    std::map<uint32_t, std::unique_ptr<Stream>> streams;
+    std::deque<std::unique_ptr<Stream>> waiting;
+    std::vector<std::unique_ptr<Stream>> finished;
+    uint32_t nextStreamId;
+    int64_t sendWindow;
+    int64_t initialWindow;
+    size_t maxFrameSize;
+    size_t maxConcurrentStreams;
+    size_t unacknowledged;
+    bool settingsReceived;
+    bool goingAway;
+    bool closed;
+    bool http1Reply;
+    std::chrono::steady_clock::time_point sleepUntil;
+
+    // Reader thread only.
+    Buffer input;
+    HpackDecoder decoder;
+    Buffer headerBlock;
+    uint32_t headerStream;
+    bool headerEndStream;
+
+    bool upgrade(const std::string& authority, bool& unsupported);
+    bool sendPreface();
+
+    static void* threadMain(void* arg);
+    void run();
+    void wake();
+    int expireStreams();
+    bool processInput();
+    bool handleFrame(const uint8_t& type, const uint8_t& flags, const uint32_t& streamId,
+                     const char* payload, const size_t& length);
+    bool handleHeaderBlock();
+    bool handleData(const uint8_t& flags, const uint32_t& streamId, const char* payload,
+                    const size_t& length);
+    bool handleSettings(const uint8_t& flags, const char* payload, const size_t& length);
+
+    void pump();
+    bool flushOutput();
+    bool writeFrame(const uint8_t& type, const uint8_t& flags, const uint32_t& streamId,
+                    const char* payload, const size_t& length);
+    void writeControl(const uint8_t& type, const uint8_t& flags, const uint32_t& streamId,
+                      const char* payload, const size_t& length);
+    void finishStream(const uint32_t& streamId, const bool& ok, const bool& retryable);
+    bool connectionError(const uint32_t& errorCode);
+    void failConnection();
+    void runCompletions();
+
+public:
+    Http2Connection();
+    ~Http2Connection();
+
+    Http2Connection(const Http2Connection&) = delete;
+    Http2Connection& operator=(const Http2Connection&) = delete;
+
+    // Connects and starts the reader thread. authority is the Host value used for the Upgrade
+    // request. unsupported is set when the server answered in HTTP/1.1 instead of switching.
+    bool connect(const std::string& host, const int& port, const std::string& authority,
+                 const Http2Mode& mode, const int& timeoutMs, const SocketOptions& options,
+                 const std::string& unixPath, bool& unsupported);
+
+    // Queues one request. headers must start with the pseudo-header fields. onComplete runs
+    // exactly once, on the reader thread (or right away when the connection is already gone);
+    // body must stay valid until then. A stream without progress for timeoutMs is reset.
+    void submit(std::vector<HpackField> headers, const DataView& body, const int& timeoutMs,
+                const Completion& onComplete);
+
+    // True while the connection accepts new requests.
+    bool isUsable();
+    bool isIdle();
+    // True when the peer replied to the HTTP/2 preface in HTTP/1.1.
+    bool repliedHttp1();
+    bool onReaderThread() const;
+    // True on the reader thread of any connection.
+    static bool onAnyReaderThread();
+    void close();
+};
+
+// The HTTP/2 connections of one client, one per host:port. Hosts that answered in HTTP/1.1 are
+// remembered so that their requests go straight to HTTP/1.1.
+class Http2Pool {
+    // A connection being opened without the lock held; callers wanting the same host:port
+    // meanwhile wait for it instead of opening their own.
+    struct Pending {
+        bool done;
+        std::shared_ptr<Http2Connection> connection;
+
+        Pending();
+    };
+
+    std::map<std::string, std::shared_ptr<Http2Connection>> connections;
+    std::map<std::string, std::shared_ptr<Pending>> pending;
+    std::condition_variable pendingDone;
+    // Connections dropped on a reader thread, destroyed by the next caller that is not one.
+    std::vector<std::shared_ptr<Http2Connection>> retired;
+    std::set<std::string> http1Hosts;
+    std::mutex mutex;
+    bool closed;
+
+public:
+    Http2Pool();
+    ~Http2Pool();
+
+    Http2Pool(const Http2Pool&) = delete;
+    Http2Pool& operator=(const Http2Pool&) = delete;
+
+    // Returns the connection for host:port, opening it when there is none (reused tells which);
+    // a non-empty unixPath is connected to instead of host:port.
+    // Returns nullptr when connecting failed; http1Only is then set if the host does not speak
+    // HTTP/2.
+    std::shared_ptr<Http2Connection> acquire(const std::string& host, const int& port,
+                                             const std::string& authority,
+                                             const Http2Mode& mode, const int& timeoutMs,
+                                             const SocketOptions& options,
+                                             const std::string& unixPath, bool& http1Only,
+                                             bool& reused);
+    // Closes connections without requests in flight.
+    void closeIdle();
+};
+
+}  // namespace SimpleHTTP
@@ -0,0 +1,128 @@
+#pragma once
+
+#include <functional>
+#include <string>
+#include <vector>
+
+#include "compression.hpp"
+#include "scan.hpp"
+
+namespace SimpleHTTP {
+
+struct HttpHeaders;
+struct HttpResponse;
+
+// Resumable HTTP/1.1 response parser. The caller appends received bytes to one buffer and calls
+// parse() with the whole buffer each time; parsing resumes where it stopped. Head fields are
+// kept as offsets into that buffer and chunked bodies are decoded in place, so the body ends up
+// contiguous at [bodyOffset(), bodyOffset() + bodyLength()) without being copied out.
+//
+// With a body handler set, body bytes are passed to the handler instead of being kept, and
+// consumeParsed() lets the caller drop them from the buffer.
+class HttpResponseParser {
+public:
+    enum class State {
+        StatusLine,
+        Headers,
+        Body,
+        BodyUntilClose,
+        ChunkSize,
+        ChunkData,
+        ChunkDataEnd,
+        Trailers,
+        Complete,
+        Error
+    };
+
+    struct Span {
+        size_t offset;
+        size_t length;
+    };
+
+    struct HeaderField {
+        Span name;
+        Span value;
+    };
+
+    typedef std::function<bool(const char* data, size_t size)> BodyHandler;
+
+    static const size_t kMaxHeadSize = 256 * 1024;
+    // Head lines located per scanLines() pass.
+    static const size_t kLineBatch = 16;
+
+private:
+    State state;
+    bool headRequest;
+    BodyHandler bodyHandler;
+
+    size_t messageStart;
+    size_t readPos;
+    size_t bodyStart;
+    size_t bodyEnd;
+    size_t remaining;
+
+    Span protocol;
+    Span statusText;
+    int statusCode;
+    std::vector<HeaderField> fields;
+
+    bool chunked;
+    bool hasContentLength;
+    bool persistent;
+    size_t contentLength;
+    ContentEncoding contentEncoding;
+
+    // Complete head lines from readPos on, found ahead and not yet parsed. Always used up before
+    // parse() returns, so they never outlive the buffer they point into.
+    ScannedLine lines[kLineBatch];
+    size_t nextLine;
+    size_t lineCount;
+
+    bool parseStatusLine(const char* data, const size_t& lineStart, const size_t& lineEnd);
+    bool parseHeaderLine(const char* data, const size_t& lineStart, const size_t& lineEnd,
+                         const size_t& colonPos);
+    void startBody();
+    bool emitBody(char* data, const size_t& size);
+    bool fail();
+
+public:
+    explicit HttpResponseParser(const bool& headRequest = false);
+
+    void reset(const bool& headRequest = false);
+    void setBodyHandler(const BodyHandler& handler);
+
+    // Continues parsing [data, data + size). Bytes seen by an earlier call must still be in place
+    // (the buffer may have moved). Returns false once the response is malformed or the body
+    // handler asked to stop.
+    bool parse(char* data, const size_t& size);
+
+    // Tells the parser the peer closed the connection; completes a close-delimited body.
+    void finishOnClose();
+
+    // Streaming mode only: returns how many leading buffer bytes are no longer needed and
+    // rebases the parser as if they had been removed. Head field offsets become invalid.
+    size_t consumeParsed();
+
+    State getState() const;
+    bool headersComplete() const;
+    bool isComplete() const;
+    bool hasError() const;
+    bool keepAlive() const;
+
+    int getStatusCode() const;
+    // Where the current response starts; past 0 once an interim (1xx) response was skipped.
+    size_t messageBegin() const;
+    size_t messageEnd() const;
+    size_t bodyOffset() const;
+    size_t bodyLength() const;
+    bool isChunked() const;
+    bool hasBodyLength() const;
+    size_t getContentLength() const;
+    ContentEncoding getContentEncoding() const;
+    const std::vector<HeaderField>& getFields() const;
+
+    bool findHeader(const char* data, const char* name, Span& value) const;
+    void copyHead(const char* data, HttpResponse& response) const;
+};
+
+}  // namespace SimpleHTTP
@@ -0,0 +1,94 @@
+#pragma once
+
+#include <sys/socket.h>
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace SimpleHTTP {
+
+// Thin wrapper over a Linux io_uring instance, driven through the raw system calls so no
+// liburing is needed. Only built with ENABLE_IO_URING; elsewhere, and on kernels without the
+// features used here, init() fails and callers keep their readiness-based path.
+class IoUring {
+public:
+    struct Completion {
+        uint64_t userData;
+        int32_t result;
+        uint32_t flags;
+    };
+
+private:
+    int ringFd;
+    void* sqRing;
+    size_t sqRingSize;
+    void* cqRing;
+    size_t cqRingSize;
+    void* sqeMemory;
+    size_t sqeMemorySize;
+
+    unsigned* sqHead;
+    unsigned* sqTail;
+    unsigned sqMask;
+    unsigned* sqArray;
+    unsigned sqEntries;
+    // Entries filled in but not yet handed to the kernel.
+    unsigned queued;
+
+    unsigned* cqHead;
+    unsigned* cqTail;
+    unsigned cqMask;
+    void* cqes;
+
+    // Provided buffer ring registered with the kernel; multishot receives pick buffers from it.
+    void* bufferRing;
+    size_t bufferRingSize;
+    char* bufferMemory;
+    unsigned bufferCount;
+    unsigned bufferSize;
+    unsigned bufferTail;
+
+    void* nextSqe();
+    void queue();
+    int enter(const unsigned& submit, const unsigned& waitFor, const int& timeoutMs);
+    void release();
+
+public:
+    IoUring();
+    ~IoUring();
+
+    IoUring(const IoUring&) = delete;
+    IoUring& operator=(const IoUring&) = delete;
+
+    // Creates the rings. Fails when the kernel (or a seccomp policy) does not offer io_uring
+    // with timed waits and the socket operations used below.
+    bool init(const unsigned& entries);
+    // Registers count buffers of size bytes for multishot receives. Needs Linux 5.19.
+    bool initBufferRing(const unsigned& count, const unsigned& size);
+    bool hasBufferRing() const;
+
+    // Each prepare call queues one request; it returns false only if the queue stays full after
+    // flushing it to the kernel.
+    bool preparePoll(const int& fd, const short& events, const uint64_t& userData);
+    bool prepareSend(const int& fd, const msghdr* message, const uint64_t& userData);
+    bool prepareReceive(const int& fd, char* data, const size_t& size, const uint64_t& userData);
+    // Keeps delivering received data in buffers from the buffer ring until it is cancelled or
+    // the ring runs dry; every completion but the last has more() set.
+    bool prepareReceiveMultishot(const int& fd, const uint64_t& userData);
+    bool prepareCancel(const uint64_t& target, const uint64_t& userData);
+
+    // Submits everything queued and waits up to timeoutMs (-1 forever) for a completion.
+    void submitAndWait(const int& timeoutMs);
+    // Moves the completions that are ready into out.
+    void reap(std::vector<Completion>& out);
+
+    static bool more(const Completion& completion);
+    // The buffer ring entry holding a multishot receive's data, if it used one.
+    static bool bufferId(const Completion& completion, unsigned& id);
+    const char* bufferData(const unsigned& id) const;
+    // Hands a buffer back to the kernel once its data was consumed.
+    void recycleBuffer(const unsigned& id);
+};
+
+}  // namespace SimpleHTTP
@@ -0,0 +1,127 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+
+namespace SimpleHTTP {
+
+// Monotonic timestamps of the phases of one request, plus what it moved on the wire. A phase
+// that did not happen (resolving and connecting on a reused connection) ends where the previous
+// one ended, so its duration is 0.
+struct HttpTiming {
+    typedef std::chrono::steady_clock Clock;
+
+    Clock::time_point start;
+    Clock::time_point resolved;
+    Clock::time_point connected;
+    Clock::time_point sent;
+    Clock::time_point firstByte;
+    Clock::time_point finished;
+    // Bytes written and read on the connection, including heads and framing.
+    size_t bytesSent;
+    size_t bytesReceived;
+    bool connectionReused;
+
+    HttpTiming();
+    // Sets every timestamp to now and clears the counters.
+    void begin();
+
+    // Phase durations in microseconds: DNS lookup, TCP connect, writing the request, waiting
+    // for the first response byte, reading the rest of the response, and all of it.
+    int64_t dnsMicros() const;
+    int64_t connectMicros() const;
+    int64_t sendMicros() const;
+    int64_t waitMicros() const;
+    int64_t receiveMicros() const;
+    int64_t totalMicros() const;
+};
+
+enum class HttpPhase { Dns, Connect, Send, Wait, Receive, Total };
+
+// Latency histogram with power-of-two buckets: bucket 0 counts durations below 1 us and bucket i
+// those in [2^(i-1), 2^i) us; the last bucket also takes everything longer.
+struct LatencyHistogram {
+    static const size_t kBuckets = 32;
+    static const size_t kPhases = 6;
+
+    uint64_t buckets[kBuckets];
+    uint64_t count;
+    uint64_t sumMicros;
+
+    LatencyHistogram();
+
+    // Upper bound in microseconds of the bucket holding the given fraction of the samples.
+    int64_t percentile(const double& fraction) const;
+    static int64_t bucketLimit(const size_t& bucket);
+    static size_t bucketFor(const int64_t& micros);
+};
+
+struct HttpMetricsSnapshot {
+    LatencyHistogram phases[LatencyHistogram::kPhases];
+    uint64_t requests;
+    uint64_t failures;
+    uint64_t reusedConnections;
+    uint64_t bytesSent;
+    uint64_t bytesReceived;
+
+    HttpMetricsSnapshot();
+    const LatencyHistogram& phase(const HttpPhase& phase) const;
+};
+
+// Process-wide request timing shared by all clients (HttpMetrics::instance()). Completed
+// requests are passed to an optional hook and, when enabled, aggregated into lock-free
+// histograms that can be scraped with snapshot(). Both are off by default.
+class HttpMetrics {
+public:
+    // Runs on the thread that completed the request; httpCode is -1 for failed requests.
+    typedef std::function<void(const std::string& method, const std::string& url,
+                               const int& httpCode, const HttpTiming& timing)>
+        Hook;
+
+private:
+    struct Histogram {
+        std::atomic<uint64_t> buckets[LatencyHistogram::kBuckets];
+        std::atomic<uint64_t> count;
+        std::atomic<uint64_t> sumMicros;
+    };
+
+    Histogram histograms[LatencyHistogram::kPhases];
+    std::atomic<uint64_t> requests;
+    std::atomic<uint64_t> failures;
+    std::atomic<uint64_t> reusedConnections;
+    std::atomic<uint64_t> bytesSent;
+    std::atomic<uint64_t> bytesReceived;
+    std::atomic<bool> histogramsEnabled;
+    std::atomic<bool> hookInstalled;
+    std::mutex hookMutex;
+    std::shared_ptr<Hook> hook;
+
+    HttpMetrics();
+
+    static void add(Histogram& histogram, const int64_t& micros);
+
+public:
+    static HttpMetrics& instance();
+
+    HttpMetrics(const HttpMetrics&) = delete;
+    HttpMetrics& operator=(const HttpMetrics&) = delete;
+
+    // Installs the hook (nullptr removes it).
+    void setHook(const Hook& newHook);
+    void setHistogramsEnabled(const bool& enabled);
+    // True when record() has anything to do.
+    bool isActive() const;
+
+    void record(const std::string& method, const std::string& url, const int& httpCode,
+                const HttpTiming& timing);
+    HttpMetricsSnapshot snapshot() const;
+    void reset();
+};
+
+}  // namespace SimpleHTTP
@@ -0,0 +1,45 @@
+#pragma once
+
+#include <sys/types.h>
+
+#include <cstdint>
+#include <functional>
+#include <string>
+
+namespace SimpleHTTP {
+
+// A request body that is streamed rather than held in memory, for HttpClient::executeUpload.
+struct RequestBody {
+    // Fills up to size bytes at data and returns how many it wrote; 0 ends the body and -1
+    // aborts the request.
+    typedef std::function<ssize_t(char* data, size_t size)> Reader;
+
+    enum class Source { Reader, File, Path };
+
+    Source source;
+    Reader reader;
+    // Source::File: a descriptor the caller keeps open (and closes) and the range to send; a
+    // negative length sends to the end of the file. Other descriptors, such as pipes, need an
+    // explicit length and are copied instead of going through sendfile.
+    int fd;
+    off_t offset;
+    int64_t length;
+    // Source::Path: opened when the request is sent.
+    std::string path;
+    // Sends Expect: 100-continue and holds the body back until the server accepts it, so a
+    // rejected upload is not transferred. Servers that stay silent get the body after
+    // continueTimeoutMs.
+    bool expectContinue;
+    int continueTimeoutMs;
+
+    RequestBody();
+
+    // Sent with Transfer-Encoding: chunked, since the length is not known up front.
+    static RequestBody fromReader(const Reader& reader);
+    // Sent with sendfile under a Content-Length.
+    static RequestBody fromFile(const int& fd, const off_t& offset = 0,
+                                const int64_t& length = -1);
+    static RequestBody fromPath(const std::string& path);
+};
+
+}  // namespace SimpleHTTP
@@ -0,0 +1,114 @@
+#pragma once
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+namespace SimpleHTTP {
+
+struct HttpHeaders;
+struct HttpResponse;
+
+struct ResponseCacheConfig {
+    // Bodies and headers kept, in bytes; least recently used entries are dropped beyond it.
+    size_t maxBytes;
+    // Larger responses are passed through without being stored.
+    size_t maxEntryBytes;
+
+    ResponseCacheConfig();
+};
+
+struct ResponseCacheStats {
+    // GETs answered from the cache without contacting the server.
+    uint64_t hits;
+    // Stale entries the server confirmed with 304 Not Modified.
+    uint64_t revalidations;
+    // GETs that went to the server and did not get a 304.
+    uint64_t misses;
+    uint64_t evictions;
+    // Body bytes that hits and revalidations did not download.
+    uint64_t bytesSaved;
+    size_t entries;
+    size_t bytes;
+
+    ResponseCacheStats();
+};
+
+// Private HTTP cache for GET responses, keyed by URL, following Cache-Control, Expires and Vary.
+// Stale entries are revalidated with their ETag / Last-Modified. Bodies are stored once; with
+// shareBody, responses reference the stored body (HttpResponse::sharedBody) instead of getting a
+// copy of it in body. Thread-safe.
+class ResponseCache {
+public:
+    typedef std::chrono::steady_clock Clock;
+
+    enum class Lookup { Bypass, Miss, Fresh, Stale };
+
+    // A stored response: its head (status line and headers, without body) and its body.
+    struct Match {
+        std::shared_ptr<const HttpResponse> head;
+        std::shared_ptr<const std::string> body;
+    };
+
+private:
+    struct Entry {
+        std::string url;
+        // Request header values named by the response's Vary header.
+        std::vector<std::pair<std::string, std::string>> varying;
+        Match match;
+        // When the response (or its last revalidation) arrived, and how old it already was.
+        Clock::time_point storedAt;
+        int64_t initialAge;
+        int64_t lifetime;
+        size_t size;
+    };
+
+    ResponseCacheConfig config;
+    // Most recently used first.
+    std::list<Entry> entries;
+    std::unordered_map<std::string, std::list<Entry>::iterator> index;
+    size_t bytes;
+    ResponseCacheStats stats;
+    mutable std::mutex mutex;
+
+    void insert(Entry entry);
+    void erase(const std::unordered_map<std::string, std::list<Entry>::iterator>::iterator& it);
+    static bool prepare(Entry& entry, const std::string& url, const HttpHeaders& requestHeaders,
+                        const HttpResponse& head, const size_t& bodySize);
+
+public:
+    explicit ResponseCache(const ResponseCacheConfig& config = ResponseCacheConfig());
+
+    ResponseCache(const ResponseCache&) = delete;
+    ResponseCache& operator=(const ResponseCache&) = delete;
+
+    // Looks up a GET of url. Requests the cache must not answer (no-store, conditional or
+    // range requests) are Bypass; for Fresh and Stale, match holds the entry.
+    Lookup lookup(const std::string& url, const HttpHeaders& requestHeaders, Match& match);
+    // Adds the validators of a stale entry to the request headers.
+    static void addValidators(const Match& match, HttpHeaders& headers);
+    // Fills response from match.
+    static void serve(const Match& match, HttpResponse& response, const bool& shareBody);
+
+    // A 304 for a stale entry: merges the new headers into it and fills response from it.
+    void revalidated(const std::string& url, const HttpHeaders& requestHeaders,
+                     const Match& match, HttpResponse& response, const bool& shareBody);
+    // A full response from the server. When it may be cached, its body is copied into the cache,
+    // or with shareBody moved there, leaving response a shared reference to it.
+    void store(const std::string& url, const HttpHeaders& requestHeaders, HttpResponse& response,
+               const bool& shareBody);
+    // Drops url's entry, after a successful unsafe request (POST, PUT, DELETE) to it.
+    void invalidate(const std::string& url);
+
+    ResponseCacheStats getStats() const;
+    void clear();
+};
+
+}  // namespace SimpleHTTP
@@ -0,0 +1,30 @@
+#pragma once
+
+#include <cstddef>
+#include <string>
+
+namespace SimpleHTTP {
+
+// Delimiter search for the response parser's head lines. The implementation is picked at startup:
+// AVX2 on x86-64 CPUs that have it, otherwise the C library's memchr. SSE2 is only used when
+// selected with setScanImplementation().
+struct ScannedLine {
+    // Offset of the terminating '\n'.
+    size_t end;
+    // Offset of the first ':' in the line, or npos.
+    size_t colon;
+};
+
+// Finds up to maxLines consecutive lines starting at from in one pass over the bytes, and stops
+// after the first empty line ("\n" or "\r\n", the end of a head). A line without its '\n' before
+// size is left out. Returns the number of lines found.
+size_t scanLines(const char* data, const size_t& from, const size_t& size, ScannedLine* lines,
+                 const size_t& maxLines);
+
+// "avx2", "sse2" or "scalar".
+const char* scanImplementation();
+// Switches to the named implementation, for benchmarks and tests. Safe to call while other
+// threads parse. Fails when the CPU or the build does not have it.
+bool setScanImplementation(const std::string& name);
+
+}  // namespace SimpleHTTP
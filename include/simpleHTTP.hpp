@@ -1,10 +1,9 @@
 #pragma once
 
-#include <pthread.h>
-
 #include <algorithm>
 #include <cstring>
 #include <functional>
+#include <future>
 #include <map>
 #include <memory>
 #include <regex>
@@ -12,16 +11,43 @@
 #include <string>
 #include <vector>
 
+#include "compression.hpp"
+#include "connectionPool.hpp"
+#include "eventLoop.hpp"
+#include "executor.hpp"
+#include "fileDownload.hpp"
+#include "http2.hpp"
+#include "httpParser.hpp"
+#include "metrics.hpp"
+#include "requestBody.hpp"
+#include "responseCache.hpp"
+#include "singleFlight.hpp"
 #include "socket.hpp"
 
 namespace SimpleHTTP {
 
+// Header fields in the order they were added, in one flat vector. Names are matched
+// case-insensitively and may repeat (e.g. Set-Cookie); well-known names are stored in their
+// canonical spelling.
 struct HttpHeaders {
-    std::map<std::string, std::string> headers;
+    typedef std::pair<std::string, std::string> Field;
+
+    std::vector<Field> headers;
 
     void addHeader(const std::string& key, const std::string& value);
+    void addHeader(const char* key, const size_t& keyLength, const char* value,
+                   const size_t& valueLength);
+    void setHeader(const std::string& key, const std::string& value);
+    // Overwrites the field at index in place, reusing its string storage.
+    void replaceHeader(const size_t& index, const char* key, const size_t& keyLength,
+                       const char* value, const size_t& valueLength);
     std::string getHeader(const std::string& key) const;
+    std::vector<std::string> getHeaders(const std::string& key) const;
+    bool hasHeader(const std::string& key) const;
+    void removeHeader(const std::string& key);
     std::string toString() const;
+    size_t size() const;
+    bool empty() const;
     void clear();
 };
 
@@ -35,13 +61,23 @@ struct HttpResponse {
     HttpHeaders headers;
     std::string statusText;
     std::string protocol;
+    // Phase timestamps and byte counts of the request that produced this response.
+    HttpTiming timing;
+    // With HttpClient::setSharedBodies, set instead of body for responses that went through the
+    // response cache or that waited for a coalesced request: the one stored body, referenced by
+    // every response handed out for it.
+    std::shared_ptr<const std::string> sharedBody;
 
     HttpResponse();
     void clear();
+    // The body, wherever it is held.
+    const std::string& getBody() const;
 };
 
 struct UrlInfo {
     std::string protocol;
+    // For http+unix URLs, the percent-decoded path of the Unix domain socket
+    // ("http+unix://%2Frun%2Fproxy.sock/status").
     std::string host;
     int port;
     std::string path;
@@ -49,30 +85,57 @@ struct UrlInfo {
 
     UrlInfo();
     static UrlInfo parseUrl(const std::string& url);
+    static void parseUrl(const std::string& url, UrlInfo& info);
 };
 
-class HttpClient {
-    std::unique_ptr<class Socket> socket;
-    std::string userAgent;
-    int timeoutSeconds;
+struct Request {
+    std::string method;
+    std::string url;
+    std::string payload;
+    std::string contentType;
+    HttpHeaders headers;
 
-    class ThreadGuard {
-        pthread_t threadId;
-        bool isJoined;
+    Request();
+    Request(const std::string& method, const std::string& url, const std::string& payload = "",
+            const std::string& contentType = "", const HttpHeaders& headers = HttpHeaders());
+};
 
-    public:
-        explicit ThreadGuard(const pthread_t& id);
-        ~ThreadGuard();
+struct BatchOptions {
+    // Time limit for the whole batch in milliseconds; 0 waits for every request.
+    int deadlineMs;
+    // Returns as soon as this many requests got a 2xx response; 0 waits for all of them.
+    size_t firstSuccesses;
 
-        ThreadGuard(const ThreadGuard&) = delete;
-        ThreadGuard& operator=(const ThreadGuard&) = delete;
+    BatchOptions();
+};
 
-        ThreadGuard(ThreadGuard&& other) noexcept;
-        ThreadGuard& operator=(ThreadGuard&& other) noexcept;
+struct AsyncExchange;
+struct RequestScratch;
+struct SegmentedDownload;
 
-        void join();
-        void detach();
-    };
+class HttpClient {
+    // Initialized first so that moving drains them before any state their tasks use moves.
+    std::unique_ptr<Executor> executor;
+    // One thread resolving the hosts of asynchronous requests that are not cached, so that
+    // neither the caller nor an event loop blocks in getaddrinfo.
+    std::unique_ptr<Executor> resolver;
+    std::unique_ptr<ConnectionPool> connectionPool;
+    std::unique_ptr<BufferPool> bufferPool;
+    std::unique_ptr<ObjectPool<RequestScratch>> scratchPool;
+    std::string userAgent;
+    int timeoutSeconds;
+    bool keepAlive;
+    bool decompression;
+    bool sharedBodies;
+    size_t requestCompressionThreshold;
+    Http2Mode http2Mode;
+    std::unique_ptr<Http2Pool> http2Pool;
+    std::unique_ptr<EventLoopGroup> eventLoops;
+    std::unique_ptr<ResponseCache> responseCache;
+    std::unique_ptr<SingleFlight> singleFlight;
+    SocketOptions socketOptions;
+    std::map<std::string, SocketOptions> hostSocketOptions;
+    std::map<std::string, std::string> unixSockets;
 
 public:
     HttpClient();
@@ -86,43 +149,203 @@ class HttpClient {
 
     HttpResponse Get(const std::string& url, const HttpHeaders& headers = HttpHeaders());
 
-    HttpResponse Post(const std::string& url, const std::string& payload = "",
+    HttpResponse Post(const std::string& url, const DataView& payload = DataView(),
                       const std::string& contentType = "",
                       const HttpHeaders& headers = HttpHeaders());
 
-    HttpResponse Put(const std::string& url, const std::string& payload = "",
+    HttpResponse Put(const std::string& url, const DataView& payload = DataView(),
                      const std::string& contentType = "",
                      const HttpHeaders& headers = HttpHeaders());
 
-    HttpResponse Delete(const std::string& url, const std::string& payload = "",
+    HttpResponse Delete(const std::string& url, const DataView& payload = DataView(),
                         const std::string& contentType = "",
                         const HttpHeaders& headers = HttpHeaders());
 
+    HttpResponse Post(const std::string& url, const RequestBody& body,
+                      const std::string& contentType = "",
+                      const HttpHeaders& headers = HttpHeaders());
+
+    HttpResponse Put(const std::string& url, const RequestBody& body,
+                     const std::string& contentType = "",
+                     const HttpHeaders& headers = HttpHeaders());
+
     void setTimeout(const int& seconds);
     void setUserAgent(const std::string& agent);
+    void setKeepAlive(const bool& enabled);
+    // Sends Accept-Encoding for the codings this build can decode and decodes response bodies.
+    void setDecompression(const bool& enabled);
+    // gzip-compresses request payloads of at least minSize bytes. 0 (the default) disables it.
+    void setRequestCompression(const size_t& minSize);
+    // Sends requests over HTTP/2 cleartext (h2c), multiplexed on one connection per host.
+    // Download always uses HTTP/1.1.
+    void setHttp2(const Http2Mode& mode);
+    void setConnectionPoolConfig(const ConnectionPoolConfig& config);
+    // Options for the sockets of new connections, to every host or to one (named as in its
+    // URLs). Call before the first request; pooled connections keep the options they had.
+    void setSocketOptions(const SocketOptions& options);
+    void setSocketOptions(const std::string& host, const SocketOptions& options);
+    // Connects to host through the Unix domain socket at path instead of TCP, e.g. for a local
+    // sidecar proxy; an empty path removes the override. Call before the first request.
+    void setUnixSocket(const std::string& host, const std::string& path);
+    void closeIdleConnections();
+    void setAsyncThreads(const size_t& threads);
+    // Worker pool behind submitRequest (call before the first submitted request).
+    void setExecutorConfig(const ExecutorConfig& config);
+    // Caches GET responses in memory as their Cache-Control / Expires headers allow (off by
+    // default; call before the first request).
+    void setResponseCache(const ResponseCacheConfig& config);
+    void disableResponseCache();
+    ResponseCacheStats getResponseCacheStats() const;
+    void clearResponseCache();
+    // Lets concurrent identical GET and HEAD requests (same URL and headers) share one request
+    // and one response body (off by default; call before the first request). Applies where the
+    // response cache does.
+    void setRequestCoalescing(const bool& enabled);
+    SingleFlightStats getRequestCoalescingStats() const;
+    // Responses handed out by the response cache or by request coalescing reference the one
+    // stored body in HttpResponse::sharedBody instead of getting a copy of it in body (off by
+    // default). Saves a copy per response of large bodies; read them with getBody().
+    void setSharedBodies(const bool& enabled);
 
-    std::unique_ptr<ThreadGuard> getAsync(
+    std::unique_ptr<AsyncHandle> getAsync(
         const std::string& url, const HttpHeaders& headers = HttpHeaders(),
         const std::function<void(HttpResponse)>& callback = nullptr);
 
-    std::unique_ptr<ThreadGuard> postAsync(
-        const std::string& url, const std::string& payload = "",
+    std::unique_ptr<AsyncHandle> postAsync(
+        const std::string& url, const DataView& payload = DataView(),
         const std::string& contentType = "", const HttpHeaders& headers = HttpHeaders(),
         const std::function<void(HttpResponse)>& callback = nullptr);
 
+    // Runs the request on the executor's worker pool. The returned future is invalid
+    // (valid() == false) when the queue is full and ExecutorConfig::overflow is Reject; requests
+    // still queued when the client is destroyed complete with httpCode -1.
+    std::future<HttpResponse> submitRequest(const std::string& method, const std::string& url,
+                                            const DataView& payload = DataView(),
+                                            const std::string& contentType = "",
+                                            const HttpHeaders& headers = HttpHeaders());
+
+    std::future<HttpResponse> getFuture(const std::string& url,
+                                        const HttpHeaders& headers = HttpHeaders());
+
+    std::future<HttpResponse> postFuture(const std::string& url,
+                                         const DataView& payload = DataView(),
+                                         const std::string& contentType = "",
+                                         const HttpHeaders& headers = HttpHeaders());
+
     HttpResponse executeRequest(const std::string& method, const std::string& url,
-                                const std::string& payload = "",
+                                const DataView& payload = DataView(),
                                 const std::string& contentType = "",
                                 const HttpHeaders& headers = HttpHeaders());
 
-    bool Download(const std::string& url, std::function<bool(const char* data, size_t size)> onChunk, const HttpHeaders& headers);
+    // Executes into a caller-owned response, reusing the capacity of its strings and headers.
+    // Returns false when no response was received (httpCode is then -1).
+    bool executeRequest(HttpResponse& response, const std::string& method,
+                        const std::string& url, const DataView& payload = DataView(),
+                        const std::string& contentType = "",
+                        const HttpHeaders& headers = HttpHeaders());
+
+    // Sends a body streamed from a file or a reader instead of memory (see RequestBody). Always
+    // over HTTP/1.1, without request compression.
+    HttpResponse executeUpload(const std::string& method, const std::string& url,
+                               const RequestBody& body, const std::string& contentType = "",
+                               const HttpHeaders& headers = HttpHeaders());
+
+    // timing, when given, receives the phase timestamps of the download.
+    bool Download(const std::string& url,
+                  std::function<bool(const char* data, size_t size)> onChunk,
+                  const HttpHeaders& headers = HttpHeaders(), HttpTiming* timing = nullptr);
+
+    // Downloads url into the file at path. When the server accepts byte ranges, the object is
+    // split into segments fetched in parallel and written in place into a preallocated
+    // "<path>.part", next to a "<path>.part.state" progress record; the part file is renamed to
+    // path once complete. Otherwise the object is fetched in one stream. Bodies are stored as
+    // sent (no decompression).
+    bool DownloadToFile(const std::string& url, const std::string& path,
+                        const FileDownloadConfig& config = FileDownloadConfig(),
+                        const HttpHeaders& headers = HttpHeaders());
+
+    std::vector<HttpResponse> executePipelined(const std::vector<Request>& requests);
+
+    // Runs the requests on the event loops, at most maxConcurrency at a time (0 for no limit),
+    // reusing pooled connections between requests to the same host. Responses are in request
+    // order. When the deadline passes or firstSuccesses is reached, requests still running are
+    // cancelled; they and those never started have httpCode -1. Bypasses the response cache.
+    std::vector<HttpResponse> executeBatch(const std::vector<Request>& requests,
+                                           const size_t& maxConcurrency,
+                                           const BatchOptions& options = BatchOptions());
 
 private:
-    std::string buildHttpRequest(const std::string& method, const UrlInfo& urlInfo,
-                                 const std::string& payload, const std::string& contentType,
-                                 const HttpHeaders& headers) const;
+    bool sendRequest(HttpResponse& response, const std::string& method, const std::string& url,
+                     const DataView& payload, const std::string& contentType,
+                     const HttpHeaders& headers);
+    bool dispatchRequest(HttpResponse& response, const std::string& method,
+                         const std::string& url, const DataView& payload,
+                         const std::string& contentType, const HttpHeaders& headers);
+    bool executeCached(HttpResponse& response, const std::string& url,
+                       const HttpHeaders& headers);
+    // Download, optionally checking the response head before any body byte reaches onChunk.
+    bool downloadStream(const std::string& url,
+                        const std::function<bool(const char* data, size_t size)>& onChunk,
+                        const HttpHeaders& headers, HttpTiming& timing,
+                        const std::function<bool(const HttpResponse& head)>& onHead,
+                        const bool& decode);
+    bool streamToFile(const std::string& url, const std::string& path,
+                      const HttpHeaders& headers);
+    void fetchSegment(SegmentedDownload& download, const size_t& index);
+    static void* segmentThread(void* arg);
+
+    std::unique_ptr<AsyncHandle> executeAsync(const std::string& method, const std::string& url,
+                                              const DataView& payload,
+                                              const std::string& contentType,
+                                              const HttpHeaders& headers,
+                                              const std::function<void(HttpResponse)>& callback);
+
+    static void startAsync(const std::shared_ptr<AsyncExchange>& exchange);
+    static void submitAsync(const std::shared_ptr<AsyncExchange>& exchange,
+                            std::unique_ptr<Socket> socket,
+                            const std::vector<SocketAddress>& addresses);
+    static void startHttp2Async(const std::shared_ptr<AsyncExchange>& exchange);
+    // Fails every asynchronous exchange still running and destroys the resolver, HTTP/2 pool
+    // and event loops they call into.
+    void stopAsync();
+
+    std::unique_ptr<Socket> openConnection(const UrlInfo& urlInfo, bool& reused,
+                                           HttpTiming& timing);
+    const SocketOptions& socketOptionsFor(const std::string& host) const;
+    const std::string& unixSocketFor(const UrlInfo& urlInfo) const;
+
+    void buildHttpRequest(Buffer& head, const std::string& method, const UrlInfo& urlInfo,
+                          const size_t& payloadSize, const std::string& contentType,
+                          const HttpHeaders& headers, const bool& closeConnection,
+                          const bool& gzipBody = false, const bool& chunkedBody = false) const;
+    void buildHttp2Request(std::vector<HpackField>& fields, const std::string& method,
+                           const UrlInfo& urlInfo, const size_t& payloadSize,
+                           const std::string& contentType, const HttpHeaders& headers,
+                           const bool& gzipBody = false) const;
+    bool compressPayload(const DataView& payload, Buffer& output) const;
+
+    bool executeHttp2(HttpResponse& response, const std::string& method, const UrlInfo& urlInfo,
+                      const DataView& body, const std::string& contentType,
+                      const HttpHeaders& headers, const bool& gzipBody, Decompressor* decompressor);
+    bool pipelineHttp2(const std::vector<Request>& requests, const std::vector<UrlInfo>& urls,
+                       const std::vector<size_t>& indices, std::vector<HttpResponse>& responses);
+
+    void pipelineGroup(const std::vector<Request>& requests, const std::vector<UrlInfo>& urls,
+                       const std::vector<size_t>& indices, std::vector<HttpResponse>& responses);
+    // requestEnds[k] is the offset in parts where requests[k] ends; each response gets its
+    // timing stamped and reported when it completes.
+    size_t exchangePipelined(Socket& connection, const std::vector<DataView>& parts,
+                             const std::vector<size_t>& requestEnds,
+                             const std::vector<const Request*>& requests,
+                             const std::vector<HttpResponse*>& responses, bool& reusable);
 
-    static HttpResponse parseHttpResponse(const std::string& rawResponse);
+    // Sets dropped when the peer closed or reset the connection before the response completed.
+    static bool receiveResponse(const Socket& connection, HttpResponseParser& parser,
+                                Buffer& buffer, HttpTiming& timing, bool& dropped);
+    static bool extractResponse(const HttpResponseParser& parser, const Buffer& buffer,
+                                HttpResponse& response, Decompressor* decompressor);
+    static bool extractHttp2Response(Http2Result& result, HttpResponse& response,
+                                     Decompressor* decompressor);
 };
 
 }  // namespace SimpleHTTP
\ No newline at end of file
@@ -0,0 +1,64 @@
+#pragma once
+
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+
+namespace SimpleHTTP {
+
+struct HttpHeaders;
+struct HttpResponse;
+
+struct SingleFlightStats {
+    // Requests that were executed and whose response others could join.
+    uint64_t executed;
+    // Requests that joined an identical one already in flight instead of being sent.
+    uint64_t coalesced;
+
+    SingleFlightStats();
+};
+
+// Collapses identical requests that are in flight at the same time: the first is executed, the
+// others wait for it and get the same response. The first caller's body stays where execute
+// put it; the waiters each get a copy of it in body or, with shareBody, share a single copy
+// (HttpResponse::sharedBody). Thread-safe.
+class SingleFlight {
+    struct Call {
+        std::condition_variable done;
+        bool finished;
+        bool succeeded;
+        size_t waiters;
+        // The response without its body, and the body, once finished.
+        std::shared_ptr<const HttpResponse> head;
+        std::shared_ptr<const std::string> body;
+
+        Call();
+    };
+
+    std::unordered_map<std::string, std::shared_ptr<Call>> calls;
+    SingleFlightStats stats;
+    mutable std::mutex mutex;
+
+public:
+    SingleFlight();
+
+    SingleFlight(const SingleFlight&) = delete;
+    SingleFlight& operator=(const SingleFlight&) = delete;
+
+    // Requests are identical when their method, URL and headers (names, values and order) are.
+    static std::string makeKey(const std::string& method, const std::string& url,
+                               const HttpHeaders& headers);
+
+    // Runs execute for the first caller with a given key; callers arriving while it runs wait
+    // and get a copy of its response. Returns what execute returned.
+    bool run(const std::string& key, HttpResponse& response,
+             const std::function<bool(HttpResponse& response)>& execute, const bool& shareBody);
+
+    SingleFlightStats getStats() const;
+};
+
+}  // namespace SimpleHTTP
@@ -1,9 +1,14 @@
 #pragma once
 
 #include <arpa/inet.h>
+#include <fcntl.h>
 #include <netdb.h>
 #include <netinet/in.h>
+#include <poll.h>
 #include <sys/socket.h>
+#include <sys/types.h>
+#include <sys/uio.h>
+#include <sys/un.h>
 #include <unistd.h>
 
 #include <cstring>
@@ -13,12 +18,77 @@
 #include <string>
 #include <vector>
 
+#include "buffer.hpp"
+
 namespace SimpleHTTP {
 
+// Non-owning view of bytes to send. The referenced memory must outlive the call using it.
+struct DataView {
+    const char* data;
+    size_t size;
+
+    DataView();
+    DataView(const std::string& text);
+    DataView(const char* text);
+    DataView(const char* bytes, const size_t& length);
+
+    bool empty() const;
+};
+
+// A resolved IPv4 or IPv6 endpoint, or a Unix domain socket path, ready to be passed to
+// ::connect.
+struct SocketAddress {
+    sockaddr_storage storage;
+    socklen_t length;
+    int family;
+
+    SocketAddress();
+
+    void setPort(const int& port);
+
+    static bool fromString(const std::string& ip, const int& port, SocketAddress& address);
+    // Fails when path does not fit in sockaddr_un.
+    static bool fromUnixPath(const std::string& path, SocketAddress& address);
+};
+
+// Options applied to every socket a client opens. Those a platform lacks are ignored.
+struct SocketOptions {
+    // TCP_NODELAY: writes go out at once instead of waiting for outstanding data to be
+    // acknowledged (Nagle's algorithm). On by default.
+    bool noDelay;
+    // SO_RCVBUF / SO_SNDBUF in bytes; 0 keeps the system's autotuned sizes.
+    int receiveBuffer;
+    int sendBuffer;
+    // TCP_FASTOPEN_CONNECT (Linux): once the server has issued a Fast Open cookie, the request
+    // goes out with the SYN of later connections, saving a round trip.
+    bool fastOpen;
+    // TCP_QUICKACK (Linux): acknowledges received data at once instead of delaying the ACK.
+    // The kernel drops the flag over time, so it is set again after every read.
+    bool quickAck;
+    // SO_BUSY_POLL (Linux): microseconds a blocking read spins on the device queue before
+    // sleeping; 0 disables it.
+    int busyPollMicros;
+    // SO_KEEPALIVE probes on idle connections: seconds idle before the first probe (0 disables
+    // them), seconds between probes, and unanswered probes before the connection is dropped.
+    int keepAliveIdle;
+    int keepAliveInterval;
+    int keepAliveCount;
+
+    SocketOptions();
+};
+
 class Socket {
 private:
     int socketFd;
     bool isConnected;
+    bool nonBlocking;
+    int timeoutMs;
+    SocketOptions options;
+
+    static int openSocket(const int& family, const SocketOptions& options);
+    void rearmQuickAck() const;
+    bool waitFor(const short& events) const;
+    int sendFlags() const;
 
 public:
     Socket();
@@ -30,12 +100,44 @@ class Socket {
     Socket(Socket&& other) noexcept;
     Socket& operator=(Socket&& other) noexcept;
 
+    // How long a connect attempt may stay unanswered before the next address is tried in
+    // parallel (RFC 8305 recommends 250 ms).
+    static const int kConnectAttemptDelayMs = 250;
+
+    // Orders resolved addresses for racing: the families alternate, starting with the one the
+    // resolver ranked first.
+    static void interleaveFamilies(std::vector<SocketAddress>& addresses);
+
     bool connect(const std::string& host, const int& port);
+    // Connects to addresses that were already resolved.
+    bool connect(const std::vector<SocketAddress>& addresses);
+    bool connectNonBlocking(const std::string& host, const int& port);
+    bool connectNonBlocking(const std::vector<SocketAddress>& addresses);
+    bool completeConnect();
+    bool setNonBlocking(const bool& enabled);
+    // Limits how long connect() may take and how long a blocking send or receive may wait for
+    // the socket to become ready. 0 waits forever.
+    void setTimeout(const int& milliseconds);
+    int getTimeout() const;
+    // Applies to connections opened afterwards.
+    void setOptions(const SocketOptions& options);
+    const SocketOptions& getOptions() const;
     bool send(const std::string& data) const;
+    bool send(const DataView* parts, const size_t& count) const;
+    // Sends length bytes of the file open at fd, starting at offset, with sendfile where the
+    // system has it. The file position of fd is left unchanged.
+    bool sendFile(const int& fd, const off_t& offset, const size_t& length) const;
+    // Waits up to milliseconds for something to read; false on timeout or error.
+    bool waitReadable(const int& milliseconds) const;
     std::string receiveChunk(size_t chunkSize = 4096) const;
     std::string receiveAll() const;
+    ssize_t sendSome(const char* data, const size_t& size) const;
+    ssize_t sendSome(const DataView* parts, const size_t& count, const size_t& skip) const;
+    ssize_t receiveSome(char* buffer, const size_t& size) const;
+    ssize_t receiveInto(Buffer& buffer, const size_t& minSpace = 16384) const;
     void close();
     bool isSocketConnected() const;
+    bool isHealthy() const;
     int getSocketFd() const;
 };
 
@@ -0,0 +1,140 @@
+#include "buffer.hpp"
+
+#include <cstring>
+
+namespace SimpleHTTP {
+
+static const size_t kDefaultBufferCapacity = 16384;
+
+Buffer::Buffer(const size_t& initialCapacity)
+    : storage(initialCapacity > 0 ? new char[initialCapacity] : nullptr),
+      capacity(initialCapacity),
+      readPos(0),
+      writePos(0) {}
+
+Buffer::Buffer(Buffer&& other) noexcept
+    : storage(std::move(other.storage)),
+      capacity(other.capacity),
+      readPos(other.readPos),
+      writePos(other.writePos) {
+    other.capacity = 0;
+    other.readPos = 0;
+    other.writePos = 0;
+}
+
+Buffer& Buffer::operator=(Buffer&& other) noexcept {
+    if (this != &other) {
+        storage = std::move(other.storage);
+        capacity = other.capacity;
+        readPos = other.readPos;
+        writePos = other.writePos;
+        other.capacity = 0;
+        other.readPos = 0;
+        other.writePos = 0;
+    }
+    return *this;
+}
+
+char* Buffer::data() {
+    return storage.get() + readPos;
+}
+
+const char* Buffer::data() const {
+    return storage.get() + readPos;
+}
+
+size_t Buffer::size() const {
+    return writePos - readPos;
+}
+
+bool Buffer::empty() const {
+    return writePos == readPos;
+}
+
+char* Buffer::writePtr() {
+    return storage.get() + writePos;
+}
+
+size_t Buffer::writable() const {
+    return capacity - writePos;
+}
+
+void Buffer::ensureWritable(const size_t& count) {
+    if (writable() >= count)
+        return;
+
+    const size_t used = size();
+    if (readPos > 0 && capacity - used >= count) {
+        std::memmove(storage.get(), storage.get() + readPos, used);
+        readPos = 0;
+        writePos = used;
+        return;
+    }
+
+    size_t newCapacity = capacity > 0 ? capacity * 2 : kDefaultBufferCapacity;
+    while (newCapacity - used < count)
+        newCapacity *= 2;
+
+    std::unique_ptr<char[]> grown(new char[newCapacity]);
+    if (used > 0)
+        std::memcpy(grown.get(), storage.get() + readPos, used);
+    storage = std::move(grown);
+    capacity = newCapacity;
+    readPos = 0;
+    writePos = used;
+}
+
+void Buffer::commit(const size_t& count) {
+    writePos += count;
+}
+
+void Buffer::append(const char* bytes, const size_t& count) {
+    ensureWritable(count);
+    std::memcpy(writePtr(), bytes, count);
+    writePos += count;
+}
+
+void Buffer::consume(const size_t& count) {
+    readPos += count;
+    if (readPos >= writePos)
+        clear();
+}
+
+void Buffer::clear() {
+    readPos = 0;
+    writePos = 0;
+}
+
+size_t Buffer::getCapacity() const {
+    return capacity;
+}
+
+BufferPool::BufferPool(const size_t& maxPooled, const size_t& maxRetainedCapacity)
+    : maxPooled(maxPooled), maxRetainedCapacity(maxRetainedCapacity) {
+    buffers.reserve(maxPooled);
+}
+
+std::unique_ptr<Buffer> BufferPool::acquire() {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (!buffers.empty()) {
+            std::unique_ptr<Buffer> buffer = std::move(buffers.back());
+            buffers.pop_back();
+            return buffer;
+        }
+    }
+    return std::unique_ptr<Buffer>(new Buffer(kDefaultBufferCapacity));
+}
+
+void BufferPool::release(std::unique_ptr<Buffer> buffer) {
+    // Buffers that grew for an unusually large response are freed rather than kept around.
+    if (!buffer || buffer->getCapacity() > maxRetainedCapacity)
+        return;
+
+    buffer->clear();
+    std::lock_guard<std::mutex> lock(mutex);
+    if (buffers.size() < maxPooled)
+        buffers.push_back(std::move(buffer));
+}
+
+}  // namespace SimpleHTTP
@@ -0,0 +1,285 @@
+#include "compression.hpp"
+
+#include <strings.h>
+
+#include <climits>
+#include <cstring>
+
+#ifdef SIMPLEHTTP_HAVE_ZLIB
+#include <zlib.h>
+#endif
+
+#ifdef SIMPLEHTTP_HAVE_ZSTD
+#include <zstd.h>
+#endif
+
+namespace SimpleHTTP {
+
+static const size_t kOutputSize = 16384;
+
+class Decompressor::Impl {
+public:
+    ContentEncoding encoding;
+    bool finished;
+    char output[kOutputSize];
+
+#ifdef SIMPLEHTTP_HAVE_ZLIB
+    z_stream zlib;
+    bool zlibReady;
+    int windowBits;
+#endif
+#ifdef SIMPLEHTTP_HAVE_ZSTD
+    ZSTD_DStream* zstd;
+#endif
+
+    Impl() : encoding(ContentEncoding::Identity), finished(false) {
+#ifdef SIMPLEHTTP_HAVE_ZLIB
+        zlib = z_stream();
+        zlibReady = false;
+        windowBits = 0;
+#endif
+#ifdef SIMPLEHTTP_HAVE_ZSTD
+        zstd = nullptr;
+#endif
+    }
+
+    ~Impl() {
+#ifdef SIMPLEHTTP_HAVE_ZLIB
+        if (zlibReady)
+            inflateEnd(&zlib);
+#endif
+#ifdef SIMPLEHTTP_HAVE_ZSTD
+        if (zstd)
+            ZSTD_freeDStream(zstd);
+#endif
+    }
+
+#ifdef SIMPLEHTTP_HAVE_ZLIB
+    bool beginZlib(const int& bits) {
+        windowBits = bits;
+        if (zlibReady)
+            return inflateReset2(&zlib, bits) == Z_OK;
+        zlibReady = inflateInit2(&zlib, bits) == Z_OK;
+        return zlibReady;
+    }
+
+    bool inflateInput(const char* data, const size_t& size, const Sink& sink) {
+        zlib.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(data));
+        zlib.avail_in = static_cast<uInt>(size);
+
+        do {
+            zlib.next_out = reinterpret_cast<Bytef*>(output);
+            zlib.avail_out = kOutputSize;
+            const int result = inflate(&zlib, Z_NO_FLUSH);
+
+            // Some servers send "deflate" as raw deflate data without the zlib wrapper.
+            if (result == Z_DATA_ERROR && encoding == ContentEncoding::Deflate &&
+                windowBits > 0 && zlib.total_out == 0) {
+                if (!beginZlib(-MAX_WBITS))
+                    return false;
+                zlib.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(data));
+                zlib.avail_in = static_cast<uInt>(size);
+                continue;
+            }
+            if (result != Z_OK && result != Z_STREAM_END && result != Z_BUF_ERROR)
+                return false;
+
+            const size_t produced = kOutputSize - zlib.avail_out;
+            if (produced > 0 && !sink(output, produced))
+                return false;
+
+            if (result == Z_STREAM_END) {
+                // Concatenated gzip members decode as one body.
+                if (encoding != ContentEncoding::Gzip || zlib.avail_in == 0) {
+                    finished = true;
+                    return true;
+                }
+                if (inflateReset(&zlib) != Z_OK)
+                    return false;
+            }
+        } while (zlib.avail_in > 0 || zlib.avail_out == 0);
+        return true;
+    }
+#endif
+
+#ifdef SIMPLEHTTP_HAVE_ZSTD
+    bool beginZstd() {
+        if (!zstd)
+            zstd = ZSTD_createDStream();
+        return zstd && !ZSTD_isError(ZSTD_initDStream(zstd));
+    }
+
+    bool zstdInput(const char* data, const size_t& size, const Sink& sink) {
+        ZSTD_inBuffer input = {data, size, 0};
+        bool outputFull = false;
+
+        while (input.pos < input.size || outputFull) {
+            ZSTD_outBuffer out = {output, kOutputSize, 0};
+            const size_t result = ZSTD_decompressStream(zstd, &out, &input);
+            if (ZSTD_isError(result))
+                return false;
+            if (out.pos > 0 && !sink(output, out.pos))
+                return false;
+
+            finished = result == 0;
+            outputFull = out.pos == out.size;
+        }
+        return true;
+    }
+#endif
+};
+
+Decompressor::Decompressor() {}
+
+Decompressor::~Decompressor() {}
+
+ContentEncoding Decompressor::parseEncoding(const char* value, const size_t& length) {
+    size_t start = 0;
+    size_t end = length;
+    while (start < end && (value[start] == ' ' || value[start] == '\t'))
+        ++start;
+    while (end > start && (value[end - 1] == ' ' || value[end - 1] == '\t'))
+        --end;
+
+    const char* token = value + start;
+    const size_t size = end - start;
+    const struct {
+        const char* name;
+        ContentEncoding encoding;
+    } known[] = {
+        {"identity", ContentEncoding::Identity}, {"gzip", ContentEncoding::Gzip},
+        {"x-gzip", ContentEncoding::Gzip},       {"deflate", ContentEncoding::Deflate},
+        {"zstd", ContentEncoding::Zstd},
+    };
+
+    if (size == 0)
+        return ContentEncoding::Identity;
+    for (const auto& entry : known) {
+        if (std::strlen(entry.name) == size && strncasecmp(entry.name, token, size) == 0)
+            return entry.encoding;
+    }
+    // Stacked codings ("gzip, br") and anything else are left to the caller.
+    return ContentEncoding::Unsupported;
+}
+
+bool Decompressor::isSupported(const ContentEncoding& encoding) {
+    switch (encoding) {
+        case ContentEncoding::Identity:
+            return true;
+        case ContentEncoding::Gzip:
+        case ContentEncoding::Deflate:
+#ifdef SIMPLEHTTP_HAVE_ZLIB
+            return true;
+#else
+            return false;
+#endif
+        case ContentEncoding::Zstd:
+#ifdef SIMPLEHTTP_HAVE_ZSTD
+            return true;
+#else
+            return false;
+#endif
+        default:
+            return false;
+    }
+}
+
+const char* Decompressor::acceptEncoding() {
+#if defined(SIMPLEHTTP_HAVE_ZLIB) && defined(SIMPLEHTTP_HAVE_ZSTD)
+    return "zstd, gzip, deflate";
+#elif defined(SIMPLEHTTP_HAVE_ZLIB)
+    return "gzip, deflate";
+#elif defined(SIMPLEHTTP_HAVE_ZSTD)
+    return "zstd";
+#else
+    return "";
+#endif
+}
+
+bool Decompressor::begin(const ContentEncoding& encoding) {
+    if (!isSupported(encoding))
+        return false;
+
+    // Allocated on first use so a decoder that never sees a compressed body costs nothing.
+    if (!impl)
+        impl.reset(new Impl());
+    impl->encoding = encoding;
+    impl->finished = false;
+
+    switch (encoding) {
+#ifdef SIMPLEHTTP_HAVE_ZLIB
+        case ContentEncoding::Gzip:
+            return impl->beginZlib(16 + MAX_WBITS);
+        case ContentEncoding::Deflate:
+            return impl->beginZlib(MAX_WBITS);
+#endif
+#ifdef SIMPLEHTTP_HAVE_ZSTD
+        case ContentEncoding::Zstd:
+            return impl->beginZstd();
+#endif
+        default:
+            impl->finished = true;
+            return true;
+    }
+}
+
+bool Decompressor::decompress(const char* data, const size_t& size, const Sink& sink) {
+    if (!impl)
+        return false;
+    if (size == 0)
+        return true;
+
+    switch (impl->encoding) {
+#ifdef SIMPLEHTTP_HAVE_ZLIB
+        case ContentEncoding::Gzip:
+        case ContentEncoding::Deflate:
+            if (size > UINT_MAX)
+                return false;
+            return impl->inflateInput(data, size, sink);
+#endif
+#ifdef SIMPLEHTTP_HAVE_ZSTD
+        case ContentEncoding::Zstd:
+            return impl->zstdInput(data, size, sink);
+#endif
+        case ContentEncoding::Identity:
+            return sink(data, size);
+        default:
+            return false;
+    }
+}
+
+bool Decompressor::isFinished() const {
+    return impl && impl->finished;
+}
+
+bool Compressor::gzip(const char* data, const size_t& size, Buffer& output, const int& level) {
+#ifdef SIMPLEHTTP_HAVE_ZLIB
+    if (size > UINT_MAX)
+        return false;
+
+    z_stream stream = z_stream();
+    if (deflateInit2(&stream, level, Z_DEFLATED, 16 + MAX_WBITS, 8, Z_DEFAULT_STRATEGY) != Z_OK)
+        return false;
+
+    const uLong bound = deflateBound(&stream, static_cast<uLong>(size));
+    output.ensureWritable(bound);
+    stream.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(data));
+    stream.avail_in = static_cast<uInt>(size);
+    stream.next_out = reinterpret_cast<Bytef*>(output.writePtr());
+    stream.avail_out = static_cast<uInt>(bound);
+
+    const bool done = deflate(&stream, Z_FINISH) == Z_STREAM_END;
+    if (done)
+        output.commit(stream.total_out);
+    deflateEnd(&stream);
+    return done;
+#else
+    (void)data;
+    (void)size;
+    (void)output;
+    (void)level;
+    return false;
+#endif
+}
+
+}  // namespace SimpleHTTP
@@ -0,0 +1,107 @@
+#include "connectionPool.hpp"
+
+#include <vector>
+
+namespace SimpleHTTP {
+
+ConnectionPoolConfig::ConnectionPoolConfig() : maxIdlePerHost(8), idleTimeoutSeconds(30) {}
+
+ConnectionPool::ConnectionPool(const ConnectionPoolConfig& config) : config(config) {}
+
+std::string ConnectionPool::makeKey(const std::string& host, const int& port) {
+    return host + ":" + std::to_string(port);
+}
+
+bool ConnectionPool::isExpired(const IdleConnection& connection,
+                               const std::chrono::steady_clock::time_point& now) const {
+    return now - connection.idleSince >= std::chrono::seconds(config.idleTimeoutSeconds);
+}
+
+std::unique_ptr<Socket> ConnectionPool::acquire(const std::string& host, const int& port) {
+    const std::string key = makeKey(host, port);
+
+    while (true) {
+        std::unique_ptr<Socket> candidate;
+        std::vector<std::unique_ptr<Socket>> expired;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            const auto it = idle.find(key);
+            if (it == idle.end())
+                return nullptr;
+
+            // Oldest connections sit at the front; drop the ones that idled out so they are
+            // closed outside the lock.
+            const auto now = std::chrono::steady_clock::now();
+            std::deque<IdleConnection>& connections = it->second;
+            while (!connections.empty() && isExpired(connections.front(), now)) {
+                expired.push_back(std::move(connections.front().socket));
+                connections.pop_front();
+            }
+
+            // The host's (possibly empty) queue is kept so a steady request loop does not
+            // reallocate it on every release; clear() drops it.
+            if (!connections.empty()) {
+                candidate = std::move(connections.back().socket);
+                connections.pop_back();
+            }
+        }
+
+        if (!candidate)
+            return nullptr;
+        if (candidate->isHealthy())
+            return candidate;
+    }
+}
+
+void ConnectionPool::release(const std::string& host, const int& port,
+                             std::unique_ptr<Socket> socket) {
+    if (!socket || !socket->isSocketConnected())
+        return;
+
+    std::unique_ptr<Socket> evicted;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (config.maxIdlePerHost == 0)
+            return;
+
+        std::deque<IdleConnection>& connections = idle[makeKey(host, port)];
+        if (connections.size() >= config.maxIdlePerHost) {
+            evicted = std::move(connections.front().socket);
+            connections.pop_front();
+        }
+
+        IdleConnection connection;
+        connection.socket = std::move(socket);
+        connection.idleSince = std::chrono::steady_clock::now();
+        connections.push_back(std::move(connection));
+    }
+}
+
+void ConnectionPool::setConfig(const ConnectionPoolConfig& newConfig) {
+    std::lock_guard<std::mutex> lock(mutex);
+    config = newConfig;
+}
+
+ConnectionPoolConfig ConnectionPool::getConfig() const {
+    std::lock_guard<std::mutex> lock(mutex);
+    return config;
+}
+
+size_t ConnectionPool::idleCount() const {
+    std::lock_guard<std::mutex> lock(mutex);
+    size_t count = 0;
+    for (const auto& entry : idle) {
+        count += entry.second.size();
+    }
+    return count;
+}
+
+void ConnectionPool::clear() {
+    std::map<std::string, std::deque<IdleConnection>> closing;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        closing.swap(idle);
+    }
+}
+
+}  // namespace SimpleHTTP
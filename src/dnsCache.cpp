@@ -0,0 +1,255 @@
+#include "dnsCache.hpp"
+
+namespace SimpleHTTP {
+
+DnsCacheConfig::DnsCacheConfig()
+    : ttlSeconds(60), negativeTtlSeconds(5), refreshAheadSeconds(10), maxEntries(1024) {}
+
+DnsCache::DnsCache() : refresherStarted(false) {}
+
+DnsCache& DnsCache::instance() {
+    // Never destroyed, so exit neither waits for a refresh stuck in getaddrinfo nor pulls the
+    // cache from under it.
+    static DnsCache* cache = new DnsCache();
+    return *cache;
+}
+
+bool DnsCache::lookup(const std::string& host, std::vector<SocketAddress>& addresses) {
+    addrinfo hints = {}, *result;
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+
+    if (getaddrinfo(host.c_str(), nullptr, &hints, &result) != 0)
+        return false;
+
+    for (const addrinfo* ptr = result; ptr != nullptr; ptr = ptr->ai_next) {
+        if (ptr->ai_addrlen > sizeof(sockaddr_storage))
+            continue;
+        SocketAddress address;
+        std::memcpy(&address.storage, ptr->ai_addr, ptr->ai_addrlen);
+        address.length = ptr->ai_addrlen;
+        address.family = ptr->ai_family;
+        addresses.push_back(address);
+    }
+
+    freeaddrinfo(result);
+    return !addresses.empty();
+}
+
+void* DnsCache::refresherMain(void* arg) {
+    static_cast<DnsCache*>(arg)->runRefresher();
+    return nullptr;
+}
+
+void DnsCache::runRefresher() {
+    std::unique_lock<std::mutex> lock(mutex);
+    while (true) {
+        while (refreshQueue.empty())
+            refreshWanted.wait(lock);
+
+        const std::string host = refreshQueue.front();
+        refreshQueue.pop_front();
+        lock.unlock();
+        std::vector<SocketAddress> addresses;
+        lookupShared(host, addresses, true);
+        lock.lock();
+    }
+}
+
+// Called with the mutex held.
+void DnsCache::scheduleRefresh(const std::string& host, Entry& entry) {
+    if (!refresherStarted) {
+        pthread_t refresherId;
+        if (pthread_create(&refresherId, nullptr, refresherMain, this) != 0)
+            return;
+        pthread_detach(refresherId);
+        refresherStarted = true;
+    }
+    entry.refreshing = true;
+    refreshQueue.push_back(host);
+    refreshWanted.notify_one();
+}
+
+// Runs getaddrinfo for host, or waits for the call already running for it, and caches the
+// result. A failed refresh is not cached: the old addresses are served until they expire.
+bool DnsCache::lookupShared(const std::string& host, std::vector<SocketAddress>& addresses,
+                            const bool& refresh) {
+    std::unique_lock<std::mutex> lock(mutex);
+    const auto running = lookups.find(host);
+    if (running != lookups.end()) {
+        const std::shared_ptr<Lookup> shared = running->second;
+        while (!shared->done)
+            lookupDone.wait(lock);
+        addresses = shared->addresses;
+        return shared->resolved;
+    }
+
+    const std::shared_ptr<Lookup> own = std::make_shared<Lookup>();
+    own->done = false;
+    own->resolved = false;
+    lookups[host] = own;
+    const int ttl = config.ttlSeconds;
+    lock.unlock();
+
+    const bool resolved = lookup(host, addresses);
+    if ((resolved || !refresh) && ttl > 0)
+        store(host, addresses, false);
+
+    lock.lock();
+    if (!resolved && refresh) {
+        const auto it = entries.find(host);
+        if (it != entries.end())
+            it->second.refreshing = false;
+    }
+    own->done = true;
+    own->resolved = resolved;
+    own->addresses = addresses;
+    lookups.erase(host);
+    lookupDone.notify_all();
+    return resolved;
+}
+
+void DnsCache::evictIfFull(const std::chrono::steady_clock::time_point& now) {
+    if (entries.size() < config.maxEntries)
+        return;
+
+    for (auto it = entries.begin(); it != entries.end();) {
+        if (!it->second.pinned && it->second.expires <= now)
+            it = entries.erase(it);
+        else
+            ++it;
+    }
+
+    while (!entries.empty() && entries.size() >= config.maxEntries) {
+        auto oldest = entries.end();
+        for (auto it = entries.begin(); it != entries.end(); ++it) {
+            if (!it->second.pinned && (oldest == entries.end() ||
+                                       it->second.expires < oldest->second.expires))
+                oldest = it;
+        }
+        if (oldest == entries.end())
+            return;
+        entries.erase(oldest);
+    }
+}
+
+void DnsCache::store(const std::string& host, const std::vector<SocketAddress>& addresses,
+                     const bool& pinned) {
+    std::lock_guard<std::mutex> lock(mutex);
+    const auto now = std::chrono::steady_clock::now();
+
+    const auto existing = entries.find(host);
+    if (existing != entries.end() && existing->second.pinned && !pinned)
+        return;
+    if (existing == entries.end())
+        evictIfFull(now);
+
+    const int ttl = addresses.empty() ? config.negativeTtlSeconds : config.ttlSeconds;
+    Entry& entry = entries[host];
+    entry.addresses = addresses;
+    entry.expires = now + std::chrono::seconds(ttl);
+    entry.pinned = pinned;
+    entry.refreshing = false;
+}
+
+// Copies the addresses of a live entry, scheduling a refresh when it is close to expiring.
+// Returns false when the host has no live entry.
+bool DnsCache::findCached(const std::string& host, std::vector<SocketAddress>& addresses) {
+    std::lock_guard<std::mutex> lock(mutex);
+    const auto now = std::chrono::steady_clock::now();
+    const auto it = entries.find(host);
+    if (it == entries.end() || (!it->second.pinned && now >= it->second.expires))
+        return false;
+
+    Entry& entry = it->second;
+    addresses = entry.addresses;
+    if (!entry.pinned && !entry.refreshing && !addresses.empty() &&
+        config.refreshAheadSeconds > 0 &&
+        entry.expires - now <= std::chrono::seconds(config.refreshAheadSeconds))
+        scheduleRefresh(host, entry);
+    return true;
+}
+
+bool DnsCache::resolveCached(const std::string& host, std::vector<SocketAddress>& addresses) {
+    if (findCached(host, addresses))
+        return !addresses.empty();
+    return lookupShared(host, addresses, false);
+}
+
+bool DnsCache::resolve(const std::string& host, const int& port,
+                       std::vector<SocketAddress>& addresses) {
+    addresses.clear();
+    if (!resolveCached(host, addresses))
+        return false;
+
+    for (SocketAddress& address : addresses)
+        address.setPort(port);
+    return true;
+}
+
+bool DnsCache::resolveIfCached(const std::string& host, const int& port,
+                               std::vector<SocketAddress>& addresses) {
+    addresses.clear();
+    if (!findCached(host, addresses))
+        return false;
+
+    for (SocketAddress& address : addresses)
+        address.setPort(port);
+    return true;
+}
+
+static bool parseAddresses(const std::vector<std::string>& ips,
+                           std::vector<SocketAddress>& addresses) {
+    for (const std::string& ip : ips) {
+        SocketAddress address;
+        if (!SocketAddress::fromString(ip, 0, address))
+            return false;
+        addresses.push_back(address);
+    }
+    return !addresses.empty();
+}
+
+bool DnsCache::seed(const std::string& host, const std::vector<std::string>& ips) {
+    std::vector<SocketAddress> addresses;
+    if (!parseAddresses(ips, addresses))
+        return false;
+    store(host, addresses, false);
+    return true;
+}
+
+bool DnsCache::pin(const std::string& host, const std::vector<std::string>& ips) {
+    std::vector<SocketAddress> addresses;
+    if (!parseAddresses(ips, addresses))
+        return false;
+    store(host, addresses, true);
+    return true;
+}
+
+void DnsCache::unpin(const std::string& host) {
+    std::lock_guard<std::mutex> lock(mutex);
+    const auto it = entries.find(host);
+    if (it != entries.end() && it->second.pinned)
+        entries.erase(it);
+}
+
+void DnsCache::remove(const std::string& host) {
+    std::lock_guard<std::mutex> lock(mutex);
+    entries.erase(host);
+}
+
+void DnsCache::clear() {
+    std::lock_guard<std::mutex> lock(mutex);
+    entries.clear();
+}
+
+void DnsCache::setConfig(const DnsCacheConfig& newConfig) {
+    std::lock_guard<std::mutex> lock(mutex);
+    config = newConfig;
+}
+
+DnsCacheConfig DnsCache::getConfig() const {
+    std::lock_guard<std::mutex> lock(mutex);
+    return config;
+}
+
+}  // namespace SimpleHTTP
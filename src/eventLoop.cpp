@@ -0,0 +1,857 @@
+#include "eventLoop.hpp"
+
+#include <sys/socket.h>
+
+#include <cerrno>
+
+#ifdef __linux__
+#include <sys/epoll.h>
+#endif
+
+namespace SimpleHTTP {
+
+namespace {
+
+// io_uring request ids that do not belong to an operation; those carry the Operation pointer.
+const uint64_t kWakeRequest = 1;
+const uint64_t kCancelRequest = 2;
+const uint64_t kConnectRequest = 3;
+
+const unsigned kRingEntries = 256;
+// Provided buffers shared by all multishot receives of a loop.
+const unsigned kReceiveBuffers = 64;
+const unsigned kReceiveBufferSize = 16384;
+
+uint64_t requestId(const void* operation) {
+    return reinterpret_cast<uint64_t>(operation);
+}
+
+}  // namespace
+
+class EventLoop::Poller {
+public:
+    struct Event {
+        int fd;
+        bool readable;
+        bool writable;
+    };
+
+#ifdef __linux__
+private:
+    int epollFd;
+
+    static uint32_t toMask(const bool& wantRead, const bool& wantWrite) {
+        return (wantRead ? EPOLLIN : 0u) | (wantWrite ? EPOLLOUT : 0u);
+    }
+
+    bool control(const int& op, const int& fd, const bool& wantRead, const bool& wantWrite) {
+        epoll_event event = {};
+        event.events = toMask(wantRead, wantWrite);
+        event.data.fd = fd;
+        return epoll_ctl(epollFd, op, fd, &event) == 0;
+    }
+
+public:
+    Poller() : epollFd(epoll_create1(EPOLL_CLOEXEC)) {}
+
+    ~Poller() {
+        if (epollFd != -1)
+            ::close(epollFd);
+    }
+
+    bool isValid() const {
+        return epollFd != -1;
+    }
+
+    // Readable while any watched descriptor has events.
+    int descriptor() const {
+        return epollFd;
+    }
+
+    bool add(const int& fd, const bool& wantRead, const bool& wantWrite) {
+        return control(EPOLL_CTL_ADD, fd, wantRead, wantWrite);
+    }
+
+    bool modify(const int& fd, const bool& wantRead, const bool& wantWrite) {
+        return control(EPOLL_CTL_MOD, fd, wantRead, wantWrite);
+    }
+
+    void remove(const int& fd) {
+        epoll_ctl(epollFd, EPOLL_CTL_DEL, fd, nullptr);
+    }
+
+    void wait(std::vector<Event>& events, const int& timeoutMs) {
+        epoll_event ready[64];
+        const int count = epoll_wait(epollFd, ready, 64, timeoutMs);
+        for (int i = 0; i < count; ++i) {
+            const bool failed = (ready[i].events & (EPOLLERR | EPOLLHUP)) != 0;
+            Event event;
+            event.fd = ready[i].data.fd;
+            event.readable = failed || (ready[i].events & EPOLLIN) != 0;
+            event.writable = failed || (ready[i].events & EPOLLOUT) != 0;
+            events.push_back(event);
+        }
+    }
+#else
+private:
+    std::map<int, short> interest;
+
+    static short toMask(const bool& wantRead, const bool& wantWrite) {
+        return static_cast<short>((wantRead ? POLLIN : 0) | (wantWrite ? POLLOUT : 0));
+    }
+
+public:
+    bool isValid() const {
+        return true;
+    }
+
+    int descriptor() const {
+        return -1;
+    }
+
+    bool add(const int& fd, const bool& wantRead, const bool& wantWrite) {
+        return interest.insert(std::make_pair(fd, toMask(wantRead, wantWrite))).second;
+    }
+
+    bool modify(const int& fd, const bool& wantRead, const bool& wantWrite) {
+        const auto it = interest.find(fd);
+        if (it == interest.end())
+            return false;
+        it->second = toMask(wantRead, wantWrite);
+        return true;
+    }
+
+    void remove(const int& fd) {
+        interest.erase(fd);
+    }
+
+    void wait(std::vector<Event>& events, const int& timeoutMs) {
+        std::vector<pollfd> fds;
+        fds.reserve(interest.size());
+        for (const auto& entry : interest) {
+            pollfd pfd = {};
+            pfd.fd = entry.first;
+            pfd.events = entry.second;
+            fds.push_back(pfd);
+        }
+
+        if (poll(fds.data(), fds.size(), timeoutMs) <= 0)
+            return;
+
+        for (const pollfd& pfd : fds) {
+            if (pfd.revents == 0)
+                continue;
+            const bool failed = (pfd.revents & (POLLERR | POLLHUP | POLLNVAL)) != 0;
+            Event event;
+            event.fd = pfd.fd;
+            event.readable = failed || (pfd.revents & POLLIN) != 0;
+            event.writable = failed || (pfd.revents & POLLOUT) != 0;
+            events.push_back(event);
+        }
+    }
+#endif
+};
+
+EventLoop::EventLoop() : multishot(false), nextId(1), running(false), stopping(false) {
+    wakeFds[0] = wakeFds[1] = -1;
+    if (pipe(wakeFds) != 0)
+        return;
+
+    for (const int fd : wakeFds) {
+        fcntl(fd, F_SETFL, fcntl(fd, F_GETFL, 0) | O_NONBLOCK);
+        fcntl(fd, F_SETFD, FD_CLOEXEC);
+    }
+
+    poller.reset(new Poller());
+    if (!poller->isValid() || (!initRing() && !poller->add(wakeFds[0], true, false)))
+        return;
+
+    running = pthread_create(&threadId, nullptr, threadMain, this) == 0;
+}
+
+// Uses io_uring when it was built in and the running kernel has what it needs. The provided
+// buffer ring for multishot receives is optional (Linux 5.19).
+bool EventLoop::initRing() {
+    std::unique_ptr<IoUring> candidate(new IoUring());
+    if (!candidate->init(kRingEntries))
+        return false;
+
+    multishot = candidate->initBufferRing(kReceiveBuffers, kReceiveBufferSize);
+    ring = std::move(candidate);
+    return true;
+}
+
+EventLoop::~EventLoop() {
+    stop();
+    for (const int fd : wakeFds) {
+        if (fd != -1)
+            ::close(fd);
+    }
+}
+
+void* EventLoop::threadMain(void* arg) {
+    static_cast<EventLoop*>(arg)->run();
+    return nullptr;
+}
+
+uint64_t EventLoop::submit(std::unique_ptr<Socket> socket,
+                           const std::vector<SocketAddress>& addresses, const DataView& head,
+                           const DataView& body, Buffer& input, DataHandler onData,
+                           CompletionHandler onComplete) {
+    std::unique_ptr<Operation> operation(new Operation());
+    if (!socket->isSocketConnected())
+        operation->addresses = addresses;
+    operation->nextAddress = 0;
+    operation->socket = std::move(socket);
+    operation->output[0] = head;
+    operation->output[1] = body;
+    operation->outputSize = head.size + body.size;
+    operation->input = &input;
+    operation->sent = 0;
+    operation->reading = false;
+    operation->inFlight = false;
+    operation->multishot = false;
+    operation->finishing = false;
+    operation->result = Result::Failed;
+    operation->timeoutMs = operation->socket->getTimeout();
+    operation->onData = std::move(onData);
+    operation->onComplete = std::move(onComplete);
+
+    uint64_t id = 0;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (!running || stopping)
+            return 0;
+        id = operation->id = nextId++;
+        incoming.push_back(std::move(operation));
+    }
+    wake();
+    return id;
+}
+
+void EventLoop::cancel(const uint64_t& id) {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (!running || stopping)
+            return;
+        cancellations.push_back(id);
+    }
+    wake();
+}
+
+void EventLoop::stop() {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (!running)
+            return;
+        stopping = true;
+    }
+    wake();
+    pthread_join(threadId, nullptr);
+
+    std::lock_guard<std::mutex> lock(mutex);
+    running = false;
+}
+
+void EventLoop::wake() {
+    const char signal = 1;
+    if (::write(wakeFds[1], &signal, 1) < 0) {
+        // The pipe is already full, so the loop has a wake-up pending anyway.
+    }
+}
+
+void EventLoop::run() {
+    if (ring) {
+        runRing();
+        return;
+    }
+
+    std::vector<Poller::Event> events;
+    events.reserve(64);
+
+    while (true) {
+        events.clear();
+        poller->wait(events, expireOperations());
+
+        for (const Poller::Event& event : events) {
+            if (event.fd == wakeFds[0]) {
+                char drain[64];
+                while (::read(wakeFds[0], drain, sizeof(drain)) > 0) {
+                }
+                continue;
+            }
+
+            const auto it = operations.find(event.fd);
+            if (it != operations.end()) {
+                handleEvent(it->second.get(), event.readable, event.writable);
+                continue;
+            }
+            const auto owner = attemptOwners.find(event.fd);
+            if (owner != attemptOwners.end() && event.writable)
+                handleAttempt(owner->second, event.fd);
+        }
+
+        acceptIncoming();
+
+        std::lock_guard<std::mutex> lock(mutex);
+        if (stopping)
+            break;
+    }
+
+    failAll();
+}
+
+void EventLoop::acceptIncoming() {
+    std::deque<std::unique_ptr<Operation>> accepted;
+    std::vector<uint64_t> cancelled;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        accepted.swap(incoming);
+        cancelled.swap(cancellations);
+    }
+
+    for (auto& operation : accepted) {
+        if (operation->socket->isSocketConnected())
+            start(std::move(operation));
+        else
+            beginConnect(std::move(operation));
+    }
+    // An exchange is always accepted before its cancellation is seen.
+    for (const uint64_t& id : cancelled)
+        cancelOperation(id);
+}
+
+void EventLoop::start(std::unique_ptr<Operation> operation) {
+    const int fd = operation->socket->getSocketFd();
+    Operation* raw = operation.get();
+    operations[fd] = std::move(operation);
+    touch(raw);
+
+    if (ring) {
+        // Sockets stay blocking: io_uring does its own readiness handling, and a request on a
+        // non-blocking socket could come back with EAGAIN instead.
+        if (raw->socket->setNonBlocking(false))
+            sendRing(raw);
+        else
+            finish(raw, Result::Failed);
+        return;
+    }
+
+    // Every exchange starts by waiting for the socket to become writable.
+    if (!raw->socket->setNonBlocking(true) || !poller->add(fd, false, true))
+        finish(raw, Result::Failed);
+}
+
+// The connect timeout runs from here, as for a blocking connect.
+void EventLoop::beginConnect(std::unique_ptr<Operation> operation) {
+    Operation* raw = operation.get();
+    Socket::interleaveFamilies(raw->addresses);
+    touch(raw);
+    connecting.push_back(std::move(operation));
+    startAttempt(raw);
+}
+
+// Starts a connect to the next address that takes one; addresses refusing it at once are
+// skipped. Fails the operation once no address is left and no attempt is in progress.
+void EventLoop::startAttempt(Operation* operation) {
+    while (operation->nextAddress < operation->addresses.size()) {
+        const SocketAddress& address = operation->addresses[operation->nextAddress++];
+        std::unique_ptr<Socket> attempt(new Socket());
+        attempt->setTimeout(operation->timeoutMs);
+        attempt->setOptions(operation->socket->getOptions());
+        if (!attempt->connectNonBlocking(std::vector<SocketAddress>(1, address)))
+            continue;
+        if (attempt->isSocketConnected()) {
+            connected(operation, std::move(attempt));
+            return;
+        }
+
+        const int fd = attempt->getSocketFd();
+        if (!poller->add(fd, false, true))
+            continue;
+        attemptOwners[fd] = operation;
+        operation->attempts.push_back(std::move(attempt));
+        operation->nextAttempt = std::chrono::steady_clock::now() +
+                                 std::chrono::milliseconds(Socket::kConnectAttemptDelayMs);
+        return;
+    }
+
+    if (operation->attempts.empty())
+        failConnect(operation, Result::Failed);
+}
+
+// Called when the attempt on fd became writable: it either connected and carries the exchange,
+// or failed, and the next address is started before the loop waits again.
+void EventLoop::handleAttempt(Operation* operation, const int& fd) {
+    auto it = operation->attempts.begin();
+    while ((*it)->getSocketFd() != fd)
+        ++it;
+    std::unique_ptr<Socket> attempt = std::move(*it);
+    operation->attempts.erase(it);
+    attemptOwners.erase(fd);
+    poller->remove(fd);
+
+    if (attempt->completeConnect()) {
+        connected(operation, std::move(attempt));
+        return;
+    }
+
+    operation->nextAttempt = std::chrono::steady_clock::now();
+    if (operation->attempts.empty() && operation->nextAddress == operation->addresses.size())
+        failConnect(operation, Result::Failed);
+}
+
+// io_uring only: the ring reported the poller readable.
+void EventLoop::pollAttempts() {
+    std::vector<Poller::Event> events;
+    poller->wait(events, 0);
+    for (const Poller::Event& event : events) {
+        const auto owner = attemptOwners.find(event.fd);
+        if (owner != attemptOwners.end() && event.writable)
+            handleAttempt(owner->second, event.fd);
+    }
+}
+
+// Removes the operation from the connecting ones and closes its remaining attempts.
+std::unique_ptr<EventLoop::Operation> EventLoop::takeConnecting(Operation* operation) {
+    for (const auto& attempt : operation->attempts) {
+        const int fd = attempt->getSocketFd();
+        poller->remove(fd);
+        attemptOwners.erase(fd);
+    }
+    operation->attempts.clear();
+
+    std::unique_ptr<Operation> owned;
+    for (auto it = connecting.begin(); it != connecting.end(); ++it) {
+        if (it->get() == operation) {
+            owned = std::move(*it);
+            connecting.erase(it);
+            break;
+        }
+    }
+    return owned;
+}
+
+void EventLoop::connected(Operation* operation, std::unique_ptr<Socket> socket) {
+    std::unique_ptr<Operation> owned = takeConnecting(operation);
+    owned->socket = std::move(socket);
+    start(std::move(owned));
+}
+
+void EventLoop::failConnect(Operation* operation, const Result& result) {
+    report(takeConnecting(operation), result);
+}
+
+void EventLoop::cancelOperation(const uint64_t& id) {
+    for (const auto& entry : operations) {
+        if (entry.second->id == id) {
+            finish(entry.second.get(), Result::Failed);
+            return;
+        }
+    }
+    for (const auto& operation : connecting) {
+        if (operation->id == id) {
+            failConnect(operation.get(), Result::Failed);
+            return;
+        }
+    }
+}
+
+void EventLoop::handleEvent(Operation* operation, const bool& readable, const bool& writable) {
+    const Socket& socket = *operation->socket;
+
+    if (!operation->reading) {
+        if (!writable)
+            return;
+        while (operation->sent < operation->outputSize) {
+            const ssize_t sent = socket.sendSome(operation->output, 2, operation->sent);
+            if (sent < 0) {
+                if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)
+                    return;
+                finish(operation, Result::Unsent);
+                return;
+            }
+            operation->sent += sent;
+            touch(operation);
+        }
+
+        operation->reading = true;
+        if (!poller->modify(socket.getSocketFd(), true, false))
+            finish(operation, Result::Failed);
+        return;
+    }
+
+    if (!readable)
+        return;
+
+    while (true) {
+        const ssize_t received = socket.receiveInto(*operation->input);
+        if (received > 0) {
+            touch(operation);
+            if (operation->onData(*operation->input)) {
+                finish(operation, Result::Complete);
+                return;
+            }
+            continue;
+        }
+
+        if (received == 0) {
+            finish(operation, Result::Closed);
+        } else if (errno == ECONNRESET || errno == ECONNABORTED) {
+            finish(operation, Result::Reset);
+        } else if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) {
+            finish(operation, Result::Failed);
+        } else if (errno == EINTR) {
+            continue;
+        }
+        return;
+    }
+}
+
+void EventLoop::runRing() {
+    std::vector<IoUring::Completion> completions;
+    completions.reserve(64);
+    ring->preparePoll(wakeFds[0], POLLIN, kWakeRequest);
+    ring->preparePoll(poller->descriptor(), POLLIN, kConnectRequest);
+
+    while (true) {
+        // Everything queued since the last iteration goes to the kernel in this one call.
+        ring->submitAndWait(expireOperations());
+        completions.clear();
+        ring->reap(completions);
+
+        for (const IoUring::Completion& completion : completions) {
+            if (completion.userData == kWakeRequest) {
+                char drain[64];
+                while (::read(wakeFds[0], drain, sizeof(drain)) > 0) {
+                }
+                ring->preparePoll(wakeFds[0], POLLIN, kWakeRequest);
+                continue;
+            }
+            if (completion.userData == kConnectRequest) {
+                pollAttempts();
+                ring->preparePoll(poller->descriptor(), POLLIN, kConnectRequest);
+                continue;
+            }
+            if (completion.userData == kCancelRequest)
+                continue;
+            handleCompletion(reinterpret_cast<Operation*>(completion.userData), completion);
+        }
+
+        acceptIncoming();
+
+        std::lock_guard<std::mutex> lock(mutex);
+        if (stopping)
+            break;
+    }
+
+    failAll();
+}
+
+void EventLoop::handleCompletion(Operation* operation, const IoUring::Completion& completion) {
+    unsigned bufferId = 0;
+    const bool buffered = IoUring::bufferId(completion, bufferId);
+    if (!IoUring::more(completion))
+        operation->inFlight = false;
+
+    const int result = completion.result;
+    if (result > 0 && operation->reading) {
+        // Bytes that arrive while the exchange is being finished are kept too, so a connection
+        // with data past the response is not mistaken for an idle one.
+        if (buffered) {
+            operation->input->append(ring->bufferData(bufferId), result);
+        } else {
+            operation->input->commit(result);
+        }
+    }
+    if (buffered)
+        ring->recycleBuffer(bufferId);
+
+    if (operation->finishing) {
+        if (!operation->inFlight)
+            finish(operation, operation->result);
+        return;
+    }
+
+    if (!operation->reading) {
+        if (result < 0) {
+            if (result == -EINTR || result == -EAGAIN)
+                sendRing(operation);
+            else
+                finish(operation, Result::Unsent);
+            return;
+        }
+        operation->sent += result;
+        touch(operation);
+        if (operation->sent < operation->outputSize) {
+            sendRing(operation);
+        } else {
+            operation->reading = true;
+            receiveRing(operation);
+        }
+        return;
+    }
+
+    if (result > 0) {
+        touch(operation);
+        if (operation->onData(*operation->input))
+            finish(operation, Result::Complete);
+        else if (!operation->inFlight)
+            receiveRing(operation);
+        return;
+    }
+
+    if (result == 0) {
+        finish(operation, Result::Closed);
+    } else if (result == -ECONNRESET || result == -ECONNABORTED) {
+        finish(operation, Result::Reset);
+    } else if (result == -EINVAL && operation->multishot) {
+        multishot = false;
+        receiveRing(operation);
+    } else if (result == -ENOBUFS || result == -EINTR || result == -EAGAIN) {
+        // A multishot receive also ends with ENOBUFS when every provided buffer is taken.
+        receiveRing(operation);
+    } else {
+        finish(operation, Result::Failed);
+    }
+}
+
+void EventLoop::sendRing(Operation* operation) {
+    size_t used = 0;
+    size_t skip = operation->sent;
+    for (const DataView& part : operation->output) {
+        if (part.size <= skip) {
+            skip -= part.size;
+            continue;
+        }
+        operation->vectors[used].iov_base = const_cast<char*>(part.data + skip);
+        operation->vectors[used].iov_len = part.size - skip;
+        skip = 0;
+        ++used;
+    }
+
+    operation->message = msghdr();
+    operation->message.msg_iov = operation->vectors;
+    operation->message.msg_iovlen = used;
+    operation->inFlight =
+        ring->prepareSend(operation->socket->getSocketFd(), &operation->message,
+                          requestId(operation));
+    if (!operation->inFlight)
+        finish(operation, Result::Failed);
+}
+
+// One multishot receive serves the whole response when the kernel supports it; otherwise each
+// receive reads straight into the input buffer.
+void EventLoop::receiveRing(Operation* operation) {
+    const int fd = operation->socket->getSocketFd();
+    operation->multishot = multishot;
+    if (multishot) {
+        operation->inFlight = ring->prepareReceiveMultishot(fd, requestId(operation));
+    } else {
+        Buffer& input = *operation->input;
+        input.ensureWritable(kReceiveBufferSize);
+        operation->inFlight =
+            ring->prepareReceive(fd, input.writePtr(), input.writable(), requestId(operation));
+    }
+    if (!operation->inFlight)
+        finish(operation, Result::Failed);
+}
+
+void EventLoop::touch(Operation* operation) {
+    if (operation->timeoutMs > 0)
+        operation->deadline =
+            std::chrono::steady_clock::now() + std::chrono::milliseconds(operation->timeoutMs);
+}
+
+// Fails every operation that made no progress within its timeout, starts the connect attempts
+// that are due and returns how long the poller may sleep before the next deadline (-1 when none
+// is pending).
+int EventLoop::expireOperations() {
+    const auto now = std::chrono::steady_clock::now();
+    std::vector<Operation*> expired, expiredConnects, due;
+    int wait = -1;
+    const auto waitUntil = [&now, &wait](const std::chrono::steady_clock::time_point& deadline) {
+        const auto left =
+            std::chrono::duration_cast<std::chrono::milliseconds>(deadline - now).count() + 1;
+        if (wait == -1 || left < wait)
+            wait = static_cast<int>(left);
+    };
+
+    for (const auto& entry : operations) {
+        const Operation* operation = entry.second.get();
+        if (operation->timeoutMs <= 0 || operation->finishing)
+            continue;
+        if (operation->deadline <= now)
+            expired.push_back(entry.second.get());
+        else
+            waitUntil(operation->deadline);
+    }
+
+    for (const auto& operation : connecting) {
+        if (operation->timeoutMs > 0 && operation->deadline <= now) {
+            expiredConnects.push_back(operation.get());
+            continue;
+        }
+        if (operation->nextAddress < operation->addresses.size()) {
+            if (operation->nextAttempt <= now)
+                due.push_back(operation.get());
+            else
+                waitUntil(operation->nextAttempt);
+        }
+        if (operation->timeoutMs > 0)
+            waitUntil(operation->deadline);
+    }
+
+    for (Operation* operation : expired)
+        finish(operation, Result::TimedOut);
+    for (Operation* operation : expiredConnects)
+        failConnect(operation, Result::TimedOut);
+    for (Operation* operation : due)
+        startAttempt(operation);
+    if (!due.empty())
+        waitUntil(now + std::chrono::milliseconds(Socket::kConnectAttemptDelayMs));
+    return wait;
+}
+
+void EventLoop::finish(Operation* operation, const Result& result) {
+    // The kernel may still write into the operation's buffers and use its socket; report the
+    // result only once the cancelled request has completed.
+    if (operation->inFlight) {
+        if (!operation->finishing) {
+            operation->finishing = true;
+            operation->result = result;
+            ring->prepareCancel(requestId(operation), kCancelRequest);
+        }
+        return;
+    }
+
+    const int fd = operation->socket->getSocketFd();
+    if (!ring)
+        poller->remove(fd);
+
+    const auto it = operations.find(fd);
+    std::unique_ptr<Operation> owned = std::move(it->second);
+    operations.erase(it);
+
+    // Sockets handed back may go to the connection pool and be used by blocking callers.
+    owned->socket->setNonBlocking(false);
+    report(std::move(owned), result);
+}
+
+void EventLoop::report(std::unique_ptr<Operation> operation, const Result& result) {
+    try {
+        operation->onComplete(result, std::move(operation->socket));
+    } catch (...) {
+    }
+}
+
+void EventLoop::failAll() {
+    std::vector<Operation*> active;
+    for (const auto& entry : operations)
+        active.push_back(entry.second.get());
+    for (Operation* operation : active)
+        finish(operation, Result::Failed);
+    while (!connecting.empty())
+        failConnect(connecting.front().get(), Result::Failed);
+
+    // With io_uring, operations whose requests are being cancelled are still in the map.
+    std::vector<IoUring::Completion> completions;
+    while (!operations.empty()) {
+        ring->submitAndWait(-1);
+        completions.clear();
+        ring->reap(completions);
+        for (const IoUring::Completion& completion : completions) {
+            if (completion.userData != kWakeRequest && completion.userData != kCancelRequest &&
+                completion.userData != kConnectRequest)
+                handleCompletion(reinterpret_cast<Operation*>(completion.userData), completion);
+        }
+    }
+
+    std::deque<std::unique_ptr<Operation>> pending;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        pending.swap(incoming);
+    }
+    for (auto& operation : pending)
+        report(std::move(operation), Result::Failed);
+}
+
+EventLoopGroup::EventLoopGroup(const size_t& threadCount)
+    : threadCount(threadCount == 0 ? 1 : threadCount), nextLoop(0) {}
+
+EventLoop* EventLoopGroup::next() {
+    std::lock_guard<std::mutex> lock(mutex);
+    if (loops.empty()) {
+        for (size_t i = 0; i < threadCount; ++i)
+            loops.push_back(std::unique_ptr<EventLoop>(new EventLoop()));
+    }
+
+    EventLoop* loop = loops[nextLoop].get();
+    nextLoop = (nextLoop + 1) % loops.size();
+    return loop;
+}
+
+void EventLoopGroup::setThreadCount(const size_t& count) {
+    std::lock_guard<std::mutex> lock(mutex);
+    if (loops.empty())
+        threadCount = count == 0 ? 1 : count;
+}
+
+AsyncHandle::State::State() : done(false), cancelled(false), loop(nullptr), operationId(0) {}
+
+void AsyncHandle::State::markDone() {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        done = true;
+    }
+    finished.notify_all();
+}
+
+bool AsyncHandle::State::release() {
+    std::lock_guard<std::mutex> lock(mutex);
+    loop = nullptr;
+    return !cancelled;
+}
+
+AsyncHandle::AsyncHandle(const std::shared_ptr<State>& state) : state(state) {}
+
+void AsyncHandle::join() {
+    if (!state)
+        return;
+    std::unique_lock<std::mutex> lock(state->mutex);
+    while (!state->done)
+        state->finished.wait(lock);
+}
+
+void AsyncHandle::detach() {
+    state.reset();
+}
+
+bool AsyncHandle::isDone() const {
+    if (!state)
+        return true;
+    std::lock_guard<std::mutex> lock(state->mutex);
+    return state->done;
+}
+
+// The loop finishes the exchange on its own thread, wherever it was (connecting, writing or
+// reading).
+void AsyncHandle::cancel() {
+    if (!state)
+        return;
+    std::lock_guard<std::mutex> lock(state->mutex);
+    if (state->done)
+        return;
+    state->cancelled = true;
+    if (state->loop)
+        state->loop->cancel(state->operationId);
+}
+
+bool AsyncHandle::isCancelled() const {
+    if (!state)
+        return false;
+    std::lock_guard<std::mutex> lock(state->mutex);
+    return state->cancelled;
+}
+
+}  // namespace SimpleHTTP
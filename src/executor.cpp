@@ -0,0 +1,218 @@
+#include "executor.hpp"
+
+#include <algorithm>
+#include <thread>
+
+namespace SimpleHTTP {
+
+ExecutorConfig::ExecutorConfig()
+    : threads(0), queueCapacity(1024), overflow(Overflow::Block), maxPerHost(0) {}
+
+Executor::Executor(const ExecutorConfig& config)
+    : config(config), nextWorker(0), ready(0), pending(0), active(0), stopping(false) {}
+
+void Executor::setConfig(const ExecutorConfig& newConfig) {
+    std::lock_guard<std::mutex> lock(mutex);
+    if (workers.empty())
+        config = newConfig;
+}
+
+// Caller holds mutex. The worker list never changes once created, so it is read without the lock
+// afterwards.
+void Executor::start() {
+    size_t count = config.threads;
+    if (count == 0)
+        count = std::max(1u, std::thread::hardware_concurrency());
+
+    for (size_t i = 0; i < count; ++i) {
+        std::unique_ptr<Worker> worker(new Worker());
+        worker->owner = this;
+        worker->index = i;
+        worker->started = false;
+        workers.push_back(std::move(worker));
+    }
+    // Started once every deque exists, since workers steal from each other.
+    for (const std::unique_ptr<Worker>& worker : workers) {
+        worker->started =
+            pthread_create(&worker->threadId, nullptr, threadMain, worker.get()) == 0;
+    }
+}
+
+Executor::~Executor() {
+    shutdown();
+}
+
+size_t Executor::threadCount() {
+    std::lock_guard<std::mutex> lock(mutex);
+    return workers.size();
+}
+
+void* Executor::threadMain(void* arg) {
+    Worker* worker = static_cast<Worker*>(arg);
+    worker->owner->run(*worker);
+    return nullptr;
+}
+
+// The job is pushed before the lock is released: shutdown() sets stopping under the same lock,
+// so it either refuses the job here or finds it in a deque once the workers are joined.
+bool Executor::submit(const std::string& key, const Task& task) {
+    Job job;
+    job.key = key;
+    job.task = task;
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        if (workers.empty() && !stopping)
+            start();
+        if (config.queueCapacity > 0 && config.overflow == ExecutorConfig::Overflow::Block)
+            space.wait(lock, [this] { return stopping || pending < config.queueCapacity; });
+        if (stopping || (config.queueCapacity > 0 && pending >= config.queueCapacity))
+            return false;
+
+        ++pending;
+        if (config.maxPerHost > 0) {
+            KeyState& state = keys[key];
+            if (state.running >= config.maxPerHost) {
+                state.held.push_back(std::move(job));
+                return true;
+            }
+            ++state.running;
+        }
+        push(nextWorker++ % workers.size(), std::move(job));
+    }
+    available.notify_one();
+    return true;
+}
+
+// Caller holds mutex; worker mutexes are only ever taken inside it, never the other way round.
+void Executor::push(const size_t& index, Job job) {
+    Worker& worker = *workers[index];
+    {
+        std::lock_guard<std::mutex> lock(worker.mutex);
+        worker.jobs.push_back(std::move(job));
+    }
+    ++ready;
+}
+
+// Newest job of this worker first (its data is likely still in cache), otherwise the oldest job
+// of the next worker that has one.
+bool Executor::take(Worker& worker, Job& job) {
+    {
+        std::lock_guard<std::mutex> lock(worker.mutex);
+        if (!worker.jobs.empty()) {
+            job = std::move(worker.jobs.back());
+            worker.jobs.pop_back();
+            return true;
+        }
+    }
+
+    for (size_t offset = 1; offset < workers.size(); ++offset) {
+        Worker& victim = *workers[(worker.index + offset) % workers.size()];
+        std::lock_guard<std::mutex> lock(victim.mutex);
+        if (!victim.jobs.empty()) {
+            job = std::move(victim.jobs.front());
+            victim.jobs.pop_front();
+            return true;
+        }
+    }
+    return false;
+}
+
+void Executor::run(Worker& worker) {
+    while (!stopping) {
+        Job job;
+        if (take(worker, job)) {
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                --ready;
+                --pending;
+                ++active;
+            }
+            space.notify_one();
+
+            try {
+                job.task(false);
+            } catch (...) {
+            }
+            finish(worker, job.key);
+            continue;
+        }
+
+        std::unique_lock<std::mutex> lock(mutex);
+        available.wait(lock, [this] { return stopping || ready > 0; });
+    }
+}
+
+// Releases the key's slot, handing it to a held job of the same key if there is one.
+void Executor::finish(Worker& worker, const std::string& key) {
+    bool release = false;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        --active;
+        if (config.maxPerHost > 0) {
+            const auto it = keys.find(key);
+            if (it != keys.end()) {
+                KeyState& state = it->second;
+                if (!state.held.empty() && !stopping) {
+                    push(worker.index, std::move(state.held.front()));
+                    state.held.pop_front();
+                    release = true;
+                } else if (--state.running == 0 && state.held.empty()) {
+                    keys.erase(it);
+                }
+            }
+        }
+        if (!release && pending == 0 && active == 0)
+            idle.notify_all();
+    }
+
+    if (release)
+        available.notify_one();
+}
+
+void Executor::waitIdle() {
+    std::unique_lock<std::mutex> lock(mutex);
+    idle.wait(lock, [this] { return stopping || (pending == 0 && active == 0); });
+}
+
+void Executor::shutdown() {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (stopping)
+            return;
+        stopping = true;
+    }
+    available.notify_all();
+    space.notify_all();
+    idle.notify_all();
+
+    for (const std::unique_ptr<Worker>& worker : workers) {
+        if (worker->started)
+            pthread_join(worker->threadId, nullptr);
+    }
+
+    // Workers are gone, so what is left never started.
+    std::vector<Job> cancelled;
+    for (const std::unique_ptr<Worker>& worker : workers) {
+        for (Job& job : worker->jobs)
+            cancelled.push_back(std::move(job));
+        worker->jobs.clear();
+    }
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        for (auto& entry : keys) {
+            for (Job& job : entry.second.held)
+                cancelled.push_back(std::move(job));
+        }
+        keys.clear();
+        pending = 0;
+        ready = 0;
+    }
+    for (Job& job : cancelled) {
+        try {
+            job.task(true);
+        } catch (...) {
+        }
+    }
+}
+
+}  // namespace SimpleHTTP
@@ -0,0 +1,398 @@
+#include "fileDownload.hpp"
+
+#include <fcntl.h>
+#include <pthread.h>
+#include <strings.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "simpleHTTP.hpp"
+
+namespace SimpleHTTP {
+
+namespace {
+
+const char* const kPartSuffix = ".part";
+const char* const kStateSuffix = ".part.state";
+const char* const kStateMagic = "simpleHTTP download 1";
+// Each segment flushes its data and records its progress after this many bytes, which bounds
+// what an interrupted download fetches again.
+const uint64_t kCheckpointBytes = 8 * 1024 * 1024;
+
+struct Segment {
+    uint64_t start;
+    uint64_t end;
+    // Bytes from start already written to the file.
+    uint64_t done;
+};
+
+bool writeAll(const int& fd, const char* data, size_t size, uint64_t offset) {
+    while (size > 0) {
+        const ssize_t written = pwrite(fd, data, size, static_cast<off_t>(offset));
+        if (written < 0 && errno == EINTR)
+            continue;
+        if (written <= 0)
+            return false;
+        data += written;
+        size -= written;
+        offset += written;
+    }
+    return true;
+}
+
+// Reserves the blocks up front, so a full disk shows up now rather than midway and parallel
+// segments do not leave the file fragmented. Falls back to a sparse file where the filesystem
+// cannot allocate.
+bool preallocate(const int& fd, const uint64_t& size) {
+#ifdef __linux__
+    const int result = posix_fallocate(fd, 0, static_cast<off_t>(size));
+    if (result == 0)
+        return true;
+    if (result != EOPNOTSUPP && result != EINVAL)
+        return false;
+#endif
+    return ftruncate(fd, static_cast<off_t>(size)) == 0;
+}
+
+bool parseSize(const std::string& value, uint64_t& size) {
+    if (value.empty() || value[0] < '0' || value[0] > '9')
+        return false;
+    char* end = nullptr;
+    errno = 0;
+    const unsigned long long parsed = std::strtoull(value.c_str(), &end, 10);
+    if (errno != 0 || *end != '\0')
+        return false;
+    size = parsed;
+    return true;
+}
+
+// "bytes first-last/total"
+bool parseContentRange(const std::string& value, uint64_t& first, uint64_t& last,
+                       uint64_t& total) {
+    unsigned long long parsedFirst = 0;
+    unsigned long long parsedLast = 0;
+    unsigned long long parsedTotal = 0;
+    if (std::sscanf(value.c_str(), "bytes %llu-%llu/%llu", &parsedFirst, &parsedLast,
+                    &parsedTotal) != 3)
+        return false;
+    first = parsedFirst;
+    last = parsedLast;
+    total = parsedTotal;
+    return true;
+}
+
+// The validator If-Range can carry: a strong ETag, else Last-Modified.
+std::string rangeValidator(const HttpHeaders& headers) {
+    const std::string etag = headers.getHeader("ETag");
+    if (!etag.empty() && etag.compare(0, 2, "W/") != 0)
+        return etag;
+    return headers.getHeader("Last-Modified");
+}
+
+// The state file holds the object's size and validator, then one "start end done" line per
+// segment. It is replaced through a rename so an interruption never leaves it half written.
+bool saveState(const std::string& path, const uint64_t& size, const std::string& validator,
+               const std::vector<Segment>& segments) {
+    const std::string temporary = path + ".tmp";
+    FILE* file = std::fopen(temporary.c_str(), "w");
+    if (!file)
+        return false;
+
+    bool written = std::fprintf(file, "%s\n%llu\n%s\n", kStateMagic,
+                                static_cast<unsigned long long>(size), validator.c_str()) > 0;
+    for (const Segment& segment : segments) {
+        written = written && std::fprintf(file, "%llu %llu %llu\n",
+                                          static_cast<unsigned long long>(segment.start),
+                                          static_cast<unsigned long long>(segment.end),
+                                          static_cast<unsigned long long>(segment.done)) > 0;
+    }
+    written = std::fclose(file) == 0 && written;
+    if (!written || std::rename(temporary.c_str(), path.c_str()) != 0) {
+        std::remove(temporary.c_str());
+        return false;
+    }
+    return true;
+}
+
+// Loads the segments of an earlier download, if it was of the same object.
+bool loadState(const std::string& path, const uint64_t& size, const std::string& validator,
+               std::vector<Segment>& segments) {
+    FILE* file = std::fopen(path.c_str(), "r");
+    if (!file)
+        return false;
+
+    bool matches = false;
+    char line[1024];
+    const std::string magic = std::string(kStateMagic) + "\n";
+    if (std::fgets(line, sizeof(line), file) && line == magic &&
+        std::fgets(line, sizeof(line), file) && std::strtoull(line, nullptr, 10) == size &&
+        std::fgets(line, sizeof(line), file) && line == validator + "\n") {
+        matches = true;
+        unsigned long long start = 0;
+        unsigned long long end = 0;
+        unsigned long long done = 0;
+        uint64_t covered = 0;
+        while (std::fscanf(file, "%llu %llu %llu", &start, &end, &done) == 3) {
+            // Segments must tile the object in order.
+            if (start != covered || end <= start || end > size || done > end - start) {
+                matches = false;
+                break;
+            }
+            segments.push_back(Segment{start, end, done});
+            covered = end;
+        }
+        matches = matches && covered == size;
+    }
+    std::fclose(file);
+    if (!matches)
+        segments.clear();
+    return matches;
+}
+
+}  // namespace
+
+FileDownloadConfig::FileDownloadConfig()
+    : segments(4), minSegmentSize(1024 * 1024), attemptsPerSegment(3), resume(true) {}
+
+struct SegmentedDownload {
+    std::string url;
+    // The caller's headers plus Accept-Encoding: identity and If-Range.
+    HttpHeaders headers;
+    std::string statePath;
+    int fd;
+    uint64_t size;
+    std::string validator;
+    int attempts;
+    // Whether progress is recorded for a later resume.
+    bool persist;
+    std::vector<Segment> segments;
+    // Guards the segments' progress and writing the state file.
+    std::mutex mutex;
+    // The server stopped serving the probed object in ranges (it changed, or ignores Range).
+    std::atomic<bool> invalid;
+
+    SegmentedDownload() : fd(-1), size(0), attempts(1), persist(false), invalid(false) {}
+
+    // Makes the written data durable before the state file claims it. Checkpoints racing each
+    // other may record an older snapshot last, which only means refetching a little more.
+    void checkpoint() {
+        if (!persist)
+            return;
+        std::vector<Segment> snapshot;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            snapshot = segments;
+        }
+        if (fsync(fd) != 0)
+            return;
+        std::lock_guard<std::mutex> lock(mutex);
+        saveState(statePath, size, validator, snapshot);
+    }
+};
+
+namespace {
+
+struct SegmentTask {
+    HttpClient* client;
+    SegmentedDownload* download;
+    size_t index;
+    pthread_t threadId;
+    bool started;
+};
+
+}  // namespace
+
+void* HttpClient::segmentThread(void* arg) {
+    SegmentTask* task = static_cast<SegmentTask*>(arg);
+    task->client->fetchSegment(*task->download, task->index);
+    return nullptr;
+}
+
+// Requests the rest of one segment until it is complete. Only attempts that made no progress
+// count against the limit.
+void HttpClient::fetchSegment(SegmentedDownload& download, const size_t& index) {
+    Segment& segment = download.segments[index];
+    const uint64_t length = segment.end - segment.start;
+
+    int failures = 0;
+    while (segment.done < length && failures < download.attempts && !download.invalid) {
+        const uint64_t from = segment.start + segment.done;
+        HttpHeaders headers(download.headers);
+        headers.setHeader("Range",
+                          "bytes=" + std::to_string(from) + "-" + std::to_string(segment.end - 1));
+
+        const auto onHead = [&download, &segment, from](const HttpResponse& head) {
+            uint64_t first = 0;
+            uint64_t last = 0;
+            uint64_t total = 0;
+            if (head.httpCode == 206 &&
+                parseContentRange(head.headers.getHeader("Content-Range"), first, last, total))
+                return first == from && last < segment.end && total == download.size;
+            // A 200 answers If-Range when the object changed; 416 when it shrank.
+            if (head.httpCode == 200 || head.httpCode == 416)
+                download.invalid = true;
+            return false;
+        };
+
+        uint64_t unflushed = 0;
+        const auto onChunk = [&download, &segment, &unflushed, length](const char* data,
+                                                                        size_t size) {
+            if (size > length - segment.done ||
+                !writeAll(download.fd, data, size, segment.start + segment.done))
+                return false;
+            {
+                std::lock_guard<std::mutex> lock(download.mutex);
+                segment.done += size;
+            }
+            unflushed += size;
+            if (unflushed >= kCheckpointBytes) {
+                unflushed = 0;
+                download.checkpoint();
+            }
+            return true;
+        };
+
+        const uint64_t before = segment.done;
+        HttpTiming timing;
+        downloadStream(download.url, onChunk, headers, timing, onHead, false);
+        failures = segment.done > before ? 0 : failures + 1;
+    }
+}
+
+bool HttpClient::DownloadToFile(const std::string& url, const std::string& path,
+                                const FileDownloadConfig& config, const HttpHeaders& headers) {
+    const std::string partPath = path + kPartSuffix;
+    const std::string statePath = path + kStateSuffix;
+
+    // Ranges count bytes of the representation as sent, so that is what gets stored.
+    HttpHeaders identity(headers);
+    identity.setHeader("Accept-Encoding", "identity");
+
+    HttpResponse probe;
+    if (!sendRequest(probe, "HEAD", url, DataView(), "", identity))
+        return false;
+
+    uint64_t size = 0;
+    const std::string acceptRanges = probe.headers.getHeader("Accept-Ranges");
+    const bool ranged = probe.httpCode == 200 && strcasecmp(acceptRanges.c_str(), "bytes") == 0 &&
+                        parseSize(probe.headers.getHeader("Content-Length"), size) && size > 0;
+    if (!ranged) {
+        std::remove(statePath.c_str());
+        return streamToFile(url, path, identity);
+    }
+
+    SegmentedDownload download;
+    download.url = url;
+    download.headers = identity;
+    download.statePath = statePath;
+    download.size = size;
+    download.validator = rangeValidator(probe.headers);
+    download.attempts = config.attemptsPerSegment > 0 ? config.attemptsPerSegment : 1;
+    // Without a validator, a changed object could not be told apart from the one on disk.
+    download.persist = config.resume && !download.validator.empty();
+    if (!download.validator.empty())
+        download.headers.setHeader("If-Range", download.validator);
+
+    bool resumed = download.persist &&
+                   loadState(statePath, size, download.validator, download.segments);
+    download.fd = open(partPath.c_str(), O_RDWR | O_CREAT, 0644);
+    if (download.fd < 0)
+        return false;
+
+    struct stat info;
+    if (resumed && (fstat(download.fd, &info) != 0 || static_cast<uint64_t>(info.st_size) != size))
+        resumed = false;
+    if (!resumed) {
+        download.segments.clear();
+        const uint64_t minSize = config.minSegmentSize > 0 ? config.minSegmentSize : 1;
+        uint64_t count = size / minSize;
+        if (count > config.segments)
+            count = config.segments;
+        if (count == 0)
+            count = 1;
+        const uint64_t each = size / count;
+        for (uint64_t i = 0; i < count; ++i) {
+            const uint64_t start = i * each;
+            download.segments.push_back(Segment{start, i + 1 == count ? size : start + each, 0});
+        }
+
+        if (ftruncate(download.fd, 0) != 0 || !preallocate(download.fd, size)) {
+            close(download.fd);
+            std::remove(partPath.c_str());
+            return false;
+        }
+        download.checkpoint();
+    }
+
+    std::vector<SegmentTask> tasks;
+    for (size_t i = 0; i < download.segments.size(); ++i) {
+        const Segment& segment = download.segments[i];
+        if (segment.done < segment.end - segment.start)
+            tasks.push_back(SegmentTask{this, &download, i, pthread_t(), false});
+    }
+    for (SegmentTask& task : tasks)
+        task.started = pthread_create(&task.threadId, nullptr, segmentThread, &task) == 0;
+    for (SegmentTask& task : tasks) {
+        if (!task.started)
+            fetchSegment(download, task.index);
+    }
+    for (SegmentTask& task : tasks) {
+        if (task.started)
+            pthread_join(task.threadId, nullptr);
+    }
+
+    bool complete = !download.invalid;
+    for (const Segment& segment : download.segments)
+        complete = complete && segment.done == segment.end - segment.start;
+    complete = complete && fsync(download.fd) == 0;
+    if (!complete && !download.invalid)
+        download.checkpoint();
+    close(download.fd);
+
+    if (complete && std::rename(partPath.c_str(), path.c_str()) == 0) {
+        std::remove(statePath.c_str());
+        return true;
+    }
+    if (download.invalid || !download.persist) {
+        std::remove(partPath.c_str());
+        std::remove(statePath.c_str());
+    }
+    return false;
+}
+
+// For servers without range support: one request, written front to back, nothing to resume.
+bool HttpClient::streamToFile(const std::string& url, const std::string& path,
+                              const HttpHeaders& headers) {
+    const std::string partPath = path + kPartSuffix;
+    const int fd = open(partPath.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0)
+        return false;
+
+    uint64_t offset = 0;
+    const auto onHead = [](const HttpResponse& head) { return head.httpCode == 200; };
+    const auto onChunk = [fd, &offset](const char* data, size_t size) {
+        if (!writeAll(fd, data, size, offset))
+            return false;
+        offset += size;
+        return true;
+    };
+
+    HttpTiming timing;
+    const bool complete =
+        downloadStream(url, onChunk, headers, timing, onHead, false) && fsync(fd) == 0;
+    close(fd);
+    if (complete && std::rename(partPath.c_str(), path.c_str()) == 0)
+        return true;
+    std::remove(partPath.c_str());
+    return false;
+}
+
+}  // namespace SimpleHTTP
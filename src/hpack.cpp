@@ -0,0 +1,434 @@
+#include "hpack.hpp"
+
+namespace SimpleHTTP {
+
+// RFC 7541 Appendix B, indexed by symbol (EOS, 0x3fffffff/30, is handled separately).
+static const uint32_t kHuffmanCodes[256] = {
+    0x1ff8, 0x7fffd8, 0xfffffe2, 0xfffffe3, 0xfffffe4, 0xfffffe5, 0xfffffe6, 0xfffffe7,
+    0xfffffe8, 0xffffea, 0x3ffffffc, 0xfffffe9, 0xfffffea, 0x3ffffffd, 0xfffffeb, 0xfffffec,
+    0xfffffed, 0xfffffee, 0xfffffef, 0xffffff0, 0xffffff1, 0xffffff2, 0x3ffffffe, 0xffffff3,
+    0xffffff4, 0xffffff5, 0xffffff6, 0xffffff7, 0xffffff8, 0xffffff9, 0xffffffa, 0xffffffb,
+    0x14, 0x3f8, 0x3f9, 0xffa, 0x1ff9, 0x15, 0xf8, 0x7fa,
+    0x3fa, 0x3fb, 0xf9, 0x7fb, 0xfa, 0x16, 0x17, 0x18,
+    0x0, 0x1, 0x2, 0x19, 0x1a, 0x1b, 0x1c, 0x1d,
+    0x1e, 0x1f, 0x5c, 0xfb, 0x7ffc, 0x20, 0xffb, 0x3fc,
+    0x1ffa, 0x21, 0x5d, 0x5e, 0x5f, 0x60, 0x61, 0x62,
+    0x63, 0x64, 0x65, 0x66, 0x67, 0x68, 0x69, 0x6a,
+    0x6b, 0x6c, 0x6d, 0x6e, 0x6f, 0x70, 0x71, 0x72,
+    0xfc, 0x73, 0xfd, 0x1ffb, 0x7fff0, 0x1ffc, 0x3ffc, 0x22,
+    0x7ffd, 0x3, 0x23, 0x4, 0x24, 0x5, 0x25, 0x26,
+    0x27, 0x6, 0x74, 0x75, 0x28, 0x29, 0x2a, 0x7,
+    0x2b, 0x76, 0x2c, 0x8, 0x9, 0x2d, 0x77, 0x78,
+    0x79, 0x7a, 0x7b, 0x7ffe, 0x7fc, 0x3ffd, 0x1ffd, 0xffffffc,
+    0xfffe6, 0x3fffd2, 0xfffe7, 0xfffe8, 0x3fffd3, 0x3fffd4, 0x3fffd5, 0x7fffd9,
+    0x3fffd6, 0x7fffda, 0x7fffdb, 0x7fffdc, 0x7fffdd, 0x7fffde, 0xffffeb, 0x7fffdf,
+    0xffffec, 0xffffed, 0x3fffd7, 0x7fffe0, 0xffffee, 0x7fffe1, 0x7fffe2, 0x7fffe3,
+    0x7fffe4, 0x1fffdc, 0x3fffd8, 0x7fffe5, 0x3fffd9, 0x7fffe6, 0x7fffe7, 0xffffef,
+    0x3fffda, 0x1fffdd, 0xfffe9, 0x3fffdb, 0x3fffdc, 0x7fffe8, 0x7fffe9, 0x1fffde,
+    0x7fffea, 0x3fffdd, 0x3fffde, 0xfffff0, 0x1fffdf, 0x3fffdf, 0x7fffeb, 0x7fffec,
+    0x1fffe0, 0x1fffe1, 0x3fffe0, 0x1fffe2, 0x7fffed, 0x3fffe1, 0x7fffee, 0x7fffef,
+    0xfffea, 0x3fffe2, 0x3fffe3, 0x3fffe4, 0x7ffff0, 0x3fffe5, 0x3fffe6, 0x7ffff1,
+    0x3ffffe0, 0x3ffffe1, 0xfffeb, 0x7fff1, 0x3fffe7, 0x7ffff2, 0x3fffe8, 0x1ffffec,
+    0x3ffffe2, 0x3ffffe3, 0x3ffffe4, 0x7ffffde, 0x7ffffdf, 0x3ffffe5, 0xfffff1, 0x1ffffed,
+    0x7fff2, 0x1fffe3, 0x3ffffe6, 0x7ffffe0, 0x7ffffe1, 0x3ffffe7, 0x7ffffe2, 0xfffff2,
+    0x1fffe4, 0x1fffe5, 0x3ffffe8, 0x3ffffe9, 0xffffffd, 0x7ffffe3, 0x7ffffe4, 0x7ffffe5,
+    0xfffec, 0xfffff3, 0xfffed, 0x1fffe6, 0x3fffe9, 0x1fffe7, 0x1fffe8, 0x7ffff3,
+    0x3fffea, 0x3fffeb, 0x1ffffee, 0x1ffffef, 0xfffff4, 0xfffff5, 0x3ffffea, 0x7ffff4,
+    0x3ffffeb, 0x7ffffe6, 0x3ffffec, 0x3ffffed, 0x7ffffe7, 0x7ffffe8, 0x7ffffe9, 0x7ffffea,
+    0x7ffffeb, 0xffffffe, 0x7ffffec, 0x7ffffed, 0x7ffffee, 0x7ffffef, 0x7fffff0, 0x3ffffee,
+};
+
+static const uint8_t kHuffmanLengths[256] = {
+    13, 23, 28, 28, 28, 28, 28, 28, 28, 24, 30, 28, 28, 30, 28, 28, 28, 28, 28, 28, 28, 28, 30, 28,
+    28, 28, 28, 28, 28, 28, 28, 28, 6, 10, 10, 12, 13, 6, 8, 11, 10, 10, 8, 11, 8, 6, 6, 6,
+    5, 5, 5, 6, 6, 6, 6, 6, 6, 6, 7, 8, 15, 6, 12, 10, 13, 6, 7, 7, 7, 7, 7, 7,
+    7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 8, 7, 8, 13, 19, 13, 14, 6,
+    15, 5, 6, 5, 6, 5, 6, 6, 6, 5, 7, 7, 6, 6, 6, 5, 6, 7, 6, 5, 5, 6, 7, 7,
+    7, 7, 7, 15, 11, 14, 13, 28, 20, 22, 20, 20, 22, 22, 22, 23, 22, 23, 23, 23, 23, 23, 24, 23,
+    24, 24, 22, 23, 24, 23, 23, 23, 23, 21, 22, 23, 22, 23, 23, 24, 22, 21, 20, 22, 22, 23, 23, 21,
+    23, 22, 22, 24, 21, 22, 23, 23, 21, 21, 22, 21, 23, 22, 23, 23, 20, 22, 22, 22, 23, 22, 22, 23,
+    26, 26, 20, 19, 22, 23, 22, 25, 26, 26, 26, 27, 27, 26, 24, 25, 19, 21, 26, 27, 27, 26, 27, 24,
+    21, 21, 26, 26, 28, 27, 27, 27, 20, 24, 20, 21, 22, 21, 21, 23, 22, 22, 25, 25, 24, 24, 26, 23,
+    26, 27, 26, 26, 27, 27, 27, 27, 27, 28, 27, 27, 27, 27, 27, 26,
+};
+
+// RFC 7541 Appendix A; HPACK index i refers to kStaticTable[i - 1].
+static const struct {
+    const char* name;
+    const char* value;
+} kStaticTable[] = {
+    {":authority", ""}, {":method", "GET"}, {":method", "POST"}, {":path", "/"},
+    {":path", "/index.html"}, {":scheme", "http"}, {":scheme", "https"}, {":status", "200"},
+    {":status", "204"}, {":status", "206"}, {":status", "304"}, {":status", "400"},
+    {":status", "404"}, {":status", "500"}, {"accept-charset", ""},
+    {"accept-encoding", "gzip, deflate"}, {"accept-language", ""}, {"accept-ranges", ""},
+    {"accept", ""}, {"access-control-allow-origin", ""}, {"age", ""}, {"allow", ""},
+    {"authorization", ""}, {"cache-control", ""}, {"content-disposition", ""},
+    {"content-encoding", ""}, {"content-language", ""}, {"content-length", ""},
+    {"content-location", ""}, {"content-range", ""}, {"content-type", ""}, {"cookie", ""},
+    {"date", ""}, {"etag", ""}, {"expect", ""}, {"expires", ""}, {"from", ""}, {"host", ""},
+    {"if-match", ""}, {"if-modified-since", ""}, {"if-none-match", ""}, {"if-range", ""},
+    {"if-unmodified-since", ""}, {"last-modified", ""}, {"link", ""}, {"location", ""},
+    {"max-forwards", ""}, {"proxy-authenticate", ""}, {"proxy-authorization", ""}, {"range", ""},
+    {"referer", ""}, {"refresh", ""}, {"retry-after", ""}, {"server", ""}, {"set-cookie", ""},
+    {"strict-transport-security", ""}, {"transfer-encoding", ""}, {"user-agent", ""}, {"vary", ""},
+    {"via", ""}, {"www-authenticate", ""},
+};
+
+static const size_t kStaticCount = sizeof(kStaticTable) / sizeof(kStaticTable[0]);
+static const size_t kEntryOverhead = 32;
+static const size_t kMaxEncoderTableSize = 4096;
+
+// Bit-by-bit decoding tree for the Huffman code. Leaves store -(symbol + 1); EOS has no leaf, so
+// a string containing it fails to decode as the RFC requires.
+struct HuffmanTree {
+    struct Node {
+        int16_t child[2];
+    };
+    std::vector<Node> nodes;
+
+    HuffmanTree() {
+        nodes.reserve(512);
+        nodes.push_back(Node{{0, 0}});
+        for (int symbol = 0; symbol < 256; ++symbol) {
+            size_t node = 0;
+            for (int bit = kHuffmanLengths[symbol] - 1; bit >= 0; --bit) {
+                const int branch = (kHuffmanCodes[symbol] >> bit) & 1;
+                if (bit == 0) {
+                    nodes[node].child[branch] = static_cast<int16_t>(-(symbol + 1));
+                } else {
+                    if (nodes[node].child[branch] == 0) {
+                        nodes[node].child[branch] = static_cast<int16_t>(nodes.size());
+                        nodes.push_back(Node{{0, 0}});
+                    }
+                    node = nodes[node].child[branch];
+                }
+            }
+        }
+    }
+};
+
+static const HuffmanTree& huffmanTree() {
+    static const HuffmanTree tree;
+    return tree;
+}
+
+static const std::vector<HpackField>& staticFields() {
+    static const std::vector<HpackField> fields = [] {
+        std::vector<HpackField> result;
+        for (size_t i = 0; i < kStaticCount; ++i)
+            result.push_back(HpackField(kStaticTable[i].name, kStaticTable[i].value));
+        return result;
+    }();
+    return fields;
+}
+
+static size_t huffmanLength(const std::string& text) {
+    size_t bits = 0;
+    for (const char c : text)
+        bits += kHuffmanLengths[static_cast<uint8_t>(c)];
+    return (bits + 7) / 8;
+}
+
+static void huffmanEncode(const std::string& text, const size_t& length, Buffer& output) {
+    output.ensureWritable(length);
+    char* out = output.writePtr();
+    uint64_t pending = 0;
+    int bits = 0;
+    for (const char c : text) {
+        const uint8_t symbol = static_cast<uint8_t>(c);
+        pending = (pending << kHuffmanLengths[symbol]) | kHuffmanCodes[symbol];
+        bits += kHuffmanLengths[symbol];
+        while (bits >= 8) {
+            bits -= 8;
+            *out++ = static_cast<char>(pending >> bits);
+        }
+    }
+    // Padded with the most significant bits of EOS (all ones).
+    if (bits > 0)
+        *out++ = static_cast<char>((pending << (8 - bits)) | (0xff >> bits));
+    output.commit(length);
+}
+
+static bool huffmanDecode(const uint8_t* data, const size_t& size, std::string& text) {
+    const HuffmanTree& tree = huffmanTree();
+    size_t node = 0;
+    int depth = 0;
+    bool allOnes = true;
+
+    for (size_t i = 0; i < size; ++i) {
+        for (int bit = 7; bit >= 0; --bit) {
+            const int branch = (data[i] >> bit) & 1;
+            const int next = tree.nodes[node].child[branch];
+            if (next == 0)
+                return false;
+            ++depth;
+            allOnes = allOnes && branch == 1;
+            if (next < 0) {
+                text.push_back(static_cast<char>(-next - 1));
+                node = 0;
+                depth = 0;
+                allOnes = true;
+            } else {
+                node = next;
+            }
+        }
+    }
+    // Only a prefix of EOS shorter than a byte may be left over as padding.
+    return depth < 8 && allOnes;
+}
+
+static bool isSensitive(const std::string& name) {
+    return name == "authorization" || name == "proxy-authorization" || name == "cookie";
+}
+
+// Fields that change with nearly every request would only push reusable entries out of the table.
+static bool isVolatile(const std::string& name) {
+    return name == ":path" || name == "content-length";
+}
+
+HpackField::HpackField() {}
+
+HpackField::HpackField(const std::string& name, const std::string& value)
+    : name(name), value(value) {}
+
+HpackTable::HpackTable(const size_t& maxSize) : size(0), maxSize(maxSize) {}
+
+void HpackTable::evict(const size_t& room) {
+    while (!entries.empty() && size + room > maxSize) {
+        const HpackField& oldest = entries.back();
+        size -= oldest.name.size() + oldest.value.size() + kEntryOverhead;
+        entries.pop_back();
+    }
+}
+
+void HpackTable::add(const std::string& name, const std::string& value) {
+    const size_t entrySize = name.size() + value.size() + kEntryOverhead;
+    // An entry larger than the whole table empties it and is not added.
+    evict(entrySize);
+    if (entrySize > maxSize)
+        return;
+    entries.push_front(HpackField(name, value));
+    size += entrySize;
+}
+
+void HpackTable::setMaxSize(const size_t& newMaxSize) {
+    maxSize = newMaxSize;
+    evict(0);
+}
+
+size_t HpackTable::getMaxSize() const {
+    return maxSize;
+}
+
+const HpackField* HpackTable::lookup(const uint64_t& index) const {
+    if (index == 0)
+        return nullptr;
+    if (index <= kStaticCount)
+        return &staticFields()[index - 1];
+    const uint64_t dynamicIndex = index - kStaticCount - 1;
+    return dynamicIndex < entries.size() ? &entries[dynamicIndex] : nullptr;
+}
+
+size_t HpackTable::find(const std::string& name, const std::string& value,
+                        bool& valueMatch) const {
+    size_t nameIndex = 0;
+    valueMatch = false;
+
+    const std::vector<HpackField>& fixed = staticFields();
+    for (size_t i = 0; i < fixed.size(); ++i) {
+        if (fixed[i].name != name)
+            continue;
+        if (fixed[i].value == value) {
+            valueMatch = true;
+            return i + 1;
+        }
+        if (nameIndex == 0)
+            nameIndex = i + 1;
+    }
+    for (size_t i = 0; i < entries.size(); ++i) {
+        if (entries[i].name != name)
+            continue;
+        if (entries[i].value == value) {
+            valueMatch = true;
+            return kStaticCount + i + 1;
+        }
+        if (nameIndex == 0)
+            nameIndex = kStaticCount + i + 1;
+    }
+    return nameIndex;
+}
+
+HpackEncoder::HpackEncoder() : table(kMaxEncoderTableSize), sizeUpdatePending(false) {}
+
+void HpackEncoder::setMaxTableSize(const size_t& size) {
+    const size_t limited = size < kMaxEncoderTableSize ? size : kMaxEncoderTableSize;
+    if (limited != table.getMaxSize()) {
+        table.setMaxSize(limited);
+        sizeUpdatePending = true;
+    }
+}
+
+void HpackEncoder::encode(const std::vector<HpackField>& fields, Buffer& output) {
+    if (sizeUpdatePending) {
+        encodeInteger(table.getMaxSize(), 5, 0x20, output);
+        sizeUpdatePending = false;
+    }
+
+    for (const HpackField& field : fields) {
+        bool valueMatch = false;
+        const size_t index = table.find(field.name, field.value, valueMatch);
+        const bool sensitive = isSensitive(field.name);
+
+        if (valueMatch && !sensitive) {
+            encodeInteger(index, 7, 0x80, output);
+            continue;
+        }
+
+        // Literal with incremental indexing (01), without indexing (0000) or never indexed
+        // (0001), referring to the name by index when the table has it.
+        const bool indexed = !sensitive && !isVolatile(field.name);
+        const int prefixBits = indexed ? 6 : 4;
+        const uint8_t flags = indexed ? 0x40 : (sensitive ? 0x10 : 0x00);
+        encodeInteger(index, prefixBits, flags, output);
+        if (index == 0)
+            encodeString(field.name, output);
+        encodeString(field.value, output);
+
+        if (indexed)
+            table.add(field.name, field.value);
+    }
+}
+
+void HpackEncoder::encodeInteger(const uint64_t& value, const int& prefixBits,
+                                 const uint8_t& flags, Buffer& output) {
+    const uint64_t limit = (1u << prefixBits) - 1;
+    char bytes[16];
+    size_t count = 0;
+
+    if (value < limit) {
+        bytes[count++] = static_cast<char>(flags | value);
+    } else {
+        bytes[count++] = static_cast<char>(flags | limit);
+        uint64_t remaining = value - limit;
+        while (remaining >= 128) {
+            bytes[count++] = static_cast<char>(0x80 | (remaining & 0x7f));
+            remaining >>= 7;
+        }
+        bytes[count++] = static_cast<char>(remaining);
+    }
+    output.append(bytes, count);
+}
+
+// Huffman-coded whenever that is shorter.
+void HpackEncoder::encodeString(const std::string& text, Buffer& output) {
+    const size_t huffman = huffmanLength(text);
+    if (huffman < text.size()) {
+        encodeInteger(huffman, 7, 0x80, output);
+        huffmanEncode(text, huffman, output);
+    } else {
+        encodeInteger(text.size(), 7, 0x00, output);
+        output.append(text.data(), text.size());
+    }
+}
+
+HpackDecoder::HpackDecoder(const size_t& maxTableSize, const size_t& maxListSize)
+    : table(maxTableSize), maxTableSize(maxTableSize), maxListSize(maxListSize) {}
+
+bool HpackDecoder::decode(const char* data, const size_t& size, std::vector<HpackField>& fields) {
+    const uint8_t* bytes = reinterpret_cast<const uint8_t*>(data);
+    size_t pos = 0;
+    size_t listSize = 0;
+    bool fieldSeen = false;
+
+    while (pos < size) {
+        const uint8_t first = bytes[pos];
+
+        if ((first & 0xe0) == 0x20) {
+            // Dynamic table size updates are only allowed before the first field of a block.
+            uint64_t newSize = 0;
+            if (fieldSeen || !decodeInteger(bytes, size, pos, 5, newSize) ||
+                newSize > maxTableSize)
+                return false;
+            table.setMaxSize(newSize);
+            continue;
+        }
+        fieldSeen = true;
+
+        HpackField field;
+        if (first & 0x80) {
+            uint64_t index = 0;
+            if (!decodeInteger(bytes, size, pos, 7, index))
+                return false;
+            const HpackField* entry = table.lookup(index);
+            if (!entry)
+                return false;
+            field = *entry;
+        } else {
+            const bool indexed = (first & 0xc0) == 0x40;
+            uint64_t nameIndex = 0;
+            if (!decodeInteger(bytes, size, pos, indexed ? 6 : 4, nameIndex))
+                return false;
+            if (nameIndex > 0) {
+                const HpackField* entry = table.lookup(nameIndex);
+                if (!entry)
+                    return false;
+                field.name = entry->name;
+            } else if (!decodeString(bytes, size, pos, field.name)) {
+                return false;
+            }
+            if (!decodeString(bytes, size, pos, field.value))
+                return false;
+            if (indexed)
+                table.add(field.name, field.value);
+        }
+
+        listSize += field.name.size() + field.value.size() + kEntryOverhead;
+        if (listSize > maxListSize)
+            return false;
+        fields.push_back(std::move(field));
+    }
+    return true;
+}
+
+bool HpackDecoder::decodeInteger(const uint8_t* data, const size_t& size, size_t& pos,
+                                 const int& prefixBits, uint64_t& value) {
+    if (pos >= size)
+        return false;
+    const uint64_t limit = (1u << prefixBits) - 1;
+    value = data[pos++] & limit;
+    if (value < limit)
+        return true;
+
+    // Anything that needs more than 28 continuation bits is treated as an attack.
+    for (int shift = 0; shift <= 21; shift += 7) {
+        if (pos >= size)
+            return false;
+        const uint8_t byte = data[pos++];
+        value += static_cast<uint64_t>(byte & 0x7f) << shift;
+        if (!(byte & 0x80))
+            return true;
+    }
+    return false;
+}
+
+bool HpackDecoder::decodeString(const uint8_t* data, const size_t& size, size_t& pos,
+                                std::string& text) {
+    if (pos >= size)
+        return false;
+    const bool huffman = (data[pos] & 0x80) != 0;
+    uint64_t length = 0;
+    if (!decodeInteger(data, size, pos, 7, length) || length > size - pos)
+        return false;
+
+    text.clear();
+    const uint8_t* start = data + pos;
+    pos += length;
+    if (!huffman) {
+        text.assign(reinterpret_cast<const char*>(start), length);
+        return true;
+    }
+    return huffmanDecode(start, length, text);
+}
+
+}  // namespace SimpleHTTP
@@ -0,0 +1,1106 @@
+#include "http2.hpp"
+
+#include <fcntl.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+
+#include "httpParser.hpp"
+
+namespace SimpleHTTP {
+
+static const char kPreface[] = "PRI * HTTP/2.0\r\n\r\nSM\r\n\r\n";
+static const size_t kPrefaceSize = sizeof(kPreface) - 1;
+static const size_t kFrameHeaderSize = 9;
+
+static const uint8_t kData = 0x0;
+static const uint8_t kHeaders = 0x1;
+static const uint8_t kRstStream = 0x3;
+static const uint8_t kSettings = 0x4;
+static const uint8_t kPushPromise = 0x5;
+static const uint8_t kPing = 0x6;
+static const uint8_t kGoaway = 0x7;
+static const uint8_t kWindowUpdate = 0x8;
+static const uint8_t kContinuation = 0x9;
+
+static const uint8_t kEndStream = 0x1;
+static const uint8_t kAck = 0x1;
+static const uint8_t kEndHeaders = 0x4;
+static const uint8_t kPadded = 0x8;
+static const uint8_t kPriority = 0x20;
+
+static const uint32_t kNoError = 0x0;
+static const uint32_t kProtocolError = 0x1;
+static const uint32_t kFlowControlError = 0x3;
+static const uint32_t kFrameSizeError = 0x6;
+static const uint32_t kRefusedStream = 0x7;
+static const uint32_t kCancel = 0x8;
+static const uint32_t kCompressionError = 0x9;
+
+static const uint16_t kHeaderTableSize = 0x1;
+static const uint16_t kEnablePush = 0x2;
+static const uint16_t kMaxConcurrentStreams = 0x3;
+static const uint16_t kInitialWindowSize = 0x4;
+static const uint16_t kMaxFrameSize = 0x5;
+static const uint16_t kMaxHeaderListSize = 0x6;
+
+static const int64_t kDefaultWindow = 65535;
+static const int64_t kMaxWindow = 0x7fffffff;
+static const size_t kDefaultFrameSize = 16384;
+// Assumed until the server's SETTINGS say otherwise.
+static const size_t kDefaultConcurrentStreams = 100;
+static const uint32_t kMaxStreamId = 0x7fffffff;
+
+// What we advertise: a larger receive window than the default so one stream can use the
+// bandwidth of a fast link, and a cap on decoded header lists.
+static const uint32_t kStreamWindow = 1 << 20;
+static const uint32_t kConnectionWindow = 16 << 20;
+static const uint32_t kHeaderListLimit = 256 * 1024;
+static const size_t kSettingsSize = 18;
+
+static uint32_t readUint32(const char* data) {
+    const uint8_t* bytes = reinterpret_cast<const uint8_t*>(data);
+    return (static_cast<uint32_t>(bytes[0]) << 24) | (static_cast<uint32_t>(bytes[1]) << 16) |
+           (static_cast<uint32_t>(bytes[2]) << 8) | bytes[3];
+}
+
+static void putUint32(char* out, const uint32_t& value) {
+    out[0] = static_cast<char>(value >> 24);
+    out[1] = static_cast<char>(value >> 16);
+    out[2] = static_cast<char>(value >> 8);
+    out[3] = static_cast<char>(value);
+}
+
+static void putFrameHeader(char* out, const size_t& length, const uint8_t& type,
+                           const uint8_t& flags, const uint32_t& streamId) {
+    out[0] = static_cast<char>(length >> 16);
+    out[1] = static_cast<char>(length >> 8);
+    out[2] = static_cast<char>(length);
+    out[3] = static_cast<char>(type);
+    out[4] = static_cast<char>(flags);
+    putUint32(out + 5, streamId);
+}
+
+static void putSettings(char* out) {
+    const struct {
+        uint16_t id;
+        uint32_t value;
+    } settings[] = {
+        {kEnablePush, 0},
+        {kInitialWindowSize, kStreamWindow},
+        {kMaxHeaderListSize, kHeaderListLimit},
+    };
+    for (const auto& setting : settings) {
+        out[0] = static_cast<char>(setting.id >> 8);
+        out[1] = static_cast<char>(setting.id);
+        putUint32(out + 2, setting.value);
+        out += 6;
+    }
+}
+
+// base64url without padding, as the HTTP2-Settings header wants it.
+static std::string encodeBase64Url(const char* data, const size_t& size) {
+    static const char kAlphabet[] =
+        "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789-_";
+    const uint8_t* bytes = reinterpret_cast<const uint8_t*>(data);
+    std::string out;
+    for (size_t i = 0; i < size; i += 3) {
+        const uint32_t chunk = (bytes[i] << 16) | (i + 1 < size ? bytes[i + 1] << 8 : 0) |
+                               (i + 2 < size ? bytes[i + 2] : 0);
+        out.push_back(kAlphabet[(chunk >> 18) & 0x3f]);
+        out.push_back(kAlphabet[(chunk >> 12) & 0x3f]);
+        if (i + 1 < size)
+            out.push_back(kAlphabet[(chunk >> 6) & 0x3f]);
+        if (i + 2 < size)
+            out.push_back(kAlphabet[chunk & 0x3f]);
+    }
+    return out;
+}
+
+// Strips the padding of a DATA or HEADERS payload (and the priority block of HEADERS).
+static bool unpad(const uint8_t& flags, const size_t& priorityBytes, const char* payload,
+                  const size_t& length, size_t& start, size_t& size) {
+    size_t padding = 0;
+    start = 0;
+    if (flags & kPadded) {
+        if (length < 1)
+            return false;
+        padding = static_cast<uint8_t>(payload[0]);
+        start = 1;
+    }
+    start += priorityBytes;
+    if (start + padding > length)
+        return false;
+    size = length - start - padding;
+    return true;
+}
+
+static void touch(const int& timeoutMs, std::chrono::steady_clock::time_point& deadline) {
+    if (timeoutMs > 0)
+        deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(timeoutMs);
+}
+
+Http2Result::Http2Result()
+    : ok(false), retryable(false), status(0), bytesSent(0), bytesReceived(0) {}
+
+Http2Connection::Http2Connection()
+    : running(false),
+      nextStreamId(1),
+      sendWindow(kDefaultWindow),
+      initialWindow(kDefaultWindow),
+      maxFrameSize(kDefaultFrameSize),
+      maxConcurrentStreams(kDefaultConcurrentStreams),
+      unacknowledged(0),
+      settingsReceived(false),
+      goingAway(false),
+      closed(true),
+      http1Reply(false),
+      sleepUntil(std::chrono::steady_clock::time_point::max()),
+      decoder(4096, kHeaderListLimit),
+      headerStream(0),
+      headerEndStream(false) {
+    wakeFds[0] = wakeFds[1] = -1;
+}
+
+Http2Connection::~Http2Connection() {
+    close();
+    if (running)
+        pthread_join(threadId, nullptr);
+    runCompletions();
+    for (const int fd : wakeFds) {
+        if (fd != -1)
+            ::close(fd);
+    }
+}
+
+bool Http2Connection::connect(const std::string& host, const int& port,
+                              const std::string& authority, const Http2Mode& mode,
+                              const int& timeoutMs, const SocketOptions& options,
+                              const std::string& unixPath, bool& unsupported) {
+    unsupported = false;
+    socket.reset(new Socket());
+    socket->setTimeout(timeoutMs);
+    socket->setOptions(options);
+    if (unixPath.empty()) {
+        if (!socket->connect(host, port))
+            return false;
+    } else {
+        std::vector<SocketAddress> addresses(1);
+        if (!SocketAddress::fromUnixPath(unixPath, addresses[0]) || !socket->connect(addresses))
+            return false;
+    }
+    if (mode == Http2Mode::Upgrade && !upgrade(authority, unsupported))
+        return false;
+    if (!sendPreface() || pipe(wakeFds) != 0 || !socket->setNonBlocking(true))
+        return false;
+    for (const int fd : wakeFds) {
+        fcntl(fd, F_SETFL, fcntl(fd, F_GETFL, 0) | O_NONBLOCK);
+        fcntl(fd, F_SETFD, FD_CLOEXEC);
+    }
+
+    closed = false;
+    running = pthread_create(&threadId, nullptr, threadMain, this) == 0;
+    if (!running)
+        closed = true;
+    return running;
+}
+
+// Switches with a body-less "OPTIONS *" so no request has to be buffered for a possible resend
+// over HTTP/1.1. The server answers it on stream 1, which is drained and ignored.
+bool Http2Connection::upgrade(const std::string& authority, bool& unsupported) {
+    char settings[kSettingsSize];
+    putSettings(settings);
+
+    const std::string request = "OPTIONS * HTTP/1.1\r\nHost: " + authority +
+                                "\r\nConnection: Upgrade, HTTP2-Settings\r\nUpgrade: h2c\r\n"
+                                "HTTP2-Settings: " +
+                                encodeBase64Url(settings, sizeof(settings)) + "\r\n\r\n";
+    if (!socket->send(request))
+        return false;
+
+    HttpResponseParser parser;
+    while (!parser.isComplete()) {
+        const ssize_t received = socket->receiveInto(input);
+        if (received < 0 && errno == EINTR)
+            continue;
+        if (received <= 0 || !parser.parse(input.data(), input.size()))
+            return false;
+    }
+    if (parser.getStatusCode() != 101) {
+        unsupported = true;
+        return false;
+    }
+    // Anything after the 101 head is already HTTP/2.
+    input.consume(parser.messageEnd());
+
+    std::unique_ptr<Stream> stream(new Stream());
+    stream->id = 1;
+    stream->bodySent = 0;
+    stream->sendWindow = initialWindow;
+    stream->unacknowledged = 0;
+    stream->responseStarted = false;
+    stream->timeoutMs = 0;
+    streams[1] = std::move(stream);
+    nextStreamId = 3;
+    return true;
+}
+
+bool Http2Connection::sendPreface() {
+    char frames[kPrefaceSize + kFrameHeaderSize + kSettingsSize + kFrameHeaderSize + 4];
+    char* out = frames;
+    std::memcpy(out, kPreface, kPrefaceSize);
+    out += kPrefaceSize;
+    putFrameHeader(out, kSettingsSize, kSettings, 0, 0);
+    putSettings(out + kFrameHeaderSize);
+    out += kFrameHeaderSize + kSettingsSize;
+    putFrameHeader(out, 4, kWindowUpdate, 0, 0);
+    putUint32(out + kFrameHeaderSize, kConnectionWindow - kDefaultWindow);
+
+    const DataView preface(frames, sizeof(frames));
+    return socket->send(&preface, 1);
+}
+
+// Set on reader threads, whatever connection they belong to.
+static thread_local bool readerThread = false;
+
+void* Http2Connection::threadMain(void* arg) {
+    readerThread = true;
+    static_cast<Http2Connection*>(arg)->run();
+    return nullptr;
+}
+
+void Http2Connection::wake() {
+    const char signal = 1;
+    if (::write(wakeFds[1], &signal, 1) < 0) {
+        // The pipe is already full, so the reader has a wake-up pending anyway.
+    }
+}
+
+void Http2Connection::run() {
+    while (true) {
+        const int waitMs = expireStreams();
+        runCompletions();
+
+        bool outputQueued = false;
+        {
+            std::lock_guard<std::mutex> writeLock(writeMutex);
+            outputQueued = !output.empty();
+        }
+
+        pollfd pfds[2] = {};
+        pfds[0].fd = socket->getSocketFd();
+        pfds[0].events = outputQueued ? POLLIN | POLLOUT : POLLIN;
+        pfds[1].fd = wakeFds[0];
+        pfds[1].events = POLLIN;
+        const int ready = poll(pfds, 2, waitMs);
+        if (ready < 0 && errno == EINTR)
+            continue;
+        if (pfds[1].revents & POLLIN) {
+            char drain[64];
+            while (::read(wakeFds[0], drain, sizeof(drain)) > 0) {
+            }
+        }
+        // Room in the socket may let more request bodies out too.
+        if (ready > 0 && (pfds[0].revents & POLLOUT) && flushOutput())
+            pump();
+        if (ready == 0 || (ready > 0 && !(pfds[0].revents & (POLLIN | POLLHUP | POLLERR))))
+            continue;
+
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            if (closed)
+                break;
+        }
+
+        const ssize_t received = ready < 0 ? -1 : socket->receiveInto(input);
+        if (received < 0 && (errno == EINTR || errno == EAGAIN || errno == EWOULDBLOCK))
+            continue;
+        if (received <= 0) {
+            failConnection();
+            break;
+        }
+        if (!processInput())
+            break;
+        runCompletions();
+    }
+    runCompletions();
+}
+
+// Fails streams that made no progress within their timeout and returns how long the reader may
+// wait for the next deadline (-1 for none).
+int Http2Connection::expireStreams() {
+    std::vector<uint32_t> expired;
+    int waitMs = -1;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        const auto now = std::chrono::steady_clock::now();
+        const auto nextWait = [&waitMs, &now](const Stream& stream) {
+            const long long left =
+                std::chrono::duration_cast<std::chrono::milliseconds>(stream.deadline - now)
+                    .count() + 1;
+            if (waitMs < 0 || left < waitMs)
+                waitMs = static_cast<int>(left);
+        };
+
+        for (const auto& entry : streams) {
+            if (entry.second->timeoutMs <= 0)
+                continue;
+            if (entry.second->deadline <= now)
+                expired.push_back(entry.first);
+            else
+                nextWait(*entry.second);
+        }
+        for (auto it = waiting.begin(); it != waiting.end();) {
+            if ((*it)->timeoutMs > 0 && (*it)->deadline <= now) {
+                finished.push_back(std::move(*it));
+                it = waiting.erase(it);
+            } else {
+                if ((*it)->timeoutMs > 0)
+                    nextWait(**it);
+                ++it;
+            }
+        }
+        for (const uint32_t streamId : expired)
+            finishStream(streamId, false, false);
+        sleepUntil = waitMs < 0 ? std::chrono::steady_clock::time_point::max()
+                                : now + std::chrono::milliseconds(waitMs);
+    }
+
+    char code[4];
+    putUint32(code, kCancel);
+    for (const uint32_t streamId : expired)
+        writeControl(kRstStream, 0, streamId, code, sizeof(code));
+    if (!expired.empty())
+        pump();
+    return waitMs;
+}
+
+bool Http2Connection::processInput() {
+    // A server without HTTP/2 support answers the preface with an HTTP/1.1 error.
+    if (!settingsReceived && input.size() >= 5 && std::memcmp(input.data(), "HTTP/", 5) == 0) {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            http1Reply = true;
+        }
+        failConnection();
+        return false;
+    }
+
+    while (input.size() >= kFrameHeaderSize) {
+        const char* header = input.data();
+        const size_t length = readUint32(header) >> 8;
+        const uint8_t type = static_cast<uint8_t>(header[3]);
+        if (length > kDefaultFrameSize)
+            return connectionError(kFrameSizeError);
+        if (input.size() < kFrameHeaderSize + length)
+            break;
+        if (!settingsReceived && type != kSettings)
+            return connectionError(kProtocolError);
+
+        const uint32_t streamId = readUint32(header + 5) & kMaxStreamId;
+        if (!handleFrame(type, static_cast<uint8_t>(header[4]), streamId,
+                         header + kFrameHeaderSize, length))
+            return false;
+        input.consume(kFrameHeaderSize + length);
+    }
+    return true;
+}
+
+bool Http2Connection::handleFrame(const uint8_t& type, const uint8_t& flags,
+                                  const uint32_t& streamId, const char* payload,
+                                  const size_t& length) {
+    // A header block must arrive in one piece: HEADERS followed only by its CONTINUATIONs.
+    if (headerStream != 0 && type != kContinuation)
+        return connectionError(kProtocolError);
+
+    switch (type) {
+        case kData:
+            return handleData(flags, streamId, payload, length);
+
+        case kHeaders: {
+            size_t start = 0;
+            size_t size = 0;
+            if (streamId == 0 || !unpad(flags, (flags & kPriority) ? 5 : 0, payload, length,
+                                        start, size))
+                return connectionError(kProtocolError);
+            headerBlock.clear();
+            headerBlock.append(payload + start, size);
+            headerStream = streamId;
+            headerEndStream = (flags & kEndStream) != 0;
+            return (flags & kEndHeaders) ? handleHeaderBlock() : true;
+        }
+
+        case kContinuation:
+            if (streamId == 0 || streamId != headerStream)
+                return connectionError(kProtocolError);
+            headerBlock.append(payload, length);
+            if (headerBlock.size() > kHeaderListLimit)
+                return connectionError(kProtocolError);
+            return (flags & kEndHeaders) ? handleHeaderBlock() : true;
+
+        case kRstStream:
+            if (streamId == 0 || length != 4)
+                return connectionError(kProtocolError);
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                finishStream(streamId, false, readUint32(payload) == kRefusedStream);
+            }
+            pump();
+            return true;
+
+        case kSettings:
+            return handleSettings(flags, payload, length);
+
+        case kPing:
+            if (streamId != 0 || length != 8)
+                return connectionError(kFrameSizeError);
+            if (!(flags & kAck))
+                writeControl(kPing, kAck, 0, payload, length);
+            return true;
+
+        case kGoaway: {
+            if (streamId != 0 || length < 8)
+                return connectionError(kProtocolError);
+            // Streams above lastStreamId were never processed and may be retried elsewhere.
+            const uint32_t lastStreamId = readUint32(payload) & kMaxStreamId;
+            std::lock_guard<std::mutex> lock(mutex);
+            goingAway = true;
+            std::vector<uint32_t> refused;
+            for (const auto& entry : streams) {
+                if (entry.first > lastStreamId)
+                    refused.push_back(entry.first);
+            }
+            for (const uint32_t refusedId : refused)
+                finishStream(refusedId, false, true);
+            for (std::unique_ptr<Stream>& stream : waiting) {
+                stream->result.retryable = true;
+                finished.push_back(std::move(stream));
+            }
+            waiting.clear();
+            return true;
+        }
+
+        case kWindowUpdate: {
+            if (length != 4)
+                return connectionError(kFrameSizeError);
+            const uint32_t increment = readUint32(payload) & kMaxStreamId;
+            bool overflow = false;
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                if (streamId == 0) {
+                    sendWindow += increment;
+                    overflow = increment == 0 || sendWindow > kMaxWindow;
+                } else {
+                    const auto it = streams.find(streamId);
+                    if (it != streams.end())
+                        it->second->sendWindow += increment;
+                }
+            }
+            if (overflow)
+                return connectionError(kFlowControlError);
+            pump();
+            return true;
+        }
+
+        case kPushPromise:
+            // Push is disabled in our SETTINGS.
+            return connectionError(kProtocolError);
+
+        default:
+            // PRIORITY and unknown frame types are ignored.
+            return true;
+    }
+}
+
+bool Http2Connection::handleHeaderBlock() {
+    const uint32_t streamId = headerStream;
+    headerStream = 0;
+
+    // Every block is decoded, even for streams we gave up on, to keep the HPACK state in step.
+    std::vector<HpackField> fields;
+    if (!decoder.decode(headerBlock.data(), headerBlock.size(), fields))
+        return connectionError(kCompressionError);
+
+    int status = 0;
+    size_t contentLength = 0;
+    for (const HpackField& field : fields) {
+        if (field.name == ":status")
+            status = std::atoi(field.value.c_str());
+        else if (field.name == "content-length")
+            contentLength = std::strtoul(field.value.c_str(), nullptr, 10);
+    }
+
+    bool streamClosed = false;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        const auto it = streams.find(streamId);
+        if (it == streams.end())
+            return true;
+        Stream& stream = *it->second;
+        touch(stream.timeoutMs, stream.deadline);
+        stream.result.bytesReceived += headerBlock.size() + kFrameHeaderSize;
+
+        if (!stream.responseStarted) {
+            // Interim 1xx responses are skipped.
+            if (status >= 100 && status < 200 && !headerEndStream)
+                return true;
+            stream.responseStarted = true;
+            stream.result.status = status;
+            stream.result.firstByte = std::chrono::steady_clock::now();
+            if (contentLength > 0 && contentLength <= kConnectionWindow)
+                stream.result.body.reserve(contentLength);
+        }
+        // Trailers are appended to the response headers.
+        for (HpackField& field : fields) {
+            if (field.name.empty() || field.name[0] != ':')
+                stream.result.headers.push_back(std::move(field));
+        }
+
+        if (headerEndStream) {
+            finishStream(streamId, stream.result.status > 0, false);
+            streamClosed = true;
+        }
+    }
+    if (streamClosed)
+        pump();
+    return true;
+}
+
+bool Http2Connection::handleData(const uint8_t& flags, const uint32_t& streamId,
+                                 const char* payload, const size_t& length) {
+    size_t start = 0;
+    size_t size = 0;
+    if (streamId == 0 || !unpad(flags, 0, payload, length, start, size))
+        return connectionError(kProtocolError);
+
+    // Received bytes are handed back to the peer's send window once half of a window has been
+    // used, so a large body keeps flowing without a WINDOW_UPDATE per frame.
+    uint32_t connectionCredit = 0;
+    uint32_t streamCredit = 0;
+    bool streamClosed = false;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        unacknowledged += length;
+        if (unacknowledged >= kConnectionWindow / 2) {
+            connectionCredit = static_cast<uint32_t>(unacknowledged);
+            unacknowledged = 0;
+        }
+
+        const auto it = streams.find(streamId);
+        if (it != streams.end()) {
+            Stream& stream = *it->second;
+            touch(stream.timeoutMs, stream.deadline);
+            stream.result.bytesReceived += length + kFrameHeaderSize;
+            if (!stream.responseStarted) {
+                finishStream(streamId, false, false);
+                streamClosed = true;
+            } else {
+                stream.result.body.append(payload + start, size);
+                if (flags & kEndStream) {
+                    finishStream(streamId, true, false);
+                    streamClosed = true;
+                } else {
+                    stream.unacknowledged += length;
+                    if (stream.unacknowledged >= kStreamWindow / 2) {
+                        streamCredit = static_cast<uint32_t>(stream.unacknowledged);
+                        stream.unacknowledged = 0;
+                    }
+                }
+            }
+        }
+    }
+
+    char increment[4];
+    if (connectionCredit > 0) {
+        putUint32(increment, connectionCredit);
+        writeControl(kWindowUpdate, 0, 0, increment, sizeof(increment));
+    }
+    if (streamCredit > 0) {
+        putUint32(increment, streamCredit);
+        writeControl(kWindowUpdate, 0, streamId, increment, sizeof(increment));
+    }
+    if (streamClosed)
+        pump();
+    return true;
+}
+
+bool Http2Connection::handleSettings(const uint8_t& flags, const char* payload,
+                                     const size_t& length) {
+    if (flags & kAck)
+        return length == 0 ? true : connectionError(kFrameSizeError);
+    if (length % 6 != 0)
+        return connectionError(kFrameSizeError);
+
+    bool invalid = false;
+    bool tableSizeChanged = false;
+    uint32_t tableSize = 0;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        for (size_t offset = 0; offset < length; offset += 6) {
+            const uint16_t id = static_cast<uint16_t>(
+                (static_cast<uint8_t>(payload[offset]) << 8) |
+                static_cast<uint8_t>(payload[offset + 1]));
+            const uint32_t value = readUint32(payload + offset + 2);
+
+            switch (id) {
+                case kHeaderTableSize:
+                    tableSizeChanged = true;
+                    tableSize = value;
+                    break;
+                case kMaxConcurrentStreams:
+                    maxConcurrentStreams = value;
+                    break;
+                case kInitialWindowSize:
+                    if (value > kMaxWindow) {
+                        invalid = true;
+                        break;
+                    }
+                    // Applies retroactively to every open stream.
+                    for (const auto& entry : streams)
+                        entry.second->sendWindow += static_cast<int64_t>(value) - initialWindow;
+                    initialWindow = value;
+                    break;
+                case kMaxFrameSize:
+                    if (value < kDefaultFrameSize || value > 0xffffff)
+                        invalid = true;
+                    else
+                        maxFrameSize = value;
+                    break;
+                default:
+                    break;
+            }
+        }
+        settingsReceived = true;
+    }
+    if (invalid)
+        return connectionError(kProtocolError);
+
+    {
+        std::lock_guard<std::mutex> writeLock(writeMutex);
+        if (tableSizeChanged)
+            encoder.setMaxTableSize(tableSize);
+        if (!writeFrame(kSettings, kAck, 0, nullptr, 0))
+            return false;
+    }
+    pump();
+    return true;
+}
+
+// Opens queued streams while the concurrency limit allows, then sends request bodies as far as
+// the flow-control windows and the socket allow: DATA stops while output is queued, and the
+// reader thread pumps again once it has been sent. Runs on whichever thread made progress
+// possible.
+void Http2Connection::pump() {
+    std::lock_guard<std::mutex> writeLock(writeMutex);
+    bool writing = true;
+
+    while (writing) {
+        std::vector<HpackField> fields;
+        uint32_t streamId = 0;
+        bool endStream = false;
+        size_t frameLimit = 0;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            if (closed || goingAway || waiting.empty() || streams.size() >= maxConcurrentStreams)
+                break;
+            if (nextStreamId > kMaxStreamId) {
+                // Out of stream ids; new requests go to a fresh connection.
+                goingAway = true;
+                break;
+            }
+
+            std::unique_ptr<Stream> stream = std::move(waiting.front());
+            waiting.pop_front();
+            streamId = nextStreamId;
+            nextStreamId += 2;
+            stream->id = streamId;
+            stream->sendWindow = initialWindow;
+            touch(stream->timeoutMs, stream->deadline);
+            fields.swap(stream->requestHeaders);
+            endStream = stream->body.size == 0;
+            frameLimit = maxFrameSize;
+            streams[streamId] = std::move(stream);
+        }
+
+        headerOutput.clear();
+        encoder.encode(fields, headerOutput);
+        size_t offset = 0;
+        size_t frames = 0;
+        do {
+            const size_t size = std::min(headerOutput.size() - offset, frameLimit);
+            const uint8_t flags = (offset == 0 && endStream ? kEndStream : 0) |
+                                  (offset + size == headerOutput.size() ? kEndHeaders : 0);
+            writing = writeFrame(offset == 0 ? kHeaders : kContinuation, flags, streamId,
+                                 headerOutput.data() + offset, size);
+            offset += size;
+            ++frames;
+        } while (writing && offset < headerOutput.size());
+
+        std::lock_guard<std::mutex> lock(mutex);
+        const auto it = streams.find(streamId);
+        if (it != streams.end()) {
+            Http2Result& result = it->second->result;
+            result.bytesSent += headerOutput.size() + frames * kFrameHeaderSize;
+            if (endStream)
+                result.sent = std::chrono::steady_clock::now();
+        }
+    }
+
+    while (writing) {
+        uint32_t streamId = 0;
+        const char* data = nullptr;
+        size_t size = 0;
+        bool last = false;
+        if (!output.empty())
+            break;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            if (closed || sendWindow <= 0)
+                break;
+            for (const auto& entry : streams) {
+                Stream& stream = *entry.second;
+                if (stream.bodySent >= stream.body.size || stream.sendWindow <= 0)
+                    continue;
+
+                size = std::min(stream.body.size - stream.bodySent, maxFrameSize);
+                size = std::min<int64_t>(size, std::min(stream.sendWindow, sendWindow));
+                streamId = stream.id;
+                data = stream.body.data + stream.bodySent;
+                stream.bodySent += size;
+                stream.sendWindow -= size;
+                sendWindow -= size;
+                last = stream.bodySent == stream.body.size;
+                stream.result.bytesSent += size + kFrameHeaderSize;
+                if (last)
+                    stream.result.sent = std::chrono::steady_clock::now();
+                break;
+            }
+        }
+        if (streamId == 0)
+            break;
+        writing = writeFrame(kData, last ? kEndStream : 0, streamId, data, size);
+    }
+}
+
+// Reader thread. Sends as much of the queued output as the socket takes.
+bool Http2Connection::flushOutput() {
+    std::lock_guard<std::mutex> writeLock(writeMutex);
+    while (!output.empty()) {
+        const ssize_t written = socket->sendSome(output.data(), output.size());
+        if (written > 0) {
+            output.consume(written);
+        } else if (written < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            return true;
+        } else if (written < 0 && errno != EINTR) {
+            failConnection();
+            return false;
+        }
+    }
+    return true;
+}
+
+// Caller holds writeMutex. The frame goes straight out when nothing is queued ahead of it; the
+// part the socket does not take is queued for the reader thread. A failed write leaves the
+// framing unusable, so it ends the connection.
+bool Http2Connection::writeFrame(const uint8_t& type, const uint8_t& flags,
+                                 const uint32_t& streamId, const char* payload,
+                                 const size_t& length) {
+    char header[kFrameHeaderSize];
+    putFrameHeader(header, length, type, flags, streamId);
+    const DataView parts[] = {DataView(header, sizeof(header)), DataView(payload, length)};
+    const size_t total = sizeof(header) + length;
+
+    const bool queued = !output.empty();
+    size_t sent = 0;
+    while (!queued && sent < total) {
+        const ssize_t written = socket->sendSome(parts, length > 0 ? 2 : 1, sent);
+        if (written > 0) {
+            sent += written;
+        } else if (written < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            break;
+        } else if (written < 0 && errno != EINTR) {
+            failConnection();
+            return false;
+        }
+    }
+    if (sent == total)
+        return true;
+
+    if (sent < sizeof(header))
+        output.append(header + sent, sizeof(header) - sent);
+    const size_t payloadSent = sent > sizeof(header) ? sent - sizeof(header) : 0;
+    if (length > payloadSent)
+        output.append(payload + payloadSent, length - payloadSent);
+    // The reader only watches for writability while output is queued.
+    if (!queued && !onReaderThread())
+        wake();
+    return true;
+}
+
+void Http2Connection::writeControl(const uint8_t& type, const uint8_t& flags,
+                                   const uint32_t& streamId, const char* payload,
+                                   const size_t& length) {
+    std::lock_guard<std::mutex> writeLock(writeMutex);
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (closed)
+            return;
+    }
+    writeFrame(type, flags, streamId, payload, length);
+}
+
+// Caller holds mutex.
+void Http2Connection::finishStream(const uint32_t& streamId, const bool& ok,
+                                   const bool& retryable) {
+    const auto it = streams.find(streamId);
+    if (it == streams.end())
+        return;
+    it->second->result.ok = ok;
+    it->second->result.retryable = retryable;
+    finished.push_back(std::move(it->second));
+    streams.erase(it);
+}
+
+bool Http2Connection::connectionError(const uint32_t& errorCode) {
+    char goaway[8];
+    putUint32(goaway, 0);
+    putUint32(goaway + 4, errorCode);
+    writeControl(kGoaway, 0, 0, goaway, sizeof(goaway));
+    failConnection();
+    return false;
+}
+
+void Http2Connection::failConnection() {
+    std::lock_guard<std::mutex> lock(mutex);
+    if (!closed && socket)
+        ::shutdown(socket->getSocketFd(), SHUT_RDWR);
+    closed = true;
+
+    // Requests are only safe to resend when the server never spoke HTTP/2 on this connection.
+    for (auto& entry : streams) {
+        entry.second->result.retryable = !settingsReceived;
+        finished.push_back(std::move(entry.second));
+    }
+    streams.clear();
+    for (std::unique_ptr<Stream>& stream : waiting) {
+        stream->result.retryable = true;
+        finished.push_back(std::move(stream));
+    }
+    waiting.clear();
+}
+
+void Http2Connection::runCompletions() {
+    std::vector<std::unique_ptr<Stream>> done;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        done.swap(finished);
+    }
+    if (done.empty())
+        return;
+
+    // pump() may still be writing DATA out of a body that a completion lets its owner free;
+    // taking writeMutex waits for that write to end.
+    { std::lock_guard<std::mutex> writeLock(writeMutex); }
+
+    for (std::unique_ptr<Stream>& stream : done) {
+        if (!stream->onComplete)
+            continue;
+        try {
+            stream->onComplete(stream->result);
+        } catch (...) {
+        }
+    }
+}
+
+void Http2Connection::submit(std::vector<HpackField> headers, const DataView& body,
+                             const int& timeoutMs, const Completion& onComplete) {
+    std::unique_ptr<Stream> stream(new Stream());
+    stream->id = 0;
+    stream->requestHeaders.swap(headers);
+    stream->body = body;
+    stream->bodySent = 0;
+    stream->sendWindow = 0;
+    stream->unacknowledged = 0;
+    stream->responseStarted = false;
+    stream->timeoutMs = timeoutMs;
+    touch(timeoutMs, stream->deadline);
+    stream->onComplete = onComplete;
+
+    bool earlier = false;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (!closed && !goingAway) {
+            earlier = timeoutMs > 0 && stream->deadline < sleepUntil;
+            if (earlier)
+                sleepUntil = stream->deadline;
+            waiting.push_back(std::move(stream));
+        }
+    }
+    if (earlier)
+        wake();
+    if (stream) {
+        stream->result.retryable = true;
+        if (stream->onComplete)
+            stream->onComplete(stream->result);
+        return;
+    }
+    pump();
+}
+
+bool Http2Connection::isUsable() {
+    std::lock_guard<std::mutex> lock(mutex);
+    return !closed && !goingAway;
+}
+
+bool Http2Connection::isIdle() {
+    std::lock_guard<std::mutex> lock(mutex);
+    return streams.empty() && waiting.empty();
+}
+
+bool Http2Connection::repliedHttp1() {
+    std::lock_guard<std::mutex> lock(mutex);
+    return http1Reply;
+}
+
+bool Http2Connection::onReaderThread() const {
+    return running && pthread_equal(pthread_self(), threadId);
+}
+
+bool Http2Connection::onAnyReaderThread() {
+    return readerThread;
+}
+
+void Http2Connection::close() {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (closed)
+            return;
+    }
+    char goaway[8];
+    putUint32(goaway, 0);
+    putUint32(goaway + 4, kNoError);
+    writeControl(kGoaway, 0, 0, goaway, sizeof(goaway));
+    failConnection();
+}
+
+Http2Pool::Pending::Pending() : done(false) {}
+
+Http2Pool::Http2Pool() : closed(false) {}
+
+Http2Pool::~Http2Pool() {
+    std::map<std::string, std::shared_ptr<Http2Connection>> open;
+    std::vector<std::shared_ptr<Http2Connection>> old;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        closed = true;
+        open.swap(connections);
+        old.swap(retired);
+    }
+    // Destroyed here, outside the lock, so completions running meanwhile can still call in.
+}
+
+std::shared_ptr<Http2Connection> Http2Pool::acquire(const std::string& host, const int& port,
+                                                    const std::string& authority,
+                                                    const Http2Mode& mode, const int& timeoutMs,
+                                                    const SocketOptions& options,
+                                                    const std::string& unixPath, bool& http1Only,
+                                                    bool& reused) {
+    // A connection dropped here is destroyed after the lock is released, because destroying it
+    // waits for its reader thread. One dropped on a reader thread (a completion retrying the
+    // request) is parked in retired instead: it may be that thread's own connection, or one whose
+    // reader is at the same time dropping this thread's connection, and each would wait for the
+    // other forever. Only callers that are not reader threads destroy retired connections.
+    const bool parkDropped = Http2Connection::onAnyReaderThread();
+    std::vector<std::shared_ptr<Http2Connection>> stale;
+    std::unique_lock<std::mutex> lock(mutex);
+
+    http1Only = false;
+    reused = false;
+    if (closed)
+        return nullptr;
+    const std::string key = host + ":" + std::to_string(port);
+
+    const auto opening = pending.find(key);
+    if (opening != pending.end()) {
+        const std::shared_ptr<Pending> slot = opening->second;
+        pendingDone.wait(lock, [&slot]() { return slot->done; });
+        http1Only = http1Hosts.count(key) > 0;
+        return slot->connection;
+    }
+
+    if (http1Hosts.count(key)) {
+        http1Only = true;
+        return nullptr;
+    }
+
+    if (!parkDropped) {
+        for (std::shared_ptr<Http2Connection>& connection : retired)
+            stale.push_back(std::move(connection));
+        retired.clear();
+    }
+
+    const auto it = connections.find(key);
+    if (it != connections.end()) {
+        if (it->second->isUsable()) {
+            reused = true;
+            return it->second;
+        }
+        if (it->second->repliedHttp1())
+            http1Only = true;
+        (parkDropped ? retired : stale).push_back(std::move(it->second));
+        connections.erase(it);
+    }
+
+    if (http1Only) {
+        http1Hosts.insert(key);
+        return nullptr;
+    }
+
+    // Connecting (and upgrading) takes a round trip or more, so it happens without the lock;
+    // the slot makes concurrent callers for this host:port wait for its outcome.
+    const std::shared_ptr<Pending> slot = std::make_shared<Pending>();
+    pending[key] = slot;
+    lock.unlock();
+
+    std::shared_ptr<Http2Connection> connection(new Http2Connection());
+    bool unsupported = false;
+    const bool connected = connection->connect(host, port, authority, mode, timeoutMs, options,
+                                               unixPath, unsupported);
+
+    lock.lock();
+    pending.erase(key);
+    if (connected && !closed) {
+        connections[key] = connection;
+        slot->connection = connection;
+    } else {
+        stale.push_back(std::move(connection));
+    }
+    if (unsupported) {
+        http1Only = true;
+        http1Hosts.insert(key);
+    }
+    slot->done = true;
+    pendingDone.notify_all();
+    return slot->connection;
+}
+
+// On a reader thread the idle connections are parked in retired, as in acquire().
+void Http2Pool::closeIdle() {
+    const bool parkDropped = Http2Connection::onAnyReaderThread();
+    std::vector<std::shared_ptr<Http2Connection>> idle;
+    std::lock_guard<std::mutex> lock(mutex);
+    for (auto it = connections.begin(); it != connections.end();) {
+        if (it->second->isIdle()) {
+            (parkDropped ? retired : idle).push_back(std::move(it->second));
+            it = connections.erase(it);
+        } else {
+            ++it;
+        }
+    }
+}
+
+}  // namespace SimpleHTTP
@@ -0,0 +1,437 @@
+#include "httpParser.hpp"
+
+#include <strings.h>
+
+#include <cstring>
+
+#include "scan.hpp"
+#include "simpleHTTP.hpp"
+
+namespace SimpleHTTP {
+
+const size_t HttpResponseParser::kMaxHeadSize;
+const size_t HttpResponseParser::kLineBatch;
+
+static bool spanEquals(const char* data, const HttpResponseParser::Span& span, const char* text) {
+    const size_t length = std::strlen(text);
+    return span.length == length && strncasecmp(data + span.offset, text, length) == 0;
+}
+
+static bool spanContains(const char* data, const HttpResponseParser::Span& span,
+                         const char* token) {
+    const size_t length = std::strlen(token);
+    for (size_t i = 0; i + length <= span.length; ++i) {
+        if (strncasecmp(data + span.offset + i, token, length) == 0)
+            return true;
+    }
+    return false;
+}
+
+static bool isSpace(const char& c) {
+    return c == ' ' || c == '\t';
+}
+
+// Digit values of the hex characters, -1 for everything else; one load per chunk-size digit.
+struct HexTable {
+    signed char values[256];
+
+    HexTable() {
+        std::memset(values, -1, sizeof(values));
+        for (int i = 0; i < 10; ++i)
+            values['0' + i] = static_cast<signed char>(i);
+        for (int i = 0; i < 6; ++i) {
+            values['a' + i] = static_cast<signed char>(10 + i);
+            values['A' + i] = static_cast<signed char>(10 + i);
+        }
+    }
+};
+
+static const HexTable kHexTable;
+
+static int hexValue(const char& c) {
+    return kHexTable.values[static_cast<unsigned char>(c)];
+}
+
+// Returns the offset of the next '\n' at or after from, or npos.
+static size_t findLineEnd(const char* data, const size_t& from, const size_t& size) {
+    const void* found = std::memchr(data + from, '\n', size - from);
+    return found ? static_cast<const char*>(found) - data : std::string::npos;
+}
+
+HttpResponseParser::HttpResponseParser(const bool& headRequest) {
+    fields.reserve(16);
+    reset(headRequest);
+}
+
+void HttpResponseParser::reset(const bool& headRequest) {
+    state = State::StatusLine;
+    this->headRequest = headRequest;
+    messageStart = 0;
+    readPos = 0;
+    bodyStart = 0;
+    bodyEnd = 0;
+    remaining = 0;
+    protocol = Span();
+    statusText = Span();
+    statusCode = 0;
+    fields.clear();
+    chunked = false;
+    hasContentLength = false;
+    persistent = false;
+    contentLength = 0;
+    contentEncoding = ContentEncoding::Identity;
+    nextLine = 0;
+    lineCount = 0;
+}
+
+void HttpResponseParser::setBodyHandler(const BodyHandler& handler) {
+    bodyHandler = handler;
+}
+
+bool HttpResponseParser::fail() {
+    state = State::Error;
+    return false;
+}
+
+bool HttpResponseParser::parseStatusLine(const char* data, const size_t& lineStart,
+                                         const size_t& lineEnd) {
+    size_t pos = lineStart;
+    while (pos < lineEnd && data[pos] != ' ')
+        ++pos;
+    if (pos == lineEnd || pos - lineStart < 5 || std::strncmp(data + lineStart, "HTTP/", 5) != 0)
+        return false;
+
+    protocol.offset = lineStart;
+    protocol.length = pos - lineStart;
+
+    while (pos < lineEnd && data[pos] == ' ')
+        ++pos;
+
+    int code = 0;
+    size_t digits = 0;
+    while (pos < lineEnd && data[pos] >= '0' && data[pos] <= '9' && digits < 3) {
+        code = code * 10 + (data[pos] - '0');
+        ++pos;
+        ++digits;
+    }
+    if (digits != 3)
+        return false;
+    statusCode = code;
+
+    if (pos < lineEnd && data[pos] == ' ')
+        ++pos;
+    statusText.offset = pos;
+    statusText.length = lineEnd - pos;
+
+    persistent = spanEquals(data, protocol, "HTTP/1.1");
+    return true;
+}
+
+bool HttpResponseParser::parseHeaderLine(const char* data, const size_t& lineStart,
+                                         const size_t& lineEnd, const size_t& colonPos) {
+    // Folded continuation lines are obsolete (RFC 7230 3.2.4); skip them.
+    if (isSpace(data[lineStart]))
+        return true;
+    if (colonPos == std::string::npos)
+        return false;
+
+    size_t valueStart = colonPos + 1;
+    size_t valueEnd = lineEnd;
+    while (valueStart < valueEnd && isSpace(data[valueStart]))
+        ++valueStart;
+    while (valueEnd > valueStart && isSpace(data[valueEnd - 1]))
+        --valueEnd;
+
+    HeaderField field;
+    field.name.offset = lineStart;
+    field.name.length = colonPos - lineStart;
+    field.value.offset = valueStart;
+    field.value.length = valueEnd - valueStart;
+    fields.push_back(field);
+
+    if (spanEquals(data, field.name, "Content-Length")) {
+        size_t length = 0;
+        for (size_t i = 0; i < field.value.length; ++i) {
+            const char c = data[field.value.offset + i];
+            if (c < '0' || c > '9' || length > (static_cast<size_t>(-1) - 9) / 10)
+                return false;
+            length = length * 10 + (c - '0');
+        }
+        if (field.value.length == 0 || (hasContentLength && length != contentLength))
+            return false;
+        contentLength = length;
+        hasContentLength = true;
+    } else if (spanEquals(data, field.name, "Transfer-Encoding")) {
+        chunked = spanContains(data, field.value, "chunked");
+    } else if (spanEquals(data, field.name, "Content-Encoding")) {
+        contentEncoding =
+            Decompressor::parseEncoding(data + field.value.offset, field.value.length);
+    } else if (spanEquals(data, field.name, "Connection")) {
+        if (spanContains(data, field.value, "close"))
+            persistent = false;
+        else if (spanContains(data, field.value, "keep-alive"))
+            persistent = true;
+    }
+    return true;
+}
+
+void HttpResponseParser::startBody() {
+    bodyStart = readPos;
+    bodyEnd = readPos;
+
+    if (statusCode >= 100 && statusCode < 200 && statusCode != 101) {
+        // Interim response (e.g. 100 Continue): the real one follows it in the same buffer.
+        const bool head = headRequest;
+        const size_t start = readPos;
+        const BodyHandler handler = bodyHandler;
+        reset(head);
+        bodyHandler = handler;
+        messageStart = start;
+        readPos = start;
+        return;
+    }
+
+    if (headRequest || statusCode == 101 || statusCode == 204 || statusCode == 304) {
+        state = State::Complete;
+    } else if (chunked) {
+        state = State::ChunkSize;
+    } else if (hasContentLength) {
+        remaining = contentLength;
+        state = remaining == 0 ? State::Complete : State::Body;
+    } else {
+        persistent = false;
+        state = State::BodyUntilClose;
+    }
+}
+
+bool HttpResponseParser::emitBody(char* data, const size_t& size) {
+    if (bodyHandler) {
+        if (!bodyHandler(data + readPos, size))
+            return false;
+    } else {
+        if (bodyEnd != readPos)
+            std::memmove(data + bodyEnd, data + readPos, size);
+        bodyEnd += size;
+    }
+    readPos += size;
+    return true;
+}
+
+bool HttpResponseParser::parse(char* data, const size_t& size) {
+    while (true) {
+        switch (state) {
+            case State::StatusLine:
+            case State::Headers:
+            case State::Trailers: {
+                // Lines are located a batch at a time, each with its colon, in one pass.
+                if (nextLine == lineCount) {
+                    nextLine = 0;
+                    lineCount = scanLines(data, readPos, size, lines, kLineBatch);
+                    if (lineCount == 0)
+                        return size - messageStart > kMaxHeadSize ? fail() : true;
+                }
+                const size_t lineEnd = lines[nextLine].end;
+                const size_t colonPos = lines[nextLine].colon;
+                ++nextLine;
+
+                const size_t lineStart = readPos;
+                size_t contentEnd = lineEnd;
+                if (contentEnd > lineStart && data[contentEnd - 1] == '\r')
+                    --contentEnd;
+                readPos = lineEnd + 1;
+
+                if (state == State::StatusLine) {
+                    if (!parseStatusLine(data, lineStart, contentEnd))
+                        return fail();
+                    state = State::Headers;
+                } else if (contentEnd == lineStart) {
+                    if (state == State::Trailers)
+                        state = State::Complete;
+                    else
+                        startBody();
+                } else if (state == State::Headers &&
+                           !parseHeaderLine(data, lineStart, contentEnd, colonPos)) {
+                    return fail();
+                }
+                break;
+            }
+
+            case State::ChunkSize: {
+                const size_t lineEnd = findLineEnd(data, readPos, size);
+                if (lineEnd == std::string::npos)
+                    return size - readPos > 1024 ? fail() : true;
+
+                size_t chunkSize = 0;
+                size_t pos = readPos;
+                int digit = 0;
+                while (pos < lineEnd && (digit = hexValue(data[pos])) >= 0) {
+                    if (chunkSize > (static_cast<size_t>(-1) >> 4))
+                        return fail();
+                    chunkSize = (chunkSize << 4) | static_cast<size_t>(digit);
+                    ++pos;
+                }
+                if (pos == readPos)
+                    return fail();
+
+                readPos = lineEnd + 1;
+                remaining = chunkSize;
+                state = chunkSize == 0 ? State::Trailers : State::ChunkData;
+                break;
+            }
+
+            case State::ChunkData:
+            case State::Body: {
+                const size_t available = size - readPos;
+                const size_t count = available < remaining ? available : remaining;
+                if (count > 0 && !emitBody(data, count))
+                    return fail();
+                remaining -= count;
+                if (remaining > 0)
+                    return true;
+                state = state == State::Body ? State::Complete : State::ChunkDataEnd;
+                break;
+            }
+
+            case State::ChunkDataEnd: {
+                if (readPos < size && data[readPos] == '\n') {
+                    readPos += 1;
+                } else if (size - readPos < 2) {
+                    return true;
+                } else if (data[readPos] == '\r' && data[readPos + 1] == '\n') {
+                    readPos += 2;
+                } else {
+                    return fail();
+                }
+                state = State::ChunkSize;
+                break;
+            }
+
+            case State::BodyUntilClose: {
+                if (readPos < size && !emitBody(data, size - readPos))
+                    return fail();
+                return true;
+            }
+
+            case State::Complete:
+                return true;
+
+            case State::Error:
+                return false;
+        }
+    }
+}
+
+void HttpResponseParser::finishOnClose() {
+    if (state == State::BodyUntilClose)
+        state = State::Complete;
+    else if (state != State::Complete)
+        state = State::Error;
+}
+
+size_t HttpResponseParser::consumeParsed() {
+    if (!bodyHandler || !headersComplete())
+        return 0;
+
+    const size_t consumed = readPos;
+    readPos = 0;
+    messageStart = 0;
+    bodyStart = 0;
+    bodyEnd = 0;
+    return consumed;
+}
+
+HttpResponseParser::State HttpResponseParser::getState() const {
+    return state;
+}
+
+bool HttpResponseParser::headersComplete() const {
+    return state != State::StatusLine && state != State::Headers && state != State::Error;
+}
+
+bool HttpResponseParser::isComplete() const {
+    return state == State::Complete;
+}
+
+bool HttpResponseParser::hasError() const {
+    return state == State::Error;
+}
+
+bool HttpResponseParser::keepAlive() const {
+    return state == State::Complete && persistent;
+}
+
+int HttpResponseParser::getStatusCode() const {
+    return statusCode;
+}
+
+size_t HttpResponseParser::messageBegin() const {
+    return messageStart;
+}
+
+size_t HttpResponseParser::messageEnd() const {
+    return readPos;
+}
+
+size_t HttpResponseParser::bodyOffset() const {
+    return bodyStart;
+}
+
+size_t HttpResponseParser::bodyLength() const {
+    return bodyEnd - bodyStart;
+}
+
+bool HttpResponseParser::isChunked() const {
+    return chunked;
+}
+
+bool HttpResponseParser::hasBodyLength() const {
+    return hasContentLength;
+}
+
+size_t HttpResponseParser::getContentLength() const {
+    return contentLength;
+}
+
+ContentEncoding HttpResponseParser::getContentEncoding() const {
+    return contentEncoding;
+}
+
+const std::vector<HttpResponseParser::HeaderField>& HttpResponseParser::getFields() const {
+    return fields;
+}
+
+bool HttpResponseParser::findHeader(const char* data, const char* name, Span& value) const {
+    for (const HeaderField& field : fields) {
+        if (spanEquals(data, field.name, name)) {
+            value = field.value;
+            return true;
+        }
+    }
+    return false;
+}
+
+void HttpResponseParser::copyHead(const char* data, HttpResponse& response) const {
+    response.protocol.assign(data + protocol.offset, protocol.length);
+    response.statusText.assign(data + statusText.offset, statusText.length);
+    response.httpCode = statusCode;
+
+    // Fields left in a reused response are overwritten in place so their strings keep their
+    // capacity; the surplus is dropped.
+    HttpHeaders& headers = response.headers;
+    headers.headers.reserve(fields.size());
+    for (size_t i = 0; i < fields.size(); ++i) {
+        const HeaderField& field = fields[i];
+        if (i < headers.size()) {
+            headers.replaceHeader(i, data + field.name.offset, field.name.length,
+                                  data + field.value.offset, field.value.length);
+        } else {
+            headers.addHeader(data + field.name.offset, field.name.length,
+                              data + field.value.offset, field.value.length);
+        }
+    }
+    headers.headers.erase(headers.headers.begin() + fields.size(), headers.headers.end());
+
+    response.contentLength = hasContentLength && !chunked ? contentLength : bodyLength();
+}
+
+}  // namespace SimpleHTTP
@@ -0,0 +1,488 @@
+#include "ioUring.hpp"
+
+#ifdef SIMPLEHTTP_HAVE_IO_URING
+#include <linux/io_uring.h>
+#include <signal.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <cstring>
+#include <memory>
+#endif
+
+namespace SimpleHTTP {
+
+#ifdef SIMPLEHTTP_HAVE_IO_URING
+
+namespace {
+
+// Group id of the one provided buffer ring.
+const uint16_t kBufferGroup = 0;
+
+// Setup flags tried first; each is a hint, so the ring is created without them on kernels that
+// do not know them.
+unsigned preferredSetupFlags() {
+    unsigned flags = 0;
+#ifdef IORING_SETUP_SUBMIT_ALL
+    flags |= IORING_SETUP_SUBMIT_ALL;
+#endif
+#ifdef IORING_SETUP_COOP_TASKRUN
+    // Completions are only ever reaped from io_uring_enter(), so the kernel need not interrupt
+    // the loop thread to post them.
+    flags |= IORING_SETUP_COOP_TASKRUN;
+#endif
+    return flags;
+}
+
+template <typename T>
+T* at(void* base, const unsigned& offset) {
+    return reinterpret_cast<T*>(static_cast<char*>(base) + offset);
+}
+
+}  // namespace
+
+IoUring::IoUring()
+    : ringFd(-1),
+      sqRing(MAP_FAILED),
+      sqRingSize(0),
+      cqRing(MAP_FAILED),
+      cqRingSize(0),
+      sqeMemory(MAP_FAILED),
+      sqeMemorySize(0),
+      sqHead(nullptr),
+      sqTail(nullptr),
+      sqMask(0),
+      sqArray(nullptr),
+      sqEntries(0),
+      queued(0),
+      cqHead(nullptr),
+      cqTail(nullptr),
+      cqMask(0),
+      cqes(nullptr),
+      bufferRing(MAP_FAILED),
+      bufferRingSize(0),
+      bufferMemory(nullptr),
+      bufferCount(0),
+      bufferSize(0),
+      bufferTail(0) {}
+
+IoUring::~IoUring() {
+    release();
+}
+
+void IoUring::release() {
+    // Closing the ring cancels whatever is still queued; callers drain their requests first, so
+    // nothing can write into the buffers freed below.
+    if (ringFd != -1)
+        ::close(ringFd);
+    ringFd = -1;
+
+    if (sqeMemory != MAP_FAILED)
+        munmap(sqeMemory, sqeMemorySize);
+    if (cqRing != MAP_FAILED && cqRing != sqRing)
+        munmap(cqRing, cqRingSize);
+    if (sqRing != MAP_FAILED)
+        munmap(sqRing, sqRingSize);
+    if (bufferRing != MAP_FAILED)
+        munmap(bufferRing, bufferRingSize);
+    sqeMemory = cqRing = sqRing = bufferRing = MAP_FAILED;
+
+    delete[] bufferMemory;
+    bufferMemory = nullptr;
+    bufferCount = 0;
+}
+
+bool IoUring::init(const unsigned& entries) {
+    io_uring_params params;
+    std::memset(&params, 0, sizeof(params));
+    params.flags = preferredSetupFlags();
+    ringFd = static_cast<int>(syscall(__NR_io_uring_setup, entries, &params));
+    if (ringFd < 0 && errno == EINVAL) {
+        std::memset(&params, 0, sizeof(params));
+        ringFd = static_cast<int>(syscall(__NR_io_uring_setup, entries, &params));
+    }
+    if (ringFd < 0) {
+        ringFd = -1;
+        return false;
+    }
+
+    // Timed waits without a separate timeout request need IORING_ENTER_EXT_ARG (Linux 5.11).
+    if ((params.features & IORING_FEAT_EXT_ARG) == 0) {
+        release();
+        return false;
+    }
+
+    sqRingSize = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    cqRingSize = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+    const bool singleMmap = (params.features & IORING_FEAT_SINGLE_MMAP) != 0;
+    if (singleMmap && cqRingSize > sqRingSize)
+        sqRingSize = cqRingSize;
+
+    sqRing = mmap(nullptr, sqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ringFd,
+                  IORING_OFF_SQ_RING);
+    if (sqRing == MAP_FAILED) {
+        release();
+        return false;
+    }
+    if (singleMmap) {
+        cqRing = sqRing;
+    } else {
+        cqRing = mmap(nullptr, cqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                      ringFd, IORING_OFF_CQ_RING);
+        if (cqRing == MAP_FAILED) {
+            release();
+            return false;
+        }
+    }
+
+    sqeMemorySize = params.sq_entries * sizeof(io_uring_sqe);
+    sqeMemory = mmap(nullptr, sqeMemorySize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                     ringFd, IORING_OFF_SQES);
+    if (sqeMemory == MAP_FAILED) {
+        release();
+        return false;
+    }
+
+    sqHead = at<unsigned>(sqRing, params.sq_off.head);
+    sqTail = at<unsigned>(sqRing, params.sq_off.tail);
+    sqMask = *at<unsigned>(sqRing, params.sq_off.ring_mask);
+    sqArray = at<unsigned>(sqRing, params.sq_off.array);
+    sqEntries = params.sq_entries;
+    cqHead = at<unsigned>(cqRing, params.cq_off.head);
+    cqTail = at<unsigned>(cqRing, params.cq_off.tail);
+    cqMask = *at<unsigned>(cqRing, params.cq_off.ring_mask);
+    cqes = at<io_uring_cqe>(cqRing, params.cq_off.cqes);
+
+    // Everything the event loop submits must be available, or it is better off with epoll.
+    const unsigned probeOps = 256;
+    std::unique_ptr<char[]> probeMemory(
+        new char[sizeof(io_uring_probe) + probeOps * sizeof(io_uring_probe_op)]());
+    io_uring_probe* probe = reinterpret_cast<io_uring_probe*>(probeMemory.get());
+    if (syscall(__NR_io_uring_register, ringFd, IORING_REGISTER_PROBE, probe, probeOps) != 0) {
+        release();
+        return false;
+    }
+    const uint8_t required[] = {IORING_OP_POLL_ADD, IORING_OP_SENDMSG, IORING_OP_RECV,
+                                IORING_OP_ASYNC_CANCEL};
+    for (const uint8_t op : required) {
+        if (op > probe->last_op || (probe->ops[op].flags & IO_URING_OP_SUPPORTED) == 0) {
+            release();
+            return false;
+        }
+    }
+    return true;
+}
+
+bool IoUring::initBufferRing(const unsigned& count, const unsigned& size) {
+#ifdef IORING_RECV_MULTISHOT
+    // The kernel wants a power-of-two number of entries in page-aligned memory.
+    if (ringFd == -1 || bufferRing != MAP_FAILED || count == 0 || (count & (count - 1)) != 0 ||
+        count > 32768)
+        return false;
+
+    bufferRingSize = count * sizeof(io_uring_buf);
+    bufferRing = mmap(nullptr, bufferRingSize, PROT_READ | PROT_WRITE,
+                      MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (bufferRing == MAP_FAILED)
+        return false;
+
+    io_uring_buf_reg registration;
+    std::memset(&registration, 0, sizeof(registration));
+    registration.ring_addr = reinterpret_cast<uint64_t>(bufferRing);
+    registration.ring_entries = count;
+    registration.bgid = kBufferGroup;
+    if (syscall(__NR_io_uring_register, ringFd, IORING_REGISTER_PBUF_RING, &registration, 1) !=
+        0) {
+        munmap(bufferRing, bufferRingSize);
+        bufferRing = MAP_FAILED;
+        return false;
+    }
+
+    bufferMemory = new char[static_cast<size_t>(count) * size];
+    bufferCount = count;
+    bufferSize = size;
+    bufferTail = 0;
+    for (unsigned id = 0; id < count; ++id)
+        recycleBuffer(id);
+    return true;
+#else
+    (void)count;
+    (void)size;
+    return false;
+#endif
+}
+
+bool IoUring::hasBufferRing() const {
+    return bufferCount > 0;
+}
+
+// A zeroed submission queue entry, or nullptr when the queue is full even after flushing it.
+void* IoUring::nextSqe() {
+    unsigned tail = *sqTail;
+    if (tail - __atomic_load_n(sqHead, __ATOMIC_ACQUIRE) >= sqEntries) {
+        enter(queued, 0, 0);
+        if (tail - __atomic_load_n(sqHead, __ATOMIC_ACQUIRE) >= sqEntries)
+            return nullptr;
+    }
+
+    io_uring_sqe* sqe = static_cast<io_uring_sqe*>(sqeMemory) + (tail & sqMask);
+    std::memset(sqe, 0, sizeof(*sqe));
+    return sqe;
+}
+
+// Publishes the entry returned by the last nextSqe(). The kernel only looks at it during the
+// next io_uring_enter(), which is what batches submissions.
+void IoUring::queue() {
+    const unsigned tail = *sqTail;
+    sqArray[tail & sqMask] = tail & sqMask;
+    __atomic_store_n(sqTail, tail + 1, __ATOMIC_RELEASE);
+    ++queued;
+}
+
+bool IoUring::preparePoll(const int& fd, const short& events, const uint64_t& userData) {
+    io_uring_sqe* sqe = static_cast<io_uring_sqe*>(nextSqe());
+    if (sqe == nullptr)
+        return false;
+    sqe->opcode = IORING_OP_POLL_ADD;
+    sqe->fd = fd;
+    // The 16-bit field reads back correctly as poll32_events on either byte order.
+    sqe->poll_events = static_cast<uint16_t>(events);
+    sqe->user_data = userData;
+    queue();
+    return true;
+}
+
+bool IoUring::prepareSend(const int& fd, const msghdr* message, const uint64_t& userData) {
+    io_uring_sqe* sqe = static_cast<io_uring_sqe*>(nextSqe());
+    if (sqe == nullptr)
+        return false;
+    sqe->opcode = IORING_OP_SENDMSG;
+    sqe->fd = fd;
+    sqe->addr = reinterpret_cast<uint64_t>(message);
+    sqe->len = 1;
+    sqe->msg_flags = MSG_NOSIGNAL;
+    sqe->user_data = userData;
+    queue();
+    return true;
+}
+
+bool IoUring::prepareReceive(const int& fd, char* data, const size_t& size,
+                             const uint64_t& userData) {
+    io_uring_sqe* sqe = static_cast<io_uring_sqe*>(nextSqe());
+    if (sqe == nullptr)
+        return false;
+    sqe->opcode = IORING_OP_RECV;
+    sqe->fd = fd;
+    sqe->addr = reinterpret_cast<uint64_t>(data);
+    sqe->len = static_cast<uint32_t>(size);
+    sqe->user_data = userData;
+    queue();
+    return true;
+}
+
+bool IoUring::prepareReceiveMultishot(const int& fd, const uint64_t& userData) {
+#ifdef IORING_RECV_MULTISHOT
+    if (!hasBufferRing())
+        return false;
+    io_uring_sqe* sqe = static_cast<io_uring_sqe*>(nextSqe());
+    if (sqe == nullptr)
+        return false;
+    sqe->opcode = IORING_OP_RECV;
+    sqe->fd = fd;
+    sqe->ioprio = IORING_RECV_MULTISHOT;
+    sqe->flags = IOSQE_BUFFER_SELECT;
+    sqe->buf_group = kBufferGroup;
+    sqe->user_data = userData;
+    queue();
+    return true;
+#else
+    (void)fd;
+    (void)userData;
+    return false;
+#endif
+}
+
+bool IoUring::prepareCancel(const uint64_t& target, const uint64_t& userData) {
+    io_uring_sqe* sqe = static_cast<io_uring_sqe*>(nextSqe());
+    if (sqe == nullptr)
+        return false;
+    sqe->opcode = IORING_OP_ASYNC_CANCEL;
+    sqe->fd = -1;
+    sqe->addr = target;
+    sqe->user_data = userData;
+    queue();
+    return true;
+}
+
+int IoUring::enter(const unsigned& submit, const unsigned& waitFor, const int& timeoutMs) {
+    unsigned flags = 0;
+    io_uring_getevents_arg arg;
+    std::memset(&arg, 0, sizeof(arg));
+    __kernel_timespec timeout;
+    if (waitFor > 0) {
+        flags |= IORING_ENTER_GETEVENTS | IORING_ENTER_EXT_ARG;
+        arg.sigmask_sz = _NSIG / 8;
+        if (timeoutMs >= 0) {
+            timeout.tv_sec = timeoutMs / 1000;
+            timeout.tv_nsec = (timeoutMs % 1000) * 1000000LL;
+            arg.ts = reinterpret_cast<uint64_t>(&timeout);
+        }
+    }
+
+    const long result = syscall(__NR_io_uring_enter, ringFd, submit, waitFor, flags,
+                                waitFor > 0 ? &arg : nullptr, waitFor > 0 ? sizeof(arg) : 0);
+    // Whatever the kernel did not take stays queued for the next call.
+    queued = *sqTail - __atomic_load_n(sqHead, __ATOMIC_ACQUIRE);
+    return static_cast<int>(result);
+}
+
+void IoUring::submitAndWait(const int& timeoutMs) {
+    // A timeout (ETIME) or a signal (EINTR) just returns with whatever completed.
+    enter(queued, 1, timeoutMs);
+}
+
+void IoUring::reap(std::vector<Completion>& out) {
+    unsigned head = *cqHead;
+    const unsigned tail = __atomic_load_n(cqTail, __ATOMIC_ACQUIRE);
+    for (; head != tail; ++head) {
+        const io_uring_cqe& cqe = static_cast<io_uring_cqe*>(cqes)[head & cqMask];
+        Completion completion;
+        completion.userData = cqe.user_data;
+        completion.result = cqe.res;
+        completion.flags = cqe.flags;
+        out.push_back(completion);
+    }
+    __atomic_store_n(cqHead, head, __ATOMIC_RELEASE);
+}
+
+bool IoUring::more(const Completion& completion) {
+    return (completion.flags & IORING_CQE_F_MORE) != 0;
+}
+
+bool IoUring::bufferId(const Completion& completion, unsigned& id) {
+    if ((completion.flags & IORING_CQE_F_BUFFER) == 0)
+        return false;
+    id = completion.flags >> IORING_CQE_BUFFER_SHIFT;
+    return true;
+}
+
+const char* IoUring::bufferData(const unsigned& id) const {
+    return bufferMemory + static_cast<size_t>(id) * bufferSize;
+}
+
+void IoUring::recycleBuffer(const unsigned& id) {
+#ifdef IORING_RECV_MULTISHOT
+    // Indexed by hand: compiled as C++, the header's flexible bufs[] array does not start at
+    // offset 0 as it does for the kernel.
+    io_uring_buf& entry =
+        static_cast<io_uring_buf*>(bufferRing)[bufferTail & (bufferCount - 1)];
+    entry.addr = reinterpret_cast<uint64_t>(bufferMemory + static_cast<size_t>(id) * bufferSize);
+    entry.len = bufferSize;
+    entry.bid = static_cast<uint16_t>(id);
+    ++bufferTail;
+    // The tail overlays the reserved field of the first entry.
+    io_uring_buf_ring* ring = static_cast<io_uring_buf_ring*>(bufferRing);
+    __atomic_store_n(&ring->tail, static_cast<uint16_t>(bufferTail), __ATOMIC_RELEASE);
+#else
+    (void)id;
+#endif
+}
+
+#else
+
+// Built without io_uring: init() always fails, so nothing else is ever called.
+
+IoUring::IoUring()
+    : ringFd(-1),
+      sqRing(nullptr),
+      sqRingSize(0),
+      cqRing(nullptr),
+      cqRingSize(0),
+      sqeMemory(nullptr),
+      sqeMemorySize(0),
+      sqHead(nullptr),
+      sqTail(nullptr),
+      sqMask(0),
+      sqArray(nullptr),
+      sqEntries(0),
+      queued(0),
+      cqHead(nullptr),
+      cqTail(nullptr),
+      cqMask(0),
+      cqes(nullptr),
+      bufferRing(nullptr),
+      bufferRingSize(0),
+      bufferMemory(nullptr),
+      bufferCount(0),
+      bufferSize(0),
+      bufferTail(0) {}
+
+IoUring::~IoUring() {}
+
+void IoUring::release() {}
+
+bool IoUring::init(const unsigned&) {
+    return false;
+}
+
+bool IoUring::initBufferRing(const unsigned&, const unsigned&) {
+    return false;
+}
+
+bool IoUring::hasBufferRing() const {
+    return false;
+}
+
+void* IoUring::nextSqe() {
+    return nullptr;
+}
+
+void IoUring::queue() {}
+
+bool IoUring::preparePoll(const int&, const short&, const uint64_t&) {
+    return false;
+}
+
+bool IoUring::prepareSend(const int&, const msghdr*, const uint64_t&) {
+    return false;
+}
+
+bool IoUring::prepareReceive(const int&, char*, const size_t&, const uint64_t&) {
+    return false;
+}
+
+bool IoUring::prepareReceiveMultishot(const int&, const uint64_t&) {
+    return false;
+}
+
+bool IoUring::prepareCancel(const uint64_t&, const uint64_t&) {
+    return false;
+}
+
+int IoUring::enter(const unsigned&, const unsigned&, const int&) {
+    return -1;
+}
+
+void IoUring::submitAndWait(const int&) {}
+
+void IoUring::reap(std::vector<Completion>&) {}
+
+bool IoUring::more(const Completion&) {
+    return false;
+}
+
+bool IoUring::bufferId(const Completion&, unsigned&) {
+    return false;
+}
+
+const char* IoUring::bufferData(const unsigned&) const {
+    return nullptr;
+}
+
+void IoUring::recycleBuffer(const unsigned&) {}
+
+#endif
+
+}  // namespace SimpleHTTP
@@ -0,0 +1,179 @@
+#include "metrics.hpp"
+
+namespace SimpleHTTP {
+
+static int64_t microsecondsBetween(const HttpTiming::Clock::time_point& from,
+                                   const HttpTiming::Clock::time_point& to) {
+    return std::chrono::duration_cast<std::chrono::microseconds>(to - from).count();
+}
+
+HttpTiming::HttpTiming() : bytesSent(0), bytesReceived(0), connectionReused(false) {}
+
+void HttpTiming::begin() {
+    start = Clock::now();
+    resolved = connected = sent = firstByte = finished = start;
+    bytesSent = 0;
+    bytesReceived = 0;
+    connectionReused = false;
+}
+
+int64_t HttpTiming::dnsMicros() const {
+    return microsecondsBetween(start, resolved);
+}
+
+int64_t HttpTiming::connectMicros() const {
+    return microsecondsBetween(resolved, connected);
+}
+
+int64_t HttpTiming::sendMicros() const {
+    return microsecondsBetween(connected, sent);
+}
+
+int64_t HttpTiming::waitMicros() const {
+    return microsecondsBetween(sent, firstByte);
+}
+
+int64_t HttpTiming::receiveMicros() const {
+    return microsecondsBetween(firstByte, finished);
+}
+
+int64_t HttpTiming::totalMicros() const {
+    return microsecondsBetween(start, finished);
+}
+
+LatencyHistogram::LatencyHistogram() : buckets(), count(0), sumMicros(0) {}
+
+int64_t LatencyHistogram::bucketLimit(const size_t& bucket) {
+    return static_cast<int64_t>(1) << bucket;
+}
+
+size_t LatencyHistogram::bucketFor(const int64_t& micros) {
+    size_t bucket = 0;
+    for (int64_t rest = micros; rest > 0 && bucket + 1 < kBuckets; rest >>= 1)
+        ++bucket;
+    return bucket;
+}
+
+int64_t LatencyHistogram::percentile(const double& fraction) const {
+    if (count == 0)
+        return 0;
+
+    const uint64_t rank = static_cast<uint64_t>(fraction * count);
+    uint64_t seen = 0;
+    for (size_t i = 0; i < kBuckets; ++i) {
+        seen += buckets[i];
+        if (seen > rank)
+            return bucketLimit(i);
+    }
+    return bucketLimit(kBuckets - 1);
+}
+
+HttpMetricsSnapshot::HttpMetricsSnapshot()
+    : requests(0), failures(0), reusedConnections(0), bytesSent(0), bytesReceived(0) {}
+
+const LatencyHistogram& HttpMetricsSnapshot::phase(const HttpPhase& phase) const {
+    return phases[static_cast<size_t>(phase)];
+}
+
+HttpMetrics::HttpMetrics() : histogramsEnabled(false), hookInstalled(false) {
+    reset();
+}
+
+HttpMetrics& HttpMetrics::instance() {
+    // Never destroyed, so requests finishing on other threads during exit can still record.
+    static HttpMetrics* metrics = new HttpMetrics();
+    return *metrics;
+}
+
+void HttpMetrics::setHook(const Hook& newHook) {
+    std::shared_ptr<Hook> installed;
+    if (newHook)
+        installed = std::make_shared<Hook>(newHook);
+
+    std::lock_guard<std::mutex> lock(hookMutex);
+    hook.swap(installed);
+    hookInstalled = static_cast<bool>(hook);
+}
+
+void HttpMetrics::setHistogramsEnabled(const bool& enabled) {
+    histogramsEnabled = enabled;
+}
+
+bool HttpMetrics::isActive() const {
+    return histogramsEnabled.load(std::memory_order_relaxed) ||
+           hookInstalled.load(std::memory_order_relaxed);
+}
+
+void HttpMetrics::add(Histogram& histogram, const int64_t& micros) {
+    const uint64_t value = micros > 0 ? static_cast<uint64_t>(micros) : 0;
+    histogram.buckets[LatencyHistogram::bucketFor(micros)].fetch_add(1,
+                                                                     std::memory_order_relaxed);
+    histogram.count.fetch_add(1, std::memory_order_relaxed);
+    histogram.sumMicros.fetch_add(value, std::memory_order_relaxed);
+}
+
+void HttpMetrics::record(const std::string& method, const std::string& url,
+                         const int& httpCode, const HttpTiming& timing) {
+    if (histogramsEnabled.load(std::memory_order_relaxed)) {
+        const int64_t phases[LatencyHistogram::kPhases] = {
+            timing.dnsMicros(),  timing.connectMicros(), timing.sendMicros(),
+            timing.waitMicros(), timing.receiveMicros(), timing.totalMicros()};
+        for (size_t i = 0; i < LatencyHistogram::kPhases; ++i)
+            add(histograms[i], phases[i]);
+
+        requests.fetch_add(1, std::memory_order_relaxed);
+        if (httpCode == -1)
+            failures.fetch_add(1, std::memory_order_relaxed);
+        if (timing.connectionReused)
+            reusedConnections.fetch_add(1, std::memory_order_relaxed);
+        bytesSent.fetch_add(timing.bytesSent, std::memory_order_relaxed);
+        bytesReceived.fetch_add(timing.bytesReceived, std::memory_order_relaxed);
+    }
+
+    if (hookInstalled.load(std::memory_order_relaxed)) {
+        std::shared_ptr<Hook> current;
+        {
+            std::lock_guard<std::mutex> lock(hookMutex);
+            current = hook;
+        }
+        if (current) {
+            try {
+                (*current)(method, url, httpCode, timing);
+            } catch (...) {
+            }
+        }
+    }
+}
+
+HttpMetricsSnapshot HttpMetrics::snapshot() const {
+    HttpMetricsSnapshot result;
+    for (size_t i = 0; i < LatencyHistogram::kPhases; ++i) {
+        const Histogram& histogram = histograms[i];
+        for (size_t b = 0; b < LatencyHistogram::kBuckets; ++b)
+            result.phases[i].buckets[b] = histogram.buckets[b].load(std::memory_order_relaxed);
+        result.phases[i].count = histogram.count.load(std::memory_order_relaxed);
+        result.phases[i].sumMicros = histogram.sumMicros.load(std::memory_order_relaxed);
+    }
+    result.requests = requests.load(std::memory_order_relaxed);
+    result.failures = failures.load(std::memory_order_relaxed);
+    result.reusedConnections = reusedConnections.load(std::memory_order_relaxed);
+    result.bytesSent = bytesSent.load(std::memory_order_relaxed);
+    result.bytesReceived = bytesReceived.load(std::memory_order_relaxed);
+    return result;
+}
+
+void HttpMetrics::reset() {
+    for (Histogram& histogram : histograms) {
+        for (std::atomic<uint64_t>& bucket : histogram.buckets)
+            bucket.store(0, std::memory_order_relaxed);
+        histogram.count.store(0, std::memory_order_relaxed);
+        histogram.sumMicros.store(0, std::memory_order_relaxed);
+    }
+    requests.store(0, std::memory_order_relaxed);
+    failures.store(0, std::memory_order_relaxed);
+    reusedConnections.store(0, std::memory_order_relaxed);
+    bytesSent.store(0, std::memory_order_relaxed);
+    bytesReceived.store(0, std::memory_order_relaxed);
+}
+
+}  // namespace SimpleHTTP
@@ -0,0 +1,36 @@
+#include "requestBody.hpp"
+
+namespace SimpleHTTP {
+
+RequestBody::RequestBody()
+    : source(Source::Reader),
+      fd(-1),
+      offset(0),
+      length(-1),
+      expectContinue(false),
+      continueTimeoutMs(1000) {}
+
+RequestBody RequestBody::fromReader(const Reader& reader) {
+    RequestBody body;
+    body.source = Source::Reader;
+    body.reader = reader;
+    return body;
+}
+
+RequestBody RequestBody::fromFile(const int& fd, const off_t& offset, const int64_t& length) {
+    RequestBody body;
+    body.source = Source::File;
+    body.fd = fd;
+    body.offset = offset;
+    body.length = length;
+    return body;
+}
+
+RequestBody RequestBody::fromPath(const std::string& path) {
+    RequestBody body;
+    body.source = Source::Path;
+    body.path = path;
+    return body;
+}
+
+}  // namespace SimpleHTTP
@@ -0,0 +1,375 @@
+#include "responseCache.hpp"
+
+#include <strings.h>
+
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+
+#include "simpleHTTP.hpp"
+
+namespace SimpleHTTP {
+
+namespace {
+
+// Heuristic freshness from Last-Modified is capped at a day.
+const int64_t kMaxHeuristicLifetime = 24 * 60 * 60;
+
+bool tokenEquals(const std::string& token, const char* text) {
+    return token.size() == std::strlen(text) && strncasecmp(token.data(), text, token.size()) == 0;
+}
+
+// Splits a comma-separated header value into trimmed, non-empty items.
+void splitList(const std::string& value, std::vector<std::string>& items) {
+    size_t start = 0;
+    while (start <= value.size()) {
+        size_t end = value.find(',', start);
+        if (end == std::string::npos)
+            end = value.size();
+
+        size_t first = start;
+        size_t last = end;
+        while (first < last && (value[first] == ' ' || value[first] == '\t'))
+            ++first;
+        while (last > first && (value[last - 1] == ' ' || value[last - 1] == '\t'))
+            --last;
+        if (last > first)
+            items.push_back(value.substr(first, last - first));
+        start = end + 1;
+    }
+}
+
+struct CacheDirectives {
+    bool noStore;
+    bool noCache;
+    // Seconds, or -1 when absent.
+    int64_t maxAge;
+
+    CacheDirectives() : noStore(false), noCache(false), maxAge(-1) {}
+};
+
+// Only the directives a private cache acts on; no-cache with a field list is treated as plain
+// no-cache, which is the safe reading.
+CacheDirectives parseCacheControl(const HttpHeaders& headers) {
+    CacheDirectives directives;
+    std::vector<std::string> items;
+    for (const std::string& value : headers.getHeaders("Cache-Control"))
+        splitList(value, items);
+
+    for (const std::string& item : items) {
+        const size_t equals = item.find('=');
+        const std::string name = item.substr(0, equals);
+        if (tokenEquals(name, "no-store")) {
+            directives.noStore = true;
+        } else if (tokenEquals(name, "no-cache")) {
+            directives.noCache = true;
+        } else if (tokenEquals(name, "max-age") && equals != std::string::npos) {
+            std::string value = item.substr(equals + 1);
+            if (value.size() >= 2 && value.front() == '"' && value.back() == '"')
+                value = value.substr(1, value.size() - 2);
+            char* end = nullptr;
+            const long long seconds = std::strtoll(value.c_str(), &end, 10);
+            if (end != value.c_str() && *end == '\0' && seconds >= 0)
+                directives.maxAge = seconds;
+            else
+                directives.maxAge = 0;
+        }
+    }
+
+    // HTTP/1.0 caches understood only Pragma: no-cache.
+    if (headers.getHeaders("Cache-Control").empty() &&
+        tokenEquals(headers.getHeader("Pragma"), "no-cache"))
+        directives.noCache = true;
+    return directives;
+}
+
+// IMF-fixdate, plus the obsolete RFC 850 and asctime forms every recipient must accept.
+bool parseHttpDate(const std::string& value, int64_t& seconds) {
+    static const char* const kFormats[] = {"%a, %d %b %Y %H:%M:%S", "%A, %d-%b-%y %H:%M:%S",
+                                           "%a %b %d %H:%M:%S %Y"};
+    for (const char* format : kFormats) {
+        tm parsed = {};
+        if (strptime(value.c_str(), format, &parsed) != nullptr) {
+            seconds = static_cast<int64_t>(timegm(&parsed));
+            return true;
+        }
+    }
+    return false;
+}
+
+int64_t wallClock() {
+    return static_cast<int64_t>(std::time(nullptr));
+}
+
+bool isCacheableStatus(const int& code) {
+    switch (code) {
+        case 200:
+        case 203:
+        case 204:
+        case 300:
+        case 301:
+        case 308:
+        case 404:
+        case 410:
+            return true;
+        default:
+            return false;
+    }
+}
+
+size_t headSize(const HttpResponse& head) {
+    size_t size = head.statusText.size() + head.protocol.size();
+    for (const HttpHeaders::Field& field : head.headers.headers)
+        size += field.first.size() + field.second.size();
+    return size;
+}
+
+}  // namespace
+
+ResponseCacheConfig::ResponseCacheConfig()
+    : maxBytes(64 * 1024 * 1024), maxEntryBytes(8 * 1024 * 1024) {}
+
+ResponseCacheStats::ResponseCacheStats()
+    : hits(0), revalidations(0), misses(0), evictions(0), bytesSaved(0), entries(0), bytes(0) {}
+
+ResponseCache::ResponseCache(const ResponseCacheConfig& config) : config(config), bytes(0) {}
+
+ResponseCache::Lookup ResponseCache::lookup(const std::string& url,
+                                            const HttpHeaders& requestHeaders, Match& match) {
+    // Conditional and range requests are the caller's own validation; pass them through.
+    const CacheDirectives request = parseCacheControl(requestHeaders);
+    if (request.noStore || requestHeaders.hasHeader("If-None-Match") ||
+        requestHeaders.hasHeader("If-Modified-Since") || requestHeaders.hasHeader("Range"))
+        return Lookup::Bypass;
+
+    std::lock_guard<std::mutex> lock(mutex);
+    const auto it = index.find(url);
+    if (it == index.end())
+        return Lookup::Miss;
+
+    Entry& entry = *it->second;
+    for (const auto& field : entry.varying) {
+        if (requestHeaders.getHeader(field.first) != field.second)
+            return Lookup::Miss;
+    }
+
+    entries.splice(entries.begin(), entries, it->second);
+    match = entry.match;
+
+    const int64_t resident =
+        std::chrono::duration_cast<std::chrono::seconds>(Clock::now() - entry.storedAt).count();
+    const int64_t age = entry.initialAge + resident;
+    const bool fresh = !request.noCache && age < entry.lifetime &&
+                       (request.maxAge < 0 || age <= request.maxAge);
+    if (!fresh)
+        return Lookup::Stale;
+
+    ++stats.hits;
+    stats.bytesSaved += match.body->size();
+    return Lookup::Fresh;
+}
+
+void ResponseCache::addValidators(const Match& match, HttpHeaders& headers) {
+    const std::string etag = match.head->headers.getHeader("ETag");
+    if (!etag.empty())
+        headers.setHeader("If-None-Match", etag);
+    const std::string lastModified = match.head->headers.getHeader("Last-Modified");
+    if (!lastModified.empty())
+        headers.setHeader("If-Modified-Since", lastModified);
+}
+
+void ResponseCache::serve(const Match& match, HttpResponse& response, const bool& shareBody) {
+    const HttpResponse& head = *match.head;
+    response.path = head.path;
+    response.remoteAddr = head.remoteAddr;
+    response.httpCode = head.httpCode;
+    response.headers = head.headers;
+    response.statusText = head.statusText;
+    response.protocol = head.protocol;
+    if (shareBody) {
+        response.body.clear();
+        response.sharedBody = match.body;
+    } else {
+        response.body.assign(*match.body);
+        response.sharedBody.reset();
+    }
+    response.contentLength = match.body->size();
+}
+
+// Works out whether a response may be stored and, if so, how long it stays fresh. head carries
+// the response headers; the body is not needed beyond its size.
+bool ResponseCache::prepare(Entry& entry, const std::string& url,
+                            const HttpHeaders& requestHeaders, const HttpResponse& head,
+                            const size_t& bodySize) {
+    const HttpHeaders& headers = head.headers;
+    const CacheDirectives response = parseCacheControl(headers);
+    if (response.noStore || parseCacheControl(requestHeaders).noStore ||
+        !isCacheableStatus(head.httpCode))
+        return false;
+
+    entry.url = url;
+    entry.varying.clear();
+    std::vector<std::string> varyNames;
+    for (const std::string& value : headers.getHeaders("Vary"))
+        splitList(value, varyNames);
+    for (const std::string& name : varyNames) {
+        if (name == "*")
+            return false;
+        entry.varying.push_back(std::make_pair(name, requestHeaders.getHeader(name)));
+    }
+
+    const int64_t now = wallClock();
+    int64_t date = now;
+    if (!parseHttpDate(headers.getHeader("Date"), date))
+        date = now;
+
+    int64_t ageHeader = 0;
+    const std::string age = headers.getHeader("Age");
+    if (!age.empty())
+        ageHeader = std::max<int64_t>(0, std::strtoll(age.c_str(), nullptr, 10));
+    entry.initialAge = std::max<int64_t>(ageHeader, now - date);
+
+    int64_t lastModified = 0;
+    const bool hasLastModified = parseHttpDate(headers.getHeader("Last-Modified"), lastModified);
+    const bool hasValidator = headers.hasHeader("ETag") || hasLastModified;
+
+    int64_t expires = 0;
+    if (response.noCache) {
+        entry.lifetime = 0;
+    } else if (response.maxAge >= 0) {
+        entry.lifetime = response.maxAge;
+    } else if (headers.hasHeader("Expires")) {
+        // An unparsable Expires ("0") means already expired.
+        entry.lifetime =
+            parseHttpDate(headers.getHeader("Expires"), expires) ? expires - date : 0;
+    } else if (hasLastModified && date > lastModified) {
+        entry.lifetime = std::min(kMaxHeuristicLifetime, (date - lastModified) / 10);
+    } else {
+        entry.lifetime = 0;
+    }
+
+    // Without freshness or a validator, an entry could never be used.
+    if (entry.lifetime <= entry.initialAge && !hasValidator)
+        return false;
+
+    entry.storedAt = Clock::now();
+    entry.size = url.size() + headSize(head) + bodySize;
+    return true;
+}
+
+void ResponseCache::revalidated(const std::string& url, const HttpHeaders& requestHeaders,
+                                const Match& match, HttpResponse& response,
+                                const bool& shareBody) {
+    // The stored headers, updated with those of the 304.
+    std::shared_ptr<HttpResponse> head = std::make_shared<HttpResponse>(*match.head);
+    for (const HttpHeaders::Field& field : response.headers.headers)
+        head->headers.removeHeader(field.first);
+    for (const HttpHeaders::Field& field : response.headers.headers)
+        head->headers.addHeader(field.first, field.second);
+
+    Match updated;
+    updated.head = head;
+    updated.body = match.body;
+    serve(updated, response, shareBody);
+
+    Entry entry;
+    entry.match = updated;
+    const bool storable = prepare(entry, url, requestHeaders, *head, match.body->size());
+
+    std::lock_guard<std::mutex> lock(mutex);
+    ++stats.revalidations;
+    stats.bytesSaved += match.body->size();
+    if (storable)
+        insert(std::move(entry));
+}
+
+void ResponseCache::store(const std::string& url, const HttpHeaders& requestHeaders,
+                          HttpResponse& response, const bool& shareBody) {
+    Entry entry;
+    const bool storable = response.httpCode != -1 &&
+                          prepare(entry, url, requestHeaders, response, response.body.size()) &&
+                          entry.size <= config.maxEntryBytes;
+
+    std::lock_guard<std::mutex> lock(mutex);
+    ++stats.misses;
+    if (!storable) {
+        // A newer response that may not be kept replaces whatever was stored before.
+        if (response.httpCode != -1) {
+            const auto it = index.find(url);
+            if (it != index.end())
+                erase(it);
+        }
+        return;
+    }
+
+    std::shared_ptr<HttpResponse> head = std::make_shared<HttpResponse>();
+    head->url = response.url;
+    head->path = response.path;
+    head->remoteAddr = response.remoteAddr;
+    head->httpCode = response.httpCode;
+    head->headers = response.headers;
+    head->statusText = response.statusText;
+    head->protocol = response.protocol;
+    head->contentLength = response.body.size();
+
+    std::shared_ptr<const std::string> body;
+    if (shareBody) {
+        body = std::make_shared<const std::string>(std::move(response.body));
+        response.body.clear();
+        response.sharedBody = body;
+    } else {
+        body = std::make_shared<const std::string>(response.body);
+    }
+
+    entry.match.head = head;
+    entry.match.body = body;
+    insert(std::move(entry));
+}
+
+void ResponseCache::invalidate(const std::string& url) {
+    std::lock_guard<std::mutex> lock(mutex);
+    const auto it = index.find(url);
+    if (it != index.end())
+        erase(it);
+}
+
+// Caller holds mutex. Replaces any entry for the same URL and evicts from the cold end.
+void ResponseCache::insert(Entry entry) {
+    const auto existing = index.find(entry.url);
+    if (existing != index.end())
+        erase(existing);
+
+    bytes += entry.size;
+    entries.push_front(std::move(entry));
+    index[entries.front().url] = entries.begin();
+
+    while (bytes > config.maxBytes && !entries.empty()) {
+        erase(index.find(entries.back().url));
+        ++stats.evictions;
+    }
+}
+
+void ResponseCache::erase(
+    const std::unordered_map<std::string, std::list<Entry>::iterator>::iterator& it) {
+    bytes -= it->second->size;
+    entries.erase(it->second);
+    index.erase(it);
+}
+
+ResponseCacheStats ResponseCache::getStats() const {
+    std::lock_guard<std::mutex> lock(mutex);
+    ResponseCacheStats result = stats;
+    result.entries = entries.size();
+    result.bytes = bytes;
+    return result;
+}
+
+void ResponseCache::clear() {
+    std::lock_guard<std::mutex> lock(mutex);
+    entries.clear();
+    index.clear();
+    bytes = 0;
+}
+
+}  // namespace SimpleHTTP
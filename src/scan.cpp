@@ -0,0 +1,190 @@
+#include "scan.hpp"
+
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+#define SIMPLEHTTP_SCAN_X86 1
+#include <immintrin.h>
+#endif
+
+namespace SimpleHTTP {
+
+namespace {
+
+typedef size_t (*ScanFunction)(const char* data, const size_t& from, const size_t& size,
+                               ScannedLine* lines, const size_t& maxLines);
+
+const size_t npos = std::string::npos;
+
+bool isEmptyLine(const char* data, const size_t& start, const size_t& end) {
+    return end == start || (end == start + 1 && data[start] == '\r');
+}
+
+size_t scanScalar(const char* data, const size_t& from, const size_t& size, ScannedLine* lines,
+                  const size_t& maxLines) {
+    size_t count = 0;
+    size_t start = from;
+    while (count < maxLines) {
+        const void* found = std::memchr(data + start, '\n', size - start);
+        if (!found)
+            break;
+        const size_t end = static_cast<const char*>(found) - data;
+        const void* colon = std::memchr(data + start, ':', end - start);
+        lines[count].end = end;
+        lines[count].colon = colon ? static_cast<const char*>(colon) - data : npos;
+        ++count;
+        if (isEmptyLine(data, start, end))
+            break;
+        start = end + 1;
+    }
+    return count;
+}
+
+#ifdef SIMPLEHTTP_SCAN_X86
+
+// Walk over one block's newline and colon bitmasks (bit i stands for base + i) and the lines
+// ending in it. Returns false once the caller should stop scanning.
+struct LineWalk {
+    const char* data;
+    ScannedLine* lines;
+    size_t maxLines;
+    size_t count;
+    size_t start;
+    // First colon of the line in progress.
+    size_t colon;
+
+    bool block(const size_t& base, uint64_t newlines, uint64_t colons) {
+        while (newlines != 0) {
+            const unsigned bit = __builtin_ctzll(newlines);
+            const uint64_t before = (uint64_t(1) << bit) - 1;
+            if (colon == npos && (colons & before) != 0)
+                colon = base + __builtin_ctzll(colons & before);
+            colons &= ~before;
+
+            const size_t end = base + bit;
+            lines[count].end = end;
+            lines[count].colon = colon;
+            ++count;
+            if (count == maxLines || isEmptyLine(data, start, end))
+                return false;
+            start = end + 1;
+            colon = npos;
+            newlines &= newlines - 1;
+        }
+        if (colon == npos && colons != 0)
+            colon = base + __builtin_ctzll(colons);
+        return true;
+    }
+
+    // The bytes after the last whole block.
+    size_t tail(size_t pos, const size_t& size) {
+        for (; pos < size; ++pos) {
+            if (data[pos] == ':' && colon == npos) {
+                colon = pos;
+            } else if (data[pos] == '\n' && !block(pos, 1, 0)) {
+                break;
+            }
+        }
+        return count;
+    }
+};
+
+size_t scanSse2(const char* data, const size_t& from, const size_t& size, ScannedLine* lines,
+                const size_t& maxLines) {
+    if (maxLines == 0)
+        return 0;
+    LineWalk walk = {data, lines, maxLines, 0, from, npos};
+    const __m128i newline = _mm_set1_epi8('\n');
+    const __m128i separator = _mm_set1_epi8(':');
+    size_t pos = from;
+    for (; pos + 16 <= size; pos += 16) {
+        const __m128i block = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + pos));
+        const unsigned newlines = _mm_movemask_epi8(_mm_cmpeq_epi8(block, newline));
+        const unsigned colons = _mm_movemask_epi8(_mm_cmpeq_epi8(block, separator));
+        if (!walk.block(pos, newlines, colons))
+            return walk.count;
+    }
+    return walk.tail(pos, size);
+}
+
+__attribute__((target("avx2"))) size_t scanAvx2(const char* data, const size_t& from,
+                                                const size_t& size, ScannedLine* lines,
+                                                const size_t& maxLines) {
+    if (maxLines == 0)
+        return 0;
+    LineWalk walk = {data, lines, maxLines, 0, from, npos};
+    const __m256i newline = _mm256_set1_epi8('\n');
+    const __m256i separator = _mm256_set1_epi8(':');
+    size_t pos = from;
+    for (; pos + 32 <= size; pos += 32) {
+        const __m256i block = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(data + pos));
+        const uint32_t newlines =
+            static_cast<uint32_t>(_mm256_movemask_epi8(_mm256_cmpeq_epi8(block, newline)));
+        const uint32_t colons =
+            static_cast<uint32_t>(_mm256_movemask_epi8(_mm256_cmpeq_epi8(block, separator)));
+        if (!walk.block(pos, newlines, colons))
+            return walk.count;
+    }
+    return walk.tail(pos, size);
+}
+
+bool hasAvx2() {
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("avx2");
+}
+
+#endif
+
+// SSE2 alone is not picked: on a head of 40 fields it measured slower than memchr (2250 against
+// 2190 cycles), whose own SIMD search wins on lines this short.
+ScanFunction pickScanner() {
+#ifdef SIMPLEHTTP_SCAN_X86
+    return hasAvx2() ? scanAvx2 : scanScalar;
+#else
+    return scanScalar;
+#endif
+}
+
+// Atomic because setScanImplementation() may replace it while other threads parse; the relaxed
+// load is a plain load on the platforms with a SIMD scanner.
+std::atomic<ScanFunction> scanner(pickScanner());
+
+}  // namespace
+
+size_t scanLines(const char* data, const size_t& from, const size_t& size, ScannedLine* lines,
+                 const size_t& maxLines) {
+    return scanner.load(std::memory_order_relaxed)(data, from, size, lines, maxLines);
+}
+
+const char* scanImplementation() {
+#ifdef SIMPLEHTTP_SCAN_X86
+    const ScanFunction current = scanner.load(std::memory_order_relaxed);
+    if (current == scanAvx2)
+        return "avx2";
+    if (current == scanSse2)
+        return "sse2";
+#endif
+    return "scalar";
+}
+
+bool setScanImplementation(const std::string& name) {
+    if (name == "scalar") {
+        scanner.store(scanScalar, std::memory_order_relaxed);
+        return true;
+    }
+#ifdef SIMPLEHTTP_SCAN_X86
+    if (name == "sse2") {
+        scanner.store(scanSse2, std::memory_order_relaxed);
+        return true;
+    }
+    if (name == "avx2" && hasAvx2()) {
+        scanner.store(scanAvx2, std::memory_order_relaxed);
+        return true;
+    }
+#endif
+    return false;
+}
+
+}  // namespace SimpleHTTP
@@ -1,23 +1,123 @@
 #include "simpleHTTP.hpp"
 
+#include <strings.h>
+#include <sys/stat.h>
+
+#include <cctype>
+#include <cerrno>
+#include <condition_variable>
+#include <cstdio>
+#include <cstdlib>
+
+#include "dnsCache.hpp"
+
 namespace SimpleHTTP {
 
+static const char* const kWellKnownHeaders[] = {
+    "Accept-Ranges", "Age", "Cache-Control", "Connection", "Content-Encoding", "Content-Length",
+    "Content-Type", "Date", "ETag", "Expires", "Keep-Alive", "Last-Modified", "Location",
+    "Server", "Set-Cookie", "Transfer-Encoding", "Vary",
+};
+
+static bool namesEqual(const std::string& name, const char* key, const size_t& keyLength) {
+    return name.size() == keyLength && strncasecmp(name.data(), key, keyLength) == 0;
+}
+
+// Returns the canonical spelling of a well-known header name, or nullptr.
+static const char* internName(const char* key, const size_t& keyLength) {
+    if (keyLength == 0)
+        return nullptr;
+    for (const char* known : kWellKnownHeaders) {
+        if ((known[0] | 0x20) == (key[0] | 0x20) && std::strlen(known) == keyLength &&
+            strncasecmp(known, key, keyLength) == 0)
+            return known;
+    }
+    return nullptr;
+}
+
 // HttpHeaders implementation
 void HttpHeaders::addHeader(const std::string& key, const std::string& value) {
-    headers[key] = value;
+    addHeader(key.data(), key.size(), value.data(), value.size());
+}
+
+void HttpHeaders::addHeader(const char* key, const size_t& keyLength, const char* value,
+                            const size_t& valueLength) {
+    headers.push_back(Field());
+    Field& field = headers.back();
+    const char* known = internName(key, keyLength);
+    if (known)
+        field.first.assign(known);
+    else
+        field.first.assign(key, keyLength);
+    field.second.assign(value, valueLength);
+}
+
+void HttpHeaders::replaceHeader(const size_t& index, const char* key, const size_t& keyLength,
+                                const char* value, const size_t& valueLength) {
+    Field& field = headers[index];
+    const char* known = internName(key, keyLength);
+    if (known)
+        field.first.assign(known);
+    else
+        field.first.assign(key, keyLength);
+    field.second.assign(value, valueLength);
+}
+
+void HttpHeaders::setHeader(const std::string& key, const std::string& value) {
+    removeHeader(key);
+    addHeader(key, value);
 }
 
 std::string HttpHeaders::getHeader(const std::string& key) const {
-    const auto it = headers.find(key);
-    return (it != headers.end()) ? it->second : "";
+    for (const Field& field : headers) {
+        if (namesEqual(field.first, key.data(), key.size()))
+            return field.second;
+    }
+    return "";
+}
+
+std::vector<std::string> HttpHeaders::getHeaders(const std::string& key) const {
+    std::vector<std::string> values;
+    for (const Field& field : headers) {
+        if (namesEqual(field.first, key.data(), key.size()))
+            values.push_back(field.second);
+    }
+    return values;
+}
+
+bool HttpHeaders::hasHeader(const std::string& key) const {
+    for (const Field& field : headers) {
+        if (namesEqual(field.first, key.data(), key.size()))
+            return true;
+    }
+    return false;
+}
+
+void HttpHeaders::removeHeader(const std::string& key) {
+    headers.erase(std::remove_if(headers.begin(), headers.end(),
+                                 [&key](const Field& field) {
+                                     return namesEqual(field.first, key.data(), key.size());
+                                 }),
+                  headers.end());
 }
 
 std::string HttpHeaders::toString() const {
-    std::stringstream ss;
-    for (const auto& header : headers) {
-        ss << header.first << ": " << header.second << "\r\n";
+    std::string result;
+    for (const Field& field : headers) {
+        result.append(field.first);
+        result.append(": ");
+        result.append(field.second);
+        result.append("\r\n");
     }
-    return ss.str();
+    return result;
+}
+
+size_t HttpHeaders::size() const {
+    return headers.size();
+}
+
+bool HttpHeaders::empty() const {
+    return headers.empty();
 }
 
 void HttpHeaders::clear() {
@@ -36,103 +136,229 @@ void HttpResponse::clear() {
     headers.clear();
     statusText.clear();
     protocol.clear();
+    timing = HttpTiming();
+    sharedBody.reset();
+}
+
+const std::string& HttpResponse::getBody() const {
+    return sharedBody ? *sharedBody : body;
 }
 
 UrlInfo::UrlInfo() : port(80) {}
 
 UrlInfo UrlInfo::parseUrl(const std::string& url) {
     UrlInfo info;
+    parseUrl(url, info);
+    return info;
+}
 
-    const size_t protocolEnd = url.find("://");
-    if (protocolEnd != std::string::npos) {
-        info.protocol = url.substr(0, protocolEnd);
-        const size_t hostStart = protocolEnd + 3;
-        size_t hostEnd = url.find('/', hostStart);
-
-        if (hostEnd == std::string::npos)
-            hostEnd = url.length();
+static int parsePort(const std::string& url, const size_t& start, const size_t& end) {
+    if (start == end)
+        throw std::invalid_argument("Invalid port");
 
-        std::string hostPort = url.substr(hostStart, hostEnd - hostStart);
-        const size_t portPos = hostPort.find(':');
+    int port = 0;
+    for (size_t i = start; i < end; ++i) {
+        if (url[i] < '0' || url[i] > '9' || port > 65535)
+            throw std::invalid_argument("Invalid port");
+        port = port * 10 + (url[i] - '0');
+    }
+    return port;
+}
 
-        if (portPos != std::string::npos) {
-            info.host = hostPort.substr(0, portPos);
-            info.port = std::stoi(hostPort.substr(portPos + 1));
-        } else {
-            info.host = hostPort;
-            info.port = (info.protocol == "https") ? 443 : 80;
-        }
+static bool isUnixScheme(const UrlInfo& info) {
+    return info.protocol == "http+unix";
+}
 
-        if (hostEnd < url.length()) {
-            const size_t pathStart = hostEnd;
-            const size_t queryPos = url.find('?', pathStart);
+static int hexDigit(const char& c) {
+    if (c >= '0' && c <= '9')
+        return c - '0';
+    if (c >= 'a' && c <= 'f')
+        return c - 'a' + 10;
+    if (c >= 'A' && c <= 'F')
+        return c - 'A' + 10;
+    return -1;
+}
 
-            if (queryPos != std::string::npos) {
-                info.path = url.substr(pathStart, queryPos - pathStart);
-                info.query = url.substr(queryPos + 1);
-            } else {
-                info.path = url.substr(pathStart);
-            }
+// Decodes %XX escapes in place; the socket path of an http+unix URL has its slashes escaped.
+static void percentDecode(std::string& text) {
+    size_t out = 0;
+    for (size_t i = 0; i < text.size(); ++i) {
+        const int high = i + 2 < text.size() && text[i] == '%' ? hexDigit(text[i + 1]) : -1;
+        const int low = high >= 0 ? hexDigit(text[i + 2]) : -1;
+        if (low >= 0) {
+            text[out++] = static_cast<char>(high * 16 + low);
+            i += 2;
         } else {
-            info.path = "/";
+            text[out++] = text[i];
         }
     }
-
-    return info;
+    text.resize(out);
 }
 
-HttpClient::ThreadGuard::ThreadGuard(const pthread_t& id) : threadId(id), isJoined(false) {}
+// Parses into info, assigning its strings in place so a reused UrlInfo keeps their capacity.
+void UrlInfo::parseUrl(const std::string& url, UrlInfo& info) {
+    info.protocol.clear();
+    info.host.clear();
+    info.port = 80;
+    info.path.clear();
+    info.query.clear();
 
-HttpClient::ThreadGuard::~ThreadGuard() {
-    if (!isJoined)
-        pthread_detach(threadId);
-}
+    const size_t protocolEnd = url.find("://");
+    if (protocolEnd == std::string::npos)
+        return;
+
+    info.protocol.assign(url, 0, protocolEnd);
+    const size_t hostStart = protocolEnd + 3;
+    size_t hostEnd = url.find('/', hostStart);
+    if (hostEnd == std::string::npos)
+        hostEnd = url.length();
+
+    size_t portPos;
+    if (hostStart < hostEnd && url[hostStart] == '[') {
+        // IPv6 literal ("[::1]:8080"); the brackets are not part of the host.
+        const size_t bracketEnd = url.find(']', hostStart);
+        if (bracketEnd == std::string::npos || bracketEnd > hostEnd)
+            throw std::invalid_argument("Invalid IPv6 host");
+        info.host.assign(url, hostStart + 1, bracketEnd - hostStart - 1);
+        portPos = url.find(':', bracketEnd);
+    } else {
+        portPos = url.find(':', hostStart);
+        if (portPos > hostEnd)
+            portPos = std::string::npos;
+        info.host.assign(url, hostStart,
+                         (portPos != std::string::npos ? portPos : hostEnd) - hostStart);
+    }
 
-HttpClient::ThreadGuard::ThreadGuard(ThreadGuard&& other) noexcept
-    : threadId(other.threadId), isJoined(other.isJoined) {
-    other.isJoined = true;
-}
+    if (isUnixScheme(info))
+        percentDecode(info.host);
 
-HttpClient::ThreadGuard& HttpClient::ThreadGuard::operator=(ThreadGuard&& other) noexcept {
-    if (this != &other) {
-        if (!isJoined) {
-            pthread_detach(threadId);
+    if (portPos != std::string::npos && portPos < hostEnd)
+        info.port = parsePort(url, portPos + 1, hostEnd);
+    else
+        info.port = (info.protocol == "https") ? 443 : 80;
+
+    if (hostEnd < url.length()) {
+        const size_t queryPos = url.find('?', hostEnd);
+        if (queryPos != std::string::npos) {
+            info.path.assign(url, hostEnd, queryPos - hostEnd);
+            info.query.assign(url, queryPos + 1, std::string::npos);
+        } else {
+            info.path.assign(url, hostEnd, std::string::npos);
         }
-        threadId = other.threadId;
-        isJoined = other.isJoined;
-        other.isJoined = true;
+    } else {
+        info.path.assign("/");
     }
-    return *this;
 }
 
-void HttpClient::ThreadGuard::join() {
-    if (!isJoined) {
-        pthread_join(threadId, nullptr);
-        isJoined = true;
-    }
+Request::Request() {}
+
+Request::Request(const std::string& method, const std::string& url, const std::string& payload,
+                 const std::string& contentType, const HttpHeaders& headers)
+    : method(method), url(url), payload(payload), contentType(contentType), headers(headers) {}
+
+BatchOptions::BatchOptions() : deadlineMs(0), firstSuccesses(0) {}
+
+// Per-request temporaries the client keeps between requests.
+struct RequestScratch {
+    UrlInfo urlInfo;
+    HttpResponseParser parser;
+    Decompressor decompressor;
+};
+
+static ExecutorConfig resolverConfig() {
+    ExecutorConfig config;
+    config.threads = 1;
+    // Unbounded, so that submitting never blocks an event loop.
+    config.queueCapacity = 0;
+    return config;
 }
 
-void HttpClient::ThreadGuard::detach() {
-    if (!isJoined) {
-        pthread_detach(threadId);
-        isJoined = true;
-    }
+HttpClient::HttpClient()
+    : executor(new Executor()),
+      resolver(new Executor(resolverConfig())),
+      connectionPool(new ConnectionPool()),
+      bufferPool(new BufferPool()),
+      scratchPool(new ObjectPool<RequestScratch>()),
+      userAgent("SimpleHTTP/1.0"),
+      timeoutSeconds(30),
+      keepAlive(true),
+      decompression(false),
+      sharedBodies(false),
+      requestCompressionThreshold(0),
+      http2Mode(Http2Mode::Disabled),
+      http2Pool(new Http2Pool()),
+      eventLoops(new EventLoopGroup()) {}
+
+// The executor goes first: its running tasks still use the rest of the client.
+HttpClient::~HttpClient() {
+    executor.reset();
+    stopAsync();
 }
 
-HttpClient::HttpClient() : socket(new Socket()), userAgent("SimpleHTTP/1.0"), timeoutSeconds(30) {}
+// Asynchronous exchanges point at the resolver, the pools and their event loop, and a failing
+// one may start again (a retry, or an HTTP/2 request falling back to HTTP/1.1). So the resolver
+// only stops taking hosts at first (the ones it holds fail on their loops), the HTTP/2
+// connections and then the loops fail what they run, and the resolver is destroyed last.
+void HttpClient::stopAsync() {
+    if (resolver)
+        resolver->shutdown();
+    http2Pool.reset();
+    eventLoops.reset();
+    resolver.reset();
+}
 
-HttpClient::~HttpClient() = default;
+// Submitted requests run against the client they were submitted to, so its executor is drained
+// before the client's state moves.
+static std::unique_ptr<Executor> takeExecutor(std::unique_ptr<Executor>& executor) {
+    if (executor)
+        executor->waitIdle();
+    return std::move(executor);
+}
 
 HttpClient::HttpClient(HttpClient&& other) noexcept
-    : socket(std::move(other.socket)),
+    : executor(takeExecutor(other.executor)),
+      resolver(takeExecutor(other.resolver)),
+      connectionPool(std::move(other.connectionPool)),
+      bufferPool(std::move(other.bufferPool)),
+      scratchPool(std::move(other.scratchPool)),
       userAgent(std::move(other.userAgent)),
-      timeoutSeconds(other.timeoutSeconds) {}
+      timeoutSeconds(other.timeoutSeconds),
+      keepAlive(other.keepAlive),
+      decompression(other.decompression),
+      sharedBodies(other.sharedBodies),
+      requestCompressionThreshold(other.requestCompressionThreshold),
+      http2Mode(other.http2Mode),
+      http2Pool(std::move(other.http2Pool)),
+      eventLoops(std::move(other.eventLoops)),
+      responseCache(std::move(other.responseCache)),
+      singleFlight(std::move(other.singleFlight)),
+      socketOptions(other.socketOptions),
+      hostSocketOptions(std::move(other.hostSocketOptions)),
+      unixSockets(std::move(other.unixSockets)) {}
 
 HttpClient& HttpClient::operator=(HttpClient&& other) noexcept {
     if (this != &other) {
-        socket = std::move(other.socket);
+        executor.reset();
+        executor = takeExecutor(other.executor);
+        stopAsync();
+        resolver = takeExecutor(other.resolver);
+        connectionPool = std::move(other.connectionPool);
+        bufferPool = std::move(other.bufferPool);
+        scratchPool = std::move(other.scratchPool);
         userAgent = std::move(other.userAgent);
         timeoutSeconds = other.timeoutSeconds;
+        keepAlive = other.keepAlive;
+        decompression = other.decompression;
+        sharedBodies = other.sharedBodies;
+        requestCompressionThreshold = other.requestCompressionThreshold;
+        http2Mode = other.http2Mode;
+        http2Pool = std::move(other.http2Pool);
+        eventLoops = std::move(other.eventLoops);
+        responseCache = std::move(other.responseCache);
+        singleFlight = std::move(other.singleFlight);
+        socketOptions = other.socketOptions;
+        hostSocketOptions = std::move(other.hostSocketOptions);
+        unixSockets = std::move(other.unixSockets);
     }
     return *this;
 }
@@ -141,52 +367,224 @@ HttpResponse HttpClient::Get(const std::string& url, const HttpHeaders& headers)
     return executeRequest("GET", url, "", "", headers);
 }
 
-HttpResponse HttpClient::Post(const std::string& url, const std::string& payload,
+HttpResponse HttpClient::Post(const std::string& url, const DataView& payload,
                               const std::string& contentType, const HttpHeaders& headers) {
     return executeRequest("POST", url, payload, contentType, headers);
 }
 
-HttpResponse HttpClient::Put(const std::string& url, const std::string& payload,
+HttpResponse HttpClient::Put(const std::string& url, const DataView& payload,
                              const std::string& contentType, const HttpHeaders& headers) {
     return executeRequest("PUT", url, payload, contentType, headers);
 }
 
-HttpResponse HttpClient::Delete(const std::string& url, const std::string& payload,
+HttpResponse HttpClient::Delete(const std::string& url, const DataView& payload,
                                 const std::string& contentType, const HttpHeaders& headers) {
     return executeRequest("DELETE", url, payload, contentType, headers);
 }
 
-bool HttpClient::Download(const std::string& url, std::function<bool(const char* data, size_t size)> onChunk, const HttpHeaders& headers) {
-    try {
-        UrlInfo urlInfo = UrlInfo::parseUrl(url);
-        socket.reset(new Socket());
-        if (!socket->connect(urlInfo.host, urlInfo.port)) return false;
+HttpResponse HttpClient::Post(const std::string& url, const RequestBody& body,
+                              const std::string& contentType, const HttpHeaders& headers) {
+    return executeUpload("POST", url, body, contentType, headers);
+}
 
-        std::string request = buildHttpRequest("GET", urlInfo, "", "", headers);
-        if (!socket->send(request)) return false;
+HttpResponse HttpClient::Put(const std::string& url, const RequestBody& body,
+                             const std::string& contentType, const HttpHeaders& headers) {
+    return executeUpload("PUT", url, body, contentType, headers);
+}
 
-        std::string headersStr;
-        while (true) {
-            std::string chunk = socket->receiveChunk(1);
-            if (chunk.empty()) return false;
-            headersStr += chunk;
-            if (headersStr.find("\r\n\r\n") != std::string::npos) break;
-        }
-        size_t bodyStart = headersStr.find("\r\n\r\n") + 4;
+// Makes the timestamps non-decreasing (phases that did not happen take the end of the previous
+// one), stamps the end of the request and reports it to HttpMetrics.
+static void finishTiming(HttpTiming& timing, const std::string& method, const std::string& url,
+                         const int& httpCode) {
+    timing.finished = HttpTiming::Clock::now();
+    timing.resolved = std::max(timing.resolved, timing.start);
+    timing.connected = std::max(timing.connected, timing.resolved);
+    timing.sent = std::max(timing.sent, timing.connected);
+    timing.firstByte = std::max(timing.firstByte, timing.sent);
+    timing.finished = std::max(timing.finished, timing.firstByte);
+
+    HttpMetrics& metrics = HttpMetrics::instance();
+    if (metrics.isActive())
+        metrics.record(method, url, httpCode, timing);
+}
 
-        if (bodyStart < headersStr.size()) {
-            if (!onChunk(headersStr.data() + bodyStart, headersStr.size() - bodyStart)) return false;
+// Takes over what the HTTP/2 connection measured for the stream.
+static void applyHttp2Timing(const Http2Result& result, HttpTiming& timing) {
+    timing.sent = std::max(timing.connected, result.sent);
+    timing.firstByte = std::max(timing.sent, result.firstByte);
+    timing.bytesSent += result.bytesSent;
+    timing.bytesReceived += result.bytesReceived;
+}
+
+static bool isIdempotent(const std::string& method) {
+    return method == "GET" || method == "HEAD" || method == "PUT" || method == "DELETE" ||
+           method == "OPTIONS" || method == "TRACE";
+}
+
+// Whether a receive that returned received ended because the peer closed or reset the
+// connection, rather than timing out.
+static bool peerDropped(const ssize_t& received) {
+    return received == 0 || errno == ECONNRESET || errno == ECONNABORTED || errno == EPIPE;
+}
+
+// A pooled connection may have been closed by the server while it sat idle. A request that failed
+// on one is sent again on a fresh connection only if the server cannot have acted on it: the
+// connection failed before the request was fully written, or it was closed or reset before a
+// response byte arrived and the method may be repeated. A timeout proves neither.
+static bool shouldRetryStale(const bool& reused, const bool& receivedAny, const bool& unsent,
+                             const bool& dropped, const std::string& method) {
+    return reused && !receivedAny && (unsent || (dropped && isIdempotent(method)));
+}
+
+// Body handler state of one Download attempt.
+struct DownloadDecoding {
+    Decompressor* decoder;
+    const HttpResponseParser* parser;
+    const std::function<bool(const char* data, size_t size)>* onChunk;
+    // When set, gets the response head before the first body byte and may refuse the body.
+    const std::function<bool(const HttpResponse& head)>* onHead;
+    const Buffer* buffer;
+    bool started;
+    bool active;
+    bool refused;
+
+    // Runs once the headers are parsed, while the head is still at the start of the buffer
+    // (until the first consumeParsed()).
+    bool begin() {
+        started = true;
+        if (*onHead) {
+            HttpResponse head;
+            parser->copyHead(buffer->data(), head);
+            refused = !(*onHead)(head);
+            if (refused)
+                return false;
         }
+        const ContentEncoding encoding = parser->getContentEncoding();
+        active = decoder && encoding != ContentEncoding::Identity &&
+                 Decompressor::isSupported(encoding);
+        return !active || decoder->begin(encoding);
+    }
+
+    bool feed(const char* data, const size_t& size) {
+        if (!started && !begin())
+            return false;
+        return active ? decoder->decompress(data, size, *onChunk) : (*onChunk)(data, size);
+    }
+};
+
+bool HttpClient::Download(const std::string& url,
+                          std::function<bool(const char* data, size_t size)> onChunk,
+                          const HttpHeaders& headers, HttpTiming* timing) {
+    HttpTiming localTiming;
+    return downloadStream(url, onChunk, headers, timing ? *timing : localTiming, nullptr,
+                          decompression);
+}
+
+bool HttpClient::downloadStream(const std::string& url,
+                                const std::function<bool(const char* data, size_t size)>& onChunk,
+                                const HttpHeaders& headers, HttpTiming& measured,
+                                const std::function<bool(const HttpResponse& head)>& onHead,
+                                const bool& decode) {
+    static const size_t kReadSize = 65536;
+
+    measured.begin();
+    int statusCode = -1;
+
+    try {
+        std::unique_ptr<RequestScratch> scratch = scratchPool->acquire();
+        UrlInfo& urlInfo = scratch->urlInfo;
+        UrlInfo::parseUrl(url, urlInfo);
+        std::unique_ptr<Buffer> head = bufferPool->acquire();
+        buildHttpRequest(*head, "GET", urlInfo, 0, "", headers, !keepAlive);
+        const DataView request(head->data(), head->size());
+
+        bool completed = false;
+        for (int attempt = 0; attempt < 2; ++attempt) {
+            bool reused = false;
+            std::unique_ptr<Socket> socket = openConnection(urlInfo, reused, measured);
+            if (!socket)
+                break;
+
+            // Body bytes go to onChunk straight from the receive buffer with the chunked framing
+            // stripped; only a partial chunk-size line is ever carried over between reads.
+            HttpResponseParser& parser = scratch->parser;
+            parser.reset();
+
+            // The decoder is picked when the first body bytes arrive, once Content-Encoding is
+            // known, and inflates each received piece straight into onChunk.
+            std::unique_ptr<Buffer> buffer = bufferPool->acquire();
+            DownloadDecoding decoding = {decode ? &scratch->decompressor : nullptr,
+                                         &parser,
+                                         &onChunk,
+                                         &onHead,
+                                         buffer.get(),
+                                         false,
+                                         false,
+                                         false};
+            parser.setBodyHandler([&decoding](const char* data, size_t size) {
+                return decoding.feed(data, size);
+            });
+
+            bool receivedAny = false;
+            bool unsent = false;
+            bool dropped = false;
+
+            if (socket->send(&request, 1)) {
+                measured.sent = HttpTiming::Clock::now();
+                measured.bytesSent += request.size;
+                while (!parser.isComplete()) {
+                    const ssize_t received = socket->receiveInto(*buffer, kReadSize);
+                    if (received < 0 && errno == EINTR)
+                        continue;
+                    if (received <= 0) {
+                        // Only an orderly close ends a close-delimited body; a timeout or a
+                        // reset leaves it truncated.
+                        dropped = peerDropped(received);
+                        if (received == 0)
+                            parser.finishOnClose();
+                        break;
+                    }
+
+                    if (!receivedAny)
+                        measured.firstByte = HttpTiming::Clock::now();
+                    measured.bytesReceived += received;
+                    receivedAny = true;
+                    if (!parser.parse(buffer->data(), buffer->size()))
+                        break;
+                    // Bodiless responses never reach the body handler.
+                    if (!decoding.started && parser.headersComplete() && !decoding.begin())
+                        break;
+                    buffer->consume(parser.consumeParsed());
+                }
+            } else {
+                unsent = errno != ETIMEDOUT;
+            }
+
+            const bool drained = buffer->size() == parser.messageEnd();
+            bufferPool->release(std::move(buffer));
+
+            if (shouldRetryStale(reused, receivedAny, unsent, dropped, "GET"))
+                continue;
 
-        while (true) {
-            std::string chunk = socket->receiveChunk(8192);
-            if (chunk.empty()) break;
-            if (!onChunk(chunk.data(), chunk.size())) return false;
+            completed = parser.isComplete() && !decoding.refused &&
+                        (!decoding.active || decoding.decoder->isFinished());
+            if (completed)
+                statusCode = parser.getStatusCode();
+            if (completed && keepAlive && parser.keepAlive() && drained)
+                connectionPool->release(urlInfo.host, urlInfo.port, std::move(socket));
+            break;
         }
-        return true;
+
+        // The scratch parser goes back to buffering bodies for the next request.
+        scratch->parser.setBodyHandler(nullptr);
+        bufferPool->release(std::move(head));
+        scratchPool->release(std::move(scratch));
     } catch (...) {
-        return false;
+        statusCode = -1;
     }
+
+    finishTiming(measured, "GET", url, statusCode);
+    return statusCode != -1;
 }
 
 void HttpClient::setTimeout(const int& seconds) {
@@ -197,239 +595,1540 @@ void HttpClient::setUserAgent(const std::string& agent) {
     userAgent = agent;
 }
 
+void HttpClient::setKeepAlive(const bool& enabled) {
+    keepAlive = enabled;
+    if (!keepAlive)
+        connectionPool->clear();
+}
+
+void HttpClient::setDecompression(const bool& enabled) {
+    decompression = enabled;
+}
+
+void HttpClient::setRequestCompression(const size_t& minSize) {
+    requestCompressionThreshold = minSize;
+}
+
+void HttpClient::setHttp2(const Http2Mode& mode) {
+    http2Mode = mode;
+    if (http2Mode == Http2Mode::Disabled)
+        http2Pool->closeIdle();
+}
+
+void HttpClient::setConnectionPoolConfig(const ConnectionPoolConfig& config) {
+    connectionPool->setConfig(config);
+}
+
+void HttpClient::setSocketOptions(const SocketOptions& options) {
+    socketOptions = options;
+}
+
+void HttpClient::setSocketOptions(const std::string& host, const SocketOptions& options) {
+    hostSocketOptions[host] = options;
+}
+
+const SocketOptions& HttpClient::socketOptionsFor(const std::string& host) const {
+    const auto it = hostSocketOptions.find(host);
+    return it != hostSocketOptions.end() ? it->second : socketOptions;
+}
+
+void HttpClient::setUnixSocket(const std::string& host, const std::string& path) {
+    if (path.empty())
+        unixSockets.erase(host);
+    else
+        unixSockets[host] = path;
+}
+
+const std::string& HttpClient::unixSocketFor(const UrlInfo& urlInfo) const {
+    static const std::string kNone;
+    if (isUnixScheme(urlInfo))
+        return urlInfo.host;
+    const auto it = unixSockets.find(urlInfo.host);
+    return it != unixSockets.end() ? it->second : kNone;
+}
+
+// A target with a Unix domain socket has that as its only address; other hosts are resolved
+// through the DNS cache.
+static bool resolveTarget(const UrlInfo& urlInfo, const std::string& unixPath,
+                          std::vector<SocketAddress>& addresses) {
+    if (unixPath.empty())
+        return DnsCache::instance().resolve(urlInfo.host, urlInfo.port, addresses);
+    addresses.resize(1);
+    return SocketAddress::fromUnixPath(unixPath, addresses[0]);
+}
+
+// Like resolveTarget, but only answers from the cache; returns false when a DNS lookup is
+// needed. addresses is left empty when the target cannot be resolved.
+static bool resolveTargetNow(const UrlInfo& urlInfo, const std::string& unixPath,
+                             std::vector<SocketAddress>& addresses) {
+    if (unixPath.empty())
+        return DnsCache::instance().resolveIfCached(urlInfo.host, urlInfo.port, addresses);
+    if (!resolveTarget(urlInfo, unixPath, addresses))
+        addresses.clear();
+    return true;
+}
+
+void HttpClient::closeIdleConnections() {
+    connectionPool->clear();
+    http2Pool->closeIdle();
+}
+
+void HttpClient::setAsyncThreads(const size_t& threads) {
+    eventLoops->setThreadCount(threads);
+}
+
+void HttpClient::setExecutorConfig(const ExecutorConfig& config) {
+    executor->setConfig(config);
+}
+
+void HttpClient::setResponseCache(const ResponseCacheConfig& config) {
+    responseCache.reset(new ResponseCache(config));
+}
+
+void HttpClient::disableResponseCache() {
+    responseCache.reset();
+}
+
+ResponseCacheStats HttpClient::getResponseCacheStats() const {
+    return responseCache ? responseCache->getStats() : ResponseCacheStats();
+}
+
+void HttpClient::clearResponseCache() {
+    if (responseCache)
+        responseCache->clear();
+}
+
+void HttpClient::setRequestCoalescing(const bool& enabled) {
+    if (!enabled)
+        singleFlight.reset();
+    else if (!singleFlight)
+        singleFlight.reset(new SingleFlight());
+}
+
+SingleFlightStats HttpClient::getRequestCoalescingStats() const {
+    return singleFlight ? singleFlight->getStats() : SingleFlightStats();
+}
+
+void HttpClient::setSharedBodies(const bool& enabled) {
+    sharedBodies = enabled;
+}
+
+std::unique_ptr<Socket> HttpClient::openConnection(const UrlInfo& urlInfo, bool& reused,
+                                                   HttpTiming& timing) {
+    reused = false;
+    if (keepAlive) {
+        std::unique_ptr<Socket> pooled = connectionPool->acquire(urlInfo.host, urlInfo.port);
+        if (pooled) {
+            reused = true;
+            timing.connectionReused = true;
+            timing.resolved = timing.connected = HttpTiming::Clock::now();
+            pooled->setTimeout(timeoutSeconds * 1000);
+            return pooled;
+        }
+    }
+
+    timing.connectionReused = false;
+    std::vector<SocketAddress> addresses;
+    const bool resolved = resolveTarget(urlInfo, unixSocketFor(urlInfo), addresses);
+    timing.resolved = HttpTiming::Clock::now();
+    if (!resolved)
+        return nullptr;
+
+    std::unique_ptr<Socket> fresh(new Socket());
+    fresh->setTimeout(timeoutSeconds * 1000);
+    fresh->setOptions(socketOptionsFor(urlInfo.host));
+    const bool connected = fresh->connect(addresses);
+    timing.connected = HttpTiming::Clock::now();
+    if (!connected)
+        return nullptr;
+    return fresh;
+}
+
+// Writes "host:port" into out without temporaries.
+static void formatRemoteAddr(const UrlInfo& urlInfo, std::string& out) {
+    char digits[8];
+    size_t pos = sizeof(digits);
+    int remaining = urlInfo.port;
+    do {
+        digits[--pos] = static_cast<char>('0' + remaining % 10);
+        remaining /= 10;
+    } while (remaining > 0);
+
+    out.assign(urlInfo.host);
+    if (isUnixScheme(urlInfo))
+        return;
+    out.push_back(':');
+    out.append(digits + pos, sizeof(digits) - pos);
+}
+
+// Writes the Host / :authority value: the host, bracketed when it is an IPv6 literal, and the
+// port unless it is the default one. An http+unix URL names no host; localhost stands in.
+static void formatAuthority(const UrlInfo& urlInfo, std::string& out) {
+    out.clear();
+    if (isUnixScheme(urlInfo)) {
+        out.append("localhost");
+        return;
+    }
+    const bool ipv6 = urlInfo.host.find(':') != std::string::npos;
+    if (ipv6)
+        out.push_back('[');
+    out.append(urlInfo.host);
+    if (ipv6)
+        out.push_back(']');
+    if (urlInfo.port != 80 && urlInfo.port != 443) {
+        out.push_back(':');
+        out.append(std::to_string(urlInfo.port));
+    }
+}
+
 HttpResponse HttpClient::executeRequest(const std::string& method, const std::string& url,
-                                        const std::string& payload, const std::string& contentType,
+                                        const DataView& payload, const std::string& contentType,
                                         const HttpHeaders& headers) {
     HttpResponse response;
-    response.url = url;
+    executeRequest(response, method, url, payload, contentType, headers);
+    return response;
+}
 
+std::future<HttpResponse> HttpClient::submitRequest(const std::string& method,
+                                                    const std::string& url,
+                                                    const DataView& payload,
+                                                    const std::string& contentType,
+                                                    const HttpHeaders& headers) {
+    // The request runs after this call returns, so it keeps its own copy of the payload.
+    std::shared_ptr<Request> request = std::make_shared<Request>(
+        method, url, std::string(payload.data, payload.size), contentType, headers);
+    std::shared_ptr<std::promise<HttpResponse>> promise =
+        std::make_shared<std::promise<HttpResponse>>();
+    std::future<HttpResponse> future = promise->get_future();
+
+    // Requests are limited per host:port.
+    std::string key;
     try {
-        UrlInfo urlInfo = UrlInfo::parseUrl(url);
-        response.path = urlInfo.path;
-        response.remoteAddr = urlInfo.host + ":" + std::to_string(urlInfo.port);
-
-        socket.reset(new Socket());
+        UrlInfo urlInfo;
+        UrlInfo::parseUrl(url, urlInfo);
+        formatRemoteAddr(urlInfo, key);
+    } catch (...) {
+    }
 
-        if (!socket->connect(urlInfo.host, urlInfo.port)) {
+    const bool queued = executor->submit(key, [this, request, promise](const bool& cancelled) {
+        HttpResponse response;
+        if (cancelled) {
+            response.url = request->url;
             response.httpCode = -1;
-            return response;
+        } else {
+            executeRequest(response, request->method, request->url, request->payload,
+                           request->contentType, request->headers);
         }
+        promise->set_value(std::move(response));
+    });
+    if (!queued)
+        return std::future<HttpResponse>();
+    return future;
+}
 
-        std::string request = buildHttpRequest(method, urlInfo, payload, contentType, headers);
+std::future<HttpResponse> HttpClient::getFuture(const std::string& url,
+                                                const HttpHeaders& headers) {
+    return submitRequest("GET", url, "", "", headers);
+}
 
-        if (!socket->send(request)) {
-            response.httpCode = -1;
-            return response;
+std::future<HttpResponse> HttpClient::postFuture(const std::string& url, const DataView& payload,
+                                                 const std::string& contentType,
+                                                 const HttpHeaders& headers) {
+    return submitRequest("POST", url, payload, contentType, headers);
+}
+
+bool HttpClient::executeRequest(HttpResponse& response, const std::string& method,
+                                const std::string& url, const DataView& payload,
+                                const std::string& contentType, const HttpHeaders& headers) {
+    // Only safe requests without a body may stand in for one another.
+    if (!singleFlight || !payload.empty() || (method != "GET" && method != "HEAD"))
+        return dispatchRequest(response, method, url, payload, contentType, headers);
+
+    return singleFlight->run(SingleFlight::makeKey(method, url, headers), response,
+                             [&](HttpResponse& leader) {
+                                 return dispatchRequest(leader, method, url, payload,
+                                                        contentType, headers);
+                             },
+                             sharedBodies);
+}
+
+bool HttpClient::dispatchRequest(HttpResponse& response, const std::string& method,
+                                 const std::string& url, const DataView& payload,
+                                 const std::string& contentType, const HttpHeaders& headers) {
+    if (!responseCache)
+        return sendRequest(response, method, url, payload, contentType, headers);
+    if (method == "GET")
+        return executeCached(response, url, headers);
+
+    const bool sent = sendRequest(response, method, url, payload, contentType, headers);
+    // What a successful unsafe request changed is no longer what the cache holds.
+    if (sent && method != "HEAD" && method != "OPTIONS" && response.httpCode < 400)
+        responseCache->invalidate(url);
+    return sent;
+}
+
+// Fresh entries are answered without a request; stale ones are revalidated with their ETag or
+// Last-Modified, and a 304 serves the stored body.
+bool HttpClient::executeCached(HttpResponse& response, const std::string& url,
+                               const HttpHeaders& headers) {
+    ResponseCache::Match match;
+    const ResponseCache::Lookup lookup = responseCache->lookup(url, headers, match);
+    if (lookup == ResponseCache::Lookup::Bypass)
+        return sendRequest(response, "GET", url, DataView(), "", headers);
+
+    if (lookup == ResponseCache::Lookup::Fresh) {
+        response.url.assign(url);
+        response.timing.begin();
+        ResponseCache::serve(match, response, sharedBodies);
+        finishTiming(response.timing, "GET", url, response.httpCode);
+        return true;
+    }
+
+    if (lookup == ResponseCache::Lookup::Stale) {
+        HttpHeaders conditional(headers);
+        ResponseCache::addValidators(match, conditional);
+        sendRequest(response, "GET", url, DataView(), "", conditional);
+        if (response.httpCode == 304) {
+            responseCache->revalidated(url, headers, match, response, sharedBodies);
+            return true;
         }
+    } else {
+        sendRequest(response, "GET", url, DataView(), "", headers);
+    }
+
+    responseCache->store(url, headers, response, sharedBodies);
+    return response.httpCode != -1;
+}
 
-        std::string rawResponse;
-        std::string chunk;
+bool HttpClient::sendRequest(HttpResponse& response, const std::string& method,
+                             const std::string& url, const DataView& payload,
+                             const std::string& contentType, const HttpHeaders& headers) {
+    // Every field is overwritten with assign() so a reused response keeps its capacity; its
+    // headers are overwritten by copyHead once a response arrives.
+    response.url.assign(url);
+    response.path.clear();
+    response.remoteAddr.clear();
+    response.body.clear();
+    response.sharedBody.reset();
+    response.statusText.clear();
+    response.protocol.clear();
+    response.contentLength = 0;
+    response.httpCode = -1;
+    HttpTiming& timing = response.timing;
+    timing.begin();
 
-        while (!(chunk = socket->receiveChunk()).empty()) {
-            rawResponse += chunk;
+    try {
+        std::unique_ptr<RequestScratch> scratch = scratchPool->acquire();
+        UrlInfo& urlInfo = scratch->urlInfo;
+        UrlInfo::parseUrl(url, urlInfo);
+        response.path.assign(urlInfo.path);
+        formatRemoteAddr(urlInfo, response.remoteAddr);
+
+        const bool headRequest = method == "HEAD";
+        std::unique_ptr<Buffer> head = bufferPool->acquire();
+        std::unique_ptr<Buffer> compressed;
+        DataView body = payload;
+        bool gzipBody = false;
+        if (requestCompressionThreshold > 0 && payload.size >= requestCompressionThreshold) {
+            compressed = bufferPool->acquire();
+            gzipBody = compressPayload(payload, *compressed);
+            if (gzipBody)
+                body = DataView(compressed->data(), compressed->size());
         }
+        Decompressor* decompressor = decompression ? &scratch->decompressor : nullptr;
+
+        // Hosts that turn out not to speak HTTP/2 are served by the HTTP/1.1 path below.
+        const bool handled = http2Mode != Http2Mode::Disabled &&
+                             executeHttp2(response, method, urlInfo, body, contentType, headers,
+                                          gzipBody, decompressor);
+        if (!handled)
+            buildHttpRequest(*head, method, urlInfo, body.size, contentType, headers, !keepAlive,
+                             gzipBody);
+
+        // The head and the payload go out in one sendmsg; the caller's payload is not copied.
+        const DataView request[] = {DataView(head->data(), head->size()), body};
+
+        // A stale pooled connection is retried once on a fresh one (see shouldRetryStale).
+        for (int attempt = 0; attempt < 2 && !handled; ++attempt) {
+            bool reused = false;
+            std::unique_ptr<Socket> connection = openConnection(urlInfo, reused, timing);
+            if (!connection)
+                break;
+
+            std::unique_ptr<Buffer> buffer = bufferPool->acquire();
+            HttpResponseParser& parser = scratch->parser;
+            parser.reset(headRequest);
+            bool unsent = false;
+            bool dropped = false;
+            if (connection->send(request, 2)) {
+                timing.sent = HttpTiming::Clock::now();
+                timing.bytesSent += request[0].size + request[1].size;
+                receiveResponse(*connection, parser, *buffer, timing, dropped);
+            } else {
+                unsent = errno != ETIMEDOUT;
+            }
 
-        response = parseHttpResponse(rawResponse);
-        response.url = url;
+            const bool receivedAny = !buffer->empty();
+            if (parser.isComplete()) {
+                if (keepAlive && parser.keepAlive() && parser.messageEnd() == buffer->size())
+                    connectionPool->release(urlInfo.host, urlInfo.port, std::move(connection));
+                extractResponse(parser, *buffer, response, decompressor);
+            }
+            bufferPool->release(std::move(buffer));
+
+            if (!shouldRetryStale(reused, receivedAny, unsent, dropped, method))
+                break;
+        }
+
+        bufferPool->release(std::move(head));
+        bufferPool->release(std::move(compressed));
+        scratchPool->release(std::move(scratch));
+    } catch (...) {
+        response.httpCode = -1;
+    }
+
+    if (response.httpCode == -1)
+        response.headers.clear();
+    finishTiming(timing, method, url, response.httpCode);
+    return response.httpCode != -1;
+}
+
+// Reads the answer to Expect: 100-continue into buffer. Returns true when the body should follow:
+// after 100 Continue, or when the server stays silent for timeoutMs (not every server honours
+// the expectation). Returns false when a final response or an error came instead.
+static bool awaitContinue(const Socket& connection, HttpResponseParser& parser, Buffer& buffer,
+                          HttpTiming& timing, const int& timeoutMs) {
+    const HttpTiming::Clock::time_point deadline =
+        HttpTiming::Clock::now() + std::chrono::milliseconds(timeoutMs);
+    while (true) {
+        const auto left = std::chrono::duration_cast<std::chrono::milliseconds>(
+                              deadline - HttpTiming::Clock::now())
+                              .count();
+        if (left <= 0 || !connection.waitReadable(static_cast<int>(left)))
+            return true;
+
+        const ssize_t received = connection.receiveInto(buffer);
+        if (received < 0 && errno == EINTR)
+            continue;
+        if (received <= 0) {
+            if (received == 0)
+                parser.finishOnClose();
+            return false;
+        }
+        if (buffer.size() == static_cast<size_t>(received))
+            timing.firstByte = HttpTiming::Clock::now();
+        timing.bytesReceived += received;
+        if (!parser.parse(buffer.data(), buffer.size()) || parser.headersComplete())
+            return false;
+        // The parser skips interim responses; the current one starting later means it did.
+        if (parser.messageBegin() > 0)
+            return true;
+    }
+}
+
+// Size of the chunks a RequestBody::Reader is asked for.
+static const size_t kUploadChunkSize = 64 * 1024;
+
+// Sends what reader produces as chunks, then the last chunk. aborted is set when the reader
+// gave up, as opposed to the connection failing.
+static bool sendChunked(const Socket& connection, const RequestBody::Reader& reader,
+                        Buffer& chunk, uint64_t& bytesSent, bool& aborted) {
+    chunk.clear();
+    chunk.ensureWritable(kUploadChunkSize);
+    char sizeLine[24];
+    while (true) {
+        ssize_t produced = -1;
+        try {
+            produced = reader(chunk.writePtr(), kUploadChunkSize);
+        } catch (...) {
+        }
+        if (produced < 0 || static_cast<size_t>(produced) > kUploadChunkSize) {
+            aborted = true;
+            return false;
+        }
+        if (produced == 0)
+            break;
+
+        const int lineLength = std::snprintf(sizeLine, sizeof(sizeLine), "%zx\r\n",
+                                             static_cast<size_t>(produced));
+        const DataView parts[] = {DataView(sizeLine, lineLength),
+                                  DataView(chunk.writePtr(), produced), DataView("\r\n", 2)};
+        if (!connection.send(parts, 3))
+            return false;
+        bytesSent += lineLength + produced + 2;
+    }
+
+    const DataView lastChunk("0\r\n\r\n", 5);
+    if (!connection.send(&lastChunk, 1))
+        return false;
+    bytesSent += 5;
+    return true;
+}
+
+// Like sendRequest, but the body is streamed: sendfile for files, chunked for readers. A reader
+// cannot be rewound, so the stale keep-alive retry only happens before it was first called.
+HttpResponse HttpClient::executeUpload(const std::string& method, const std::string& url,
+                                       const RequestBody& body, const std::string& contentType,
+                                       const HttpHeaders& headers) {
+    HttpResponse response;
+    response.url = url;
+    response.httpCode = -1;
+    HttpTiming& timing = response.timing;
+    timing.begin();
+
+    const bool chunked = body.source == RequestBody::Source::Reader;
+    int fd = body.source == RequestBody::Source::File ? body.fd : -1;
+    if (body.source == RequestBody::Source::Path)
+        fd = ::open(body.path.c_str(), O_RDONLY | O_CLOEXEC);
+
+    try {
+        UrlInfo urlInfo = UrlInfo::parseUrl(url);
         response.path = urlInfo.path;
-        response.remoteAddr = urlInfo.host + ":" + std::to_string(urlInfo.port);
+        formatRemoteAddr(urlInfo, response.remoteAddr);
+
+        size_t length = 0;
+        struct stat info;
+        if (!chunked) {
+            if (fd < 0 || fstat(fd, &info) != 0)
+                throw std::runtime_error("Cannot read the request body file");
+            // Only regular files have a size to check against; a pipe needs an explicit length.
+            int64_t available = body.length;
+            if (S_ISREG(info.st_mode))
+                available = static_cast<int64_t>(info.st_size) - body.offset;
+            if (body.offset < 0 || available < 0 || body.length > available)
+                throw std::runtime_error("Request body range is outside the file");
+            length = static_cast<size_t>(body.length >= 0 ? body.length : available);
+        }
+
+        HttpHeaders requestHeaders(headers);
+        if (body.expectContinue)
+            requestHeaders.setHeader("Expect", "100-continue");
+
+        std::unique_ptr<RequestScratch> scratch = scratchPool->acquire();
+        std::unique_ptr<Buffer> head = bufferPool->acquire();
+        buildHttpRequest(*head, method, urlInfo, length, contentType, requestHeaders, !keepAlive,
+                         false, chunked);
+        Decompressor* decompressor = decompression ? &scratch->decompressor : nullptr;
+
+        bool readerCalled = false;
+        for (int attempt = 0; attempt < 2; ++attempt) {
+            bool reused = false;
+            std::unique_ptr<Socket> connection = openConnection(urlInfo, reused, timing);
+            if (!connection)
+                break;
+
+            std::unique_ptr<Buffer> buffer = bufferPool->acquire();
+            HttpResponseParser& parser = scratch->parser;
+            parser.reset(method == "HEAD");
+            bool bodySent = false;
+            bool aborted = false;
+            bool unsent = false;
+            bool dropped = false;
+            const DataView requestHead(head->data(), head->size());
+            if (connection->send(&requestHead, 1)) {
+                timing.bytesSent += head->size();
+                if (!body.expectContinue ||
+                    awaitContinue(*connection, parser, *buffer, timing, body.continueTimeoutMs)) {
+                    if (chunked) {
+                        readerCalled = true;
+                        std::unique_ptr<Buffer> chunk = bufferPool->acquire();
+                        bodySent = sendChunked(*connection, body.reader, *chunk, timing.bytesSent,
+                                               aborted);
+                        bufferPool->release(std::move(chunk));
+                    } else {
+                        bodySent = connection->sendFile(fd, body.offset, length);
+                        if (bodySent)
+                            timing.bytesSent += length;
+                    }
+                    unsent = !bodySent && !aborted && errno != ETIMEDOUT;
+                } else {
+                    // Closed while waiting for 100 Continue; the body never went out.
+                    unsent = buffer->empty();
+                }
+                timing.sent = HttpTiming::Clock::now();
+                // A server refusing the body mid-way may still have answered before closing.
+                if (!aborted)
+                    receiveResponse(*connection, parser, *buffer, timing, dropped);
+            } else {
+                unsent = errno != ETIMEDOUT;
+            }
+
+            const bool receivedAny = !buffer->empty();
+            if (parser.isComplete()) {
+                // Without the whole body sent, the server cannot find the next request.
+                if (keepAlive && bodySent && parser.keepAlive() &&
+                    parser.messageEnd() == buffer->size())
+                    connectionPool->release(urlInfo.host, urlInfo.port, std::move(connection));
+                extractResponse(parser, *buffer, response, decompressor);
+            }
+            bufferPool->release(std::move(buffer));
 
+            if (aborted || readerCalled ||
+                !shouldRetryStale(reused, receivedAny, unsent, dropped, method))
+                break;
+        }
+
+        bufferPool->release(std::move(head));
+        scratchPool->release(std::move(scratch));
     } catch (...) {
         response.httpCode = -1;
     }
 
+    if (body.source == RequestBody::Source::Path && fd >= 0)
+        ::close(fd);
+    if (response.httpCode == -1)
+        response.headers.clear();
+    else if (responseCache && response.httpCode < 400)
+        responseCache->invalidate(url);
+    finishTiming(timing, method, url, response.httpCode);
     return response;
 }
 
-std::string HttpClient::buildHttpRequest(const std::string& method, const UrlInfo& urlInfo,
-                                         const std::string& payload, const std::string& contentType,
-                                         const HttpHeaders& headers) const {
-    std::stringstream request;
+// Collects HTTP/2 results for a caller waiting on the connection's reader thread.
+struct Http2Waiter {
+    std::mutex mutex;
+    std::condition_variable finished;
+    size_t remaining;
+    std::vector<Http2Result> results;
+
+    explicit Http2Waiter(const size_t& count) : remaining(count), results(count) {}
+
+    Http2Connection::Completion completion(const std::shared_ptr<Http2Waiter>& self,
+                                           const size_t& index) {
+        return [self, index](Http2Result& result) {
+            std::lock_guard<std::mutex> lock(self->mutex);
+            self->results[index] = std::move(result);
+            if (--self->remaining == 0)
+                self->finished.notify_all();
+        };
+    }
 
-    request << method << " " << urlInfo.path;
-    if (!urlInfo.query.empty())
-        request << "?" << urlInfo.query;
+    void wait() {
+        std::unique_lock<std::mutex> lock(mutex);
+        finished.wait(lock, [this] { return remaining == 0; });
+    }
+};
 
-    request << " HTTP/1.1\r\n";
+// Runs one request on the host's HTTP/2 connection. Returns false when the host only speaks
+// HTTP/1.1; a request the server did not process is resent once on a new connection.
+bool HttpClient::executeHttp2(HttpResponse& response, const std::string& method,
+                              const UrlInfo& urlInfo, const DataView& body,
+                              const std::string& contentType, const HttpHeaders& headers,
+                              const bool& gzipBody, Decompressor* decompressor) {
+    std::string authority;
+    formatAuthority(urlInfo, authority);
+    const int timeoutMs = timeoutSeconds * 1000;
+
+    HttpTiming& timing = response.timing;
+    for (int attempt = 0; attempt < 2; ++attempt) {
+        bool http1Only = false;
+        bool reused = false;
+        std::shared_ptr<Http2Connection> connection =
+            http2Pool->acquire(urlInfo.host, urlInfo.port, authority, http2Mode, timeoutMs,
+                               socketOptionsFor(urlInfo.host), unixSocketFor(urlInfo), http1Only,
+                               reused);
+        // Resolving, connecting and the HTTP/2 handshake all count as connecting.
+        timing.resolved = reused ? HttpTiming::Clock::now() : timing.start;
+        timing.connected = HttpTiming::Clock::now();
+        timing.connectionReused = reused;
+        if (!connection)
+            return !http1Only;
+
+        std::vector<HpackField> fields;
+        buildHttp2Request(fields, method, urlInfo, body.size, contentType, headers, gzipBody);
+        std::shared_ptr<Http2Waiter> waiter = std::make_shared<Http2Waiter>(1);
+        connection->submit(std::move(fields), body, timeoutMs, waiter->completion(waiter, 0));
+        waiter->wait();
+
+        Http2Result& result = waiter->results[0];
+        applyHttp2Timing(result, timing);
+        if (result.ok) {
+            extractHttp2Response(result, response, decompressor);
+            return true;
+        }
+        if (!result.retryable)
+            return true;
+    }
+    return true;
+}
 
-    request << "Host: " << urlInfo.host;
-    if (urlInfo.port != 80 && urlInfo.port != 443)
-        request << ":" << urlInfo.port;
+// Requests to the same host:port share one connection and are written back to back; responses
+// are matched to them in order. Non-idempotent requests are never pipelined because they could
+// not be resent safely, so they run one by one through executeRequest. Each is a barrier: the
+// requests before it are finished before it is sent, and those after it are sent after it.
+std::vector<HttpResponse> HttpClient::executePipelined(const std::vector<Request>& requests) {
+    std::vector<HttpResponse> responses(requests.size());
+    std::vector<UrlInfo> urls(requests.size());
+    std::vector<std::string> order;
+    std::map<std::string, std::vector<size_t>> groups;
+
+    const auto flush = [&]() {
+        for (const std::string& key : order) {
+            try {
+                pipelineGroup(requests, urls, groups[key], responses);
+            } catch (...) {
+            }
+        }
+        order.clear();
+        groups.clear();
+    };
+
+    for (size_t i = 0; i < requests.size(); ++i) {
+        const Request& request = requests[i];
+        if (!isIdempotent(request.method)) {
+            flush();
+            responses[i] = executeRequest(request.method, request.url, request.payload,
+                                          request.contentType, request.headers);
+            continue;
+        }
 
-    request << "\r\n";
+        HttpResponse& response = responses[i];
+        response.url = request.url;
+        response.httpCode = -1;
+        try {
+            urls[i] = UrlInfo::parseUrl(request.url);
+        } catch (...) {
+            continue;
+        }
+        response.path = urls[i].path;
+        formatRemoteAddr(urls[i], response.remoteAddr);
 
-    request << "User-Agent: " << userAgent << "\r\n";
-    request << "Connection: close\r\n";
+        std::vector<size_t>& group = groups[response.remoteAddr];
+        if (group.empty())
+            order.push_back(response.remoteAddr);
+        group.push_back(i);
+    }
 
-    for (const auto& header : headers.headers) {
-        request << header.first << ": " << header.second << "\r\n";
+    flush();
+    return responses;
+}
+
+void HttpClient::pipelineGroup(const std::vector<Request>& requests,
+                               const std::vector<UrlInfo>& urls, const std::vector<size_t>& indices,
+                               std::vector<HttpResponse>& responses) {
+    if (http2Mode != Http2Mode::Disabled && pipelineHttp2(requests, urls, indices, responses))
+        return;
+
+    const UrlInfo& target = urls[indices.front()];
+
+    std::unique_ptr<Buffer> heads = bufferPool->acquire();
+    std::vector<size_t> headEnds;
+    for (const size_t index : indices) {
+        const Request& request = requests[index];
+        buildHttpRequest(*heads, request.method, urls[index], request.payload.size(),
+                         request.contentType, request.headers, !keepAlive);
+        headEnds.push_back(heads->size());
     }
 
-    if (!payload.empty()) {
-        if (!contentType.empty()) {
-            request << "Content-Type: " << contentType << "\r\n";
-        } else {
-            request << "Content-Type: application/x-www-form-urlencoded\r\n";
+    // Every request of the group starts now; each one takes the connect phases of the
+    // connection it is (re)sent on.
+    HttpTiming timing;
+    timing.begin();
+    for (const size_t index : indices)
+        responses[index].timing = timing;
+
+    size_t next = 0;
+    while (next < indices.size()) {
+        bool reused = false;
+        std::unique_ptr<Socket> connection = openConnection(target, reused, timing);
+        for (size_t k = next; k < indices.size(); ++k) {
+            HttpTiming& pendingTiming = responses[indices[k]].timing;
+            pendingTiming.resolved = timing.resolved;
+            pendingTiming.connected = timing.connected;
+            pendingTiming.connectionReused = timing.connectionReused;
         }
-        request << "Content-Length: " << payload.length() << "\r\n";
+        if (!connection)
+            break;
+
+        std::vector<DataView> parts;
+        std::vector<size_t> requestEnds;
+        std::vector<const Request*> pendingRequests;
+        std::vector<HttpResponse*> pending;
+        size_t end = 0;
+        for (size_t k = next; k < indices.size(); ++k) {
+            const Request& request = requests[indices[k]];
+            const size_t headStart = k == 0 ? 0 : headEnds[k - 1];
+            parts.push_back(DataView(heads->data() + headStart, headEnds[k] - headStart));
+            end += headEnds[k] - headStart;
+            if (!request.payload.empty()) {
+                parts.push_back(DataView(request.payload));
+                end += request.payload.size();
+            }
+            requestEnds.push_back(end);
+            pendingRequests.push_back(&request);
+            pending.push_back(&responses[indices[k]]);
+        }
+
+        bool reusable = false;
+        const size_t answered = exchangePipelined(*connection, parts, requestEnds,
+                                                  pendingRequests, pending, reusable);
+        next += answered;
+
+        if (keepAlive && reusable)
+            connectionPool->release(target.host, target.port, std::move(connection));
+
+        // The server closed the connection partway through; unanswered requests are resent on
+        // a new one unless even a fresh connection produced nothing.
+        if (answered == 0 && !reused)
+            break;
     }
 
-    request << "\r\n";
+    for (size_t k = next; k < indices.size(); ++k) {
+        const Request& request = requests[indices[k]];
+        finishTiming(responses[indices[k]].timing, request.method, request.url, -1);
+    }
+    bufferPool->release(std::move(heads));
+}
 
-    if (!payload.empty()) {
-        request << payload;
+// Over HTTP/2 the whole group is in flight at once as streams of one connection. Returns false
+// when the host only speaks HTTP/1.1.
+bool HttpClient::pipelineHttp2(const std::vector<Request>& requests,
+                               const std::vector<UrlInfo>& urls, const std::vector<size_t>& indices,
+                               std::vector<HttpResponse>& responses) {
+    const UrlInfo& target = urls[indices.front()];
+    std::string authority;
+    formatAuthority(target, authority);
+    const int timeoutMs = timeoutSeconds * 1000;
+
+    HttpTiming timing;
+    timing.begin();
+    bool http1Only = false;
+    bool reused = false;
+    std::shared_ptr<Http2Connection> connection =
+        http2Pool->acquire(target.host, target.port, authority, http2Mode, timeoutMs,
+                           socketOptionsFor(target.host), unixSocketFor(target), http1Only,
+                           reused);
+    timing.resolved = reused ? HttpTiming::Clock::now() : timing.start;
+    timing.connected = HttpTiming::Clock::now();
+    timing.connectionReused = reused;
+    if (!connection) {
+        if (http1Only)
+            return false;
+        for (const size_t index : indices) {
+            responses[index].timing = timing;
+            finishTiming(responses[index].timing, requests[index].method, requests[index].url,
+                         -1);
+        }
+        return true;
     }
 
-    return request.str();
+    std::shared_ptr<Http2Waiter> waiter = std::make_shared<Http2Waiter>(indices.size());
+    for (size_t k = 0; k < indices.size(); ++k) {
+        const Request& request = requests[indices[k]];
+        std::vector<HpackField> fields;
+        buildHttp2Request(fields, request.method, urls[indices[k]], request.payload.size(),
+                          request.contentType, request.headers);
+        connection->submit(std::move(fields), DataView(request.payload), timeoutMs,
+                           waiter->completion(waiter, k));
+    }
+    waiter->wait();
+
+    Decompressor decompressor;
+    for (size_t k = 0; k < indices.size(); ++k) {
+        const Request& request = requests[indices[k]];
+        Http2Result& result = waiter->results[k];
+        HttpResponse& response = responses[indices[k]];
+        if (!result.ok && result.retryable) {
+            executeRequest(response, request.method, request.url, request.payload,
+                           request.contentType, request.headers);
+            continue;
+        }
+        if (result.ok)
+            extractHttp2Response(result, response, decompression ? &decompressor : nullptr);
+        response.timing = timing;
+        applyHttp2Timing(result, response.timing);
+        finishTiming(response.timing, request.method, request.url, response.httpCode);
+    }
+    return true;
 }
 
-static std::string decodeChunkedBody(const std::string& chunked) {
-    std::istringstream stream(chunked);
-    std::string decoded;
-    while (true) {
-        std::string line;
-        if (!std::getline(stream, line)) break;
-        if (!line.empty() && line.back() == '\r') line.pop_back();
-        if (line.empty()) continue;
-        size_t chunkSize = 0;
-        std::istringstream(line) >> std::hex >> chunkSize;
-        if (chunkSize == 0) break;
-        std::string chunk(chunkSize, '\0');
-        stream.read(&chunk[0], chunkSize);
-        decoded += chunk;
-        stream.get();
-        stream.get();
-    }
-    return decoded;
-}
-
-HttpResponse HttpClient::parseHttpResponse(const std::string& rawResponse) {
-    HttpResponse response;
+size_t HttpClient::exchangePipelined(Socket& connection, const std::vector<DataView>& parts,
+                                     const std::vector<size_t>& requestEnds,
+                                     const std::vector<const Request*>& requests,
+                                     const std::vector<HttpResponse*>& responses,
+                                     bool& reusable) {
+    const size_t total = requestEnds.back();
+    std::unique_ptr<Buffer> buffer = bufferPool->acquire();
+    HttpResponseParser parser(requests.front()->method == "HEAD");
+    Decompressor decompressor;
+    size_t sent = 0;
+    size_t written = 0;
+    size_t answered = 0;
+    bool canWrite = true;
+    bool persistent = true;
+
+    // Reads and writes are interleaved so a long pipeline cannot deadlock with the server
+    // blocked on sending responses we are not reading yet.
+    const int waitMs = connection.getTimeout() > 0 ? connection.getTimeout() : -1;
+    connection.setNonBlocking(true);
+    while (answered < responses.size() && persistent) {
+        pollfd pfd = {};
+        pfd.fd = connection.getSocketFd();
+        pfd.events = POLLIN;
+        if (canWrite && sent < total)
+            pfd.events |= POLLOUT;
+
+        const int ready = poll(&pfd, 1, waitMs);
+        if (ready < 0 && errno == EINTR)
+            continue;
+        if (ready <= 0)
+            break;
 
-    if (rawResponse.empty()) {
-        response.httpCode = -1;
-        return response;
+        if ((pfd.revents & POLLOUT) && canWrite && sent < total) {
+            const ssize_t wrote = connection.sendSome(parts.data(), parts.size(), sent);
+            if (wrote > 0)
+                sent += wrote;
+            else if (wrote < 0 && errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)
+                canWrite = false;
+
+            const HttpTiming::Clock::time_point now = HttpTiming::Clock::now();
+            for (; written < requestEnds.size() && requestEnds[written] <= sent; ++written) {
+                const size_t start = written == 0 ? 0 : requestEnds[written - 1];
+                HttpTiming& timing = responses[written]->timing;
+                timing.sent = now;
+                timing.bytesSent += requestEnds[written] - start;
+            }
+        }
+
+        if (!(pfd.revents & (POLLIN | POLLHUP | POLLERR)))
+            continue;
+
+        const ssize_t received = connection.receiveInto(*buffer);
+        if (received < 0 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR))
+            continue;
+        if (received < 0)
+            break;
+        if (received == 0) {
+            parser.finishOnClose();
+        } else {
+            if (buffer->size() == static_cast<size_t>(received))
+                responses[answered]->timing.firstByte = HttpTiming::Clock::now();
+            parser.parse(buffer->data(), buffer->size());
+        }
+
+        while (parser.isComplete()) {
+            HttpResponse& response = *responses[answered];
+            extractResponse(parser, *buffer, response, decompression ? &decompressor : nullptr);
+            response.timing.bytesReceived += parser.messageEnd();
+            finishTiming(response.timing, requests[answered]->method, requests[answered]->url,
+                         response.httpCode);
+            persistent = parser.keepAlive();
+            buffer->consume(parser.messageEnd());
+            if (++answered == responses.size() || !persistent)
+                break;
+            // Whatever is left over is the start of the next response.
+            if (!buffer->empty())
+                responses[answered]->timing.firstByte = HttpTiming::Clock::now();
+            parser.reset(requests[answered]->method == "HEAD");
+            parser.parse(buffer->data(), buffer->size());
+        }
+
+        if (received <= 0 || parser.hasError())
+            break;
     }
+    connection.setNonBlocking(false);
 
-    size_t headerEnd = rawResponse.find("\r\n\r\n");
-    if (headerEnd == std::string::npos) {
-        response.httpCode = -1;
-        return response;
+    reusable = answered == responses.size() && persistent && buffer->empty();
+    bufferPool->release(std::move(buffer));
+    return answered;
+}
+
+static void appendText(Buffer& buffer, const std::string& text) {
+    buffer.append(text.data(), text.size());
+}
+
+static void appendText(Buffer& buffer, const char* text) {
+    buffer.append(text, std::strlen(text));
+}
+
+static void appendNumber(Buffer& buffer, const size_t& value) {
+    char digits[24];
+    size_t pos = sizeof(digits);
+    size_t remaining = value;
+    do {
+        digits[--pos] = static_cast<char>('0' + remaining % 10);
+        remaining /= 10;
+    } while (remaining > 0);
+    buffer.append(digits + pos, sizeof(digits) - pos);
+}
+
+void HttpClient::buildHttpRequest(Buffer& head, const std::string& method,
+                                  const UrlInfo& urlInfo, const size_t& payloadSize,
+                                  const std::string& contentType, const HttpHeaders& headers,
+                                  const bool& closeConnection, const bool& gzipBody,
+                                  const bool& chunkedBody) const {
+    appendText(head, method);
+    appendText(head, " ");
+    appendText(head, urlInfo.path);
+    if (!urlInfo.query.empty()) {
+        appendText(head, "?");
+        appendText(head, urlInfo.query);
     }
 
-    std::string headers = rawResponse.substr(0, headerEnd);
-    response.body = rawResponse.substr(headerEnd + 4);
+    appendText(head, " HTTP/1.1\r\nHost: ");
+    if (isUnixScheme(urlInfo)) {
+        appendText(head, "localhost");
+    } else if (urlInfo.host.find(':') != std::string::npos) {
+        appendText(head, "[");
+        appendText(head, urlInfo.host);
+        appendText(head, "]");
+    } else {
+        appendText(head, urlInfo.host);
+    }
+    if (urlInfo.port != 80 && urlInfo.port != 443) {
+        appendText(head, ":");
+        appendNumber(head, urlInfo.port);
+    }
 
-    std::istringstream headerStream(headers);
-    std::string statusLine;
-    std::getline(headerStream, statusLine);
+    appendText(head, "\r\nUser-Agent: ");
+    appendText(head, userAgent);
+    appendText(head, "\r\n");
+    if (closeConnection)
+        appendText(head, "Connection: close\r\n");
+    if (decompression && *Decompressor::acceptEncoding() && !headers.hasHeader("Accept-Encoding")) {
+        appendText(head, "Accept-Encoding: ");
+        appendText(head, Decompressor::acceptEncoding());
+        appendText(head, "\r\n");
+    }
+
+    for (const auto& header : headers.headers) {
+        appendText(head, header.first);
+        appendText(head, ": ");
+        appendText(head, header.second);
+        appendText(head, "\r\n");
+    }
+
+    if (payloadSize > 0 || chunkedBody) {
+        appendText(head, "Content-Type: ");
+        appendText(head, contentType.empty() ? "application/x-www-form-urlencoded" : contentType);
+        if (chunkedBody) {
+            appendText(head, "\r\nTransfer-Encoding: chunked\r\n");
+        } else {
+            appendText(head, "\r\nContent-Length: ");
+            appendNumber(head, payloadSize);
+            appendText(head, "\r\n");
+        }
+        if (gzipBody)
+            appendText(head, "Content-Encoding: gzip\r\n");
+    }
+
+    appendText(head, "\r\n");
+}
+
+// Connection-specific fields have no meaning in HTTP/2 and make the request malformed.
+static bool isHopByHop(const std::string& name) {
+    return name == "connection" || name == "keep-alive" || name == "proxy-connection" ||
+           name == "transfer-encoding" || name == "upgrade" || name == "host" || name == "te";
+}
 
-    if (!statusLine.empty() && statusLine.back() == '\r') {
-        statusLine.pop_back();
+void HttpClient::buildHttp2Request(std::vector<HpackField>& fields, const std::string& method,
+                                   const UrlInfo& urlInfo, const size_t& payloadSize,
+                                   const std::string& contentType, const HttpHeaders& headers,
+                                   const bool& gzipBody) const {
+    fields.push_back(HpackField(":method", method));
+    fields.push_back(HpackField(":scheme", "http"));
+    fields.push_back(HpackField(":authority", ""));
+    formatAuthority(urlInfo, fields.back().value);
+    fields.push_back(HpackField(":path", urlInfo.path));
+    if (!urlInfo.query.empty()) {
+        fields.back().value.push_back('?');
+        fields.back().value.append(urlInfo.query);
     }
 
-    std::istringstream statusStream(statusLine);
-    statusStream >> response.protocol >> response.httpCode;
+    fields.push_back(HpackField("user-agent", userAgent));
+    if (decompression && *Decompressor::acceptEncoding() && !headers.hasHeader("Accept-Encoding"))
+        fields.push_back(HpackField("accept-encoding", Decompressor::acceptEncoding()));
 
-    std::getline(statusStream, response.statusText);
-    if (!response.statusText.empty() && response.statusText.front() == ' ') {
-        response.statusText = response.statusText.substr(1);
+    for (const auto& header : headers.headers) {
+        HpackField field(header.first, header.second);
+        for (char& c : field.name)
+            c = static_cast<char>(std::tolower(static_cast<unsigned char>(c)));
+        if (!isHopByHop(field.name))
+            fields.push_back(std::move(field));
+    }
+
+    if (payloadSize > 0) {
+        fields.push_back(HpackField("content-type", contentType.empty()
+                                                        ? "application/x-www-form-urlencoded"
+                                                        : contentType));
+        fields.push_back(HpackField("content-length", std::to_string(payloadSize)));
+        if (gzipBody)
+            fields.push_back(HpackField("content-encoding", "gzip"));
     }
+}
+
+// Compression is only kept when it actually makes the payload smaller.
+bool HttpClient::compressPayload(const DataView& payload, Buffer& output) const {
+    output.clear();
+    return Compressor::gzip(payload.data, payload.size, output) && output.size() < payload.size;
+}
 
-    std::string headerLine;
-    bool isChunked = false;
-    size_t contentLength = 0;
-    while (std::getline(headerStream, headerLine)) {
-        if (headerLine.empty() || headerLine == "\r")
+bool HttpClient::receiveResponse(const Socket& connection, HttpResponseParser& parser,
+                                 Buffer& buffer, HttpTiming& timing, bool& dropped) {
+    while (!parser.isComplete()) {
+        const ssize_t received = connection.receiveInto(buffer);
+        if (received < 0 && errno == EINTR)
+            continue;
+        if (received <= 0) {
+            // Only an orderly close ends a close-delimited body; a timeout or a reset leaves it
+            // truncated.
+            dropped = peerDropped(received);
+            if (received == 0)
+                parser.finishOnClose();
             break;
+        }
+        if (buffer.size() == static_cast<size_t>(received))
+            timing.firstByte = HttpTiming::Clock::now();
+        timing.bytesReceived += received;
+        if (!parser.parse(buffer.data(), buffer.size()))
+            return false;
+    }
+    return parser.isComplete();
+}
 
-        if (headerLine.back() == '\r')
-            headerLine.pop_back();
+static bool shouldDecode(const Decompressor* decompressor, const ContentEncoding& encoding,
+                         const size_t& bodyLength) {
+    return decompressor && encoding != ContentEncoding::Identity && bodyLength > 0 &&
+           Decompressor::isSupported(encoding);
+}
 
-        size_t colonPos = headerLine.find(':');
-        if (colonPos != std::string::npos) {
-            std::string key = headerLine.substr(0, colonPos);
-            std::string value = headerLine.substr(colonPos + 1);
+// Decodes body into response.body; a corrupt body fails the response.
+static bool decodeBody(Decompressor& decompressor, const ContentEncoding& encoding,
+                       const char* body, const size_t& bodyLength, HttpResponse& response) {
+    std::string& decoded = response.body;
+    decoded.clear();
+    const bool ok = decompressor.begin(encoding) &&
+                    decompressor.decompress(body, bodyLength,
+                                            [&decoded](const char* data, size_t size) {
+                                                decoded.append(data, size);
+                                                return true;
+                                            }) &&
+                    decompressor.isFinished();
+    if (!ok) {
+        decoded.clear();
+        response.contentLength = 0;
+        response.httpCode = -1;
+        return false;
+    }
 
-            if (!value.empty() && value.front() == ' ')
-                value = value.substr(1);
+    response.contentLength = decoded.size();
+    return true;
+}
 
-            response.headers.addHeader(key, value);
+// Copies the parsed response out of the receive buffer. With a decompressor, a body in a
+// supported Content-Encoding is decoded on the way.
+bool HttpClient::extractResponse(const HttpResponseParser& parser, const Buffer& buffer,
+                                 HttpResponse& response, Decompressor* decompressor) {
+    parser.copyHead(buffer.data(), response);
+    const char* body = buffer.data() + parser.bodyOffset();
+    const ContentEncoding encoding = parser.getContentEncoding();
 
-            if (key == "Content-Length") {
-                try {
-                    contentLength = std::stoul(value);
-                    response.contentLength = contentLength;
-                } catch (...) {
-                    response.contentLength = 0;
-                }
-            }
-            if (key == "Transfer-Encoding" && value.find("chunked") != std::string::npos) {
-                isChunked = true;
-            }
-        }
+    if (!shouldDecode(decompressor, encoding, parser.bodyLength())) {
+        response.body.assign(body, parser.bodyLength());
+        return true;
     }
+    return decodeBody(*decompressor, encoding, body, parser.bodyLength(), response);
+}
 
-    if (isChunked) {
-        response.body = decodeChunkedBody(response.body);
-        response.contentLength = response.body.size();
-    } else if (contentLength > 0 && response.body.size() > contentLength) {
-        response.body = response.body.substr(0, contentLength);
+// Moves an HTTP/2 result into response; the body is taken over without a copy unless it has
+// to be decoded.
+bool HttpClient::extractHttp2Response(Http2Result& result, HttpResponse& response,
+                                      Decompressor* decompressor) {
+    response.httpCode = result.status;
+    response.protocol.assign("HTTP/2");
+    response.statusText.clear();
+    response.headers.clear();
+    response.contentLength = result.body.size();
+
+    ContentEncoding encoding = ContentEncoding::Identity;
+    for (const HpackField& field : result.headers) {
+        response.headers.addHeader(field.name, field.value);
+        if (field.name == "content-encoding")
+            encoding = Decompressor::parseEncoding(field.value.data(), field.value.size());
+        else if (field.name == "content-length" && result.body.empty())
+            response.contentLength = std::strtoul(field.value.c_str(), nullptr, 10);
     }
 
-    return response;
+    if (!shouldDecode(decompressor, encoding, result.body.size())) {
+        response.body.swap(result.body);
+        return true;
+    }
+    return decodeBody(*decompressor, encoding, result.body.data(), result.body.size(), response);
 }
 
-struct AsyncRequestData {
-    HttpClient* client;
+// State of one getAsync/postAsync exchange while it runs on an event loop.
+struct AsyncExchange {
+    ConnectionPool* pool;
+    BufferPool* buffers;
+    EventLoop* loop;
+    Executor* resolver;
+    Http2Pool* http2;
+    Http2Mode http2Mode;
+    std::string authority;
+    std::vector<HpackField> http2Fields;
+    UrlInfo urlInfo;
     std::string method;
     std::string url;
+    HttpTiming timing;
+    std::unique_ptr<Buffer> head;
     std::string payload;
-    std::string contentType;
-    HttpHeaders headers;
+    bool headRequest;
+    bool keepAlive;
+    bool decompression;
+    int timeoutMs;
+    SocketOptions socketOptions;
+    std::string unixPath;
+    bool reused;
+    int attempts;
+    std::unique_ptr<Buffer> buffer;
+    HttpResponseParser parser;
+    Decompressor decompressor;
     std::function<void(HttpResponse)> callback;
+    std::shared_ptr<AsyncHandle::State> state;
 };
 
-void* asyncRequestThread(void* arg) {
-    const auto* data = static_cast<AsyncRequestData*>(arg);
+static void completeAsync(const std::shared_ptr<AsyncExchange>& exchange,
+                          HttpResponse response) {
+    exchange->buffers->release(std::move(exchange->buffer));
+    exchange->buffers->release(std::move(exchange->head));
+    response.url = exchange->url;
+    response.path = exchange->urlInfo.path;
+    formatRemoteAddr(exchange->urlInfo, response.remoteAddr);
+    response.timing = exchange->timing;
+    finishTiming(response.timing, exchange->method, exchange->url, response.httpCode);
+
+    if (exchange->callback) {
+        try {
+            exchange->callback(response);
+        } catch (...) {
+        }
+    }
+    exchange->state->markDone();
+}
+
+static void failAsync(const std::shared_ptr<AsyncExchange>& exchange) {
+    HttpResponse response;
+    response.httpCode = -1;
+    completeAsync(exchange, response);
+}
+
+void HttpClient::startAsync(const std::shared_ptr<AsyncExchange>& exchange) {
+    const UrlInfo& urlInfo = exchange->urlInfo;
+    std::unique_ptr<Socket> socket;
+    std::vector<SocketAddress> addresses;
 
-    const HttpResponse response = data->client->executeRequest(
-        data->method, data->url, data->payload, data->contentType, data->headers);
+    exchange->attempts++;
+    exchange->reused = false;
+    exchange->buffer->clear();
+    exchange->parser.reset(exchange->headRequest);
 
-    if (data->callback) {
-        data->callback(response);
+    try {
+        if (exchange->keepAlive)
+            socket = exchange->pool->acquire(urlInfo.host, urlInfo.port);
+        if (socket) {
+            exchange->reused = true;
+            socket->setTimeout(exchange->timeoutMs);
+        } else if (!resolveTargetNow(urlInfo, exchange->unixPath, addresses)) {
+            // getaddrinfo blocks, so a host missing from the cache is resolved on the client's
+            // resolver thread, which then hands the exchange to its loop.
+            const bool queued =
+                exchange->resolver->submit(urlInfo.host, [exchange](const bool& cancelled) {
+                    std::vector<SocketAddress> resolved;
+                    if (!cancelled)
+                        DnsCache::instance().resolve(exchange->urlInfo.host,
+                                                     exchange->urlInfo.port, resolved);
+                    submitAsync(exchange, nullptr, resolved);
+                });
+            if (!queued)
+                failAsync(exchange);
+            return;
+        }
+    } catch (...) {
+        failAsync(exchange);
+        return;
     }
+    submitAsync(exchange, std::move(socket), addresses);
+}
 
-    delete data;
-    return nullptr;
+// Hands the exchange to its loop, on socket if it is a pooled connection, else on a new one to
+// addresses. Without addresses, the loop fails the exchange.
+void HttpClient::submitAsync(const std::shared_ptr<AsyncExchange>& exchange,
+                             std::unique_ptr<Socket> socket,
+                             const std::vector<SocketAddress>& addresses) {
+    // The connect completes and the request is written on the loop thread, so for this path
+    // those phases are part of the wait for the first byte.
+    HttpTiming& timing = exchange->timing;
+    timing.resolved = HttpTiming::Clock::now();
+    timing.connectionReused = exchange->reused;
+    timing.connected = timing.sent = timing.resolved;
+    timing.bytesSent += exchange->head->size() + exchange->payload.size();
+    try {
+        if (!socket) {
+            socket.reset(new Socket());
+            socket->setTimeout(exchange->timeoutMs);
+            socket->setOptions(exchange->socketOptions);
+        }
+    } catch (...) {
+        failAsync(exchange);
+        return;
+    }
+
+    // The exchange is registered for cancel() in the same critical section that hands it to the
+    // loop, so a cancel cannot slip in between.
+    AsyncHandle::State& state = *exchange->state;
+    std::unique_lock<std::mutex> lock(state.mutex);
+    if (state.cancelled) {
+        lock.unlock();
+        failAsync(exchange);
+        return;
+    }
+    state.operationId = exchange->loop->submit(
+        std::move(socket), addresses, DataView(exchange->head->data(), exchange->head->size()),
+        exchange->payload, *exchange->buffer,
+        [exchange](Buffer& input) {
+            if (exchange->timing.firstByte <= exchange->timing.sent)
+                exchange->timing.firstByte = HttpTiming::Clock::now();
+            exchange->parser.parse(input.data(), input.size());
+            return exchange->parser.isComplete() || exchange->parser.hasError();
+        },
+        [exchange](EventLoop::Result result, std::unique_ptr<Socket> connection) {
+            const bool cancelled = !exchange->state->release();
+
+            // Same stale keep-alive retry as the synchronous path.
+            const bool unsent = result == EventLoop::Result::Unsent;
+            const bool dropped =
+                result == EventLoop::Result::Closed || result == EventLoop::Result::Reset;
+            if (!cancelled && exchange->attempts < 2 &&
+                shouldRetryStale(exchange->reused, !exchange->buffer->empty(), unsent, dropped,
+                                 exchange->method)) {
+                startAsync(exchange);
+                return;
+            }
+
+            exchange->timing.bytesReceived += exchange->buffer->size();
+            HttpResponseParser& parser = exchange->parser;
+            if (result == EventLoop::Result::Closed)
+                parser.finishOnClose();
+            if (!parser.isComplete()) {
+                failAsync(exchange);
+                return;
+            }
+
+            if (!cancelled && exchange->keepAlive && parser.keepAlive() &&
+                parser.messageEnd() == exchange->buffer->size()) {
+                exchange->pool->release(exchange->urlInfo.host, exchange->urlInfo.port,
+                                        std::move(connection));
+            }
+
+            HttpResponse response;
+            extractResponse(parser, *exchange->buffer, response,
+                            exchange->decompression ? &exchange->decompressor : nullptr);
+            completeAsync(exchange, response);
+        });
+    const bool submitted = state.operationId != 0;
+    if (submitted)
+        state.loop = exchange->loop;
+    lock.unlock();
+
+    if (!submitted)
+        failAsync(exchange);
 }
 
-std::unique_ptr<HttpClient::ThreadGuard> HttpClient::getAsync(
-    const std::string& url, const HttpHeaders& headers,
+// Runs the exchange as a stream of the host's HTTP/2 connection; the callback then runs on that
+// connection's reader thread. Falls back to startAsync for hosts that only speak HTTP/1.1.
+void HttpClient::startHttp2Async(const std::shared_ptr<AsyncExchange>& exchange) {
+    const UrlInfo& urlInfo = exchange->urlInfo;
+    exchange->attempts++;
+
+    bool http1Only = false;
+    bool reused = false;
+    std::shared_ptr<Http2Connection> connection;
+    try {
+        connection = exchange->http2->acquire(urlInfo.host, urlInfo.port, exchange->authority,
+                                              exchange->http2Mode, exchange->timeoutMs,
+                                              exchange->socketOptions, exchange->unixPath,
+                                              http1Only, reused);
+    } catch (...) {
+    }
+    exchange->timing.resolved = reused ? HttpTiming::Clock::now() : exchange->timing.start;
+    exchange->timing.connected = HttpTiming::Clock::now();
+    exchange->timing.connectionReused = reused;
+    if (!connection) {
+        exchange->attempts = 0;
+        if (http1Only)
+            startAsync(exchange);
+        else
+            failAsync(exchange);
+        return;
+    }
+
+    connection->submit(
+        exchange->http2Fields, exchange->payload, exchange->timeoutMs,
+        [exchange](Http2Result& result) {
+            applyHttp2Timing(result, exchange->timing);
+            if (!result.ok && result.retryable && exchange->attempts < 2) {
+                startHttp2Async(exchange);
+                return;
+            }
+
+            HttpResponse response;
+            response.httpCode = -1;
+            if (result.ok)
+                extractHttp2Response(result, response,
+                                     exchange->decompression ? &exchange->decompressor : nullptr);
+            completeAsync(exchange, response);
+        });
+}
+
+std::unique_ptr<AsyncHandle> HttpClient::executeAsync(
+    const std::string& method, const std::string& url, const DataView& payload,
+    const std::string& contentType, const HttpHeaders& headers,
     const std::function<void(HttpResponse)>& callback) {
-    auto* data = new AsyncRequestData{this, "GET", url, "", "", headers, callback};
+    std::shared_ptr<AsyncExchange> exchange(new AsyncExchange());
+    exchange->pool = connectionPool.get();
+    exchange->buffers = bufferPool.get();
+    exchange->resolver = resolver.get();
+    exchange->http2 = http2Pool.get();
+    exchange->http2Mode = http2Mode;
+    exchange->buffer = bufferPool->acquire();
+    exchange->head = bufferPool->acquire();
+    exchange->method = method;
+    exchange->url = url;
+    exchange->timing.begin();
+    exchange->headRequest = method == "HEAD";
+    exchange->keepAlive = keepAlive;
+    exchange->decompression = decompression;
+    exchange->timeoutMs = timeoutSeconds * 1000;
+    exchange->attempts = 0;
+    exchange->callback = callback;
+    exchange->state = std::make_shared<AsyncHandle::State>();
+
+    std::unique_ptr<AsyncHandle> handle(new AsyncHandle(exchange->state));
 
-    pthread_t threadId;
-    if (pthread_create(&threadId, nullptr, asyncRequestThread, data) != 0) {
-        delete data;
-        return nullptr;
+    try {
+        exchange->urlInfo = UrlInfo::parseUrl(url);
+        exchange->socketOptions = socketOptionsFor(exchange->urlInfo.host);
+        exchange->unixPath = unixSocketFor(exchange->urlInfo);
+        // The caller's payload may be gone before the loop writes it, so it is copied once here
+        // (compressed, when request compression applies).
+        bool gzipBody = false;
+        if (requestCompressionThreshold > 0 && payload.size >= requestCompressionThreshold) {
+            std::unique_ptr<Buffer> compressed = bufferPool->acquire();
+            gzipBody = compressPayload(payload, *compressed);
+            if (gzipBody)
+                exchange->payload.assign(compressed->data(), compressed->size());
+            bufferPool->release(std::move(compressed));
+        }
+        if (!gzipBody)
+            exchange->payload.assign(payload.data, payload.size);
+        buildHttpRequest(*exchange->head, method, exchange->urlInfo, exchange->payload.size(),
+                         contentType, headers, !keepAlive, gzipBody);
+        if (http2Mode != Http2Mode::Disabled) {
+            formatAuthority(exchange->urlInfo, exchange->authority);
+            buildHttp2Request(exchange->http2Fields, method, exchange->urlInfo,
+                              exchange->payload.size(), contentType, headers, gzipBody);
+        }
+        exchange->loop = eventLoops->next();
+    } catch (...) {
+        failAsync(exchange);
+        return handle;
     }
 
-    return std::unique_ptr<ThreadGuard>(new ThreadGuard(threadId));
+    if (http2Mode != Http2Mode::Disabled)
+        startHttp2Async(exchange);
+    else
+        startAsync(exchange);
+    return handle;
+}
+
+std::unique_ptr<AsyncHandle> HttpClient::getAsync(
+    const std::string& url, const HttpHeaders& headers,
+    const std::function<void(HttpResponse)>& callback) {
+    return executeAsync("GET", url, "", "", headers, callback);
 }
 
-std::unique_ptr<HttpClient::ThreadGuard> HttpClient::postAsync(
-    const std::string& url, const std::string& payload, const std::string& contentType,
+std::unique_ptr<AsyncHandle> HttpClient::postAsync(
+    const std::string& url, const DataView& payload, const std::string& contentType,
     const HttpHeaders& headers, const std::function<void(HttpResponse)>& callback) {
-    auto* data = new AsyncRequestData{this, "POST", url, payload, contentType, headers, callback};
+    return executeAsync("POST", url, payload, contentType, headers, callback);
+}
 
-    pthread_t threadId;
-    if (pthread_create(&threadId, nullptr, asyncRequestThread, data) != 0) {
-        delete data;
-        return nullptr;
+// Shared with the completion callbacks, which may outlive executeBatch once it has returned.
+struct BatchState {
+    std::mutex mutex;
+    std::condition_variable progress;
+    std::vector<HttpResponse> responses;
+    size_t inFlight;
+    size_t succeeded;
+    // Set when executeBatch returns; later completions are dropped.
+    bool closed;
+
+    BatchState() : inFlight(0), succeeded(0), closed(false) {}
+};
+
+std::vector<HttpResponse> HttpClient::executeBatch(const std::vector<Request>& requests,
+                                                   const size_t& maxConcurrency,
+                                                   const BatchOptions& options) {
+    typedef std::chrono::steady_clock Clock;
+    const Clock::time_point deadline = Clock::now() + std::chrono::milliseconds(options.deadlineMs);
+    const size_t limit = maxConcurrency == 0 ? requests.size() : maxConcurrency;
+
+    std::shared_ptr<BatchState> batch = std::make_shared<BatchState>();
+    batch->responses.resize(requests.size());
+    for (size_t i = 0; i < requests.size(); ++i) {
+        batch->responses[i].url = requests[i].url;
+        batch->responses[i].httpCode = -1;
     }
 
-    return std::unique_ptr<ThreadGuard>(new ThreadGuard(threadId));
+    std::vector<std::unique_ptr<AsyncHandle>> handles(requests.size());
+    size_t next = 0;
+    std::unique_lock<std::mutex> lock(batch->mutex);
+    for (;;) {
+        if (options.firstSuccesses > 0 && batch->succeeded >= options.firstSuccesses)
+            break;
+        if (options.deadlineMs > 0 && Clock::now() >= deadline)
+            break;
+
+        if (next < requests.size() && batch->inFlight < limit) {
+            const size_t index = next++;
+            const Request& request = requests[index];
+            batch->inFlight++;
+            // A request that fails before reaching a loop completes inside executeAsync.
+            lock.unlock();
+            handles[index] = executeAsync(
+                request.method, request.url, DataView(request.payload), request.contentType,
+                request.headers, [batch, index](HttpResponse response) {
+                    std::lock_guard<std::mutex> guard(batch->mutex);
+                    if (batch->closed)
+                        return;
+                    batch->inFlight--;
+                    if (response.httpCode >= 200 && response.httpCode < 300)
+                        batch->succeeded++;
+                    batch->responses[index] = std::move(response);
+                    batch->progress.notify_all();
+                });
+            lock.lock();
+            continue;
+        }
+
+        if (batch->inFlight == 0)
+            break;
+        if (options.deadlineMs > 0)
+            batch->progress.wait_until(lock, deadline);
+        else
+            batch->progress.wait(lock);
+    }
+
+    batch->closed = true;
+    std::vector<HttpResponse> responses;
+    responses.swap(batch->responses);
+    lock.unlock();
+
+    for (const std::unique_ptr<AsyncHandle>& handle : handles) {
+        if (handle)
+            handle->cancel();
+    }
+    return responses;
 }
 
 }  // namespace SimpleHTTP
@@ -0,0 +1,102 @@
+#include "singleFlight.hpp"
+
+#include "simpleHTTP.hpp"
+
+namespace SimpleHTTP {
+
+SingleFlightStats::SingleFlightStats() : executed(0), coalesced(0) {}
+
+SingleFlight::Call::Call() : finished(false), succeeded(false), waiters(0) {}
+
+SingleFlight::SingleFlight() {}
+
+std::string SingleFlight::makeKey(const std::string& method, const std::string& url,
+                                  const HttpHeaders& headers) {
+    std::string key;
+    key.reserve(method.size() + url.size() + 1);
+    key.append(method).append(1, ' ').append(url);
+    for (const HttpHeaders::Field& field : headers.headers)
+        key.append(1, '\n').append(field.first).append(": ").append(field.second);
+    return key;
+}
+
+bool SingleFlight::run(const std::string& key, HttpResponse& response,
+                       const std::function<bool(HttpResponse& response)>& execute,
+                       const bool& shareBody) {
+    std::unique_lock<std::mutex> lock(mutex);
+    const auto it = calls.find(key);
+    if (it != calls.end()) {
+        const std::shared_ptr<Call> call = it->second;
+        ++call->waiters;
+        ++stats.coalesced;
+        call->done.wait(lock, [&call]() { return call->finished; });
+        lock.unlock();
+
+        const HttpResponse& head = *call->head;
+        response.url = head.url;
+        response.path = head.path;
+        response.remoteAddr = head.remoteAddr;
+        response.contentLength = head.contentLength;
+        response.httpCode = head.httpCode;
+        response.headers = head.headers;
+        response.statusText = head.statusText;
+        response.protocol = head.protocol;
+        response.timing = head.timing;
+        if (shareBody) {
+            response.body.clear();
+            response.sharedBody = call->body;
+        } else {
+            response.body.assign(*call->body);
+            response.sharedBody.reset();
+        }
+        return call->succeeded;
+    }
+
+    const std::shared_ptr<Call> call = std::make_shared<Call>();
+    calls.emplace(key, call);
+    ++stats.executed;
+    lock.unlock();
+
+    bool succeeded = false;
+    try {
+        succeeded = execute(response);
+    } catch (...) {
+        response.httpCode = -1;
+    }
+
+    // Nobody can join once the call is out of the map, so waiters is final.
+    lock.lock();
+    calls.erase(key);
+    const bool shared = call->waiters > 0;
+    lock.unlock();
+
+    if (shared) {
+        std::shared_ptr<HttpResponse> head = std::make_shared<HttpResponse>();
+        head->url = response.url;
+        head->path = response.path;
+        head->remoteAddr = response.remoteAddr;
+        head->contentLength = response.contentLength;
+        head->httpCode = response.httpCode;
+        head->headers = response.headers;
+        head->statusText = response.statusText;
+        head->protocol = response.protocol;
+        head->timing = response.timing;
+        call->head = head;
+        // This response keeps its body where execute left it; the waiters share one copy of it.
+        call->body = response.sharedBody ? response.sharedBody
+                                         : std::make_shared<const std::string>(response.body);
+    }
+
+    lock.lock();
+    call->succeeded = succeeded;
+    call->finished = true;
+    call->done.notify_all();
+    return succeeded;
+}
+
+SingleFlightStats SingleFlight::getStats() const {
+    std::lock_guard<std::mutex> lock(mutex);
+    return stats;
+}
+
+}  // namespace SimpleHTTP
@@ -1,18 +1,121 @@
 #include "socket.hpp"
 
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstddef>
+
+#include <netinet/tcp.h>
+
+#ifdef __linux__
+#include <signal.h>
+#include <sys/sendfile.h>
+#endif
+
+#include "dnsCache.hpp"
+
 namespace SimpleHTTP {
 
-Socket::Socket() : socketFd(-1), isConnected(false) {
-    socketFd = socket(AF_INET, SOCK_STREAM, 0);
-    if (socketFd == -1)
-        throw std::runtime_error("Failed to create socket");
+#ifdef MSG_NOSIGNAL
+static const int kSendFlags = MSG_NOSIGNAL;
+#else
+static const int kSendFlags = 0;
+#endif
+
+static const size_t kMaxSendParts = 8;
+
+// Read size of the pread() fallback of sendFile.
+static const size_t kFileCopyChunk = 64 * 1024;
+
+typedef std::chrono::steady_clock Clock;
+
+static int millisecondsUntil(const Clock::time_point& deadline) {
+    const auto left =
+        std::chrono::duration_cast<std::chrono::milliseconds>(deadline - Clock::now()).count();
+    return left > 0 ? static_cast<int>(left) : 0;
+}
+
+DataView::DataView() : data(""), size(0) {}
+
+DataView::DataView(const std::string& text) : data(text.data()), size(text.size()) {}
+
+DataView::DataView(const char* text) : data(text), size(std::strlen(text)) {}
+
+DataView::DataView(const char* bytes, const size_t& length) : data(bytes), size(length) {}
+
+bool DataView::empty() const {
+    return size == 0;
+}
+
+SocketAddress::SocketAddress() : storage(), length(0), family(AF_UNSPEC) {}
+
+void SocketAddress::setPort(const int& port) {
+    if (family == AF_INET)
+        reinterpret_cast<sockaddr_in*>(&storage)->sin_port = htons(port);
+    else if (family == AF_INET6)
+        reinterpret_cast<sockaddr_in6*>(&storage)->sin6_port = htons(port);
 }
 
+bool SocketAddress::fromString(const std::string& ip, const int& port, SocketAddress& address) {
+    address = SocketAddress();
+
+    sockaddr_in* v4 = reinterpret_cast<sockaddr_in*>(&address.storage);
+    if (inet_pton(AF_INET, ip.c_str(), &v4->sin_addr) == 1) {
+        v4->sin_family = AF_INET;
+        address.family = AF_INET;
+        address.length = sizeof(sockaddr_in);
+        address.setPort(port);
+        return true;
+    }
+
+    sockaddr_in6* v6 = reinterpret_cast<sockaddr_in6*>(&address.storage);
+    if (inet_pton(AF_INET6, ip.c_str(), &v6->sin6_addr) == 1) {
+        v6->sin6_family = AF_INET6;
+        address.family = AF_INET6;
+        address.length = sizeof(sockaddr_in6);
+        address.setPort(port);
+        return true;
+    }
+    return false;
+}
+
+bool SocketAddress::fromUnixPath(const std::string& path, SocketAddress& address) {
+    address = SocketAddress();
+
+    sockaddr_un* local = reinterpret_cast<sockaddr_un*>(&address.storage);
+    if (path.empty() || path.size() >= sizeof(local->sun_path))
+        return false;
+
+    local->sun_family = AF_UNIX;
+    std::memcpy(local->sun_path, path.data(), path.size());
+    address.family = AF_UNIX;
+    address.length = static_cast<socklen_t>(offsetof(sockaddr_un, sun_path) + path.size() + 1);
+    return true;
+}
+
+SocketOptions::SocketOptions()
+    : noDelay(true),
+      receiveBuffer(0),
+      sendBuffer(0),
+      fastOpen(false),
+      quickAck(false),
+      busyPollMicros(0),
+      keepAliveIdle(0),
+      keepAliveInterval(0),
+      keepAliveCount(0) {}
+
+Socket::Socket() : socketFd(-1), isConnected(false), nonBlocking(false), timeoutMs(0) {}
+
 Socket::~Socket() {
     close();
 }
 
-Socket::Socket(Socket&& other) noexcept : socketFd(other.socketFd), isConnected(other.isConnected) {
+Socket::Socket(Socket&& other) noexcept
+    : socketFd(other.socketFd),
+      isConnected(other.isConnected),
+      nonBlocking(other.nonBlocking),
+      timeoutMs(other.timeoutMs),
+      options(other.options) {
     other.socketFd = -1;
     other.isConnected = false;
 }
@@ -22,60 +125,499 @@ Socket& Socket::operator=(Socket&& other) noexcept {
         close();
         socketFd = other.socketFd;
         isConnected = other.isConnected;
+        nonBlocking = other.nonBlocking;
+        timeoutMs = other.timeoutMs;
+        options = other.options;
         other.socketFd = -1;
         other.isConnected = false;
     }
     return *this;
 }
 
-bool Socket::connect(const std::string& host, const int& port) {
-    addrinfo hints = {}, *result;
-    hints.ai_family = AF_INET;
-    hints.ai_socktype = SOCK_STREAM;
+static void setIntOption(const int& fd, const int& level, const int& name, const int& value) {
+    setsockopt(fd, level, name, &value, sizeof(value));
+}
+
+// Everything here has to be set before connect: buffer sizes determine the window scale
+// announced in the SYN, and Fast Open changes what connect itself does. Failures are ignored;
+// the connection works without the option. Unix domain sockets only take the buffer sizes.
+static void applyOptions(const int& fd, const int& family, const SocketOptions& options) {
+    if (options.receiveBuffer > 0)
+        setIntOption(fd, SOL_SOCKET, SO_RCVBUF, options.receiveBuffer);
+    if (options.sendBuffer > 0)
+        setIntOption(fd, SOL_SOCKET, SO_SNDBUF, options.sendBuffer);
+    if (family == AF_UNIX)
+        return;
+
+    if (options.noDelay)
+        setIntOption(fd, IPPROTO_TCP, TCP_NODELAY, 1);
+#ifdef TCP_FASTOPEN_CONNECT
+    if (options.fastOpen)
+        setIntOption(fd, IPPROTO_TCP, TCP_FASTOPEN_CONNECT, 1);
+#endif
+#ifdef SO_BUSY_POLL
+    if (options.busyPollMicros > 0)
+        setIntOption(fd, SOL_SOCKET, SO_BUSY_POLL, options.busyPollMicros);
+#endif
+    if (options.keepAliveIdle > 0) {
+        setIntOption(fd, SOL_SOCKET, SO_KEEPALIVE, 1);
+#if defined(TCP_KEEPIDLE)
+        setIntOption(fd, IPPROTO_TCP, TCP_KEEPIDLE, options.keepAliveIdle);
+#elif defined(TCP_KEEPALIVE)
+        setIntOption(fd, IPPROTO_TCP, TCP_KEEPALIVE, options.keepAliveIdle);
+#endif
+#ifdef TCP_KEEPINTVL
+        if (options.keepAliveInterval > 0)
+            setIntOption(fd, IPPROTO_TCP, TCP_KEEPINTVL, options.keepAliveInterval);
+#endif
+#ifdef TCP_KEEPCNT
+        if (options.keepAliveCount > 0)
+            setIntOption(fd, IPPROTO_TCP, TCP_KEEPCNT, options.keepAliveCount);
+#endif
+    }
+}
+
+// Creates a non-blocking stream socket for the given address family, or returns -1.
+int Socket::openSocket(const int& family, const SocketOptions& options) {
+    const int fd = socket(family, SOCK_STREAM, 0);
+    if (fd == -1)
+        return -1;
+
+    fcntl(fd, F_SETFD, FD_CLOEXEC);
+#ifdef SO_NOSIGPIPE
+    const int on = 1;
+    setsockopt(fd, SOL_SOCKET, SO_NOSIGPIPE, &on, sizeof(on));
+#endif
+    applyOptions(fd, family, options);
+    if (fcntl(fd, F_SETFL, fcntl(fd, F_GETFL, 0) | O_NONBLOCK) != 0) {
+        ::close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+const int Socket::kConnectAttemptDelayMs;
+
+void Socket::interleaveFamilies(std::vector<SocketAddress>& addresses) {
+    if (addresses.empty())
+        return;
 
-    const std::string portStr = std::to_string(port);
+    const int firstFamily = addresses.front().family;
+    std::vector<SocketAddress> preferred, other;
+    for (const SocketAddress& address : addresses)
+        (address.family == firstFamily ? preferred : other).push_back(address);
 
-    const int status = getaddrinfo(host.c_str(), portStr.c_str(), &hints, &result);
-    if (status != 0)
+    addresses.clear();
+    for (size_t i = 0; i < preferred.size() || i < other.size(); ++i) {
+        if (i < preferred.size())
+            addresses.push_back(preferred[i]);
+        if (i < other.size())
+            addresses.push_back(other[i]);
+    }
+}
+
+// Races the resolved addresses Happy Eyeballs style (RFC 8305): a new attempt starts whenever
+// the previous one failed or has not connected within kConnectAttemptDelayMs. The first attempt
+// to connect wins and the others are dropped.
+bool Socket::connect(const std::string& host, const int& port) {
+    std::vector<SocketAddress> addresses;
+    if (!DnsCache::instance().resolve(host, port, addresses)) {
+        close();
         return false;
+    }
+    return connect(addresses);
+}
+
+bool Socket::connect(const std::vector<SocketAddress>& resolved) {
+    close();
+    std::vector<SocketAddress> addresses(resolved);
+    interleaveFamilies(addresses);
+
+    const Clock::time_point deadline = Clock::now() + std::chrono::milliseconds(timeoutMs);
+    Clock::time_point nextAttempt = Clock::now();
+    std::vector<pollfd> attempts;
+    size_t next = 0;
+    int winner = -1;
+    // Reported when nothing connects: the error of the last failed attempt, or ETIMEDOUT once
+    // the deadline has passed.
+    int lastError = EHOSTUNREACH;
+
+    while (winner == -1) {
+        const Clock::time_point now = Clock::now();
+        if (timeoutMs > 0 && now >= deadline) {
+            lastError = ETIMEDOUT;
+            break;
+        }
+
+        if (next < addresses.size() && (attempts.empty() || now >= nextAttempt)) {
+            const SocketAddress& address = addresses[next++];
+            const int fd = openSocket(address.family, options);
+            if (fd == -1) {
+                lastError = errno;
+                continue;
+            }
 
-    for (const addrinfo* ptr = result; ptr != nullptr; ptr = ptr->ai_next) {
-        if (::connect(socketFd, ptr->ai_addr, ptr->ai_addrlen) == 0) {
-            isConnected = true;
+            if (::connect(fd, reinterpret_cast<const sockaddr*>(&address.storage),
+                          address.length) == 0) {
+                winner = fd;
+            } else if (errno == EINPROGRESS) {
+                pollfd pfd = {};
+                pfd.fd = fd;
+                pfd.events = POLLOUT;
+                attempts.push_back(pfd);
+                nextAttempt = now + std::chrono::milliseconds(kConnectAttemptDelayMs);
+            } else {
+                lastError = errno;
+                ::close(fd);
+            }
+            continue;
+        }
+
+        if (attempts.empty())
             break;
+
+        int wait = next < addresses.size() ? millisecondsUntil(nextAttempt) : -1;
+        if (timeoutMs > 0) {
+            const int left = millisecondsUntil(deadline);
+            if (wait == -1 || left < wait)
+                wait = left;
+        }
+
+        const int ready = poll(attempts.data(), attempts.size(), wait);
+        if (ready < 0 && errno != EINTR) {
+            lastError = errno;
+            break;
+        }
+        if (ready <= 0)
+            continue;
+
+        for (size_t i = 0; i < attempts.size() && winner == -1;) {
+            if (attempts[i].revents == 0) {
+                ++i;
+                continue;
+            }
+
+            int error = 0;
+            socklen_t length = sizeof(error);
+            if (getsockopt(attempts[i].fd, SOL_SOCKET, SO_ERROR, &error, &length) == 0 &&
+                error == 0) {
+                winner = attempts[i].fd;
+            } else {
+                lastError = error != 0 ? error : errno;
+                ::close(attempts[i].fd);
+                nextAttempt = Clock::now();
+            }
+            attempts.erase(attempts.begin() + i);
         }
     }
 
-    freeaddrinfo(result);
-    return isConnected;
+    for (const pollfd& pfd : attempts)
+        ::close(pfd.fd);
+
+    if (winner == -1) {
+        errno = lastError;
+        return false;
+    }
+
+    socketFd = winner;
+    isConnected = true;
+    nonBlocking = true;
+    return setNonBlocking(false);
 }
 
-bool Socket::send(const std::string& data) const {
-    if (!isConnected) {
+// Starts a connect on a non-blocking socket. Returns true once the connection is established
+// or in progress; completeConnect() must be called when the socket becomes writable. Only the
+// first address that accepts the attempt is used; EventLoop::submit races all of them.
+bool Socket::connectNonBlocking(const std::string& host, const int& port) {
+    std::vector<SocketAddress> addresses;
+    if (!DnsCache::instance().resolve(host, port, addresses)) {
+        close();
         return false;
     }
+    return connectNonBlocking(addresses);
+}
 
-    size_t totalSent = 0;
-    const size_t dataSize = data.size();
+bool Socket::connectNonBlocking(const std::vector<SocketAddress>& resolved) {
+    close();
+    std::vector<SocketAddress> addresses(resolved);
+    interleaveFamilies(addresses);
 
-    while (totalSent < dataSize) {
-        const ssize_t sent = ::send(socketFd, data.c_str() + totalSent, dataSize - totalSent, 0);
-        if (sent == -1) {
+    for (const SocketAddress& address : addresses) {
+        const int fd = openSocket(address.family, options);
+        if (fd == -1)
+            continue;
+
+        const bool connected = ::connect(fd, reinterpret_cast<const sockaddr*>(&address.storage),
+                                         address.length) == 0;
+        if (connected || errno == EINPROGRESS) {
+            socketFd = fd;
+            isConnected = connected;
+            nonBlocking = true;
+            return true;
+        }
+        ::close(fd);
+    }
+
+    return false;
+}
+
+bool Socket::completeConnect() {
+    if (isConnected)
+        return true;
+
+    int error = 0;
+    socklen_t length = sizeof(error);
+    if (getsockopt(socketFd, SOL_SOCKET, SO_ERROR, &error, &length) != 0 || error != 0)
+        return false;
+
+    isConnected = true;
+    return true;
+}
+
+bool Socket::setNonBlocking(const bool& enabled) {
+    const int flags = fcntl(socketFd, F_GETFL, 0);
+    if (flags == -1)
+        return false;
+
+    const int updated = enabled ? (flags | O_NONBLOCK) : (flags & ~O_NONBLOCK);
+    if (updated != flags && fcntl(socketFd, F_SETFL, updated) != 0)
+        return false;
+
+    nonBlocking = enabled;
+    return true;
+}
+
+void Socket::setTimeout(const int& milliseconds) {
+    timeoutMs = milliseconds > 0 ? milliseconds : 0;
+}
+
+int Socket::getTimeout() const {
+    return timeoutMs;
+}
+
+void Socket::setOptions(const SocketOptions& newOptions) {
+    options = newOptions;
+}
+
+const SocketOptions& Socket::getOptions() const {
+    return options;
+}
+
+void Socket::rearmQuickAck() const {
+#ifdef TCP_QUICKACK
+    if (options.quickAck)
+        setIntOption(socketFd, IPPROTO_TCP, TCP_QUICKACK, 1);
+#endif
+}
+
+// Waits until the socket is ready for events. Only sockets in blocking mode with a timeout
+// wait here; everything else returns at once and lets the I/O call itself block or fail.
+bool Socket::waitFor(const short& events) const {
+    if (nonBlocking || timeoutMs <= 0)
+        return true;
+
+    const Clock::time_point deadline = Clock::now() + std::chrono::milliseconds(timeoutMs);
+    while (true) {
+        pollfd pfd = {};
+        pfd.fd = socketFd;
+        pfd.events = events;
+        const int ready = poll(&pfd, 1, millisecondsUntil(deadline));
+        if (ready > 0)
+            return true;
+        if (ready == 0) {
+            errno = ETIMEDOUT;
             return false;
         }
-        totalSent += sent;
+        if (errno != EINTR)
+            return false;
     }
+}
+
+bool Socket::send(const std::string& data) const {
+    const DataView part(data);
+    return send(&part, 1);
+}
 
+// Sends all parts with as few sendmsg calls as the kernel allows; nothing is concatenated.
+bool Socket::send(const DataView* parts, const size_t& count) const {
+    if (!isConnected)
+        return false;
+
+    size_t total = 0;
+    for (size_t i = 0; i < count; ++i)
+        total += parts[i].size;
+
+    size_t sent = 0;
+    while (sent < total) {
+        const ssize_t result = sendSome(parts, count, sent);
+        if (result < 0 && errno == EINTR)
+            continue;
+        if (result < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            if (!waitFor(POLLOUT))
+                return false;
+            continue;
+        }
+        if (result <= 0)
+            return false;
+        sent += result;
+    }
     return true;
 }
 
+#ifdef __linux__
+// sendfile takes no MSG_NOSIGNAL. SIGPIPE is blocked on the calling thread around it and one it
+// raised is discarded, so a peer that went away fails the call instead of ending the process.
+class SigpipeGuard {
+    sigset_t pipeMask;
+    sigset_t previousMask;
+    bool wasPending;
+
+public:
+    SigpipeGuard() {
+        sigemptyset(&pipeMask);
+        sigaddset(&pipeMask, SIGPIPE);
+        sigset_t pending;
+        sigpending(&pending);
+        wasPending = sigismember(&pending, SIGPIPE) == 1;
+        pthread_sigmask(SIG_BLOCK, &pipeMask, &previousMask);
+    }
+
+    ~SigpipeGuard() {
+        sigset_t pending;
+        sigpending(&pending);
+        if (!wasPending && sigismember(&pending, SIGPIPE) == 1) {
+            const timespec noWait = {0, 0};
+            while (sigtimedwait(&pipeMask, nullptr, &noWait) == -1 && errno == EINTR) {
+            }
+        }
+        pthread_sigmask(SIG_SETMASK, &previousMask, nullptr);
+    }
+};
+#endif
+
+// One sendfile call from position, which it advances. Returns the bytes sent, or -1 with errno
+// set (ENOSYS where there is no sendfile).
+static ssize_t sendFileSome(const int& socketFd, const int& fd, off_t& position,
+                            const size_t& size) {
+#if defined(__linux__)
+    return ::sendfile(socketFd, fd, &position, size);
+#elif defined(__APPLE__)
+    off_t length = static_cast<off_t>(size);
+    const int result = ::sendfile(fd, socketFd, position, &length, nullptr, 0);
+    position += length;
+    // A partial send on a full socket reports EAGAIN along with the bytes that went out.
+    if (result == 0 || length > 0)
+        return static_cast<ssize_t>(length);
+    return -1;
+#else
+    (void)socketFd;
+    (void)fd;
+    (void)position;
+    (void)size;
+    errno = ENOSYS;
+    return -1;
+#endif
+}
+
+// The data never passes through user space unless sendfile cannot handle the descriptor (not a
+// regular file) or the system has none; then it is copied with pread, or read for pipes. A
+// blocking socket with a timeout is switched to non-blocking meanwhile, so the waits happen in
+// waitFor() as in send().
+bool Socket::sendFile(const int& fd, const off_t& offset, const size_t& length) const {
+    if (!isConnected)
+        return false;
+
+    const int flags = fcntl(socketFd, F_GETFL, 0);
+    const bool toggle = !nonBlocking && timeoutMs > 0 && flags != -1 && !(flags & O_NONBLOCK);
+    if (toggle && fcntl(socketFd, F_SETFL, flags | O_NONBLOCK) != 0)
+        return false;
+
+    off_t position = offset;
+    size_t remaining = length;
+    bool copy = false;
+    bool ok = true;
+    {
+#ifdef __linux__
+        SigpipeGuard guard;
+#endif
+        while (remaining > 0 && !copy) {
+            const ssize_t sent = sendFileSome(socketFd, fd, position, remaining);
+            if (sent > 0) {
+                remaining -= static_cast<size_t>(sent);
+                continue;
+            }
+            if (sent < 0 && errno == EINTR)
+                continue;
+            if (sent < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+                if (!waitFor(POLLOUT)) {
+                    ok = false;
+                    break;
+                }
+                continue;
+            }
+            // Nothing went out for a descriptor sendfile does not support; copy instead.
+            if (sent < 0 && position == offset &&
+                (errno == EINVAL || errno == ESPIPE || errno == ENOSYS || errno == EOPNOTSUPP ||
+                 errno == ENOTSUP)) {
+                copy = true;
+                break;
+            }
+            // 0 means the file ended before length bytes.
+            ok = false;
+            break;
+        }
+    }
+
+    if (toggle)
+        fcntl(socketFd, F_SETFL, flags);
+
+    if (!ok || !copy)
+        return ok;
+
+    std::vector<char> chunk(kFileCopyChunk);
+    bool seekable = true;
+    while (remaining > 0) {
+        const size_t wanted = std::min(remaining, chunk.size());
+        const ssize_t got = seekable ? pread(fd, chunk.data(), wanted, position)
+                                     : read(fd, chunk.data(), wanted);
+        if (got < 0 && errno == ESPIPE && seekable) {
+            seekable = false;
+            continue;
+        }
+        if (got < 0 && errno == EINTR)
+            continue;
+        if (got <= 0)
+            return false;
+        const DataView part(chunk.data(), static_cast<size_t>(got));
+        if (!send(&part, 1))
+            return false;
+        position += got;
+        remaining -= static_cast<size_t>(got);
+    }
+    return true;
+}
+
+bool Socket::waitReadable(const int& milliseconds) const {
+    pollfd pfd = {};
+    pfd.fd = socketFd;
+    pfd.events = POLLIN;
+    const Clock::time_point deadline = Clock::now() + std::chrono::milliseconds(milliseconds);
+    while (true) {
+        const int ready = poll(&pfd, 1, millisecondsUntil(deadline));
+        if (ready >= 0)
+            return ready > 0;
+        if (errno != EINTR)
+            return false;
+    }
+}
+
 std::string Socket::receiveChunk(const size_t chunkSize) const {
     if (!isConnected) {
         return "";
     }
 
     std::vector<char> buffer(chunkSize);
-    const ssize_t received = recv(socketFd, buffer.data(), chunkSize, 0);
+    const ssize_t received = receiveSome(buffer.data(), chunkSize);
 
     if (received <= 0) {
         return "";
@@ -92,7 +634,7 @@ std::string Socket::receiveAll() const {
     std::vector<char> buffer(4096);
 
     while (true) {
-        const ssize_t received = recv(socketFd, buffer.data(), buffer.size(), 0);
+        const ssize_t received = receiveSome(buffer.data(), buffer.size());
         if (received <= 0)
             break;
         result.append(buffer.begin(), buffer.begin() + received);
@@ -101,6 +643,63 @@ std::string Socket::receiveAll() const {
     return result;
 }
 
+// With a timeout, sends never block inside the kernel; send() waits in waitFor() instead.
+int Socket::sendFlags() const {
+    return timeoutMs > 0 ? kSendFlags | MSG_DONTWAIT : kSendFlags;
+}
+
+ssize_t Socket::sendSome(const char* data, const size_t& size) const {
+    return ::send(socketFd, data, size, sendFlags());
+}
+
+// Sends what the socket accepts of the parts, skipping the first skip bytes already sent.
+ssize_t Socket::sendSome(const DataView* parts, const size_t& count, const size_t& skip) const {
+    iovec vectors[kMaxSendParts];
+    size_t used = 0;
+    size_t toSkip = skip;
+
+    for (size_t i = 0; i < count && used < kMaxSendParts; ++i) {
+        if (parts[i].size <= toSkip) {
+            toSkip -= parts[i].size;
+            continue;
+        }
+        vectors[used].iov_base = const_cast<char*>(parts[i].data + toSkip);
+        vectors[used].iov_len = parts[i].size - toSkip;
+        toSkip = 0;
+        ++used;
+    }
+
+    if (used == 0)
+        return 0;
+
+    msghdr message = {};
+    message.msg_iov = vectors;
+    message.msg_iovlen = used;
+    return sendmsg(socketFd, &message, sendFlags());
+}
+
+ssize_t Socket::receiveSome(char* buffer, const size_t& size) const {
+    if (!waitFor(POLLIN))
+        return -1;
+    const ssize_t received = recv(socketFd, buffer, size, 0);
+    if (received > 0)
+        rearmQuickAck();
+    return received;
+}
+
+// Reads straight into the caller's buffer, growing it only when less than minSpace is free.
+ssize_t Socket::receiveInto(Buffer& buffer, const size_t& minSpace) const {
+    buffer.ensureWritable(minSpace);
+    if (!waitFor(POLLIN))
+        return -1;
+    const ssize_t received = recv(socketFd, buffer.writePtr(), buffer.writable(), 0);
+    if (received > 0) {
+        buffer.commit(received);
+        rearmQuickAck();
+    }
+    return received;
+}
+
 void Socket::close() {
     if (socketFd != -1) {
         ::close(socketFd);
@@ -113,6 +712,19 @@ bool Socket::isSocketConnected() const {
     return isConnected;
 }
 
+// An idle keep-alive connection must have nothing to read: readability means the peer
+// either closed it or sent something we did not ask for.
+bool Socket::isHealthy() const {
+    if (!isConnected)
+        return false;
+
+    pollfd pfd = {};
+    pfd.fd = socketFd;
+    pfd.events = POLLIN;
+    const int ready = poll(&pfd, 1, 0);
+    return ready == 0;
+}
+
 int Socket::getSocketFd() const {
     return socketFd;
 }
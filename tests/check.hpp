@@ -0,0 +1,24 @@
+#pragma once
+
+#include <cstdio>
+
+// Checks for the test programs: EXPECT reports a failed condition and carries on, and main
+// returns finishChecks() so that ctest sees the failures.
+static int failures = 0;
+
+#define EXPECT(condition)                                                                  \
+    do {                                                                                   \
+        if (!(condition)) {                                                                \
+            std::fprintf(stderr, "%s:%d: expected %s\n", __FILE__, __LINE__, #condition); \
+            ++failures;                                                                    \
+        }                                                                                  \
+    } while (0)
+
+static int finishChecks(const char* suite) {
+    if (failures > 0) {
+        std::fprintf(stderr, "%s: %d check(s) failed\n", suite, failures);
+        return 1;
+    }
+    std::printf("%s: all checks passed\n", suite);
+    return 0;
+}
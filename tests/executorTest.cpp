@@ -0,0 +1,217 @@
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "check.hpp"
+#include "executor.hpp"
+
+using namespace SimpleHTTP;
+
+// Counts how often each task was called and how, and how many tasks of each key ran at once.
+class TaskLog {
+    std::mutex mutex;
+    std::map<std::string, int> running;
+    std::map<std::string, int> mostRunning;
+    int runningTotal;
+    int mostRunningTotal;
+    std::vector<int> calls;
+    int ran;
+    int cancelled;
+
+public:
+    explicit TaskLog(const size_t& tasks)
+        : runningTotal(0), mostRunningTotal(0), calls(tasks, 0), ran(0), cancelled(0) {}
+
+    void begin(const size_t& task, const std::string& key, const bool& wasCancelled) {
+        std::lock_guard<std::mutex> lock(mutex);
+        ++calls[task];
+        if (wasCancelled) {
+            ++cancelled;
+            return;
+        }
+        ++ran;
+        mostRunning[key] = std::max(mostRunning[key], ++running[key]);
+        mostRunningTotal = std::max(mostRunningTotal, ++runningTotal);
+    }
+
+    void end(const std::string& key) {
+        std::lock_guard<std::mutex> lock(mutex);
+        --running[key];
+        --runningTotal;
+    }
+
+    // Every task was called, and none more than once.
+    bool calledOnce() {
+        std::lock_guard<std::mutex> lock(mutex);
+        for (const int count : calls) {
+            if (count != 1)
+                return false;
+        }
+        return true;
+    }
+
+    int mostAtOnce(const std::string& key) {
+        std::lock_guard<std::mutex> lock(mutex);
+        return mostRunning[key];
+    }
+
+    int mostAtOnce() {
+        std::lock_guard<std::mutex> lock(mutex);
+        return mostRunningTotal;
+    }
+
+    int ranCount() {
+        std::lock_guard<std::mutex> lock(mutex);
+        return ran;
+    }
+
+    int cancelledCount() {
+        std::lock_guard<std::mutex> lock(mutex);
+        return cancelled;
+    }
+};
+
+// A task that holds its worker until released.
+class Gate {
+    std::mutex mutex;
+    std::condition_variable changed;
+    bool entered;
+    bool open;
+
+public:
+    Gate() : entered(false), open(false) {}
+
+    void pass() {
+        std::unique_lock<std::mutex> lock(mutex);
+        entered = true;
+        changed.notify_all();
+        changed.wait(lock, [this] { return open; });
+    }
+
+    void waitEntered() {
+        std::unique_lock<std::mutex> lock(mutex);
+        changed.wait(lock, [this] { return entered; });
+    }
+
+    void release() {
+        std::lock_guard<std::mutex> lock(mutex);
+        open = true;
+        changed.notify_all();
+    }
+};
+
+// With maxPerHost 1, the tasks of one key run one at a time, each handing its slot to the next
+// held one, while another key's tasks use the other workers meanwhile.
+static void testMaxPerHost() {
+    ExecutorConfig config;
+    config.threads = 4;
+    config.maxPerHost = 1;
+    Executor executor(config);
+
+    const size_t kTasks = 12;
+    TaskLog log(kTasks);
+    for (size_t i = 0; i < kTasks; ++i) {
+        const std::string key = i % 3 == 2 ? "b:80" : "a:80";
+        EXPECT(executor.submit(key, [&log, i, key](const bool& cancelled) {
+            log.begin(i, key, cancelled);
+            std::this_thread::sleep_for(std::chrono::milliseconds(10));
+            log.end(key);
+        }));
+    }
+    executor.waitIdle();
+
+    EXPECT(log.calledOnce());
+    EXPECT(log.ranCount() == static_cast<int>(kTasks));
+    EXPECT(log.mostAtOnce("a:80") == 1);
+    EXPECT(log.mostAtOnce("b:80") == 1);
+    EXPECT(log.mostAtOnce() == 2);
+}
+
+// Tasks that have not started when the executor shuts down, queued or held back by maxPerHost,
+// are cancelled; the running one finishes.
+static void testCancelOnShutdown() {
+    ExecutorConfig config;
+    config.threads = 1;
+    config.maxPerHost = 2;
+    std::unique_ptr<Executor> executor(new Executor(config));
+
+    const size_t kTasks = 6;
+    TaskLog log(kTasks);
+    Gate gate;
+    EXPECT(executor->submit("a:80", [&log, &gate](const bool& cancelled) {
+        log.begin(0, "a:80", cancelled);
+        if (!cancelled)
+            gate.pass();
+        log.end("a:80");
+    }));
+    gate.waitEntered();
+    // One more "a:80" task is queued, the others are held back.
+    for (size_t i = 1; i < kTasks; ++i) {
+        EXPECT(executor->submit("a:80", [&log, i](const bool& cancelled) {
+            log.begin(i, "a:80", cancelled);
+            log.end("a:80");
+        }));
+    }
+
+    std::thread stopper([&executor] { executor->shutdown(); });
+    // submit() fails once shutdown has begun; the probes accepted before are cancelled too.
+    while (executor->submit("probe:80", [](const bool&) {}))
+        std::this_thread::yield();
+    gate.release();
+    stopper.join();
+
+    EXPECT(log.calledOnce());
+    EXPECT(log.ranCount() == 1);
+    EXPECT(log.cancelledCount() == static_cast<int>(kTasks) - 1);
+}
+
+// Every task accepted by a submit() racing shutdown() is called exactly once.
+static void testSubmitDuringShutdown() {
+    const int kRounds = 200;
+    const int kSubmitters = 4;
+    const int kTasksEach = 50;
+    int lost = 0;
+
+    for (int round = 0; round < kRounds; ++round) {
+        ExecutorConfig config;
+        config.threads = 2;
+        config.maxPerHost = round % 2;
+        std::unique_ptr<Executor> executor(new Executor(config));
+        std::atomic<int> accepted(0);
+        std::atomic<int> called(0);
+
+        std::vector<std::thread> submitters;
+        for (int s = 0; s < kSubmitters; ++s) {
+            submitters.push_back(std::thread([&executor, &accepted, &called, s] {
+                for (int i = 0; i < kTasksEach; ++i) {
+                    const std::string key = "host" + std::to_string((s + i) % 3);
+                    if (executor->submit(key, [&called](const bool&) { ++called; }))
+                        ++accepted;
+                }
+            }));
+        }
+        std::this_thread::sleep_for(std::chrono::microseconds(round % 7 * 50));
+        executor->shutdown();
+        for (std::thread& submitter : submitters)
+            submitter.join();
+
+        if (called.load() != accepted.load())
+            ++lost;
+    }
+    EXPECT(lost == 0);
+}
+
+int main() {
+    testMaxPerHost();
+    testCancelOnShutdown();
+    testSubmitDuringShutdown();
+
+    return finishChecks("executor");
+}
@@ -0,0 +1,551 @@
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <signal.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <map>
+#include <mutex>
+#include <set>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "check.hpp"
+#include "hpack.hpp"
+#include "simpleHTTP.hpp"
+
+using namespace SimpleHTTP;
+
+#ifdef MSG_NOSIGNAL
+static const int kSendFlags = MSG_NOSIGNAL;
+#else
+static const int kSendFlags = 0;
+#endif
+
+static const char kPreface[] = "PRI * HTTP/2.0\r\n\r\nSM\r\n\r\n";
+static const size_t kPrefaceSize = sizeof(kPreface) - 1;
+static const size_t kFrameHeaderSize = 9;
+static const size_t kFrameSize = 16384;
+static const int64_t kDefaultWindow = 65535;
+
+static const uint8_t kData = 0x0;
+static const uint8_t kHeaders = 0x1;
+static const uint8_t kRstStream = 0x3;
+static const uint8_t kSettings = 0x4;
+static const uint8_t kPing = 0x6;
+static const uint8_t kGoaway = 0x7;
+static const uint8_t kWindowUpdate = 0x8;
+static const uint8_t kContinuation = 0x9;
+
+static const uint8_t kEndStream = 0x1;
+static const uint8_t kAck = 0x1;
+static const uint8_t kEndHeaders = 0x4;
+
+static const uint16_t kMaxConcurrentStreams = 0x3;
+static const uint16_t kInitialWindowSize = 0x4;
+
+static uint32_t readUint32(const char* data) {
+    const uint8_t* bytes = reinterpret_cast<const uint8_t*>(data);
+    return (static_cast<uint32_t>(bytes[0]) << 24) | (static_cast<uint32_t>(bytes[1]) << 16) |
+           (static_cast<uint32_t>(bytes[2]) << 8) | bytes[3];
+}
+
+static void appendUint32(std::string& out, const uint32_t& value) {
+    out.push_back(static_cast<char>(value >> 24));
+    out.push_back(static_cast<char>(value >> 16));
+    out.push_back(static_cast<char>(value >> 8));
+    out.push_back(static_cast<char>(value));
+}
+
+static bool readExact(const int& fd, char* out, size_t size) {
+    while (size > 0) {
+        const ssize_t received = ::recv(fd, out, size, 0);
+        if (received < 0 && errno == EINTR)
+            continue;
+        if (received <= 0)
+            return false;
+        out += received;
+        size -= received;
+    }
+    return true;
+}
+
+static bool writeFrame(const int& fd, const uint8_t& type, const uint8_t& flags,
+                       const uint32_t& streamId, const char* payload, const size_t& length) {
+    std::string frame;
+    frame.reserve(kFrameHeaderSize + length);
+    frame.push_back(static_cast<char>(length >> 16));
+    frame.push_back(static_cast<char>(length >> 8));
+    frame.push_back(static_cast<char>(length));
+    frame.push_back(static_cast<char>(type));
+    frame.push_back(static_cast<char>(flags));
+    appendUint32(frame, streamId);
+    frame.append(payload, length);
+
+    size_t sent = 0;
+    while (sent < frame.size()) {
+        const ssize_t written = ::send(fd, frame.data() + sent, frame.size() - sent, kSendFlags);
+        if (written < 0 && errno == EINTR)
+            continue;
+        if (written <= 0)
+            return false;
+        sent += written;
+    }
+    return true;
+}
+
+static bool writeWindowUpdate(const int& fd, const uint32_t& streamId, const uint32_t& increment) {
+    std::string payload;
+    appendUint32(payload, increment);
+    return writeFrame(fd, kWindowUpdate, 0, streamId, payload.data(), payload.size());
+}
+
+// A minimal h2c server on 127.0.0.1 with one thread per connection, built on the library's HPACK
+// coder. Each stream gets initialWindow bytes of receive window, and the server counts every
+// DATA frame the client sends beyond a window. It answers
+//   /echo       with the request body,
+//   /bytes/N    with N bytes,
+//   /stall/N    with N bytes, written before the request body is read,
+//   /goaway     with a GOAWAY that excludes every later stream of the connection,
+// and echoes each request field "x-NAME" back as "x-echo-NAME". Writes block, and frames are
+// only read while nothing can be sent, as in a simple single-threaded server.
+class LoopbackH2Server {
+    struct Stream {
+        std::vector<HpackField> request;
+        std::string body;
+        int64_t receiveWindow;
+        int64_t sendWindow;
+        bool responding;
+        std::string response;
+        size_t responseSent;
+
+        Stream() : receiveWindow(0), sendWindow(0), responding(false), responseSent(0) {}
+    };
+
+    uint32_t initialWindow;
+    int listenFd;
+    int port;
+    std::thread acceptThread;
+    std::mutex mutex;
+    std::set<int> connections;
+    std::vector<std::thread> workers;
+    std::atomic<int> accepted;
+    std::atomic<int> violations;
+
+    void acceptLoop();
+    void serve(const int fd);
+    bool respond(const int& fd, HpackEncoder& encoder, const uint32_t& streamId, Stream& stream,
+                 uint32_t& lastStreamId);
+    static bool sendResponses(const int& fd, std::map<uint32_t, Stream>& streams,
+                              int64_t& sendWindow);
+
+public:
+    LoopbackH2Server(const uint32_t& initialWindow, const int& socketBuffer);
+    ~LoopbackH2Server();
+
+    std::string url(const std::string& path) const {
+        return "http://127.0.0.1:" + std::to_string(port) + path;
+    }
+    int connectionCount() const {
+        return accepted.load();
+    }
+    int flowControlViolations() const {
+        return violations.load();
+    }
+};
+
+LoopbackH2Server::LoopbackH2Server(const uint32_t& initialWindow, const int& socketBuffer)
+    : initialWindow(initialWindow), listenFd(-1), port(0), accepted(0), violations(0) {
+    listenFd = ::socket(AF_INET, SOCK_STREAM, 0);
+    const int enable = 1;
+    setsockopt(listenFd, SOL_SOCKET, SO_REUSEADDR, &enable, sizeof(enable));
+    // Accepted sockets inherit the buffer sizes, which must be set before listen().
+    if (socketBuffer > 0) {
+        setsockopt(listenFd, SOL_SOCKET, SO_RCVBUF, &socketBuffer, sizeof(socketBuffer));
+        setsockopt(listenFd, SOL_SOCKET, SO_SNDBUF, &socketBuffer, sizeof(socketBuffer));
+    }
+
+    sockaddr_in address = {};
+    address.sin_family = AF_INET;
+    address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    socklen_t length = sizeof(address);
+    if (bind(listenFd, reinterpret_cast<sockaddr*>(&address), sizeof(address)) != 0 ||
+        listen(listenFd, 64) != 0 ||
+        getsockname(listenFd, reinterpret_cast<sockaddr*>(&address), &length) != 0) {
+        std::perror("loopback h2c server");
+        std::exit(1);
+    }
+    port = ntohs(address.sin_port);
+    acceptThread = std::thread(&LoopbackH2Server::acceptLoop, this);
+}
+
+LoopbackH2Server::~LoopbackH2Server() {
+    ::shutdown(listenFd, SHUT_RDWR);
+    acceptThread.join();
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        for (const int fd : connections)
+            ::shutdown(fd, SHUT_RDWR);
+    }
+    for (std::thread& worker : workers)
+        worker.join();
+    for (const int fd : connections)
+        ::close(fd);
+    ::close(listenFd);
+}
+
+void LoopbackH2Server::acceptLoop() {
+    while (true) {
+        const int fd = ::accept(listenFd, nullptr, nullptr);
+        if (fd < 0) {
+            if (errno == EINTR)
+                continue;
+            return;
+        }
+        std::lock_guard<std::mutex> lock(mutex);
+        connections.insert(fd);
+        ++accepted;
+        workers.push_back(std::thread(&LoopbackH2Server::serve, this, fd));
+    }
+}
+
+void LoopbackH2Server::serve(const int fd) {
+    char preface[kPrefaceSize];
+    if (!readExact(fd, preface, sizeof(preface)) ||
+        std::memcmp(preface, kPreface, kPrefaceSize) != 0)
+        return;
+
+    std::string settings;
+    settings.push_back(0);
+    settings.push_back(static_cast<char>(kMaxConcurrentStreams));
+    appendUint32(settings, 100);
+    settings.push_back(0);
+    settings.push_back(static_cast<char>(kInitialWindowSize));
+    appendUint32(settings, initialWindow);
+    if (!writeFrame(fd, kSettings, 0, 0, settings.data(), settings.size()))
+        return;
+    // The connection window is raised to match, so the stream windows are what limits a body.
+    int64_t receiveWindow = kDefaultWindow;
+    if (initialWindow > kDefaultWindow) {
+        if (!writeWindowUpdate(fd, 0, static_cast<uint32_t>(initialWindow - kDefaultWindow)))
+            return;
+        receiveWindow = initialWindow;
+    }
+
+    HpackDecoder decoder;
+    HpackEncoder encoder;
+    std::map<uint32_t, Stream> streams;
+    int64_t sendWindow = kDefaultWindow;
+    int64_t peerInitialWindow = kDefaultWindow;
+    std::string headerBlock;
+    uint32_t headerStream = 0;
+    bool headerEndStream = false;
+    uint32_t lastStreamId = 0x7fffffff;
+
+    char header[kFrameHeaderSize];
+    std::string payload;
+    while (sendResponses(fd, streams, sendWindow) && readExact(fd, header, sizeof(header))) {
+        const size_t length = readUint32(header) >> 8;
+        const uint8_t type = static_cast<uint8_t>(header[3]);
+        const uint8_t flags = static_cast<uint8_t>(header[4]);
+        const uint32_t streamId = readUint32(header + 5) & 0x7fffffff;
+        payload.resize(length);
+        if (length > 0 && !readExact(fd, &payload[0], length))
+            return;
+
+        if (type == kSettings && !(flags & kAck)) {
+            for (size_t offset = 0; offset + 6 <= length; offset += 6) {
+                const uint16_t id = static_cast<uint16_t>(
+                    (static_cast<uint8_t>(payload[offset]) << 8) |
+                    static_cast<uint8_t>(payload[offset + 1]));
+                if (id != kInitialWindowSize)
+                    continue;
+                const int64_t value = readUint32(payload.data() + offset + 2);
+                for (auto& entry : streams)
+                    entry.second.sendWindow += value - peerInitialWindow;
+                peerInitialWindow = value;
+            }
+            if (!writeFrame(fd, kSettings, kAck, 0, nullptr, 0))
+                return;
+        } else if (type == kWindowUpdate && length == 4) {
+            const uint32_t increment = readUint32(payload.data()) & 0x7fffffff;
+            if (streamId == 0) {
+                sendWindow += increment;
+            } else {
+                const auto it = streams.find(streamId);
+                if (it != streams.end())
+                    it->second.sendWindow += increment;
+            }
+        } else if (type == kHeaders || type == kContinuation) {
+            if (type == kHeaders) {
+                headerBlock.clear();
+                headerStream = streamId;
+                headerEndStream = (flags & kEndStream) != 0;
+            }
+            headerBlock.append(payload);
+            if (!(flags & kEndHeaders))
+                continue;
+
+            std::vector<HpackField> fields;
+            if (!decoder.decode(headerBlock.data(), headerBlock.size(), fields))
+                return;
+            if (headerStream > lastStreamId)
+                continue;
+            Stream& stream = streams[headerStream];
+            stream.request.swap(fields);
+            stream.receiveWindow = initialWindow;
+            stream.sendWindow = peerInitialWindow;
+            bool stall = false;
+            for (const HpackField& field : stream.request) {
+                if (field.name == ":path" && field.value.compare(0, 7, "/stall/") == 0)
+                    stall = true;
+            }
+            if ((headerEndStream || stall) &&
+                !respond(fd, encoder, headerStream, stream, lastStreamId))
+                return;
+        } else if (type == kData) {
+            receiveWindow -= length;
+            if (receiveWindow < 0)
+                ++violations;
+            const auto it = streams.find(streamId);
+            if (it != streams.end()) {
+                Stream& stream = it->second;
+                stream.receiveWindow -= length;
+                if (stream.receiveWindow < 0)
+                    ++violations;
+                if (!stream.responding)
+                    stream.body.append(payload);
+            }
+            // Everything received is handed back at once.
+            if (length > 0) {
+                if (!writeWindowUpdate(fd, 0, static_cast<uint32_t>(length)))
+                    return;
+                receiveWindow += length;
+                if (it != streams.end() && !(flags & kEndStream)) {
+                    if (!writeWindowUpdate(fd, streamId, static_cast<uint32_t>(length)))
+                        return;
+                    it->second.receiveWindow += length;
+                }
+            }
+            if (it != streams.end() && (flags & kEndStream) && !it->second.responding &&
+                !respond(fd, encoder, streamId, it->second, lastStreamId))
+                return;
+        } else if (type == kRstStream) {
+            streams.erase(streamId);
+        } else if (type == kPing && !(flags & kAck)) {
+            if (!writeFrame(fd, kPing, kAck, 0, payload.data(), payload.size()))
+                return;
+        } else if (type == kGoaway) {
+            return;
+        }
+    }
+}
+
+bool LoopbackH2Server::respond(const int& fd, HpackEncoder& encoder, const uint32_t& streamId,
+                               Stream& stream, uint32_t& lastStreamId) {
+    std::string path;
+    std::vector<HpackField> fields;
+    fields.push_back(HpackField(":status", "200"));
+    fields.push_back(HpackField("x-server", "loopback"));
+    for (const HpackField& field : stream.request) {
+        if (field.name == ":path")
+            path = field.value;
+        else if (field.name.compare(0, 2, "x-") == 0)
+            fields.push_back(HpackField("x-echo-" + field.name.substr(2), field.value));
+    }
+
+    stream.responding = true;
+    if (path == "/echo") {
+        stream.response.swap(stream.body);
+    } else if (path.compare(0, 7, "/bytes/") == 0 || path.compare(0, 7, "/stall/") == 0) {
+        const size_t size = std::strtoul(path.c_str() + 7, nullptr, 10);
+        stream.response.resize(size);
+        for (size_t i = 0; i < size; ++i)
+            stream.response[i] = static_cast<char>('a' + i % 26);
+    } else if (path == "/goaway") {
+        std::string goaway;
+        appendUint32(goaway, streamId);
+        appendUint32(goaway, 0);
+        if (!writeFrame(fd, kGoaway, 0, 0, goaway.data(), goaway.size()))
+            return false;
+        lastStreamId = streamId;
+        stream.response = "gone";
+    }
+    fields.push_back(HpackField("content-length", std::to_string(stream.response.size())));
+
+    // Blocks larger than a frame continue in CONTINUATION frames.
+    Buffer block;
+    encoder.encode(fields, block);
+    size_t offset = 0;
+    do {
+        const size_t size = std::min(block.size() - offset, kFrameSize);
+        const uint8_t flags = (offset == 0 && stream.response.empty() ? kEndStream : 0) |
+                              (offset + size == block.size() ? kEndHeaders : 0);
+        if (!writeFrame(fd, offset == 0 ? kHeaders : kContinuation, flags, streamId,
+                        block.data() + offset, size))
+            return false;
+        offset += size;
+    } while (offset < block.size());
+    return true;
+}
+
+// Writes response bodies as far as the client's windows allow; finished streams are dropped.
+bool LoopbackH2Server::sendResponses(const int& fd, std::map<uint32_t, Stream>& streams,
+                                     int64_t& sendWindow) {
+    for (auto it = streams.begin(); it != streams.end();) {
+        Stream& stream = it->second;
+        while (stream.responding && stream.responseSent < stream.response.size()) {
+            const int64_t size = std::min<int64_t>(
+                std::min<int64_t>(stream.response.size() - stream.responseSent, kFrameSize),
+                std::min(sendWindow, stream.sendWindow));
+            if (size <= 0)
+                break;
+            const bool last = stream.responseSent + size == stream.response.size();
+            if (!writeFrame(fd, kData, last ? kEndStream : 0, it->first,
+                            stream.response.data() + stream.responseSent, size))
+                return false;
+            stream.responseSent += size;
+            stream.sendWindow -= size;
+            sendWindow -= size;
+        }
+        if (stream.responding && stream.responseSent == stream.response.size())
+            it = streams.erase(it);
+        else
+            ++it;
+    }
+    return true;
+}
+
+static std::string pattern(const size_t& size) {
+    std::string bytes(size, '\0');
+    for (size_t i = 0; i < size; ++i)
+        bytes[i] = static_cast<char>('a' + i % 26);
+    return bytes;
+}
+
+// Request and response header blocks stay decodable while both dynamic tables fill up, and a
+// block larger than a frame is split into CONTINUATION frames both ways.
+static void testHpackRoundTrips() {
+    LoopbackH2Server server(kDefaultWindow, 0);
+    HttpClient client;
+    client.setHttp2(Http2Mode::PriorKnowledge);
+    client.setTimeout(10);
+
+    for (int i = 0; i < 20; ++i) {
+        HttpHeaders headers;
+        headers.addHeader("X-Token", "same-on-every-request");
+        headers.addHeader("X-Count", std::to_string(i));
+        if (i == 5)
+            headers.addHeader("X-Big", std::string(40000, 'h'));
+
+        const HttpResponse response = client.Get(server.url("/bytes/100"), headers);
+        EXPECT(response.httpCode == 200);
+        EXPECT(response.protocol == "HTTP/2");
+        EXPECT(response.body == pattern(100));
+        EXPECT(response.headers.getHeader("x-server") == "loopback");
+        EXPECT(response.headers.getHeader("x-echo-token") == "same-on-every-request");
+        EXPECT(response.headers.getHeader("x-echo-count") == std::to_string(i));
+        if (i == 5)
+            EXPECT(response.headers.getHeader("x-echo-big") == std::string(40000, 'h'));
+    }
+    EXPECT(server.connectionCount() == 1);
+}
+
+// The client keeps within the server's small stream window on uploads, and hands its own
+// window back so that a download larger than it completes.
+static void testFlowControl() {
+    LoopbackH2Server server(16384, 0);
+    HttpClient client;
+    client.setHttp2(Http2Mode::PriorKnowledge);
+    client.setTimeout(10);
+
+    const std::string upload = pattern(300000);
+    const HttpResponse echoed = client.Post(server.url("/echo"), DataView(upload));
+    EXPECT(echoed.httpCode == 200);
+    EXPECT(echoed.body == upload);
+
+    const HttpResponse downloaded = client.Get(server.url("/bytes/3000000"));
+    EXPECT(downloaded.httpCode == 200);
+    EXPECT(downloaded.body.size() == 3000000);
+    EXPECT(downloaded.body == pattern(3000000));
+    EXPECT(server.flowControlViolations() == 0);
+}
+
+// A server that writes its response before reading the upload only makes progress while the
+// client keeps reading; a client blocked writing the upload would stall until its timeout.
+static void testUploadWhileDownloading() {
+    LoopbackH2Server server(16 << 20, 16384);
+    HttpClient client;
+    client.setHttp2(Http2Mode::PriorKnowledge);
+    client.setTimeout(10);
+    SocketOptions options;
+    options.receiveBuffer = 16384;
+    options.sendBuffer = 16384;
+    client.setSocketOptions(options);
+
+    const std::string upload = pattern(4 << 20);
+    const auto start = std::chrono::steady_clock::now();
+    const HttpResponse response = client.Post(server.url("/stall/4194304"), DataView(upload));
+    const auto elapsed = std::chrono::steady_clock::now() - start;
+    EXPECT(response.httpCode == 200);
+    EXPECT(response.body.size() == 4194304);
+    EXPECT(elapsed < std::chrono::seconds(5));
+}
+
+// Streams the GOAWAY excluded are retried on a new connection; concurrent first requests to
+// one host share a single connection.
+static void testGoaway() {
+    LoopbackH2Server server(kDefaultWindow, 0);
+    HttpClient client;
+    client.setHttp2(Http2Mode::PriorKnowledge);
+    client.setTimeout(10);
+
+    std::vector<Request> requests;
+    requests.push_back(Request("GET", server.url("/goaway")));
+    requests.push_back(Request("GET", server.url("/bytes/10")));
+    requests.push_back(Request("GET", server.url("/bytes/20")));
+    const std::vector<HttpResponse> responses = client.executePipelined(requests);
+    EXPECT(responses[0].httpCode == 200);
+    EXPECT(responses[0].body == "gone");
+    EXPECT(responses[1].httpCode == 200);
+    EXPECT(responses[1].body == pattern(10));
+    EXPECT(responses[2].httpCode == 200);
+    EXPECT(responses[2].body == pattern(20));
+    EXPECT(server.connectionCount() == 2);
+
+    LoopbackH2Server fresh(kDefaultWindow, 0);
+    HttpClient concurrent;
+    concurrent.setHttp2(Http2Mode::PriorKnowledge);
+    concurrent.setTimeout(10);
+    std::atomic<int> succeeded(0);
+    std::vector<std::thread> threads;
+    for (int i = 0; i < 8; ++i) {
+        threads.push_back(std::thread([&]() {
+            if (concurrent.Get(fresh.url("/bytes/64")).httpCode == 200)
+                ++succeeded;
+        }));
+    }
+    for (std::thread& thread : threads)
+        thread.join();
+    EXPECT(succeeded.load() == 8);
+    EXPECT(fresh.connectionCount() == 1);
+}
+
+int main() {
+    signal(SIGPIPE, SIG_IGN);
+    testHpackRoundTrips();
+    testFlowControl();
+    testUploadWhileDownloading();
+    testGoaway();
+
+    return finishChecks("http2");
+}
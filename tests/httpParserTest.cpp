@@ -0,0 +1,368 @@
+#include <cstddef>
+#include <cstdio>
+#include <random>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "check.hpp"
+#include "httpParser.hpp"
+#include "scan.hpp"
+
+using namespace SimpleHTTP;
+
+typedef HttpResponseParser::State State;
+
+static const char* const kScanners[] = {"scalar", "sse2", "avx2"};
+
+// What the parser made of an input, in terms that do not depend on how it was split.
+struct Outcome {
+    State state;
+    int statusCode;
+    std::vector<std::pair<std::string, std::string>> fields;
+    std::string body;
+    bool keepAlive;
+    bool chunked;
+    size_t contentLength;
+    size_t messageBegin;
+    size_t messageEnd;
+
+    Outcome()
+        : state(State::StatusLine),
+          statusCode(0),
+          keepAlive(false),
+          chunked(false),
+          contentLength(0),
+          messageBegin(0),
+          messageEnd(0) {}
+
+    // An unfinished head or body is only compared by state: how much of it was parsed depends
+    // on where the input was split.
+    bool operator==(const Outcome& other) const {
+        if (state != other.state)
+            return false;
+        if (state != State::Complete)
+            return true;
+        return statusCode == other.statusCode && fields == other.fields &&
+               body == other.body && keepAlive == other.keepAlive &&
+               chunked == other.chunked && contentLength == other.contentLength &&
+               messageBegin == other.messageBegin && messageEnd == other.messageEnd;
+    }
+};
+
+struct Case {
+    const char* name;
+    std::string input;
+    bool headRequest;
+    // The peer closes the connection after the input.
+    bool closed;
+};
+
+// Appends input to one growing buffer at each cut and parses the whole buffer every time, as
+// the client does with what it receives.
+static Outcome feed(const Case& test, const std::vector<size_t>& cuts) {
+    HttpResponseParser parser(test.headRequest);
+    std::string buffer;
+    size_t fed = 0;
+    for (const size_t cut : cuts) {
+        buffer.append(test.input, fed, cut - fed);
+        fed = cut;
+        if (!parser.parse(&buffer[0], buffer.size()))
+            break;
+    }
+    if (test.closed && !parser.hasError())
+        parser.finishOnClose();
+
+    Outcome outcome;
+    outcome.state = parser.getState();
+    if (!parser.isComplete())
+        return outcome;
+    outcome.statusCode = parser.getStatusCode();
+    for (const HttpResponseParser::HeaderField& field : parser.getFields()) {
+        outcome.fields.push_back(
+            std::make_pair(buffer.substr(field.name.offset, field.name.length),
+                           buffer.substr(field.value.offset, field.value.length)));
+    }
+    outcome.body = buffer.substr(parser.bodyOffset(), parser.bodyLength());
+    outcome.keepAlive = parser.keepAlive();
+    outcome.chunked = parser.isChunked();
+    outcome.contentLength = parser.getContentLength();
+    outcome.messageBegin = parser.messageBegin();
+    outcome.messageEnd = parser.messageEnd();
+    return outcome;
+}
+
+// The ways an input is split: in one piece, byte by byte (for inputs small enough to afford it)
+// and at random points, from very small pieces to pieces of a few hundred bytes.
+static std::vector<std::vector<size_t>> splits(const size_t& size) {
+    std::vector<std::vector<size_t>> result;
+    result.push_back(std::vector<size_t>(1, size));
+    if (size <= 8192) {
+        std::vector<size_t> bytes;
+        for (size_t cut = 1; cut <= size; ++cut)
+            bytes.push_back(cut);
+        result.push_back(bytes);
+    }
+    for (unsigned seed = 1; seed <= 24; ++seed) {
+        std::mt19937 random(seed);
+        const size_t maxStep = size > 8192 ? 16384 : (seed % 3 == 0 ? 300 : 1 + seed % 7);
+        std::vector<size_t> cuts;
+        size_t cut = 0;
+        while (cut < size) {
+            cut += 1 + random() % maxStep;
+            if (cut > size)
+                cut = size;
+            cuts.push_back(cut);
+        }
+        result.push_back(cuts);
+    }
+    return result;
+}
+
+// Every split gives the same outcome as the whole input, with every scanner, and matches what
+// the scalar scanner makes of the whole input.
+static Outcome parseEverySplit(const Case& test) {
+    const std::vector<std::vector<size_t>> cuts = splits(test.input.size());
+    setScanImplementation("scalar");
+    const Outcome expected = feed(test, cuts.front());
+
+    for (const char* scanner : kScanners) {
+        if (!setScanImplementation(scanner))
+            continue;
+        for (size_t i = 0; i < cuts.size(); ++i) {
+            const Outcome outcome = feed(test, cuts[i]);
+            if (!(outcome == expected)) {
+                std::fprintf(stderr, "%s: split %zu with %s differs from the whole input\n",
+                             test.name, i, scanner);
+                ++failures;
+            }
+        }
+    }
+    setScanImplementation("scalar");
+    return expected;
+}
+
+static std::string headers(const size_t& count) {
+    std::string lines;
+    for (size_t i = 0; i < count; ++i) {
+        lines += "X-Filler-" + std::to_string(i) + ": ";
+        lines.append(i * 7 % 90, 'v');
+        lines += i % 3 == 0 ? "\n" : "\r\n";
+    }
+    return lines;
+}
+
+static void testContentLength() {
+    const Case test = {"content-length",
+                       "HTTP/1.1 200 OK\r\nContent-Length: 5\r\nX-Url:  http://a:1/b \r\n"
+                       "\r\nhelloHTTP/1.1 204 No Content\r\n\r\n",
+                       false, false};
+    const Outcome outcome = parseEverySplit(test);
+    EXPECT(outcome.state == State::Complete);
+    EXPECT(outcome.statusCode == 200);
+    EXPECT(outcome.body == "hello");
+    EXPECT(outcome.keepAlive);
+    EXPECT(outcome.fields.size() == 2);
+    EXPECT(outcome.fields.size() == 2 && outcome.fields[1].first == "X-Url" &&
+           outcome.fields[1].second == "http://a:1/b");
+    // The pipelined response after it is left alone.
+    EXPECT(outcome.messageEnd == test.input.find("HTTP/1.1 204"));
+}
+
+// More lines than one scan batch, bare LF line ends, lines across SIMD block boundaries and a
+// folded line, which is skipped.
+static void testManyHeaders() {
+    const Case test = {"many headers",
+                       "HTTP/1.1 200 OK\r\n" + headers(70) + " folded continuation\r\n" +
+                           "Content-Length: 3\r\n\r\nabc",
+                       false, false};
+    const Outcome outcome = parseEverySplit(test);
+    EXPECT(outcome.state == State::Complete);
+    EXPECT(outcome.fields.size() == 71);
+    EXPECT(outcome.fields.size() == 71 && outcome.fields[69].first == "X-Filler-69" &&
+           outcome.fields[69].second == std::string(69 * 7 % 90, 'v'));
+    EXPECT(outcome.body == "abc");
+}
+
+static void testChunked() {
+    const Case test = {"chunked with extensions and trailers",
+                       "HTTP/1.1 200 OK\r\nTransfer-Encoding: chunked\r\n\r\n"
+                       "5;name=value\r\nhello\r\n"
+                       "6 ; a ; b=\"c;d\"\r\n world\r\n"
+                       "A\r\n0123456789\n"
+                       "0;last\r\nX-Trailer: t\r\nX-Other: u\r\n\r\n",
+                       false, false};
+    const Outcome outcome = parseEverySplit(test);
+    EXPECT(outcome.state == State::Complete);
+    EXPECT(outcome.chunked);
+    EXPECT(outcome.body == "hello world0123456789");
+    EXPECT(outcome.keepAlive);
+    // Trailers are consumed but not added to the head fields.
+    EXPECT(outcome.fields.size() == 1);
+    EXPECT(outcome.messageEnd == test.input.size());
+}
+
+static void testInterimResponses() {
+    const Case test = {"1xx",
+                       "HTTP/1.1 100 Continue\r\n\r\n"
+                       "HTTP/1.1 103 Early Hints\r\nLink: </style.css>; rel=preload\r\n\r\n"
+                       "HTTP/1.1 200 OK\r\nContent-Length: 2\r\n\r\nok",
+                       false, false};
+    const Outcome outcome = parseEverySplit(test);
+    EXPECT(outcome.state == State::Complete);
+    EXPECT(outcome.statusCode == 200);
+    EXPECT(outcome.body == "ok");
+    EXPECT(outcome.fields.size() == 1);
+    EXPECT(outcome.messageBegin == test.input.find("HTTP/1.1 200"));
+
+    // 101 is final: what follows belongs to the new protocol.
+    const Case upgrade = {"101", "HTTP/1.1 101 Switching Protocols\r\nUpgrade: h2c\r\n\r\nPRI",
+                          false, false};
+    const Outcome switched = parseEverySplit(upgrade);
+    EXPECT(switched.state == State::Complete);
+    EXPECT(switched.statusCode == 101);
+    EXPECT(switched.messageEnd == upgrade.input.size() - 3);
+}
+
+static void testCloseDelimited() {
+    const Case test = {"close-delimited",
+                       "HTTP/1.1 200 OK\r\nX-A: 1\r\n\r\nbody until\r\n\r\nthe close", false,
+                       true};
+    const Outcome outcome = parseEverySplit(test);
+    EXPECT(outcome.state == State::Complete);
+    EXPECT(outcome.body == "body until\r\n\r\nthe close");
+    EXPECT(!outcome.keepAlive);
+
+    Case open = test;
+    open.name = "close-delimited, still open";
+    open.closed = false;
+    EXPECT(parseEverySplit(open).state == State::BodyUntilClose);
+
+    Case truncated = {"content-length, closed early",
+                      "HTTP/1.1 200 OK\r\nContent-Length: 10\r\n\r\nshort", false, true};
+    EXPECT(parseEverySplit(truncated).state == State::Error);
+
+    const Case http10 = {"HTTP/1.0", "HTTP/1.0 200 OK\r\nContent-Length: 1\r\n\r\nx", false,
+                         false};
+    const Outcome old = parseEverySplit(http10);
+    EXPECT(old.state == State::Complete);
+    EXPECT(!old.keepAlive);
+}
+
+static void testHeadRequest() {
+    const Case test = {"HEAD",
+                       "HTTP/1.1 200 OK\r\nContent-Length: 1000\r\n"
+                       "Transfer-Encoding: identity\r\n\r\nHTTP/1.1 200 OK\r\n",
+                       true, false};
+    const Outcome outcome = parseEverySplit(test);
+    EXPECT(outcome.state == State::Complete);
+    EXPECT(outcome.body.empty());
+    EXPECT(outcome.contentLength == 1000);
+    EXPECT(outcome.keepAlive);
+    EXPECT(outcome.messageEnd == test.input.find("HTTP/1.1 200", 1));
+
+    const Case notModified = {"304", "HTTP/1.1 304 Not Modified\r\nContent-Length: 50\r\n\r\n",
+                              false, false};
+    const Outcome cached = parseEverySplit(notModified);
+    EXPECT(cached.state == State::Complete);
+    EXPECT(cached.body.empty());
+}
+
+static void testOversizedHead() {
+    const std::string status = "HTTP/1.1 200 OK\r\n";
+    const size_t limit = HttpResponseParser::kMaxHeadSize;
+
+    // One line that never ends, and many lines without the blank line that ends the head.
+    const Case longLine = {"oversized line", status + "X-Big: " + std::string(limit, 'a'), false,
+                           false};
+    EXPECT(parseEverySplit(longLine).state == State::Error);
+    std::string lines = status;
+    while (lines.size() <= limit + 100)
+        lines += "X-Filler: " + std::string(60, 'f') + "\r\n";
+    const Case endless = {"oversized head", lines, false, false};
+    EXPECT(parseEverySplit(endless).state == State::Error);
+
+    // Just below the limit is still waiting for more.
+    const Case pending = {"large head", status + "X-Big: " + std::string(limit - 100, 'a'),
+                          false, false};
+    EXPECT(parseEverySplit(pending).state == State::Headers);
+}
+
+static void testMalformed() {
+    const std::string chunkedHead = "HTTP/1.1 200 OK\r\nTransfer-Encoding: chunked\r\n\r\n";
+    const Case cases[] = {
+        {"non-hex chunk size", chunkedHead + "zz\r\nhello\r\n0\r\n\r\n", false, false},
+        {"empty chunk size", chunkedHead + "\r\nhello\r\n0\r\n\r\n", false, false},
+        {"chunk extension only", chunkedHead + ";ext\r\nhello\r\n0\r\n\r\n", false, false},
+        {"overflowing chunk size", chunkedHead + "10000000000000000\r\n", false, false},
+        {"endless chunk size", chunkedHead + std::string(2000, '1'), false, false},
+        {"chunk without CRLF", chunkedHead + "5\r\nhelloXX0\r\n\r\n", false, false},
+        {"chunked body cut short", chunkedHead + "5\r\nhel", false, true},
+        {"bad protocol", "HTTX/1.1 200 OK\r\n\r\n", false, false},
+        {"short status code", "HTTP/1.1 20 OK\r\n\r\n", false, false},
+        {"header without colon", "HTTP/1.1 200 OK\r\nNoColon\r\n\r\n", false, false},
+        {"bad content length", "HTTP/1.1 200 OK\r\nContent-Length: 1x\r\n\r\nx", false, false},
+        {"conflicting content lengths",
+         "HTTP/1.1 200 OK\r\nContent-Length: 1\r\nContent-Length: 2\r\n\r\nxy", false, false},
+    };
+    for (const Case& test : cases) {
+        if (parseEverySplit(test).state != State::Error) {
+            std::fprintf(stderr, "%s: expected a parse error\n", test.name);
+            ++failures;
+        }
+    }
+}
+
+// The scanners agree line for line on arbitrary bytes, from every start offset, around the
+// 16- and 32-byte block boundaries of the SIMD versions.
+static void testScannerAgreement() {
+    std::mt19937 random(7);
+    const char alphabet[] = "ab:\r\n \t";
+    for (int round = 0; round < 200; ++round) {
+        std::string data(1 + random() % 300, 'x');
+        for (char& c : data)
+            c = alphabet[random() % (sizeof(alphabet) - 1)];
+
+        for (size_t from = 0; from < data.size(); from += 1 + random() % 5) {
+            setScanImplementation("scalar");
+            ScannedLine expected[HttpResponseParser::kLineBatch];
+            const size_t expectedCount = scanLines(data.data(), from, data.size(), expected,
+                                                   HttpResponseParser::kLineBatch);
+            for (const char* scanner : kScanners) {
+                if (!setScanImplementation(scanner))
+                    continue;
+                ScannedLine lines[HttpResponseParser::kLineBatch];
+                const size_t count = scanLines(data.data(), from, data.size(), lines,
+                                               HttpResponseParser::kLineBatch);
+                bool same = count == expectedCount;
+                for (size_t i = 0; same && i < count; ++i)
+                    same = lines[i].end == expected[i].end && lines[i].colon == expected[i].colon;
+                if (!same) {
+                    std::fprintf(stderr, "scanLines: %s differs in round %d from %zu\n", scanner,
+                                 round, from);
+                    ++failures;
+                }
+            }
+        }
+    }
+    setScanImplementation("scalar");
+}
+
+int main() {
+    for (const char* scanner : kScanners) {
+        if (!setScanImplementation(scanner))
+            std::printf("%s scanner not available, skipped\n", scanner);
+    }
+
+    testContentLength();
+    testManyHeaders();
+    testChunked();
+    testInterimResponses();
+    testCloseDelimited();
+    testHeadRequest();
+    testOversizedHead();
+    testMalformed();
+    testScannerAgreement();
+
+    return finishChecks("httpParser");
+}
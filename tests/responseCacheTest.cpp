@@ -0,0 +1,192 @@
+#include <cstdint>
+#include <ctime>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "check.hpp"
+#include "responseCache.hpp"
+#include "simpleHTTP.hpp"
+
+using namespace SimpleHTTP;
+
+typedef ResponseCache::Lookup Lookup;
+
+static const std::string kUrl = "http://example.test/resource";
+
+// An IMF-fixdate offset seconds from now.
+static std::string httpDate(const int64_t& offset) {
+    const time_t when = static_cast<time_t>(std::time(nullptr) + offset);
+    tm parts = {};
+    gmtime_r(&when, &parts);
+    char text[64];
+    std::strftime(text, sizeof(text), "%a, %d %b %Y %H:%M:%S GMT", &parts);
+    return text;
+}
+
+// A 200 response dated now, with the given headers and body.
+static HttpResponse makeResponse(const std::vector<std::pair<std::string, std::string>>& fields,
+                                 const std::string& body = "cached body") {
+    HttpResponse response;
+    response.httpCode = 200;
+    response.statusText = "OK";
+    response.protocol = "HTTP/1.1";
+    response.headers.addHeader("Date", httpDate(0));
+    for (const auto& field : fields)
+        response.headers.addHeader(field.first, field.second);
+    response.body = body;
+    return response;
+}
+
+// Stores a response for url and returns what a following plain GET of it finds.
+static Lookup storeAndLookup(ResponseCache& cache, const std::string& url,
+                             const std::vector<std::pair<std::string, std::string>>& fields) {
+    HttpHeaders requestHeaders;
+    HttpResponse response = makeResponse(fields);
+    cache.store(url, requestHeaders, response, false);
+    ResponseCache::Match match;
+    return cache.lookup(url, requestHeaders, match);
+}
+
+static void testMaxAge() {
+    ResponseCache cache;
+    EXPECT(storeAndLookup(cache, kUrl, {{"Cache-Control", "max-age=60"}}) == Lookup::Fresh);
+    // max-age wins over an Expires that has already passed.
+    EXPECT(storeAndLookup(cache, kUrl, {{"Cache-Control", "public, max-age=60"},
+                                        {"Expires", httpDate(-60)}}) == Lookup::Fresh);
+    // Already older than max-age when it arrived: stored for its validator, but stale.
+    EXPECT(storeAndLookup(cache, kUrl, {{"Cache-Control", "max-age=60"},
+                                        {"Age", "120"},
+                                        {"ETag", "\"v1\""}}) == Lookup::Stale);
+    EXPECT(storeAndLookup(cache, kUrl, {{"Cache-Control", "no-cache, max-age=60"},
+                                        {"ETag", "\"v1\""}}) == Lookup::Stale);
+
+    // A request max-age below the entry's age makes it stale for that request only.
+    HttpHeaders requestHeaders;
+    HttpResponse response = makeResponse({{"Cache-Control", "max-age=600"}, {"Age", "30"}});
+    cache.store(kUrl, requestHeaders, response, false);
+    ResponseCache::Match match;
+    EXPECT(cache.lookup(kUrl, requestHeaders, match) == Lookup::Fresh);
+    EXPECT(match.body && *match.body == "cached body");
+    HttpHeaders strict;
+    strict.addHeader("Cache-Control", "max-age=10");
+    EXPECT(cache.lookup(kUrl, strict, match) == Lookup::Stale);
+}
+
+static void testExpires() {
+    ResponseCache cache;
+    EXPECT(storeAndLookup(cache, kUrl, {{"Expires", httpDate(60)}}) == Lookup::Fresh);
+    EXPECT(storeAndLookup(cache, kUrl, {{"Expires", httpDate(-60)}, {"ETag", "\"v1\""}}) ==
+           Lookup::Stale);
+    // An invalid Expires means already expired.
+    EXPECT(storeAndLookup(cache, kUrl, {{"Expires", "0"}, {"ETag", "\"v1\""}}) == Lookup::Stale);
+    // Without a validator, a response that is never fresh is not kept at all.
+    EXPECT(storeAndLookup(cache, kUrl, {{"Expires", httpDate(-60)}}) == Lookup::Miss);
+    EXPECT(cache.getStats().entries == 0);
+}
+
+static void testHeuristicLifetime() {
+    ResponseCache cache;
+    const int64_t kDay = 24 * 60 * 60;
+    // Modified ten days ago: fresh for a tenth of that, one day.
+    EXPECT(storeAndLookup(cache, kUrl, {{"Last-Modified", httpDate(-10 * kDay)}}) ==
+           Lookup::Fresh);
+    EXPECT(storeAndLookup(cache, kUrl, {{"Last-Modified", httpDate(-10 * kDay)},
+                                        {"Age", std::to_string(kDay - 60)}}) == Lookup::Fresh);
+    EXPECT(storeAndLookup(cache, kUrl, {{"Last-Modified", httpDate(-10 * kDay)},
+                                        {"Age", std::to_string(kDay + 60)}}) == Lookup::Stale);
+    // A tenth of 100 days would be ten; the heuristic stops at one.
+    EXPECT(storeAndLookup(cache, kUrl, {{"Last-Modified", httpDate(-100 * kDay)},
+                                        {"Age", std::to_string(kDay + 60)}}) == Lookup::Stale);
+    // No explicit or heuristic freshness and no validator: not kept.
+    EXPECT(storeAndLookup(cache, kUrl, {}) == Lookup::Miss);
+}
+
+static void testVary() {
+    ResponseCache cache;
+    HttpHeaders gzip;
+    gzip.addHeader("Accept-Encoding", "gzip");
+    HttpResponse response =
+        makeResponse({{"Cache-Control", "max-age=60"}, {"Vary", "Accept-Encoding"}});
+    cache.store(kUrl, gzip, response, false);
+
+    ResponseCache::Match match;
+    EXPECT(cache.lookup(kUrl, gzip, match) == Lookup::Fresh);
+    HttpHeaders brotli;
+    brotli.addHeader("Accept-Encoding", "br");
+    EXPECT(cache.lookup(kUrl, brotli, match) == Lookup::Miss);
+    EXPECT(cache.lookup(kUrl, HttpHeaders(), match) == Lookup::Miss);
+
+    // Vary: * can never be matched, so it is not stored.
+    EXPECT(storeAndLookup(cache, kUrl, {{"Cache-Control", "max-age=60"}, {"Vary", "*"}}) ==
+           Lookup::Miss);
+}
+
+static void testNoStore() {
+    ResponseCache cache;
+    EXPECT(storeAndLookup(cache, kUrl, {{"Cache-Control", "max-age=60"}}) == Lookup::Fresh);
+    // A no-store response is not kept, and drops the entry it replaces.
+    EXPECT(storeAndLookup(cache, kUrl, {{"Cache-Control", "no-store, max-age=60"}}) ==
+           Lookup::Miss);
+    EXPECT(cache.getStats().entries == 0);
+
+    // A no-store request neither reads nor fills the cache.
+    HttpHeaders noStore;
+    noStore.addHeader("Cache-Control", "no-store");
+    HttpResponse response = makeResponse({{"Cache-Control", "max-age=60"}});
+    cache.store(kUrl, noStore, response, false);
+    EXPECT(cache.getStats().entries == 0);
+    EXPECT(storeAndLookup(cache, kUrl, {{"Cache-Control", "max-age=60"}}) == Lookup::Fresh);
+    ResponseCache::Match match;
+    EXPECT(cache.lookup(kUrl, noStore, match) == Lookup::Bypass);
+}
+
+static void testEviction() {
+    const std::string body(1000, 'x');
+    HttpHeaders requestHeaders;
+    // Room for three entries of a bit over 1000 bytes each.
+    ResponseCacheConfig config;
+    config.maxBytes = 3500;
+    config.maxEntryBytes = 2000;
+    ResponseCache cache(config);
+
+    for (int i = 0; i < 3; ++i) {
+        HttpResponse response = makeResponse({{"Cache-Control", "max-age=60"}}, body);
+        cache.store(kUrl + std::to_string(i), requestHeaders, response, false);
+    }
+    EXPECT(cache.getStats().entries == 3);
+    EXPECT(cache.getStats().bytes <= config.maxBytes);
+
+    // Using entry 0 makes entry 1 the least recently used, so the fourth entry evicts it.
+    ResponseCache::Match match;
+    EXPECT(cache.lookup(kUrl + "0", requestHeaders, match) == Lookup::Fresh);
+    HttpResponse fourth = makeResponse({{"Cache-Control", "max-age=60"}}, body);
+    cache.store(kUrl + "3", requestHeaders, fourth, false);
+
+    const ResponseCacheStats stats = cache.getStats();
+    EXPECT(stats.entries == 3);
+    EXPECT(stats.evictions == 1);
+    EXPECT(stats.bytes <= config.maxBytes);
+    EXPECT(cache.lookup(kUrl + "0", requestHeaders, match) == Lookup::Fresh);
+    EXPECT(cache.lookup(kUrl + "1", requestHeaders, match) == Lookup::Miss);
+    EXPECT(cache.lookup(kUrl + "2", requestHeaders, match) == Lookup::Fresh);
+    EXPECT(cache.lookup(kUrl + "3", requestHeaders, match) == Lookup::Fresh);
+
+    // Larger than maxEntryBytes: passed through without evicting anything.
+    HttpResponse large = makeResponse({{"Cache-Control", "max-age=60"}}, std::string(3000, 'y'));
+    cache.store(kUrl + "4", requestHeaders, large, false);
+    EXPECT(cache.lookup(kUrl + "4", requestHeaders, match) == Lookup::Miss);
+    EXPECT(cache.getStats().entries == 3);
+    EXPECT(large.body.size() == 3000);
+}
+
+int main() {
+    testMaxAge();
+    testExpires();
+    testHeuristicLifetime();
+    testVary();
+    testNoStore();
+    testEviction();
+
+    return finishChecks("responseCache");
+}